@@ -0,0 +1,466 @@
+/* gairq-aggregator.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-aggregator.h"
+
+#include <math.h>
+
+/* Every series keeps its last day of hourly values in a ring, slot by
+ * hour modulo N_SLOTS, together with running sums over the 8 and 24
+ * hour windows. A reading then costs a few additions whatever the
+ * window, and moving on by an hour subtracts what falls out of each.
+ * The sums are recomputed from the ring once it went around, so
+ * rounding errors do not pile up.
+ */
+#define N_SLOTS           24
+#define N_NOWCAST_HOURS   12
+
+#define SERIES_KEY(_idx, _pollutant) ((_idx) * N_GAIRQ_POLLUTANTS + (_pollutant))
+
+typedef struct
+{
+  gdouble   sum;
+  guint     count;
+  guint     hours;
+  guint     min_count;
+} Window;
+
+enum {
+  WINDOW_8H,
+  WINDOW_24H,
+  N_WINDOWS
+};
+
+typedef struct
+{
+  gint64          key;
+  GairqPollutant  pollutant;
+  gint64          hour;       /* Of the latest slot */
+  gint64          time;
+  gdouble         value;
+  gdouble         slots [N_SLOTS];
+  Window          windows [N_WINDOWS];
+  guint           n_advanced;
+} Series;
+
+struct _GairqAggregator
+{
+  GObject       parent_instance;
+
+  GMutex        lock;
+  GHashTable *  series;
+};
+
+G_DEFINE_TYPE (GairqAggregator, gairq_aggregator, G_TYPE_OBJECT)
+
+
+static inline gint64
+hour_of (gint64 time)
+{
+  return time >= 0 ? time / 3600 : -((-time + 3599) / 3600);
+}
+
+static inline gdouble *
+series_slot (Series *series,
+             gint64  hour)
+{
+  return &series->slots [((hour % N_SLOTS) + N_SLOTS) % N_SLOTS];
+}
+
+static Series *
+series_new (gint64          key,
+            GairqPollutant  pollutant,
+            gint64          hour)
+{
+  Series *series = g_slice_new0 (Series);
+  guint i;
+
+  series->key = key;
+  series->pollutant = pollutant;
+  series->hour = hour;
+  series->time = G_MININT64;
+  series->value = NAN;
+
+  for (i = 0; i < N_SLOTS; i++)
+    series->slots [i] = NAN;
+
+  /* US EPA wants three quarters of the hours for a valid average */
+  series->windows [WINDOW_8H].hours = 8;
+  series->windows [WINDOW_8H].min_count = 6;
+  series->windows [WINDOW_24H].hours = 24;
+  series->windows [WINDOW_24H].min_count = 18;
+
+  return series;
+}
+
+static void
+series_free (gpointer data)
+{
+  g_slice_free (Series, data);
+}
+
+static void
+series_resync (Series *series)
+{
+  guint i, w;
+
+  for (w = 0; w < N_WINDOWS; w++)
+    {
+      Window *window = &series->windows [w];
+
+      window->sum = 0;
+      window->count = 0;
+
+      for (i = 0; i < window->hours; i++)
+        {
+          gdouble value = *series_slot (series, series->hour - i);
+
+          if (!isnan (value))
+            {
+              window->sum += value;
+              window->count++;
+            }
+        }
+    }
+
+  series->n_advanced = 0;
+}
+
+/* Moves the end of the windows on to @hour */
+static void
+series_advance (Series *series,
+                gint64  hour)
+{
+  guint w;
+
+  if (hour - series->hour >= N_SLOTS)
+    {
+      guint i;
+
+      for (i = 0; i < N_SLOTS; i++)
+        series->slots [i] = NAN;
+      for (w = 0; w < N_WINDOWS; w++)
+        {
+          series->windows [w].sum = 0;
+          series->windows [w].count = 0;
+        }
+
+      series->hour = hour;
+      series->n_advanced = 0;
+      return;
+    }
+
+  while (series->hour < hour)
+    {
+      series->hour++;
+
+      for (w = 0; w < N_WINDOWS; w++)
+        {
+          Window *window = &series->windows [w];
+          gdouble leaving = *series_slot (series, series->hour - window->hours);
+
+          if (!isnan (leaving))
+            {
+              window->sum -= leaving;
+              window->count--;
+            }
+        }
+
+      /* Only now that the 24 hour window let go of it */
+      *series_slot (series, series->hour) = NAN;
+      series->n_advanced++;
+    }
+
+  if (series->n_advanced >= N_SLOTS)
+    series_resync (series);
+}
+
+static void
+series_set (Series  *series,
+            gint64   hour,
+            gdouble  value)
+{
+  gdouble *slot = series_slot (series, hour);
+  gint64 age = series->hour - hour;
+  guint w;
+
+  for (w = 0; w < N_WINDOWS; w++)
+    {
+      Window *window = &series->windows [w];
+
+      if (age >= window->hours)
+        continue;
+
+      if (!isnan (*slot))
+        {
+          window->sum -= *slot;
+          window->count--;
+        }
+      if (!isnan (value))
+        {
+          window->sum += value;
+          window->count++;
+        }
+    }
+
+  *slot = value;
+}
+
+static gdouble
+series_get_mean (Series *series,
+                 guint   w)
+{
+  Window *window = &series->windows [w];
+
+  if (window->count < window->min_count)
+    return NAN;
+
+  return window->sum / window->count;
+}
+
+/* US EPA NowCast over the last 12 hours, most recent first. The weight
+ * factor is the spread of the values, but no less than a half; two of
+ * the three latest hours have to be there.
+ */
+static gdouble
+series_get_nowcast (Series *series)
+{
+  gdouble values [N_NOWCAST_HOURS];
+  gdouble min = G_MAXDOUBLE, max = -G_MAXDOUBLE;
+  gdouble weight, factor, sum, total;
+  guint i, n_recent = 0;
+
+  if (series->pollutant != GAIRQ_POLLUTANT_PM25 &&
+      series->pollutant != GAIRQ_POLLUTANT_PM10)
+    return NAN;
+
+  for (i = 0; i < N_NOWCAST_HOURS; i++)
+    {
+      values [i] = *series_slot (series, series->hour - i);
+      if (isnan (values [i]))
+        continue;
+
+      if (i < 3)
+        n_recent++;
+      min = MIN (min, values [i]);
+      max = MAX (max, values [i]);
+    }
+
+  if (n_recent < 2)
+    return NAN;
+  if (max <= 0)
+    return 0;
+
+  factor = MAX (min / max, 0.5);
+
+  for (i = 0, weight = 1, sum = 0, total = 0; i < N_NOWCAST_HOURS; i++, weight *= factor)
+    {
+      if (isnan (values [i]))
+        continue;
+
+      sum += weight * values [i];
+      total += weight;
+    }
+
+  return sum / total;
+}
+
+/* --- GObject --- */
+static void
+gairq_aggregator_finalize (GObject *object)
+{
+  GairqAggregator *self = GAIRQ_AGGREGATOR (object);
+
+  g_hash_table_destroy (self->series);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gairq_aggregator_parent_class)->finalize (object);
+}
+
+static void
+gairq_aggregator_class_init (GairqAggregatorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_aggregator_finalize;
+}
+
+static void
+gairq_aggregator_init (GairqAggregator *self)
+{
+  self->series = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, series_free);
+  g_mutex_init (&self->lock);
+}
+
+/* --- Private Methods --- */
+
+/* Must be called with the lock held */
+static void
+gairq_aggregator_push_locked (GairqAggregator *self,
+                              gint64           idx,
+                              GairqPollutant   pollutant,
+                              gint64           time,
+                              gdouble          value)
+{
+  gint64 key = SERIES_KEY (idx, pollutant);
+  gint64 hour = hour_of (time);
+  Series *series;
+
+  series = g_hash_table_lookup (self->series, &key);
+  if (series == NULL)
+    {
+      series = series_new (key, pollutant, hour);
+      g_hash_table_insert (self->series, &series->key, series);
+    }
+
+  if (hour > series->hour)
+    series_advance (series, hour);
+
+  /* Late readings still count while inside the windows */
+  if (series->hour - hour < N_SLOTS)
+    series_set (series, hour, value);
+
+  if (time >= series->time)
+    {
+      series->time = time;
+      series->value = value;
+    }
+}
+
+/* --- Public APIs --- */
+GairqAggregator *
+gairq_aggregator_new (void)
+{
+  return g_object_new (GAIRQ_TYPE_AGGREGATOR, NULL);
+}
+
+/* Takes every pollutant reading of @air in. A later reading within the
+ * same hour replaces the earlier one.
+ */
+void
+gairq_aggregator_push (GairqAggregator *self,
+                       GairqAirObject  *air)
+{
+  GHashTable *iaqi;
+  gint64 idx, time;
+  guint i;
+
+  g_return_if_fail (GAIRQ_IS_AGGREGATOR (self));
+  g_return_if_fail (GAIRQ_IS_AIR_OBJECT (air));
+
+  iaqi = gairq_air_object_get_iaqi (air);
+  if (iaqi == NULL)
+    return;
+
+  idx = gairq_air_object_get_idx (air);
+  time = gairq_air_object_get_time (air);
+
+  g_mutex_lock (&self->lock);
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      gdouble *value = g_hash_table_lookup (iaqi, gairq_pollutant_to_string (i));
+
+      if (value)
+        gairq_aggregator_push_locked (self, idx, i, time, *value);
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+void
+gairq_aggregator_push_sample (GairqAggregator *self,
+                              gint64           idx,
+                              GairqPollutant   pollutant,
+                              gint64           time,
+                              gdouble          value)
+{
+  g_return_if_fail (GAIRQ_IS_AGGREGATOR (self));
+  g_return_if_fail (pollutant < N_GAIRQ_POLLUTANTS);
+
+  g_mutex_lock (&self->lock);
+  gairq_aggregator_push_locked (self, idx, pollutant, time, value);
+  g_mutex_unlock (&self->lock);
+}
+
+gboolean
+gairq_aggregator_lookup (GairqAggregator *self,
+                         gint64           idx,
+                         GairqPollutant   pollutant,
+                         GairqAggregate  *aggregate)
+{
+  gint64 key = SERIES_KEY (idx, pollutant);
+  Series *series;
+
+  g_return_val_if_fail (GAIRQ_IS_AGGREGATOR (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+  g_return_val_if_fail (aggregate != NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  series = g_hash_table_lookup (self->series, &key);
+  if (series)
+    {
+      aggregate->time = series->time;
+      aggregate->value = series->value;
+      aggregate->nowcast = series_get_nowcast (series);
+      aggregate->mean_8h = series_get_mean (series, WINDOW_8H);
+      aggregate->mean_24h = series_get_mean (series, WINDOW_24H);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return series != NULL;
+}
+
+/* Forgets every series of station @idx */
+void
+gairq_aggregator_remove (GairqAggregator *self,
+                         gint64           idx)
+{
+  guint i;
+
+  g_return_if_fail (GAIRQ_IS_AGGREGATOR (self));
+
+  g_mutex_lock (&self->lock);
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      gint64 key = SERIES_KEY (idx, i);
+
+      g_hash_table_remove (self->series, &key);
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+guint
+gairq_aggregator_get_n_series (GairqAggregator *self)
+{
+  guint ret;
+
+  g_return_val_if_fail (GAIRQ_IS_AGGREGATOR (self), 0);
+
+  g_mutex_lock (&self->lock);
+  ret = g_hash_table_size (self->series);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
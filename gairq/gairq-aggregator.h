@@ -0,0 +1,67 @@
+/* gairq-aggregator.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_AGGREGATOR_H
+#define GAIRQ_AGGREGATOR_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_AGGREGATOR (gairq_aggregator_get_type ())
+G_DECLARE_FINAL_TYPE (GairqAggregator, gairq_aggregator, GAIRQ, AGGREGATOR, GObject)
+
+/* Windows end at the hour of the latest reading of the series, not at
+ * the current time. Whatever is missing is NAN.
+ */
+typedef struct
+{
+  gint64    time;       /* Of the latest reading */
+  gdouble   value;      /* The latest reading as reported */
+  gdouble   nowcast;    /* US EPA NowCast, PM2.5 and PM10 only */
+  gdouble   mean_8h;    /* With at least 6 of the 8 hours */
+  gdouble   mean_24h;   /* With at least 18 of the 24 hours */
+} GairqAggregate;
+
+GairqAggregator * gairq_aggregator_new          (void);
+void              gairq_aggregator_push         (GairqAggregator *self,
+                                                 GairqAirObject  *air);
+void              gairq_aggregator_push_sample  (GairqAggregator *self,
+                                                 gint64           idx,
+                                                 GairqPollutant   pollutant,
+                                                 gint64           time,
+                                                 gdouble          value);
+gboolean          gairq_aggregator_lookup       (GairqAggregator *self,
+                                                 gint64           idx,
+                                                 GairqPollutant   pollutant,
+                                                 GairqAggregate  *aggregate);
+void              gairq_aggregator_remove       (GairqAggregator *self,
+                                                 gint64           idx);
+guint             gairq_aggregator_get_n_series (GairqAggregator *self);
+
+G_END_DECLS
+
+#endif
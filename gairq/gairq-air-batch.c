@@ -0,0 +1,833 @@
+/* gairq-air-batch.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-air-batch.h"
+#include "gairq-debug.h"
+
+#include <math.h>
+
+/* Every column grows by a multiple of the bitmap word so that
+ * the validity bitmaps never have a partially allocated word.
+ */
+#define WORD_BITS     64
+#define N_WORDS(_n)   (((_n) + WORD_BITS - 1) / WORD_BITS)
+
+struct _GairqAirBatch
+{
+  GObject     parent_instance;
+
+  guint       n_rows;
+  guint       n_allocated;
+
+  /* Structure of arrays, one contiguous column per field */
+  gint64 *    idx;
+  gint64 *    aqi;
+  gint64 *    time;
+  gdouble *   lat;
+  gdouble *   lng;
+  gdouble *   columns [N_GAIRQ_POLLUTANTS];
+  guint64 *   validity [N_GAIRQ_POLLUTANTS];
+};
+
+typedef struct
+{
+  guint       count;
+  guint       above;
+  gdouble     sum;
+  gdouble     min;
+  gdouble     max;
+} ColumnStats;
+
+G_DEFINE_TYPE (GairqAirBatch, gairq_air_batch, G_TYPE_OBJECT)
+
+#define GAIRQ_AIR_BATCH_ERROR (gairq_air_batch_error_quark ())
+
+
+/* --- GairqAirBatchError --- */
+static GQuark
+gairq_air_batch_error_quark (void)
+{
+  return g_quark_from_static_string ("gairq-air-batch-error-quark");
+}
+
+/* --- GObject --- */
+static void
+gairq_air_batch_finalize (GObject *object)
+{
+  GairqAirBatch *self = GAIRQ_AIR_BATCH (object);
+  guint i;
+
+  g_free (self->idx);
+  g_free (self->aqi);
+  g_free (self->time);
+  g_free (self->lat);
+  g_free (self->lng);
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      g_free (self->columns [i]);
+      g_free (self->validity [i]);
+    }
+
+  G_OBJECT_CLASS (gairq_air_batch_parent_class)->finalize (object);
+}
+
+static void
+gairq_air_batch_class_init (GairqAirBatchClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_air_batch_finalize;
+}
+
+static void
+gairq_air_batch_init (GairqAirBatch *self)
+{
+  self->n_rows = 0;
+  self->n_allocated = 0;
+}
+
+/* --- Private Methods --- */
+static void
+gairq_air_batch_reserve (GairqAirBatch *self,
+                         guint          n_rows)
+{
+  guint new_size, old_words, new_words;
+  guint i;
+
+  if (n_rows <= self->n_allocated)
+    return;
+
+  new_size = MAX (self->n_allocated, WORD_BITS);
+  while (new_size < n_rows)
+    new_size *= 2;
+
+  old_words = N_WORDS (self->n_allocated);
+  new_words = N_WORDS (new_size);
+
+  self->idx = g_renew (gint64, self->idx, new_size);
+  self->aqi = g_renew (gint64, self->aqi, new_size);
+  self->time = g_renew (gint64, self->time, new_size);
+  self->lat = g_renew (gdouble, self->lat, new_size);
+  self->lng = g_renew (gdouble, self->lng, new_size);
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      self->columns [i] = g_renew (gdouble, self->columns [i], new_size);
+      self->validity [i] = g_renew (guint64, self->validity [i], new_words);
+      memset (self->validity [i] + old_words, 0,
+              (new_words - old_words) * sizeof (guint64));
+    }
+
+  self->n_allocated = new_size;
+}
+
+/* Dense kernel for a run of valid cells. It keeps four independent
+ * accumulators so that the loop has no carried dependency on a single
+ * register and can be vectorized by the compiler.
+ */
+static void
+column_stats_dense (const gdouble *values,
+                    guint          n_values,
+                    gdouble        threshold,
+                    ColumnStats   *stats)
+{
+  gdouble sum [4] = { 0.0, 0.0, 0.0, 0.0 };
+  gdouble lo [4] = { stats->min, stats->min, stats->min, stats->min };
+  gdouble hi [4] = { stats->max, stats->max, stats->max, stats->max };
+  guint above [4] = { 0, 0, 0, 0 };
+  guint i, j;
+
+  for (i = 0; i + 4 <= n_values; i += 4)
+    {
+      for (j = 0; j < 4; j++)
+        {
+          gdouble v = values [i + j];
+
+          sum [j] += v;
+          lo [j] = v < lo [j] ? v : lo [j];
+          hi [j] = v > hi [j] ? v : hi [j];
+          above [j] += v > threshold;
+        }
+    }
+
+  for ( ; i < n_values; i++)
+    {
+      gdouble v = values [i];
+
+      sum [0] += v;
+      lo [0] = v < lo [0] ? v : lo [0];
+      hi [0] = v > hi [0] ? v : hi [0];
+      above [0] += v > threshold;
+    }
+
+  for (j = 0; j < 4; j++)
+    {
+      stats->sum += sum [j];
+      stats->min = MIN (stats->min, lo [j]);
+      stats->max = MAX (stats->max, hi [j]);
+      stats->above += above [j];
+    }
+
+  stats->count += n_values;
+}
+
+static void
+column_stats_scan (GairqAirBatch  *self,
+                   GairqPollutant  pollutant,
+                   gdouble         threshold,
+                   ColumnStats    *stats)
+{
+  const gdouble *values = self->columns [pollutant];
+  const guint64 *bitmap = self->validity [pollutant];
+  guint n_words = N_WORDS (self->n_rows);
+  guint w;
+
+  stats->count = 0;
+  stats->above = 0;
+  stats->sum = 0.0;
+  stats->min = INFINITY;
+  stats->max = -INFINITY;
+
+  for (w = 0; w < n_words; w++)
+    {
+      guint base = w * WORD_BITS;
+      guint len = MIN (WORD_BITS, self->n_rows - base);
+      guint64 full = (len == WORD_BITS) ? G_MAXUINT64
+                                        : (G_GUINT64_CONSTANT (1) << len) - 1;
+      guint64 bits = bitmap [w] & full;
+      guint j;
+
+      if (bits == 0)
+        continue;
+
+      if (bits == full)
+        {
+          column_stats_dense (values + base, len, threshold, stats);
+          continue;
+        }
+
+      /* Sparse word, take the valid cells one by one */
+      for (j = 0; j < len; j++)
+        {
+          if (bits & (G_GUINT64_CONSTANT (1) << j))
+            column_stats_dense (values + base + j, 1, threshold, stats);
+        }
+    }
+}
+
+static void
+swap_double (gdouble *a,
+             gdouble *b)
+{
+  gdouble tmp = *a;
+
+  *a = *b;
+  *b = tmp;
+}
+
+static gboolean
+node_holds_number (JsonNode *node)
+{
+  GType type;
+
+  if (node == NULL || !JSON_NODE_HOLDS_VALUE (node))
+    return FALSE;
+
+  type = json_node_get_value_type (node);
+
+  return type == G_TYPE_INT64 || type == G_TYPE_DOUBLE;
+}
+
+/* For responses that don't have the shape of one */
+static gboolean
+set_malformed (GError **error)
+{
+  g_set_error (error, GAIRQ_AIR_BATCH_ERROR, 0, "Malformed response");
+
+  return FALSE;
+}
+
+/* Hoare's selection, leaves the k-th smallest value at values[k] */
+static gdouble
+quickselect (gdouble *values,
+             guint    n_values,
+             guint    k)
+{
+  guint left = 0;
+  guint right = n_values - 1;
+
+  while (left < right)
+    {
+      guint mid = left + (right - left) / 2;
+      gdouble pivot;
+      guint i, j;
+
+      /* Median of three */
+      if (values [mid] < values [left])
+        swap_double (&values [mid], &values [left]);
+      if (values [right] < values [left])
+        swap_double (&values [right], &values [left]);
+      if (values [right] < values [mid])
+        swap_double (&values [right], &values [mid]);
+
+      pivot = values [mid];
+      i = left;
+      j = right;
+
+      while (i <= j)
+        {
+          while (values [i] < pivot)
+            i++;
+          while (values [j] > pivot)
+            j--;
+
+          if (i <= j)
+            {
+              swap_double (&values [i], &values [j]);
+              i++;
+              if (j == 0)
+                break;
+              j--;
+            }
+        }
+
+      if (k <= j)
+        right = j;
+      else if (k >= i)
+        left = i;
+      else
+        break;
+    }
+
+  return values [k];
+}
+
+/* --- Public APIs --- */
+GairqAirBatch *
+gairq_air_batch_new (guint reserved_size)
+{
+  GairqAirBatch *self;
+
+  self = g_object_new (GAIRQ_TYPE_AIR_BATCH, NULL);
+  gairq_air_batch_reserve (self, reserved_size);
+
+  return self;
+}
+
+void
+gairq_air_batch_append (GairqAirBatch  *self,
+                        GairqAirObject *air)
+{
+  GairqObjectCity *city;
+  GHashTable *iaqi;
+  gdouble values [N_GAIRQ_POLLUTANTS];
+  gdouble lat = NAN, lng = NAN;
+  guint valid_mask = 0;
+  guint i;
+
+  g_return_if_fail (GAIRQ_IS_AIR_BATCH (self));
+  g_return_if_fail (GAIRQ_IS_AIR_OBJECT (air));
+
+  city = gairq_air_object_get_city (air);
+  if (city)
+    {
+      lat = city->geo.latitude;
+      lng = city->geo.longitude;
+    }
+
+  iaqi = gairq_air_object_get_iaqi (air);
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      gdouble *value = NULL;
+
+      if (iaqi)
+        value = g_hash_table_lookup (iaqi, gairq_pollutant_to_string (i));
+
+      if (value)
+        {
+          values [i] = *value;
+          valid_mask |= 1u << i;
+        }
+    }
+
+  gairq_air_batch_append_row (self,
+                              gairq_air_object_get_idx (air),
+                              gairq_air_object_get_aqi (air),
+                              gairq_air_object_get_time (air),
+                              lat, lng,
+                              values, valid_mask);
+}
+
+gboolean
+gairq_air_batch_append_response (GairqAirBatch  *self,
+                                 JsonNode       *root,
+                                 GError        **error)
+{
+  JsonObject *object, *data_obj;
+  JsonNode *status, *data, *node;
+  gdouble values [N_GAIRQ_POLLUTANTS];
+  gdouble lat = NAN, lng = NAN;
+  gint64 idx = -1, aqi = -1, time = 0;
+  guint valid_mask = 0;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), FALSE);
+  g_return_val_if_fail (root != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!JSON_NODE_HOLDS_OBJECT (root))
+    return set_malformed (error);
+
+  object = json_node_get_object (root);
+  status = json_object_get_member (object, "status");
+  data = json_object_get_member (object, "data");
+
+  if (status == NULL || json_node_get_value_type (status) != G_TYPE_STRING)
+    return set_malformed (error);
+
+  if (g_strcmp0 (json_node_get_string (status), "ok") != 0)
+    {
+      if (error)
+        g_set_error (error, GAIRQ_AIR_BATCH_ERROR, 0, "Error-Response: %s",
+                     data && JSON_NODE_HOLDS_VALUE (data) ? json_node_get_string (data) : NULL);
+      return FALSE;
+    }
+
+  if (data == NULL || !JSON_NODE_HOLDS_OBJECT (data))
+    return set_malformed (error);
+
+  /* Read the columns straight out of the tree, it does not
+   * build any intermediate GairqAirObject.
+   */
+  data_obj = json_node_get_object (data);
+
+  node = json_object_get_member (data_obj, "idx");
+  if (node && JSON_NODE_HOLDS_VALUE (node))
+    idx = json_node_get_int (node);
+
+  node = json_object_get_member (data_obj, "aqi");
+  if (node && g_strcmp0 ("Integer", json_node_type_name (node)) == 0)
+    aqi = json_node_get_int (node);
+
+  node = json_object_get_member (data_obj, "time");
+  if (node && JSON_NODE_HOLDS_OBJECT (node))
+    {
+      node = json_object_get_member (json_node_get_object (node), "v");
+      if (node && JSON_NODE_HOLDS_VALUE (node))
+        time = json_node_get_int (node);
+    }
+
+  node = json_object_get_member (data_obj, "city");
+  if (node && JSON_NODE_HOLDS_OBJECT (node))
+    {
+      JsonObject *city_obj = json_node_get_object (node);
+
+      node = json_object_get_member (city_obj, "geo");
+      if (node && JSON_NODE_HOLDS_ARRAY (node) &&
+          json_array_get_length (json_node_get_array (node)) == 2)
+        {
+          JsonArray *geo = json_node_get_array (node);
+
+          if (!node_holds_number (json_array_get_element (geo, 0)) ||
+              !node_holds_number (json_array_get_element (geo, 1)))
+            return set_malformed (error);
+
+          lat = json_array_get_double_element (geo, 0);
+          lng = json_array_get_double_element (geo, 1);
+        }
+    }
+
+  node = json_object_get_member (data_obj, "iaqi");
+  if (node && JSON_NODE_HOLDS_OBJECT (node))
+    {
+      JsonObject *iaqi_obj = json_node_get_object (node);
+      guint i;
+
+      for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+        {
+          node = json_object_get_member (iaqi_obj, gairq_pollutant_to_string (i));
+          if (node == NULL)
+            continue;
+
+          /* A reading is an object with a number in "v" */
+          if (JSON_NODE_HOLDS_OBJECT (node))
+            node = json_object_get_member (json_node_get_object (node), "v");
+          if (!node_holds_number (node))
+            return set_malformed (error);
+
+          values [i] = json_node_get_double (node);
+          valid_mask |= 1u << i;
+        }
+    }
+
+  gairq_air_batch_append_row (self, idx, aqi, time, lat, lng, values, valid_mask);
+
+  return TRUE;
+}
+
+/* @values holds a reading for every pollutant whose bit is set in
+ * @valid_mask, the others are not looked at.
+ */
+void
+gairq_air_batch_append_row (GairqAirBatch *self,
+                            gint64         idx,
+                            gint64         aqi,
+                            gint64         time,
+                            gdouble        lat,
+                            gdouble        lng,
+                            const gdouble *values,
+                            guint          valid_mask)
+{
+  guint row, word;
+  guint64 bit;
+  guint i;
+
+  g_return_if_fail (GAIRQ_IS_AIR_BATCH (self));
+  g_return_if_fail (values != NULL || valid_mask == 0);
+
+  gairq_air_batch_reserve (self, self->n_rows + 1);
+
+  row = self->n_rows++;
+  word = row / WORD_BITS;
+  bit = G_GUINT64_CONSTANT (1) << (row % WORD_BITS);
+
+  self->idx [row] = idx;
+  self->aqi [row] = aqi;
+  self->time [row] = time;
+  self->lat [row] = lat;
+  self->lng [row] = lng;
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      /* Invalid cells hold NaN so that the raw columns are
+       * still safe to use without looking at the bitmap.
+       */
+      if (valid_mask & (1u << i))
+        {
+          self->columns [i][row] = values [i];
+          self->validity [i][word] |= bit;
+        }
+      else
+        {
+          self->columns [i][row] = NAN;
+          self->validity [i][word] &= ~bit;
+        }
+    }
+}
+
+/* Copies every row of @other after the rows of @self, one column at a
+ * time. Bits past the last row of a bitmap are always clear, so the
+ * validity of @other is OR-ed in at whatever bit offset @self ends.
+ */
+void
+gairq_air_batch_append_batch (GairqAirBatch *self,
+                              GairqAirBatch *other)
+{
+  guint offset, n_rows, shift, first, last;
+  guint i, w;
+
+  g_return_if_fail (GAIRQ_IS_AIR_BATCH (self));
+  g_return_if_fail (GAIRQ_IS_AIR_BATCH (other));
+  g_return_if_fail (self != other);
+
+  if (other->n_rows == 0)
+    return;
+
+  offset = self->n_rows;
+  n_rows = other->n_rows;
+  gairq_air_batch_reserve (self, offset + n_rows);
+
+  memcpy (self->idx + offset, other->idx, n_rows * sizeof (gint64));
+  memcpy (self->aqi + offset, other->aqi, n_rows * sizeof (gint64));
+  memcpy (self->time + offset, other->time, n_rows * sizeof (gint64));
+  memcpy (self->lat + offset, other->lat, n_rows * sizeof (gdouble));
+  memcpy (self->lng + offset, other->lng, n_rows * sizeof (gdouble));
+
+  shift = offset % WORD_BITS;
+  first = offset / WORD_BITS;
+  last = N_WORDS (offset + n_rows);
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      const guint64 *src = other->validity [i];
+      guint64 *dst = self->validity [i] + first;
+
+      memcpy (self->columns [i] + offset, other->columns [i], n_rows * sizeof (gdouble));
+
+      if (shift == 0)
+        {
+          memcpy (dst, src, N_WORDS (n_rows) * sizeof (guint64));
+          continue;
+        }
+
+      for (w = 0; w < N_WORDS (n_rows); w++)
+        {
+          dst [w] |= src [w] << shift;
+          if (first + w + 1 < last)
+            dst [w + 1] |= src [w] >> (WORD_BITS - shift);
+        }
+    }
+
+  self->n_rows += n_rows;
+}
+
+void
+gairq_air_batch_clear (GairqAirBatch *self)
+{
+  guint i;
+
+  g_return_if_fail (GAIRQ_IS_AIR_BATCH (self));
+
+  /* Keep the columns allocated for the next round */
+  for (i = 0; i < N_GAIRQ_POLLUTANTS && self->n_allocated > 0; i++)
+    memset (self->validity [i], 0, N_WORDS (self->n_allocated) * sizeof (guint64));
+
+  self->n_rows = 0;
+}
+
+guint
+gairq_air_batch_get_length (GairqAirBatch *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), 0);
+
+  return self->n_rows;
+}
+
+const gint64 *
+gairq_air_batch_get_idx (GairqAirBatch *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+
+  return self->idx;
+}
+
+const gint64 *
+gairq_air_batch_get_aqi (GairqAirBatch *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+
+  return self->aqi;
+}
+
+const gint64 *
+gairq_air_batch_get_time (GairqAirBatch *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+
+  return self->time;
+}
+
+const gdouble *
+gairq_air_batch_get_latitude (GairqAirBatch *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+
+  return self->lat;
+}
+
+const gdouble *
+gairq_air_batch_get_longitude (GairqAirBatch *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+
+  return self->lng;
+}
+
+const gdouble *
+gairq_air_batch_get_column (GairqAirBatch  *self,
+                            GairqPollutant  pollutant)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NULL);
+
+  return self->columns [pollutant];
+}
+
+const guint64 *
+gairq_air_batch_get_validity (GairqAirBatch  *self,
+                              GairqPollutant  pollutant)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), NULL);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NULL);
+
+  return self->validity [pollutant];
+}
+
+gboolean
+gairq_air_batch_is_valid (GairqAirBatch  *self,
+                          GairqPollutant  pollutant,
+                          guint           row)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+  g_return_val_if_fail (row < self->n_rows, FALSE);
+
+  return (self->validity [pollutant][row / WORD_BITS] >> (row % WORD_BITS)) & 1;
+}
+
+guint
+gairq_air_batch_count_valid (GairqAirBatch  *self,
+                             GairqPollutant  pollutant)
+{
+  ColumnStats stats;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), 0);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, 0);
+
+  column_stats_scan (self, pollutant, INFINITY, &stats);
+
+  return stats.count;
+}
+
+guint
+gairq_air_batch_count_above (GairqAirBatch  *self,
+                             GairqPollutant  pollutant,
+                             gdouble         threshold)
+{
+  ColumnStats stats;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), 0);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, 0);
+
+  column_stats_scan (self, pollutant, threshold, &stats);
+
+  return stats.above;
+}
+
+gboolean
+gairq_air_batch_min (GairqAirBatch  *self,
+                     GairqPollutant  pollutant,
+                     gdouble        *min)
+{
+  ColumnStats stats;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+
+  column_stats_scan (self, pollutant, INFINITY, &stats);
+  if (stats.count == 0)
+    return FALSE;
+
+  if (min)
+    *min = stats.min;
+
+  return TRUE;
+}
+
+gboolean
+gairq_air_batch_max (GairqAirBatch  *self,
+                     GairqPollutant  pollutant,
+                     gdouble        *max)
+{
+  ColumnStats stats;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+
+  column_stats_scan (self, pollutant, INFINITY, &stats);
+  if (stats.count == 0)
+    return FALSE;
+
+  if (max)
+    *max = stats.max;
+
+  return TRUE;
+}
+
+gboolean
+gairq_air_batch_mean (GairqAirBatch  *self,
+                      GairqPollutant  pollutant,
+                      gdouble        *mean)
+{
+  ColumnStats stats;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+
+  column_stats_scan (self, pollutant, INFINITY, &stats);
+  if (stats.count == 0)
+    return FALSE;
+
+  if (mean)
+    *mean = stats.sum / stats.count;
+
+  return TRUE;
+}
+
+gboolean
+gairq_air_batch_percentile (GairqAirBatch  *self,
+                            GairqPollutant  pollutant,
+                            gdouble         percentile,
+                            gdouble        *value)
+{
+  const gdouble *column;
+  const guint64 *bitmap;
+  gdouble *scratch;
+  gdouble rank, lo, hi;
+  guint n_valid = 0;
+  guint row, k;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+  g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, FALSE);
+
+  column = self->columns [pollutant];
+  bitmap = self->validity [pollutant];
+
+  /* Selection reorders the values, so gather the valid
+   * cells into a scratch buffer first.
+   */
+  scratch = g_new (gdouble, MAX (self->n_rows, 1));
+  for (row = 0; row < self->n_rows; row++)
+    {
+      if ((bitmap [row / WORD_BITS] >> (row % WORD_BITS)) & 1)
+        scratch [n_valid++] = column [row];
+    }
+
+  if (n_valid == 0)
+    {
+      g_free (scratch);
+      return FALSE;
+    }
+
+  /* Linear interpolation between the closest ranks */
+  rank = percentile / 100.0 * (n_valid - 1);
+  k = (guint) floor (rank);
+
+  lo = quickselect (scratch, n_valid, k);
+  hi = lo;
+
+  if (k + 1 < n_valid && rank > k)
+    {
+      guint i;
+
+      /* Everything right of k is not smaller than lo */
+      hi = scratch [k + 1];
+      for (i = k + 2; i < n_valid; i++)
+        hi = MIN (hi, scratch [i]);
+    }
+
+  if (value)
+    *value = lo + (hi - lo) * (rank - k);
+
+  g_free (scratch);
+
+  return TRUE;
+}
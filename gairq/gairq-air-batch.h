@@ -0,0 +1,93 @@
+/* gairq-air-batch.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_AIR_BATCH_H
+#define GAIRQ_AIR_BATCH_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include <json-glib/json-glib.h>
+
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_AIR_BATCH (gairq_air_batch_get_type ())
+G_DECLARE_FINAL_TYPE (GairqAirBatch, gairq_air_batch, GAIRQ, AIR_BATCH, GObject)
+
+GairqAirBatch *   gairq_air_batch_new             (guint reserved_size);
+void              gairq_air_batch_append          (GairqAirBatch  *self,
+                                                   GairqAirObject *air);
+gboolean          gairq_air_batch_append_response (GairqAirBatch  *self,
+                                                   JsonNode       *root,
+                                                   GError        **error);
+void              gairq_air_batch_append_row      (GairqAirBatch  *self,
+                                                   gint64          idx,
+                                                   gint64          aqi,
+                                                   gint64          time,
+                                                   gdouble         lat,
+                                                   gdouble         lng,
+                                                   const gdouble  *values,
+                                                   guint           valid_mask);
+void              gairq_air_batch_append_batch    (GairqAirBatch  *self,
+                                                   GairqAirBatch  *other);
+void              gairq_air_batch_clear           (GairqAirBatch  *self);
+guint             gairq_air_batch_get_length      (GairqAirBatch  *self);
+
+/* --- Columns --- */
+const gint64 *    gairq_air_batch_get_idx         (GairqAirBatch  *self);
+const gint64 *    gairq_air_batch_get_aqi         (GairqAirBatch  *self);
+const gint64 *    gairq_air_batch_get_time        (GairqAirBatch  *self);
+const gdouble *   gairq_air_batch_get_latitude    (GairqAirBatch  *self);
+const gdouble *   gairq_air_batch_get_longitude   (GairqAirBatch  *self);
+const gdouble *   gairq_air_batch_get_column      (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant);
+const guint64 *   gairq_air_batch_get_validity    (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant);
+gboolean          gairq_air_batch_is_valid        (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant,
+                                                   guint           row);
+
+/* --- Aggregates --- */
+guint             gairq_air_batch_count_valid     (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant);
+guint             gairq_air_batch_count_above     (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant,
+                                                   gdouble         threshold);
+gboolean          gairq_air_batch_min             (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant,
+                                                   gdouble        *min);
+gboolean          gairq_air_batch_max             (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant,
+                                                   gdouble        *max);
+gboolean          gairq_air_batch_mean            (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant,
+                                                   gdouble        *mean);
+gboolean          gairq_air_batch_percentile      (GairqAirBatch  *self,
+                                                   GairqPollutant  pollutant,
+                                                   gdouble         percentile,
+                                                   gdouble        *value);
+
+G_END_DECLS
+
+#endif
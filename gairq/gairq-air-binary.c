@@ -0,0 +1,675 @@
+/* gairq-air-binary.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-air-binary.h"
+
+#include <math.h>
+#include <string.h>
+
+/* All little-endian. A fixed-size header whose fields sit at fixed
+ * offsets, then the body and a string table at the end:
+ *
+ *   body     city name, city url, then name and url of each attribution
+ *            as string references, then each iaqi entry as a reference
+ *            to its key and a double
+ *   strings  each one a varint length, the bytes and a NUL
+ *
+ * A string reference is a varint, 0 for none or else one past the
+ * string's offset in the table, equal strings are stored once.
+ */
+#define OFF_MAGIC       0
+#define OFF_VERSION     4
+#define OFF_HEADER_SIZE 6
+#define OFF_SIZE        8
+#define OFF_STRINGS     12
+#define OFF_IDX         16
+#define OFF_AQI         24
+#define OFF_TIME        32
+#define OFF_LATITUDE    40
+#define OFF_LONGITUDE   48
+#define OFF_N_ATTRS     56
+#define OFF_N_IAQI      58
+#define OFF_FLAGS       60
+
+#define MAGIC           "GQAB"
+#define FLAG_HAS_CITY   (1 << 0)
+
+#define MAX_VARINT_SIZE 10
+
+/* Strings remembered for dedup, more than an object ever has */
+#define MAX_SEEN        32
+
+#define GAIRQ_AIR_BINARY_ERROR (gairq_air_binary_error_quark ())
+
+
+/* --- GairqAirBinaryError --- */
+static GQuark
+gairq_air_binary_error_quark (void)
+{
+  return g_quark_from_static_string ("gairq-air-binary-error-quark");
+}
+
+/* --- Helpers --- */
+static guint16
+read_u16 (const guint8 *p)
+{
+  guint16 v;
+
+  memcpy (&v, p, sizeof v);
+  return GUINT16_FROM_LE (v);
+}
+
+static guint32
+read_u32 (const guint8 *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, sizeof v);
+  return GUINT32_FROM_LE (v);
+}
+
+static guint64
+read_u64 (const guint8 *p)
+{
+  guint64 v;
+
+  memcpy (&v, p, sizeof v);
+  return GUINT64_FROM_LE (v);
+}
+
+static gdouble
+read_double (const guint8 *p)
+{
+  guint64 bits = read_u64 (p);
+  gdouble v;
+
+  memcpy (&v, &bits, sizeof v);
+  return v;
+}
+
+static gboolean
+read_varint (const guint8 **p,
+             const guint8  *end,
+             guint64       *value)
+{
+  guint shift = 0;
+
+  *value = 0;
+  while (*p < end && shift < 7 * MAX_VARINT_SIZE)
+    {
+      guint8 byte = *(*p)++;
+
+      *value |= (guint64) (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        return TRUE;
+      shift += 7;
+    }
+
+  return FALSE;
+}
+
+static gsize
+varint_size (guint64 value)
+{
+  gsize n = 1;
+
+  while (value >= 0x80)
+    {
+      value >>= 7;
+      n++;
+    }
+
+  return n;
+}
+
+/* --- Encoding --- */
+
+/* Lays the body and string table out as it goes. Nothing is written
+ * unless there is a buffer, so a first run only measures.
+ */
+typedef struct
+{
+  guint8 *        buffer;
+  gsize           body_pos;
+  gsize           strings_start;
+  gsize           strings_pos;
+
+  guint           n_seen;
+  const gchar *   seen [MAX_SEEN];
+  gsize           seen_offsets [MAX_SEEN];
+} Encoder;
+
+static void
+encoder_put (Encoder       *encoder,
+             gsize          pos,
+             gconstpointer  data,
+             gsize          length)
+{
+  if (encoder->buffer)
+    memcpy (encoder->buffer + pos, data, length);
+}
+
+static gsize
+encoder_put_varint (Encoder *encoder,
+                    gsize    pos,
+                    guint64  value)
+{
+  guint8 bytes [MAX_VARINT_SIZE];
+  gsize n = 0;
+
+  do
+    {
+      bytes [n] = value & 0x7f;
+      value >>= 7;
+      if (value)
+        bytes [n] |= 0x80;
+      n++;
+    }
+  while (value);
+
+  encoder_put (encoder, pos, bytes, n);
+
+  return n;
+}
+
+static void
+encoder_add_string (Encoder     *encoder,
+                    const gchar *str)
+{
+  gsize offset, length;
+  guint i;
+
+  if (str == NULL)
+    {
+      encoder->body_pos += encoder_put_varint (encoder, encoder->body_pos, 0);
+      return;
+    }
+
+  for (i = 0; i < encoder->n_seen; i++)
+    if (encoder->seen [i] == str || strcmp (encoder->seen [i], str) == 0)
+      break;
+
+  if (i < encoder->n_seen)
+    offset = encoder->seen_offsets [i];
+  else
+    {
+      offset = encoder->strings_pos - encoder->strings_start;
+      length = strlen (str);
+
+      encoder->strings_pos += encoder_put_varint (encoder, encoder->strings_pos, length);
+      encoder_put (encoder, encoder->strings_pos, str, length + 1);
+      encoder->strings_pos += length + 1;
+
+      if (encoder->n_seen < MAX_SEEN)
+        {
+          encoder->seen [encoder->n_seen] = str;
+          encoder->seen_offsets [encoder->n_seen] = offset;
+          encoder->n_seen++;
+        }
+    }
+
+  encoder->body_pos += encoder_put_varint (encoder, encoder->body_pos, offset + 1);
+}
+
+static void
+encoder_add_double (Encoder *encoder,
+                    gdouble  value)
+{
+  guint64 bits;
+
+  memcpy (&bits, &value, sizeof bits);
+  bits = GUINT64_TO_LE (bits);
+  encoder_put (encoder, encoder->body_pos, &bits, sizeof bits);
+  encoder->body_pos += sizeof bits;
+}
+
+/* Both runs see the members in the same order, so the second one lays
+ * them out exactly where the first one measured them to be.
+ */
+static void
+encoder_run (Encoder        *encoder,
+             GairqAirObject *air)
+{
+  GairqObjectCity *city = gairq_air_object_get_city (air);
+  GHashTable *iaqi = gairq_air_object_get_iaqi (air);
+  GSList *iter;
+
+  encoder->n_seen = 0;
+  encoder->body_pos = GAIRQ_AIR_BINARY_HEADER_SIZE;
+  encoder->strings_pos = encoder->strings_start;
+
+  encoder_add_string (encoder, city ? city->name : NULL);
+  encoder_add_string (encoder, city ? city->url : NULL);
+
+  for (iter = gairq_air_object_get_attributions (air); iter; iter = iter->next)
+    {
+      GairqObjectAttr *attr = iter->data;
+
+      encoder_add_string (encoder, attr->name);
+      encoder_add_string (encoder, attr->url);
+    }
+
+  if (iaqi)
+    {
+      GHashTableIter hiter;
+      gpointer key, value;
+
+      g_hash_table_iter_init (&hiter, iaqi);
+      while (g_hash_table_iter_next (&hiter, &key, &value))
+        {
+          encoder_add_string (encoder, key);
+          encoder_add_double (encoder, *(gdouble *) value);
+        }
+    }
+}
+
+static void
+write_header (guint8         *buffer,
+              GairqAirObject *air,
+              gsize           size,
+              gsize           strings_offset)
+{
+  GairqObjectCity *city = gairq_air_object_get_city (air);
+  GHashTable *iaqi = gairq_air_object_get_iaqi (air);
+  guint16 u16;
+  guint32 u32;
+  guint64 u64;
+  gdouble geo [2] = { 0, 0 };
+  guint i;
+
+  memset (buffer, 0, GAIRQ_AIR_BINARY_HEADER_SIZE);
+  memcpy (buffer + OFF_MAGIC, MAGIC, 4);
+
+  u16 = GUINT16_TO_LE (GAIRQ_AIR_BINARY_VERSION);
+  memcpy (buffer + OFF_VERSION, &u16, 2);
+  u16 = GUINT16_TO_LE (GAIRQ_AIR_BINARY_HEADER_SIZE);
+  memcpy (buffer + OFF_HEADER_SIZE, &u16, 2);
+
+  u32 = GUINT32_TO_LE (size);
+  memcpy (buffer + OFF_SIZE, &u32, 4);
+  u32 = GUINT32_TO_LE (strings_offset);
+  memcpy (buffer + OFF_STRINGS, &u32, 4);
+
+  u64 = GUINT64_TO_LE (gairq_air_object_get_idx (air));
+  memcpy (buffer + OFF_IDX, &u64, 8);
+  u64 = GUINT64_TO_LE (gairq_air_object_get_aqi (air));
+  memcpy (buffer + OFF_AQI, &u64, 8);
+  u64 = GUINT64_TO_LE (gairq_air_object_get_time (air));
+  memcpy (buffer + OFF_TIME, &u64, 8);
+
+  if (city)
+    {
+      geo [0] = city->geo.latitude;
+      geo [1] = city->geo.longitude;
+      buffer [OFF_FLAGS] |= FLAG_HAS_CITY;
+    }
+  for (i = 0; i < 2; i++)
+    {
+      memcpy (&u64, &geo [i], 8);
+      u64 = GUINT64_TO_LE (u64);
+      memcpy (buffer + OFF_LATITUDE + i * 8, &u64, 8);
+    }
+
+  u16 = GUINT16_TO_LE (g_slist_length (gairq_air_object_get_attributions (air)));
+  memcpy (buffer + OFF_N_ATTRS, &u16, 2);
+  u16 = GUINT16_TO_LE (iaqi ? g_hash_table_size (iaqi) : 0);
+  memcpy (buffer + OFF_N_IAQI, &u16, 2);
+}
+
+/* Encodes @self into @buffer if it takes no more than @buffer_size bytes,
+ * like snprintf () the size it takes is returned either way.
+ */
+gsize
+gairq_air_object_encode (GairqAirObject *self,
+                         gpointer        buffer,
+                         gsize           buffer_size)
+{
+  Encoder encoder;
+  gsize strings_offset, size;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), 0);
+  g_return_val_if_fail (buffer != NULL || buffer_size == 0, 0);
+
+  encoder.buffer = NULL;
+  encoder.strings_start = 0;
+  encoder_run (&encoder, self);
+
+  strings_offset = encoder.body_pos;
+  size = strings_offset + encoder.strings_pos;
+
+  /* Counts and offsets have to fit their header fields */
+  g_return_val_if_fail (size <= G_MAXUINT32, 0);
+  g_return_val_if_fail (g_slist_length (gairq_air_object_get_attributions (self)) <= G_MAXUINT16, 0);
+  g_return_val_if_fail (gairq_air_object_get_iaqi (self) == NULL ||
+                        g_hash_table_size (gairq_air_object_get_iaqi (self)) <= G_MAXUINT16, 0);
+
+  if (size > buffer_size)
+    return size;
+
+  encoder.buffer = buffer;
+  encoder.strings_start = strings_offset;
+  encoder_run (&encoder, self);
+
+  write_header (buffer, self, size, strings_offset);
+
+  return size;
+}
+
+GBytes *
+gairq_air_object_to_binary (GairqAirObject *self)
+{
+  gsize size;
+  gpointer buffer;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), NULL);
+
+  size = gairq_air_object_encode (self, NULL, 0);
+  buffer = g_malloc (size);
+  gairq_air_object_encode (self, buffer, size);
+
+  return g_bytes_new_take (buffer, size);
+}
+
+/* --- GairqAirView --- */
+static const gchar *
+view_string (const GairqAirView *view,
+             guint64             ref)
+{
+  const guint8 *p, *end = view->strings + view->strings_size;
+  guint64 length;
+
+  if (ref == 0 || ref > view->strings_size)
+    return NULL;
+
+  p = view->strings + ref - 1;
+  if (!read_varint (&p, end, &length) || length >= (guint64) (end - p) || p [length] != '\0')
+    return NULL;
+
+  return (const gchar *) p;
+}
+
+/* Steps over @n_refs string references in the body, the view checked
+ * all of them on init.
+ */
+static const guint8 *
+view_skip_refs (const guint8 *p,
+                guint         n_refs)
+{
+  while (n_refs--)
+    {
+      while (*p & 0x80)
+        p++;
+      p++;
+    }
+
+  return p;
+}
+
+/* Checks the header and that every reference in the body is in bounds,
+ * nothing is decoded. Strings are checked again when looked up.
+ */
+gboolean
+gairq_air_view_init (GairqAirView  *view,
+                     gconstpointer  data,
+                     gsize          size,
+                     GError       **error)
+{
+  const guint8 *bytes = data;
+  const guint8 *p, *end;
+  gsize header_size, total, strings_offset;
+  guint n_refs, n_iaqi, i;
+  guint64 ref;
+
+  g_return_val_if_fail (view != NULL, FALSE);
+  g_return_val_if_fail (data != NULL || size == 0, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (size < GAIRQ_AIR_BINARY_HEADER_SIZE || memcmp (bytes + OFF_MAGIC, MAGIC, 4) != 0)
+    {
+      g_set_error (error, GAIRQ_AIR_BINARY_ERROR, 0, "Not an encoded air object");
+      return FALSE;
+    }
+
+  if (read_u16 (bytes + OFF_VERSION) != GAIRQ_AIR_BINARY_VERSION)
+    {
+      g_set_error (error, GAIRQ_AIR_BINARY_ERROR, 0,
+                   "Unsupported encoding version %u", read_u16 (bytes + OFF_VERSION));
+      return FALSE;
+    }
+
+  header_size = read_u16 (bytes + OFF_HEADER_SIZE);
+  total = read_u32 (bytes + OFF_SIZE);
+  strings_offset = read_u32 (bytes + OFF_STRINGS);
+
+  if (header_size < GAIRQ_AIR_BINARY_HEADER_SIZE || total > size ||
+      strings_offset < header_size || strings_offset > total)
+    {
+      g_set_error (error, GAIRQ_AIR_BINARY_ERROR, 0, "Truncated encoded air object");
+      return FALSE;
+    }
+
+  view->data = bytes;
+  view->size = total;
+  view->body = bytes + header_size;
+  view->strings = bytes + strings_offset;
+  view->strings_size = total - strings_offset;
+
+  p = view->body;
+  end = view->strings;
+  n_refs = 2 + 2 * read_u16 (bytes + OFF_N_ATTRS);
+  n_iaqi = read_u16 (bytes + OFF_N_IAQI);
+
+  for (i = 0; i < n_refs + n_iaqi; i++)
+    {
+      if (!read_varint (&p, end, &ref) || ref > view->strings_size)
+        goto out_corrupt;
+
+      /* Each iaqi key is followed by its value */
+      if (i >= n_refs)
+        {
+          if (end - p < 8)
+            goto out_corrupt;
+          p += 8;
+        }
+    }
+
+  return TRUE;
+
+out_corrupt:
+  g_set_error (error, GAIRQ_AIR_BINARY_ERROR, 0, "Corrupt encoded air object");
+
+  return FALSE;
+}
+
+/* How many bytes of the data the object takes up, more may follow it */
+gsize
+gairq_air_view_get_size (const GairqAirView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return view->size;
+}
+
+gint64
+gairq_air_view_get_idx (const GairqAirView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return read_u64 (view->data + OFF_IDX);
+}
+
+gint64
+gairq_air_view_get_aqi (const GairqAirView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return read_u64 (view->data + OFF_AQI);
+}
+
+gint64
+gairq_air_view_get_time (const GairqAirView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return read_u64 (view->data + OFF_TIME);
+}
+
+/* FALSE if there is no city, which is never without a location */
+gboolean
+gairq_air_view_get_geo (const GairqAirView *view,
+                        gdouble            *latitude,
+                        gdouble            *longitude)
+{
+  g_return_val_if_fail (view != NULL, FALSE);
+
+  if (!(view->data [OFF_FLAGS] & FLAG_HAS_CITY))
+    return FALSE;
+
+  if (latitude)
+    *latitude = read_double (view->data + OFF_LATITUDE);
+  if (longitude)
+    *longitude = read_double (view->data + OFF_LONGITUDE);
+
+  return TRUE;
+}
+
+const gchar *
+gairq_air_view_get_city_name (const GairqAirView *view)
+{
+  const guint8 *p;
+  guint64 ref;
+
+  g_return_val_if_fail (view != NULL, NULL);
+
+  p = view->body;
+  read_varint (&p, view->strings, &ref);
+
+  return view_string (view, ref);
+}
+
+const gchar *
+gairq_air_view_get_city_url (const GairqAirView *view)
+{
+  const guint8 *p;
+  guint64 ref;
+
+  g_return_val_if_fail (view != NULL, NULL);
+
+  p = view_skip_refs (view->body, 1);
+  read_varint (&p, view->strings, &ref);
+
+  return view_string (view, ref);
+}
+
+guint
+gairq_air_view_get_n_attributions (const GairqAirView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return read_u16 (view->data + OFF_N_ATTRS);
+}
+
+gboolean
+gairq_air_view_get_attribution (const GairqAirView  *view,
+                                guint                index,
+                                const gchar        **name,
+                                const gchar        **url)
+{
+  const guint8 *p;
+  guint64 ref;
+
+  g_return_val_if_fail (view != NULL, FALSE);
+
+  if (index >= gairq_air_view_get_n_attributions (view))
+    return FALSE;
+
+  p = view_skip_refs (view->body, 2 + 2 * index);
+
+  read_varint (&p, view->strings, &ref);
+  if (name)
+    *name = view_string (view, ref);
+  read_varint (&p, view->strings, &ref);
+  if (url)
+    *url = view_string (view, ref);
+
+  return TRUE;
+}
+
+guint
+gairq_air_view_get_n_iaqi (const GairqAirView *view)
+{
+  g_return_val_if_fail (view != NULL, 0);
+
+  return read_u16 (view->data + OFF_N_IAQI);
+}
+
+gboolean
+gairq_air_view_get_iaqi (const GairqAirView  *view,
+                         guint                index,
+                         const gchar        **key,
+                         gdouble             *value)
+{
+  const guint8 *p;
+  guint64 ref;
+  guint i;
+
+  g_return_val_if_fail (view != NULL, FALSE);
+
+  if (index >= gairq_air_view_get_n_iaqi (view))
+    return FALSE;
+
+  p = view_skip_refs (view->body, 2 + 2 * gairq_air_view_get_n_attributions (view));
+  for (i = 0; i < index; i++)
+    p = view_skip_refs (p, 1) + 8;
+
+  read_varint (&p, view->strings, &ref);
+  if (key)
+    *key = view_string (view, ref);
+  if (value)
+    *value = read_double (p);
+
+  return TRUE;
+}
+
+/* NAN if @key isn't there */
+gdouble
+gairq_air_view_lookup_iaqi (const GairqAirView *view,
+                            const gchar        *key)
+{
+  const guint8 *p;
+  guint n_iaqi, i;
+  guint64 ref;
+
+  g_return_val_if_fail (view != NULL, NAN);
+  g_return_val_if_fail (key != NULL, NAN);
+
+  n_iaqi = gairq_air_view_get_n_iaqi (view);
+  p = view_skip_refs (view->body, 2 + 2 * gairq_air_view_get_n_attributions (view));
+
+  for (i = 0; i < n_iaqi; i++)
+    {
+      read_varint (&p, view->strings, &ref);
+      if (g_strcmp0 (view_string (view, ref), key) == 0)
+        return read_double (p);
+      p += 8;
+    }
+
+  return NAN;
+}
@@ -0,0 +1,91 @@
+/* gairq-air-binary.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_AIR_BINARY_H
+#define GAIRQ_AIR_BINARY_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+/* Readers refuse any other version, newer header fields only ever get
+ * appended so that the ones below keep their offsets.
+ */
+#define GAIRQ_AIR_BINARY_VERSION      1
+#define GAIRQ_AIR_BINARY_HEADER_SIZE  64
+
+/* Reads an encoded object where it lies, say in a mapped file, without
+ * decoding it. Strings point into the data, which has to outlive it.
+ */
+typedef struct _GairqAirView GairqAirView;
+
+struct _GairqAirView
+{
+  /*< private >*/
+  const guint8 *  data;
+  gsize           size;
+  const guint8 *  body;
+  const guint8 *  strings;
+  gsize           strings_size;
+};
+
+gsize           gairq_air_object_encode           (GairqAirObject      *self,
+                                                   gpointer             buffer,
+                                                   gsize                buffer_size);
+GBytes *        gairq_air_object_to_binary        (GairqAirObject      *self);
+GairqAirObject *gairq_air_object_new_from_binary  (GBytes              *bytes,
+                                                   GairqAirObjectFlags  flags,
+                                                   GError             **error);
+
+gboolean        gairq_air_view_init               (GairqAirView        *view,
+                                                   gconstpointer        data,
+                                                   gsize                size,
+                                                   GError             **error);
+gsize           gairq_air_view_get_size           (const GairqAirView  *view);
+gint64          gairq_air_view_get_idx            (const GairqAirView  *view);
+gint64          gairq_air_view_get_aqi            (const GairqAirView  *view);
+gint64          gairq_air_view_get_time           (const GairqAirView  *view);
+gboolean        gairq_air_view_get_geo            (const GairqAirView  *view,
+                                                   gdouble             *latitude,
+                                                   gdouble             *longitude);
+const gchar *   gairq_air_view_get_city_name      (const GairqAirView  *view);
+const gchar *   gairq_air_view_get_city_url       (const GairqAirView  *view);
+guint           gairq_air_view_get_n_attributions (const GairqAirView  *view);
+gboolean        gairq_air_view_get_attribution    (const GairqAirView  *view,
+                                                   guint                index,
+                                                   const gchar        **name,
+                                                   const gchar        **url);
+guint           gairq_air_view_get_n_iaqi         (const GairqAirView  *view);
+gboolean        gairq_air_view_get_iaqi           (const GairqAirView  *view,
+                                                   guint                index,
+                                                   const gchar        **key,
+                                                   gdouble             *value);
+gdouble         gairq_air_view_lookup_iaqi        (const GairqAirView  *view,
+                                                   const gchar         *key);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,39 @@
+/* gairq-air-object-priv.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_AIR_OBJECT_PRIV_H
+#define GAIRQ_AIR_OBJECT_PRIV_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include "gairq-air-object.h"
+#include "gairq-json-scanner.h"
+
+G_BEGIN_DECLS
+
+GairqAirObject *  gairq_air_object_new_from_scanner (GairqJsonScanner    *scanner,
+                                                     GBytes              *payload,
+                                                     GairqAirObjectFlags  flags);
+
+G_END_DECLS
+
+#endif
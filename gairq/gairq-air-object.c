@@ -19,19 +19,60 @@
  */
 
 #include "gairq-air-object.h"
+#include "gairq-air-object-priv.h"
+#include "gairq-air-binary.h"
+#include "gairq-arena.h"
 #include "gairq-debug.h"
+#include "gairq-intern.h"
+
+#include <string.h>
 
 #include <json-glib/json-glib.h>
 
+/* Members of "data" which can be decoded on their own */
+typedef enum {
+  LAZY_IDX,
+  LAZY_AQI,
+  LAZY_ATTRS,
+  LAZY_CITY,
+  LAZY_IAQI,
+  LAZY_TIME,
+  N_LAZY_FIELDS
+} LazyField;
+
+static const gchar * const lazy_keys [N_LAZY_FIELDS] = {
+  [LAZY_IDX] = "idx",
+  [LAZY_AQI] = "aqi",
+  [LAZY_ATTRS] = "attributions",
+  [LAZY_CITY] = "city",
+  [LAZY_IAQI] = "iaqi",
+  [LAZY_TIME] = "time",
+};
+
 struct _GairqAirObject
 {
   GObject           parent_instance;
 
   gint64            idx;
   gint64            aqi;
+  gint64            time;
   GSList *          attrs;
   GairqObjectCity * city;
   GHashTable *      iaqi;
+
+  GairqAirObjectFlags flags;
+  /* Backing block of attrs, city and iaqi entries, if any */
+  GairqArena *      arena;
+  /* Response the strings point into, in zero-copy mode */
+  GBytes *          payload;
+
+  /* Lazy mode decodes a field out of either the node or the payload,
+   * at the recorded offset, the first time it is asked for.
+   */
+  JsonNode *        lazy_node;
+  gsize             lazy_offsets [N_LAZY_FIELDS];
+  gsize             lazy_done [N_LAZY_FIELDS];
+  GMutex            lazy_lock;
 };
 
 enum {
@@ -41,6 +82,7 @@ enum {
   PROP_ATTRS,
   PROP_CITY,
   PROP_IAQI,
+  PROP_TIME,
   N_PROPERTIES
 };
 
@@ -48,22 +90,92 @@ GParamSpec* properties [N_PROPERTIES];
 
 static void gairq_air_object_json_serializable_iface_init (JsonSerializableIface *iface);
 
+static void gairq_air_object_ensure (GairqAirObject *self,
+                                     LazyField       field);
+
 G_DEFINE_TYPE_WITH_CODE (GairqAirObject, gairq_air_object, G_TYPE_OBJECT,
                          G_IMPLEMENT_INTERFACE (JSON_TYPE_SERIALIZABLE,
                                                 gairq_air_object_json_serializable_iface_init))
 
 
+/* --- Helpers --- */
+/* Only sub-structs marked interned ever ask the pool, so freeing plain
+ * ones never takes its lock.
+ */
+static gchar *
+copy_string (const gchar *str,
+             gboolean     interned)
+{
+  if (interned && gairq_intern_ref (str))
+    return (gchar *) str;
+
+  return g_strdup (str);
+}
+
+static void
+free_string (gchar    *str,
+             gboolean  interned)
+{
+  if (!interned || !gairq_intern_release (str))
+    g_free (str);
+}
+
+static void
+gairq_air_object_clear_attrs (GairqAirObject *self)
+{
+  /* Nodes and entries living in the arena go away with it at once,
+   * only the interned strings they refer to need to be given back.
+   */
+  if (!gairq_arena_contains (self->arena, self->attrs))
+    g_slist_free_full (self->attrs,
+                       (GDestroyNotify) gairq_object_attr_free);
+  else if (self->flags & GAIRQ_AIR_OBJECT_FLAGS_INTERN)
+    {
+      GSList *iter;
+
+      for (iter = self->attrs; iter; iter = g_slist_next (iter))
+        {
+          GairqObjectAttr *attr = iter->data;
+
+          if (attr->interned)
+            {
+              gairq_intern_release (attr->name);
+              gairq_intern_release (attr->url);
+            }
+        }
+    }
+
+  self->attrs = NULL;
+}
+
+static void
+gairq_air_object_clear_city (GairqAirObject *self)
+{
+  if (!gairq_arena_contains (self->arena, self->city))
+    gairq_object_city_free (self->city);
+  else if (self->city && self->city->interned)
+    gairq_intern_release (self->city->url);
+
+  self->city = NULL;
+}
+
 /* --- GObject --- */
 static void
 gairq_air_object_finalize (GObject *object)
 {
   GairqAirObject *self = GAIRQ_AIR_OBJECT (object);
 
-  g_slist_free_full (self->attrs,
-                     (GDestroyNotify) gairq_object_attr_free);
+  gairq_air_object_clear_attrs (self);
+  gairq_air_object_clear_city (self);
 
-  gairq_object_city_free (self->city);
+  /* An arena-backed table has no destroy functions, only the table
+   * itself needs to be released before the arena.
+   */
   gairq_object_iaqi_free (self->iaqi);
+  gairq_arena_free (self->arena);
+  g_clear_pointer (&self->payload, g_bytes_unref);
+  g_clear_pointer (&self->lazy_node, json_node_unref);
+  g_mutex_clear (&self->lazy_lock);
 
   G_OBJECT_CLASS (gairq_air_object_parent_class)->finalize (object);
 }
@@ -76,6 +188,11 @@ gairq_air_object_set_property (GObject      *object,
 {
   GairqAirObject *self = GAIRQ_AIR_OBJECT (object);
 
+  /* Whatever is set wins over what is still waiting to be decoded */
+  if (prop_id >= PROP_IDX && prop_id <= PROP_TIME &&
+      g_once_init_enter (&self->lazy_done [prop_id - PROP_IDX]))
+    g_once_init_leave (&self->lazy_done [prop_id - PROP_IDX], 1);
+
   switch (prop_id)
     {
     case PROP_IDX:
@@ -87,13 +204,12 @@ gairq_air_object_set_property (GObject      *object,
       break;
 
     case PROP_ATTRS:
-      g_slist_free_full (self->attrs,
-                         (GDestroyNotify) gairq_object_attr_free);
+      gairq_air_object_clear_attrs (self);
       self->attrs = g_value_get_pointer (value);
       break;
 
     case PROP_CITY:
-      gairq_object_city_free (self->city);
+      gairq_air_object_clear_city (self);
       self->city = g_value_get_pointer (value);
       break;
 
@@ -102,6 +218,10 @@ gairq_air_object_set_property (GObject      *object,
       self->iaqi = g_value_get_pointer (value);
       break;
 
+    case PROP_TIME:
+      self->time = g_value_get_int64 (value);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -115,6 +235,9 @@ gairq_air_object_get_property (GObject    *object,
 {
   GairqAirObject *self = GAIRQ_AIR_OBJECT (object);
 
+  if (prop_id >= PROP_IDX && prop_id <= PROP_TIME)
+    gairq_air_object_ensure (self, prop_id - PROP_IDX);
+
   switch (prop_id)
     {
     case PROP_IDX:
@@ -137,6 +260,10 @@ gairq_air_object_get_property (GObject    *object,
       g_value_set_pointer (value, self->iaqi);
       break;
 
+    case PROP_TIME:
+      g_value_set_int64 (value, self->time);
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -178,15 +305,35 @@ gairq_air_object_class_init (GairqAirObjectClass *klass)
                           "Measurement time information",
                           G_PARAM_READWRITE);
 
+  properties [PROP_TIME] =
+    g_param_spec_int64 ("time", "Time",
+                        "When the station took the measurements, as the server tells",
+                        G_MININT64, G_MAXINT64, 0,
+                        G_PARAM_READWRITE);
+
   g_object_class_install_properties (object_class, N_PROPERTIES, properties);
 }
 
 static void
 gairq_air_object_init (GairqAirObject *self)
 {
+  guint i;
+
   self->attrs = NULL;
   self->city = NULL;
   self->iaqi = NULL;
+  self->flags = GAIRQ_AIR_OBJECT_FLAGS_NONE;
+  self->arena = NULL;
+  self->payload = NULL;
+  self->lazy_node = NULL;
+  g_mutex_init (&self->lazy_lock);
+
+  /* Everything counts as decoded unless a lazy constructor says not */
+  for (i = 0; i < N_LAZY_FIELDS; i++)
+    {
+      self->lazy_offsets [i] = G_MAXSIZE;
+      self->lazy_done [i] = 1;
+    }
 }
 
 /* --- JsonSerializableIface --- */
@@ -196,15 +343,83 @@ gairq_air_object_json_serialize_property (JsonSerializable *serializable,
                                           const GValue     *value,
                                           GParamSpec       *pspec)
 {
-  gpointer ret;
+  JsonNode *ret = NULL;
+
+  /* The inverse of deserialize_property (), in the shape of a response */
+  if (g_strcmp0 ("attributions", property_name) == 0)
+    {
+      JsonArray *jarr = json_array_new ();
+      GSList *iter;
 
-  /* Ever since the API provides only GET method, we have nothing to do */
-  if (g_strcmp0 ("attributions", property_name) == 0 ||
-      g_strcmp0 ("city", property_name) == 0 ||
-      g_strcmp0 ("iaqi", property_name) == 0)
+      for (iter = g_value_get_pointer (value); iter; iter = g_slist_next (iter))
+        {
+          GairqObjectAttr *attr = iter->data;
+          JsonObject *elem = json_object_new ();
+
+          json_object_set_string_member (elem, "name", attr->name);
+          json_object_set_string_member (elem, "url", attr->url);
+          json_array_add_object_element (jarr, elem);
+        }
+
+      ret = json_node_init_array (json_node_alloc (), jarr);
+      json_array_unref (jarr);
+    }
+
+  else if (g_strcmp0 ("city", property_name) == 0)
+    {
+      GairqObjectCity *city = g_value_get_pointer (value);
+
+      if (city)
+        {
+          JsonObject *city_obj = json_object_new ();
+          JsonArray *geo = json_array_new ();
+
+          json_array_add_double_element (geo, city->geo.latitude);
+          json_array_add_double_element (geo, city->geo.longitude);
+
+          json_object_set_string_member (city_obj, "name", city->name);
+          json_object_set_string_member (city_obj, "url", city->url);
+          json_object_set_array_member (city_obj, "geo", geo);
+
+          ret = json_node_init_object (json_node_alloc (), city_obj);
+          json_object_unref (city_obj);
+        }
+    }
+
+  else if (g_strcmp0 ("iaqi", property_name) == 0)
+    {
+      GHashTable *iaqi = g_value_get_pointer (value);
+
+      if (iaqi)
+        {
+          JsonObject *iaqi_obj = json_object_new ();
+          GHashTableIter iter;
+          gpointer key, v;
+
+          g_hash_table_iter_init (&iter, iaqi);
+          while (g_hash_table_iter_next (&iter, &key, &v))
+            {
+              JsonObject *elem = json_object_new ();
+
+              json_object_set_double_member (elem, "v", *(gdouble *) v);
+              json_object_set_object_member (iaqi_obj, key, elem);
+            }
+
+          ret = json_node_init_object (json_node_alloc (), iaqi_obj);
+          json_object_unref (iaqi_obj);
+        }
+    }
+
+  else if (g_strcmp0 ("time", property_name) == 0)
     {
-      ret = NULL;
+      JsonObject *time_obj = json_object_new ();
+
+      json_object_set_int_member (time_obj, "v", g_value_get_int64 (value));
+
+      ret = json_node_init_object (json_node_alloc (), time_obj);
+      json_object_unref (time_obj);
     }
+
   else
     {
       ret = json_serializable_default_serialize_property (serializable,
@@ -346,6 +561,22 @@ gairq_air_object_json_deserialize_property (JsonSerializable *serializable,
         }
     }
 
+  else if (g_strcmp0 ("time", property_name) == 0)
+    {
+      if (JSON_NODE_HOLDS_OBJECT (property_node))
+        {
+          JsonObject *time_obj = json_node_get_object (property_node);
+          JsonNode *v = json_object_get_member (time_obj, "v");
+
+          /* Only the epoch seconds, "s" and "tz" are the same in text */
+          if (v && JSON_NODE_HOLDS_VALUE (v))
+            {
+              g_value_set_int64 (value, json_node_get_int (v));
+              ret = TRUE;
+            }
+        }
+    }
+
   else
     {
       ret = json_serializable_default_deserialize_property (serializable,
@@ -424,8 +655,8 @@ gairq_object_attr_free (GairqObjectAttr *attr)
 {
   if (attr)
     {
-      g_free (attr->name);
-      g_free (attr->url);
+      free_string (attr->name, attr->interned);
+      free_string (attr->url, attr->interned);
       g_slice_free (GairqObjectAttr, attr);
     }
 }
@@ -442,10 +673,18 @@ gairq_object_attr_copy (GairqObjectAttr *src)
 GairqObjectAttr *
 gairq_object_attr_copy_deep (GairqObjectAttr *src)
 {
+  GairqObjectAttr *new_attr;
+
   if (src == NULL)
     return NULL;
 
-  return gairq_object_attr_new (src->name, src->url);
+  /* Pooled strings are shared, not duplicated */
+  new_attr = g_slice_new0 (GairqObjectAttr);
+  new_attr->name = copy_string (src->name, src->interned);
+  new_attr->url = copy_string (src->url, src->interned);
+  new_attr->interned = src->interned;
+
+  return new_attr;
 }
 
 /* --- GairqObjectCity --- */
@@ -474,7 +713,7 @@ gairq_object_city_free (GairqObjectCity *city)
   if (city)
     {
       g_free (city->name);
-      g_free (city->url);
+      free_string (city->url, city->interned);
       g_slice_free (GairqObjectCity, city);
     }
 }
@@ -491,13 +730,16 @@ gairq_object_city_copy (GairqObjectCity *src)
 GairqObjectCity *
 gairq_object_city_copy_deep (GairqObjectCity *src)
 {
+  GairqObjectCity *new_city;
+
   if (src == NULL)
     return NULL;
 
-  return gairq_object_city_new (src->name,
-                                src->url,
-                                src->geo.latitude,
-                                src->geo.longitude);
+  new_city = g_slice_dup (GairqObjectCity, src);
+  new_city->name = g_strdup (src->name);
+  new_city->url = copy_string (src->url, src->interned);
+
+  return new_city;
 }
 
 /* --- GHashTable for iaqi property --- */
@@ -527,12 +769,745 @@ gairq_object_iaqi_free (GHashTable *iaqi)
     g_hash_table_destroy (iaqi);
 }
 
+/* --- GairqPollutant --- */
+static const gchar * const pollutant_keys [N_GAIRQ_POLLUTANTS] = {
+  [GAIRQ_POLLUTANT_PM25] = "pm25",
+  [GAIRQ_POLLUTANT_PM10] = "pm10",
+  [GAIRQ_POLLUTANT_O3] = "o3",
+  [GAIRQ_POLLUTANT_NO2] = "no2",
+  [GAIRQ_POLLUTANT_SO2] = "so2",
+  [GAIRQ_POLLUTANT_CO] = "co",
+};
+
+const gchar *
+gairq_pollutant_to_string (GairqPollutant pollutant)
+{
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NULL);
+
+  return pollutant_keys [pollutant];
+}
+
+gboolean
+gairq_pollutant_from_string (const gchar    *key,
+                             GairqPollutant *pollutant)
+{
+  guint i;
+
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  /* The keys are the same with the ones of "iaqi" member */
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      if (g_strcmp0 (pollutant_keys [i], key) == 0)
+        {
+          if (pollutant)
+            *pollutant = i;
+          return TRUE;
+        }
+    }
+
+  return FALSE;
+}
+
+/* --- Arena-backed deserialization --- */
+static gsize
+arena_string_size (const gchar *str)
+{
+  return str ? GAIRQ_ARENA_ALIGN (strlen (str) + 1) : 0;
+}
+
+/* Walks the members the arena will hold and sums their aligned sizes,
+ * so that the whole object is backed by a single allocation.
+ */
+static gsize
+gairq_air_object_arena_measure (JsonObject          *data,
+                                GairqAirObjectFlags  flags)
+{
+  gboolean intern = (flags & GAIRQ_AIR_OBJECT_FLAGS_INTERN) != 0;
+  JsonNode *node;
+  gsize size = 0;
+
+  node = json_object_get_member (data, "attributions");
+  if (node && JSON_NODE_HOLDS_ARRAY (node))
+    {
+      JsonArray *jarr = json_node_get_array (node);
+      guint i, len = json_array_get_length (jarr);
+
+      for (i = 0; i < len; i++)
+        {
+          JsonObject *elem = json_array_get_object_element (jarr, i);
+
+          size += GAIRQ_ARENA_ALIGN (sizeof (GSList));
+          size += GAIRQ_ARENA_ALIGN (sizeof (GairqObjectAttr));
+          if (!intern)
+            {
+              size += arena_string_size (json_object_get_string_member (elem, "name"));
+              size += arena_string_size (json_object_get_string_member (elem, "url"));
+            }
+        }
+    }
+
+  node = json_object_get_member (data, "city");
+  if (node && JSON_NODE_HOLDS_OBJECT (node))
+    {
+      JsonObject *city_obj = json_node_get_object (node);
+
+      size += GAIRQ_ARENA_ALIGN (sizeof (GairqObjectCity));
+      size += arena_string_size (json_object_get_string_member (city_obj, "name"));
+      if (!intern)
+        size += arena_string_size (json_object_get_string_member (city_obj, "url"));
+    }
+
+  node = json_object_get_member (data, "iaqi");
+  if (node && JSON_NODE_HOLDS_OBJECT (node))
+    {
+      JsonObject *iaqi_object = json_node_get_object (node);
+      GList *members, *elem;
+
+      members = json_object_get_members (iaqi_object);
+      for (elem = members; elem; elem = g_list_next (elem))
+        {
+          size += arena_string_size (elem->data);
+          size += GAIRQ_ARENA_ALIGN (sizeof (gdouble));
+        }
+      g_list_free (members);
+    }
+
+  return size;
+}
+
+/* Sub-structs of lazily decoded fields only need an arena once any of
+ * them is asked for.
+ */
+static GairqArena *
+gairq_air_object_get_arena (GairqAirObject *self)
+{
+  if (self->arena == NULL)
+    self->arena = gairq_arena_new (256);
+
+  return self->arena;
+}
+
+/* Metadata shared by many stations goes to the pool if asked to */
+static gchar *
+gairq_air_object_dup_shared (GairqAirObject *self,
+                             const gchar    *str)
+{
+  if (self->flags & GAIRQ_AIR_OBJECT_FLAGS_INTERN)
+    return (gchar *) gairq_intern_string (str);
+
+  return gairq_arena_strdup (gairq_air_object_get_arena (self), str);
+}
+
+static void
+gairq_air_object_load_member (GairqAirObject *self,
+                              LazyField       field,
+                              JsonNode       *node)
+{
+  GairqArena *arena;
+
+  switch (field)
+    {
+    case LAZY_IDX:
+      if (JSON_NODE_HOLDS_VALUE (node))
+        self->idx = json_node_get_int (node);
+      break;
+
+    case LAZY_AQI:
+      if (JSON_NODE_HOLDS_VALUE (node))
+        {
+          /* Same as the "aqi" property, see deserialize_property () */
+          if (g_strcmp0 ("Integer", json_node_type_name (node)) == 0)
+            self->aqi = json_node_get_int (node);
+          else
+            self->aqi = -1;
+        }
+      break;
+
+    case LAZY_ATTRS:
+      if (JSON_NODE_HOLDS_ARRAY (node))
+        {
+          JsonArray *jarr = json_node_get_array (node);
+          guint i, len = json_array_get_length (jarr);
+          GSList *tail = NULL;
+
+          arena = gairq_air_object_get_arena (self);
+
+          for (i = 0; i < len; i++)
+            {
+              JsonObject *elem = json_array_get_object_element (jarr, i);
+              GairqObjectAttr *attr;
+              GSList *link;
+
+              attr = gairq_arena_alloc (arena, sizeof (GairqObjectAttr));
+              attr->name = gairq_air_object_dup_shared (self, json_object_get_string_member (elem, "name"));
+              attr->url = gairq_air_object_dup_shared (self, json_object_get_string_member (elem, "url"));
+              attr->interned = (self->flags & GAIRQ_AIR_OBJECT_FLAGS_INTERN) != 0;
+
+              link = gairq_arena_alloc (arena, sizeof (GSList));
+              link->data = attr;
+              link->next = NULL;
+
+              if (tail)
+                tail->next = link;
+              else
+                self->attrs = link;
+              tail = link;
+            }
+        }
+      break;
+
+    case LAZY_CITY:
+      if (JSON_NODE_HOLDS_OBJECT (node))
+        {
+          JsonObject *city_obj = json_node_get_object (node);
+          JsonArray *geo = json_object_get_array_member (city_obj, "geo");
+
+          if (geo && json_array_get_length (geo) == 2)
+            {
+              GairqObjectCity *city;
+
+              arena = gairq_air_object_get_arena (self);
+
+              city = gairq_arena_alloc (arena, sizeof (GairqObjectCity));
+              city->name = gairq_arena_strdup (arena, json_object_get_string_member (city_obj, "name"));
+              city->url = gairq_air_object_dup_shared (self, json_object_get_string_member (city_obj, "url"));
+              city->interned = (self->flags & GAIRQ_AIR_OBJECT_FLAGS_INTERN) != 0;
+              city->geo.latitude = json_array_get_double_element (geo, 0);
+              city->geo.longitude = json_array_get_double_element (geo, 1);
+
+              self->city = city;
+            }
+        }
+      break;
+
+    case LAZY_IAQI:
+      if (JSON_NODE_HOLDS_OBJECT (node))
+        {
+          JsonObject *iaqi_object = json_node_get_object (node);
+          GList *members, *elem;
+
+          arena = gairq_air_object_get_arena (self);
+
+          /* Keys and values are owned by the arena */
+          self->iaqi = g_hash_table_new (g_str_hash, g_str_equal);
+
+          members = json_object_get_members (iaqi_object);
+          for (elem = members; elem; elem = g_list_next (elem))
+            {
+              JsonObject *measure;
+              gdouble *value;
+
+              measure = json_object_get_object_member (iaqi_object, elem->data);
+              value = gairq_arena_alloc (arena, sizeof (gdouble));
+              *value = json_object_get_double_member (measure, "v");
+
+              g_hash_table_insert (self->iaqi,
+                                   gairq_arena_strdup (arena, elem->data),
+                                   value);
+            }
+          g_list_free (members);
+        }
+      break;
+
+    case LAZY_TIME:
+      if (JSON_NODE_HOLDS_OBJECT (node))
+        {
+          JsonNode *v = json_object_get_member (json_node_get_object (node), "v");
+
+          if (v && JSON_NODE_HOLDS_VALUE (v))
+            self->time = json_node_get_int (v);
+        }
+      break;
+
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static void
+gairq_air_object_arena_load (GairqAirObject *self,
+                             JsonObject     *data)
+{
+  guint field;
+
+  self->arena = gairq_arena_new (gairq_air_object_arena_measure (data, self->flags));
+
+  for (field = 0; field < N_LAZY_FIELDS; field++)
+    {
+      JsonNode *node = json_object_get_member (data, lazy_keys [field]);
+
+      if (node)
+        gairq_air_object_load_member (self, field, node);
+    }
+}
+
+/* --- Zero-copy deserialization --- */
+static void
+scan_string (GairqJsonScanner  *scanner,
+             gchar            **str)
+{
+  /* Anything else, null included, leaves the field unset */
+  if (gairq_json_scanner_peek (scanner) == GAIRQ_JSON_STRING)
+    gairq_json_scanner_read_string (scanner, str);
+  else
+    gairq_json_scanner_skip (scanner);
+}
+
+static void
+gairq_air_object_scan_attributions (GairqAirObject   *self,
+                                    GairqJsonScanner *scanner)
+{
+  GSList *tail = NULL;
+  gchar *key;
+
+  if (!gairq_json_scanner_begin_array (scanner))
+    return;
+
+  while (gairq_json_scanner_next_element (scanner))
+    {
+      GairqObjectAttr *attr;
+      GSList *link;
+
+      if (gairq_json_scanner_peek (scanner) != GAIRQ_JSON_OBJECT)
+        {
+          gairq_json_scanner_skip (scanner);
+          continue;
+        }
+
+      attr = gairq_arena_alloc (gairq_air_object_get_arena (self), sizeof (GairqObjectAttr));
+      attr->name = attr->url = NULL;
+      attr->interned = FALSE;
+
+      gairq_json_scanner_begin_object (scanner);
+      while (gairq_json_scanner_next_member (scanner, &key))
+        {
+          if (g_strcmp0 ("name", key) == 0)
+            scan_string (scanner, &attr->name);
+          else if (g_strcmp0 ("url", key) == 0)
+            scan_string (scanner, &attr->url);
+          else
+            gairq_json_scanner_skip (scanner);
+        }
+
+      link = gairq_arena_alloc (gairq_air_object_get_arena (self), sizeof (GSList));
+      link->data = attr;
+      link->next = NULL;
+
+      if (tail)
+        tail->next = link;
+      else
+        self->attrs = link;
+      tail = link;
+    }
+}
+
+static void
+gairq_air_object_scan_city (GairqAirObject   *self,
+                            GairqJsonScanner *scanner)
+{
+  gchar *name = NULL, *url = NULL;
+  gdouble geo [2] = { 0, 0 };
+  guint n_geo = 0;
+  gchar *key;
+
+  if (!gairq_json_scanner_begin_object (scanner))
+    return;
+
+  while (gairq_json_scanner_next_member (scanner, &key))
+    {
+      if (g_strcmp0 ("name", key) == 0)
+        scan_string (scanner, &name);
+      else if (g_strcmp0 ("url", key) == 0)
+        scan_string (scanner, &url);
+      else if (g_strcmp0 ("geo", key) == 0 &&
+               gairq_json_scanner_peek (scanner) == GAIRQ_JSON_ARRAY)
+        {
+          gairq_json_scanner_begin_array (scanner);
+          while (gairq_json_scanner_next_element (scanner))
+            {
+              if (n_geo < 2 && gairq_json_scanner_peek (scanner) == GAIRQ_JSON_NUMBER)
+                gairq_json_scanner_read_number (scanner, &geo [n_geo], NULL);
+              else
+                gairq_json_scanner_skip (scanner);
+              n_geo++;
+            }
+        }
+      else
+        gairq_json_scanner_skip (scanner);
+    }
+
+  /* Same as the "city" property, no city without a location */
+  if (n_geo == 2)
+    {
+      GairqObjectCity *city;
+
+      city = gairq_arena_alloc (gairq_air_object_get_arena (self), sizeof (GairqObjectCity));
+      city->name = name;
+      city->url = url;
+      city->interned = FALSE;
+      city->geo.latitude = geo [0];
+      city->geo.longitude = geo [1];
+
+      self->city = city;
+    }
+}
+
+static void
+gairq_air_object_scan_iaqi (GairqAirObject   *self,
+                            GairqJsonScanner *scanner)
+{
+  gchar *key, *member;
+
+  if (!gairq_json_scanner_begin_object (scanner))
+    return;
+
+  self->iaqi = g_hash_table_new (g_str_hash, g_str_equal);
+
+  while (gairq_json_scanner_next_member (scanner, &key))
+    {
+      if (gairq_json_scanner_peek (scanner) != GAIRQ_JSON_OBJECT)
+        {
+          gairq_json_scanner_skip (scanner);
+          continue;
+        }
+
+      gairq_json_scanner_begin_object (scanner);
+      while (gairq_json_scanner_next_member (scanner, &member))
+        {
+          if (g_strcmp0 ("v", member) == 0 &&
+              gairq_json_scanner_peek (scanner) == GAIRQ_JSON_NUMBER)
+            {
+              gdouble *value = gairq_arena_alloc (gairq_air_object_get_arena (self), sizeof (gdouble));
+
+              gairq_json_scanner_read_number (scanner, value, NULL);
+              g_hash_table_insert (self->iaqi, key, value);
+            }
+          else
+            gairq_json_scanner_skip (scanner);
+        }
+    }
+}
+
+static void
+gairq_air_object_scan_time (GairqAirObject   *self,
+                            GairqJsonScanner *scanner)
+{
+  gchar *member;
+
+  gairq_json_scanner_begin_object (scanner);
+  while (gairq_json_scanner_next_member (scanner, &member))
+    {
+      if (g_strcmp0 ("v", member) == 0 &&
+          gairq_json_scanner_peek (scanner) == GAIRQ_JSON_NUMBER)
+        gairq_json_scanner_read_int (scanner, &self->time);
+      else
+        gairq_json_scanner_skip (scanner);
+    }
+}
+
+static void
+gairq_air_object_scan_member (GairqAirObject   *self,
+                              LazyField         field,
+                              GairqJsonScanner *scanner)
+{
+  GairqJsonType type = gairq_json_scanner_peek (scanner);
+  gboolean integer = FALSE;
+  gdouble number;
+
+  if (field == LAZY_IDX && type == GAIRQ_JSON_NUMBER)
+    {
+      gairq_json_scanner_read_number (scanner, &number, &integer);
+      if (integer)
+        self->idx = (gint64) number;
+    }
+  else if (field == LAZY_AQI && type != GAIRQ_JSON_NULL &&
+           type != GAIRQ_JSON_OBJECT && type != GAIRQ_JSON_ARRAY)
+    {
+      /* Same as the "aqi" property, see deserialize_property () */
+      if (type == GAIRQ_JSON_NUMBER)
+        gairq_json_scanner_read_number (scanner, &number, &integer);
+      else
+        gairq_json_scanner_skip (scanner);
+
+      self->aqi = integer ? (gint64) number : -1;
+    }
+  else if (field == LAZY_ATTRS && type == GAIRQ_JSON_ARRAY)
+    gairq_air_object_scan_attributions (self, scanner);
+  else if (field == LAZY_CITY && type == GAIRQ_JSON_OBJECT)
+    gairq_air_object_scan_city (self, scanner);
+  else if (field == LAZY_IAQI && type == GAIRQ_JSON_OBJECT)
+    gairq_air_object_scan_iaqi (self, scanner);
+  else if (field == LAZY_TIME && type == GAIRQ_JSON_OBJECT)
+    gairq_air_object_scan_time (self, scanner);
+  else
+    gairq_json_scanner_skip (scanner);
+}
+
+static gint
+lazy_field_from_key (const gchar *key)
+{
+  guint i;
+
+  for (i = 0; i < N_LAZY_FIELDS; i++)
+    if (g_strcmp0 (lazy_keys [i], key) == 0)
+      return i;
+
+  return -1;
+}
+
+/* Builds an object out of the "data" member @scanner is at. Strings are
+ * left in @payload, which the object keeps a reference on. In lazy mode
+ * members are only validated and their offsets noted down.
+ */
+GairqAirObject *
+gairq_air_object_new_from_scanner (GairqJsonScanner    *scanner,
+                                   GBytes              *payload,
+                                   GairqAirObjectFlags  flags)
+{
+  GairqAirObject *self;
+  const gchar *start;
+  gchar *key;
+
+  g_return_val_if_fail (scanner != NULL, NULL);
+  g_return_val_if_fail (payload != NULL, NULL);
+
+  self = g_object_new (GAIRQ_TYPE_AIR_OBJECT, NULL);
+  self->flags = GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY | (flags & GAIRQ_AIR_OBJECT_FLAGS_LAZY);
+  self->payload = g_bytes_ref (payload);
+
+  start = g_bytes_get_data (payload, NULL);
+
+  /* Only sub-structs go in here, a fraction of the payload */
+  if (!(self->flags & GAIRQ_AIR_OBJECT_FLAGS_LAZY))
+    self->arena = gairq_arena_new (MAX (256, (scanner->end - scanner->pos) / 8));
+
+  if (gairq_json_scanner_begin_object (scanner))
+    {
+      while (gairq_json_scanner_next_member (scanner, &key))
+        {
+          gint field = lazy_field_from_key (key);
+
+          if (field < 0)
+            gairq_json_scanner_skip (scanner);
+          else if (self->flags & GAIRQ_AIR_OBJECT_FLAGS_LAZY)
+            {
+              gairq_json_scanner_peek (scanner);
+              self->lazy_offsets [field] = scanner->pos - start;
+              self->lazy_done [field] = 0;
+              gairq_json_scanner_skip (scanner);
+            }
+          else
+            gairq_air_object_scan_member (self, field, scanner);
+        }
+    }
+
+  if (scanner->failed)
+    g_clear_object (&self);
+
+  return self;
+}
+
+/* --- Lazy decoding --- */
+static void
+gairq_air_object_decode (GairqAirObject *self,
+                         LazyField       field)
+{
+  if (self->lazy_node)
+    {
+      JsonObject *data = json_node_get_object (self->lazy_node);
+      JsonNode *node = json_object_get_member (data, lazy_keys [field]);
+
+      if (node)
+        gairq_air_object_load_member (self, field, node);
+    }
+  else if (self->lazy_offsets [field] != G_MAXSIZE)
+    {
+      GairqJsonScanner scanner;
+      gchar *data;
+      gsize size;
+
+      /* The payload ends with a NUL of its own, which is not part of it.
+       * Skipping left the member untouched, so it reads as if it was
+       * the first time.
+       */
+      data = (gchar *) g_bytes_get_data (self->payload, &size);
+      gairq_json_scanner_init (&scanner,
+                               data + self->lazy_offsets [field],
+                               size - 1 - self->lazy_offsets [field]);
+      gairq_air_object_scan_member (self, field, &scanner);
+
+      if (scanner.failed)
+        gairq_debug ("Failed to decode \"%s\" member", lazy_keys [field]);
+    }
+}
+
+static void
+gairq_air_object_ensure (GairqAirObject *self,
+                         LazyField       field)
+{
+  if (g_once_init_enter (&self->lazy_done [field]))
+    {
+      /* Fields are decoded once each, but may share the arena */
+      g_mutex_lock (&self->lazy_lock);
+      gairq_air_object_decode (self, field);
+      g_mutex_unlock (&self->lazy_lock);
+
+      g_once_init_leave (&self->lazy_done [field], 1);
+    }
+}
+
 /* --- GairqAirObject --- */
+GairqAirObject *
+gairq_air_object_new_from_data (JsonNode            *data,
+                                GairqAirObjectFlags  flags)
+{
+  GairqAirObject *self;
+  guint field;
+
+  g_return_val_if_fail (data != NULL, NULL);
+
+  if (flags == GAIRQ_AIR_OBJECT_FLAGS_NONE)
+    return GAIRQ_AIR_OBJECT (json_gobject_deserialize (GAIRQ_TYPE_AIR_OBJECT, data));
+
+  g_return_val_if_fail (JSON_NODE_HOLDS_OBJECT (data), NULL);
+
+  self = g_object_new (GAIRQ_TYPE_AIR_OBJECT, NULL);
+  self->flags = GAIRQ_AIR_OBJECT_FLAGS_ARENA |
+    (flags & (GAIRQ_AIR_OBJECT_FLAGS_INTERN | GAIRQ_AIR_OBJECT_FLAGS_LAZY));
+
+  if (self->flags & GAIRQ_AIR_OBJECT_FLAGS_LAZY)
+    {
+      self->lazy_node = json_node_ref (data);
+      for (field = 0; field < N_LAZY_FIELDS; field++)
+        self->lazy_done [field] = 0;
+    }
+  else
+    gairq_air_object_arena_load (self, json_node_get_object (data));
+
+  return self;
+}
+
+/* --- Binary decoding --- */
+static gchar *
+gairq_air_object_take_string (GairqAirObject *self,
+                              const gchar    *str)
+{
+  /* Zero-copy strings stay in the encoded bytes the object holds on to */
+  if (str == NULL || self->payload)
+    return (gchar *) str;
+
+  return gairq_arena_strdup (self->arena, str);
+}
+
+/* Decodes what gairq_air_object_encode () made. Everything ends up in
+ * one arena, or with ZERO_COPY only the sub-structs while strings stay
+ * in @bytes. Other flags don't apply.
+ */
+GairqAirObject *
+gairq_air_object_new_from_binary (GBytes               *bytes,
+                                  GairqAirObjectFlags   flags,
+                                  GError              **error)
+{
+  GairqAirObject *self;
+  GairqAirView view;
+  gdouble latitude, longitude;
+  GSList *tail = NULL;
+  guint n_attrs, n_iaqi, i;
+  gsize size;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (!gairq_air_view_init (&view, g_bytes_get_data (bytes, NULL), g_bytes_get_size (bytes), error))
+    return NULL;
+
+  n_attrs = gairq_air_view_get_n_attributions (&view);
+  n_iaqi = gairq_air_view_get_n_iaqi (&view);
+
+  self = g_object_new (GAIRQ_TYPE_AIR_OBJECT, NULL);
+  self->idx = gairq_air_view_get_idx (&view);
+  self->aqi = gairq_air_view_get_aqi (&view);
+  self->time = gairq_air_view_get_time (&view);
+
+  /* Strings can't take up more than the encoding does */
+  size = n_attrs * (GAIRQ_ARENA_ALIGN (sizeof (GairqObjectAttr)) + GAIRQ_ARENA_ALIGN (sizeof (GSList))) +
+    GAIRQ_ARENA_ALIGN (sizeof (GairqObjectCity)) + n_iaqi * sizeof (gdouble);
+
+  if (flags & GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY)
+    {
+      self->flags = GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY;
+      self->payload = g_bytes_ref (bytes);
+    }
+  else
+    {
+      self->flags = GAIRQ_AIR_OBJECT_FLAGS_ARENA;
+      size += gairq_air_view_get_size (&view) + 8 * (2 + 2 * n_attrs + n_iaqi);
+    }
+  self->arena = gairq_arena_new (size);
+
+  if (gairq_air_view_get_geo (&view, &latitude, &longitude))
+    {
+      GairqObjectCity *city = gairq_arena_alloc (self->arena, sizeof (GairqObjectCity));
+
+      city->name = gairq_air_object_take_string (self, gairq_air_view_get_city_name (&view));
+      city->url = gairq_air_object_take_string (self, gairq_air_view_get_city_url (&view));
+      city->interned = FALSE;
+      city->geo.latitude = latitude;
+      city->geo.longitude = longitude;
+
+      self->city = city;
+    }
+
+  for (i = 0; i < n_attrs; i++)
+    {
+      GairqObjectAttr *attr;
+      const gchar *name, *url;
+      GSList *link;
+
+      gairq_air_view_get_attribution (&view, i, &name, &url);
+
+      attr = gairq_arena_alloc (self->arena, sizeof (GairqObjectAttr));
+      attr->name = gairq_air_object_take_string (self, name);
+      attr->url = gairq_air_object_take_string (self, url);
+      attr->interned = FALSE;
+
+      link = gairq_arena_alloc (self->arena, sizeof (GSList));
+      link->data = attr;
+      link->next = NULL;
+
+      if (tail)
+        tail->next = link;
+      else
+        self->attrs = link;
+      tail = link;
+    }
+
+  if (n_iaqi > 0)
+    {
+      self->iaqi = g_hash_table_new (g_str_hash, g_str_equal);
+
+      for (i = 0; i < n_iaqi; i++)
+        {
+          gdouble *value = gairq_arena_alloc (self->arena, sizeof (gdouble));
+          const gchar *key;
+
+          gairq_air_view_get_iaqi (&view, i, &key, value);
+          if (key)
+            g_hash_table_insert (self->iaqi, gairq_air_object_take_string (self, key), value);
+        }
+    }
+
+  return self;
+}
+
 gint64
 gairq_air_object_get_idx (GairqAirObject *self)
 {
   g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), -1);
 
+  gairq_air_object_ensure (self, LAZY_IDX);
+
   return self->idx;
 }
 
@@ -541,6 +1516,8 @@ gairq_air_object_get_aqi (GairqAirObject *self)
 {
   g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), -1);
 
+  gairq_air_object_ensure (self, LAZY_AQI);
+
   return self->aqi;
 }
 
@@ -549,6 +1526,8 @@ gairq_air_object_get_attributions (GairqAirObject *self)
 {
   g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), NULL);
 
+  gairq_air_object_ensure (self, LAZY_ATTRS);
+
   return self->attrs;
 }
 
@@ -557,6 +1536,8 @@ gairq_air_object_get_city (GairqAirObject *self)
 {
   g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), NULL);
 
+  gairq_air_object_ensure (self, LAZY_CITY);
+
   return self->city;
 }
 
@@ -565,5 +1546,18 @@ gairq_air_object_get_iaqi (GairqAirObject *self)
 {
   g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), NULL);
 
+  gairq_air_object_ensure (self, LAZY_IAQI);
+
   return self->iaqi;
 }
+
+/* Epoch seconds of the measurements, 0 if the response had none */
+gint64
+gairq_air_object_get_time (GairqAirObject *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (self), 0);
+
+  gairq_air_object_ensure (self, LAZY_TIME);
+
+  return self->time;
+}
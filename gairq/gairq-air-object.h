@@ -26,12 +26,41 @@
 #endif
 
 #include <glib-object.h>
+#include <json-glib/json-glib.h>
 
 G_BEGIN_DECLS
 
 #define GAIRQ_TYPE_AIR_OBJECT (gairq_air_object_get_type ())
 G_DECLARE_FINAL_TYPE (GairqAirObject, gairq_air_object, GAIRQ, AIR_OBJECT, GObject)
 
+typedef enum {
+  GAIRQ_POLLUTANT_PM25,
+  GAIRQ_POLLUTANT_PM10,
+  GAIRQ_POLLUTANT_O3,
+  GAIRQ_POLLUTANT_NO2,
+  GAIRQ_POLLUTANT_SO2,
+  GAIRQ_POLLUTANT_CO,
+  N_GAIRQ_POLLUTANTS
+} GairqPollutant;
+
+/* ARENA backs strings and sub-structs with a single block freed at once.
+ * ZERO_COPY keeps the raw response instead and makes every string a view
+ * into it, sub-structs still come from an arena. It only applies when the
+ * raw payload is at hand, from a JsonNode it falls back to ARENA.
+ * INTERN shares attribution names and URLs and city URLs through the
+ * gairq_intern_string () pool, it implies ARENA and is moot with ZERO_COPY.
+ * Deep copies of its sub-structs share the pooled strings as well.
+ * LAZY defers decoding each member until it is first asked for, keeping
+ * the JsonNode, or with ZERO_COPY only the payload, around until then.
+ */
+typedef enum {
+  GAIRQ_AIR_OBJECT_FLAGS_NONE       = 0,
+  GAIRQ_AIR_OBJECT_FLAGS_ARENA      = 1 << 0,
+  GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY  = 1 << 1,
+  GAIRQ_AIR_OBJECT_FLAGS_INTERN     = 1 << 2,
+  GAIRQ_AIR_OBJECT_FLAGS_LAZY       = 1 << 3,
+} GairqAirObjectFlags;
+
 typedef struct _GairqObjectAttr GairqObjectAttr;
 typedef struct _GairqObjectCity GairqObjectCity;
 
@@ -39,6 +68,9 @@ struct _GairqObjectAttr
 {
   gchar *name;
   gchar *url;
+
+  /* name and url come from the gairq_intern_string () pool */
+  gboolean interned;
 };
 
 struct _GairqObjectCity
@@ -50,15 +82,21 @@ struct _GairqObjectCity
       gdouble latitude;
       gdouble longitude;
     } geo;
+
+  /* url comes from the gairq_intern_string () pool, name never does */
+  gboolean interned;
 };
 
 
 /* --- GairqAirObject --- */
+GairqAirObject *  gairq_air_object_new_from_data    (JsonNode            *data,
+                                                     GairqAirObjectFlags  flags);
 gint64            gairq_air_object_get_idx          (GairqAirObject *self);
 gint64            gairq_air_object_get_aqi          (GairqAirObject *self);
 GSList *          gairq_air_object_get_attributions (GairqAirObject *self);
 GairqObjectCity * gairq_air_object_get_city         (GairqAirObject *self);
 GHashTable *      gairq_air_object_get_iaqi         (GairqAirObject *self);
+gint64            gairq_air_object_get_time         (GairqAirObject *self);
 
 /* --- GairqObjectAttr --- */
 GairqObjectAttr *   gairq_object_attr_new       (const gchar *name,
@@ -79,6 +117,11 @@ GairqObjectCity *   gairq_object_city_copy_deep (GairqObjectCity *src);
 /* --- GHashTable typed iaqi property --- */
 GHashTable *        gairq_object_iaqi_new       (void);
 void                gairq_object_iaqi_free      (GHashTable *iaqi);
+
+/* --- GairqPollutant --- */
+const gchar *       gairq_pollutant_to_string   (GairqPollutant  pollutant);
+gboolean            gairq_pollutant_from_string (const gchar    *key,
+                                                 GairqPollutant *pollutant);
 G_END_DECLS
 
 #endif
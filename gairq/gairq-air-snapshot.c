@@ -0,0 +1,400 @@
+/* gairq-air-snapshot.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-air-snapshot.h"
+#include "gairq-arena.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct
+{
+  const gchar *  name;
+  const gchar *  url;
+} SnapshotAttr;
+
+typedef struct
+{
+  const gchar *  key;
+  gdouble        value;
+} SnapshotMeasure;
+
+/* The header is followed by the attributions, the measures sorted by key
+ * and at last every string, all in the same allocation.
+ */
+struct _GairqAirSnapshot
+{
+  volatile gint           ref_count;
+
+  gint64                  idx;
+  gint64                  aqi;
+
+  gboolean                has_city;
+  const gchar *           city_name;
+  const gchar *           city_url;
+  gdouble                 latitude;
+  gdouble                 longitude;
+
+  guint                   n_attrs;
+  const SnapshotAttr *    attrs;
+  guint                   n_iaqi;
+  const SnapshotMeasure * iaqi;
+
+  gdouble                 pollutants [N_GAIRQ_POLLUTANTS];
+};
+
+/* Bit 0 of the slot pointer, snapshots are at least 8-byte aligned */
+#define SLOT_LOCK_BIT 0
+
+G_DEFINE_BOXED_TYPE (GairqAirSnapshot, gairq_air_snapshot,
+                     gairq_air_snapshot_ref, gairq_air_snapshot_unref)
+
+static gsize
+string_size (const gchar *str)
+{
+  return str ? strlen (str) + 1 : 0;
+}
+
+static const gchar *
+place_string (gchar       **cursor,
+              const gchar  *str)
+{
+  gchar *ret = *cursor;
+  gsize size = string_size (str);
+
+  if (str == NULL)
+    return NULL;
+
+  memcpy (ret, str, size);
+  *cursor += size;
+
+  return ret;
+}
+
+static gint
+measure_compare (gconstpointer a,
+                 gconstpointer b)
+{
+  return strcmp (((const SnapshotMeasure *) a)->key,
+                 ((const SnapshotMeasure *) b)->key);
+}
+
+GairqAirSnapshot *
+gairq_air_snapshot_new (GairqAirObject *air)
+{
+  GairqAirSnapshot *self;
+  GairqObjectCity *city;
+  SnapshotAttr *attrs;
+  SnapshotMeasure *iaqi;
+  GHashTable *table;
+  GHashTableIter iter;
+  gpointer key, value;
+  GSList *elem;
+  gchar *cursor;
+  gsize size;
+  guint i;
+
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (air), NULL);
+
+  city = gairq_air_object_get_city (air);
+  table = gairq_air_object_get_iaqi (air);
+
+  /* Measure everything first, so it all fits in one block */
+  size = GAIRQ_ARENA_ALIGN (sizeof (GairqAirSnapshot));
+  size += g_slist_length (gairq_air_object_get_attributions (air)) * sizeof (SnapshotAttr);
+  size += (table ? g_hash_table_size (table) : 0) * sizeof (SnapshotMeasure);
+
+  if (city)
+    size += string_size (city->name) + string_size (city->url);
+
+  for (elem = gairq_air_object_get_attributions (air); elem; elem = elem->next)
+    {
+      GairqObjectAttr *attr = elem->data;
+
+      size += string_size (attr->name) + string_size (attr->url);
+    }
+
+  if (table)
+    {
+      g_hash_table_iter_init (&iter, table);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        size += string_size (key);
+    }
+
+  self = g_malloc (size);
+  self->ref_count = 1;
+  self->idx = gairq_air_object_get_idx (air);
+  self->aqi = gairq_air_object_get_aqi (air);
+
+  attrs = (SnapshotAttr *) ((gchar *) self + GAIRQ_ARENA_ALIGN (sizeof (GairqAirSnapshot)));
+  self->attrs = attrs;
+  self->n_attrs = g_slist_length (gairq_air_object_get_attributions (air));
+
+  iaqi = (SnapshotMeasure *) (attrs + self->n_attrs);
+  self->iaqi = iaqi;
+  self->n_iaqi = table ? g_hash_table_size (table) : 0;
+
+  cursor = (gchar *) (iaqi + self->n_iaqi);
+
+  self->has_city = city != NULL;
+  self->city_name = city ? place_string (&cursor, city->name) : NULL;
+  self->city_url = city ? place_string (&cursor, city->url) : NULL;
+  self->latitude = city ? city->geo.latitude : 0;
+  self->longitude = city ? city->geo.longitude : 0;
+
+  for (elem = gairq_air_object_get_attributions (air); elem; elem = elem->next, attrs++)
+    {
+      GairqObjectAttr *attr = elem->data;
+
+      attrs->name = place_string (&cursor, attr->name);
+      attrs->url = place_string (&cursor, attr->url);
+    }
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    self->pollutants [i] = NAN;
+
+  if (table)
+    {
+      g_hash_table_iter_init (&iter, table);
+      for (i = 0; g_hash_table_iter_next (&iter, &key, &value); i++)
+        {
+          GairqPollutant pollutant;
+
+          iaqi [i].key = place_string (&cursor, key);
+          iaqi [i].value = value ? *(gdouble *) value : NAN;
+
+          if (gairq_pollutant_from_string (key, &pollutant))
+            self->pollutants [pollutant] = iaqi [i].value;
+        }
+
+      qsort (iaqi, self->n_iaqi, sizeof (SnapshotMeasure), measure_compare);
+    }
+
+  g_assert (cursor <= (gchar *) self + size);
+
+  return self;
+}
+
+GairqAirSnapshot *
+gairq_air_snapshot_ref (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_atomic_int_inc (&self->ref_count);
+
+  return self;
+}
+
+void
+gairq_air_snapshot_unref (GairqAirSnapshot *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (g_atomic_int_dec_and_test (&self->ref_count))
+    g_free (self);
+}
+
+gint64
+gairq_air_snapshot_get_idx (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, -1);
+
+  return self->idx;
+}
+
+gint64
+gairq_air_snapshot_get_aqi (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, -1);
+
+  return self->aqi;
+}
+
+const gchar *
+gairq_air_snapshot_get_city_name (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->city_name;
+}
+
+const gchar *
+gairq_air_snapshot_get_city_url (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->city_url;
+}
+
+gboolean
+gairq_air_snapshot_get_city_geo (GairqAirSnapshot *self,
+                                 gdouble          *latitude,
+                                 gdouble          *longitude)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  if (latitude)
+    *latitude = self->latitude;
+  if (longitude)
+    *longitude = self->longitude;
+
+  return self->has_city;
+}
+
+guint
+gairq_air_snapshot_get_n_attributions (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_attrs;
+}
+
+const gchar *
+gairq_air_snapshot_get_attribution_name (GairqAirSnapshot *self,
+                                         guint             index)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (index < self->n_attrs, NULL);
+
+  return self->attrs [index].name;
+}
+
+const gchar *
+gairq_air_snapshot_get_attribution_url (GairqAirSnapshot *self,
+                                        guint             index)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (index < self->n_attrs, NULL);
+
+  return self->attrs [index].url;
+}
+
+guint
+gairq_air_snapshot_get_n_iaqi (GairqAirSnapshot *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_iaqi;
+}
+
+/* Keys come in sorted order */
+const gchar *
+gairq_air_snapshot_get_iaqi_key (GairqAirSnapshot *self,
+                                 guint             index)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (index < self->n_iaqi, NULL);
+
+  return self->iaqi [index].key;
+}
+
+gboolean
+gairq_air_snapshot_lookup_iaqi (GairqAirSnapshot *self,
+                                const gchar      *key,
+                                gdouble          *value)
+{
+  SnapshotMeasure needle = { key, 0 };
+  const SnapshotMeasure *found;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+
+  found = bsearch (&needle, self->iaqi, self->n_iaqi,
+                   sizeof (SnapshotMeasure), measure_compare);
+  if (found == NULL)
+    return FALSE;
+
+  if (value)
+    *value = found->value;
+
+  return TRUE;
+}
+
+/* NAN if the station does not measure @pollutant */
+gdouble
+gairq_air_snapshot_get_pollutant (GairqAirSnapshot *self,
+                                  GairqPollutant    pollutant)
+{
+  g_return_val_if_fail (self != NULL, NAN);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NAN);
+
+  return self->pollutants [pollutant];
+}
+
+/* --- GairqAirSnapshotSlot --- */
+void
+gairq_air_snapshot_slot_init (GairqAirSnapshotSlot *slot)
+{
+  g_return_if_fail (slot != NULL);
+
+  slot->snapshot = NULL;
+}
+
+void
+gairq_air_snapshot_slot_clear (GairqAirSnapshotSlot *slot)
+{
+  gairq_air_snapshot_slot_publish (slot, NULL);
+}
+
+/* The lock only covers the pointer swap on one side and taking a
+ * reference on the other, never the readers' use of the snapshot.
+ */
+void
+gairq_air_snapshot_slot_publish (GairqAirSnapshotSlot *slot,
+                                 GairqAirSnapshot     *snapshot)
+{
+  GairqAirSnapshot *old;
+
+  g_return_if_fail (slot != NULL);
+
+  if (snapshot)
+    gairq_air_snapshot_ref (snapshot);
+
+  g_pointer_bit_lock (&slot->snapshot, SLOT_LOCK_BIT);
+  old = (GairqAirSnapshot *) ((gsize) slot->snapshot & ~((gsize) 1 << SLOT_LOCK_BIT));
+  g_atomic_pointer_set (&slot->snapshot,
+                        (gpointer) ((gsize) snapshot | ((gsize) 1 << SLOT_LOCK_BIT)));
+  g_pointer_bit_unlock (&slot->snapshot, SLOT_LOCK_BIT);
+
+  /* Readers still holding it keep it alive */
+  if (old)
+    gairq_air_snapshot_unref (old);
+}
+
+GairqAirSnapshot *
+gairq_air_snapshot_slot_acquire (GairqAirSnapshotSlot *slot)
+{
+  GairqAirSnapshot *ret;
+
+  g_return_val_if_fail (slot != NULL, NULL);
+
+  /* Nothing to race with on an empty slot */
+  if (g_atomic_pointer_get (&slot->snapshot) == NULL)
+    return NULL;
+
+  g_pointer_bit_lock (&slot->snapshot, SLOT_LOCK_BIT);
+  ret = (GairqAirSnapshot *) ((gsize) slot->snapshot & ~((gsize) 1 << SLOT_LOCK_BIT));
+  if (ret)
+    gairq_air_snapshot_ref (ret);
+  g_pointer_bit_unlock (&slot->snapshot, SLOT_LOCK_BIT);
+
+  return ret;
+}
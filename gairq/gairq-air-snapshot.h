@@ -0,0 +1,89 @@
+/* gairq-air-snapshot.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_AIR_SNAPSHOT_H
+#define GAIRQ_AIR_SNAPSHOT_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_AIR_SNAPSHOT (gairq_air_snapshot_get_type ())
+
+/* A frozen copy of a GairqAirObject in one block. It never changes once
+ * made, so any number of threads may hold and read it without copying.
+ */
+typedef struct _GairqAirSnapshot GairqAirSnapshot;
+
+/* Holds the latest snapshot. Readers acquire their own reference while
+ * a writer swaps in a new one, the old one goes away with its last reader.
+ */
+typedef struct _GairqAirSnapshotSlot GairqAirSnapshotSlot;
+
+struct _GairqAirSnapshotSlot
+{
+  /*< private >*/
+  gpointer snapshot;
+};
+
+GType               gairq_air_snapshot_get_type             (void) G_GNUC_CONST;
+GairqAirSnapshot *  gairq_air_snapshot_new                  (GairqAirObject   *air);
+GairqAirSnapshot *  gairq_air_snapshot_ref                  (GairqAirSnapshot *self);
+void                gairq_air_snapshot_unref                (GairqAirSnapshot *self);
+
+gint64              gairq_air_snapshot_get_idx              (GairqAirSnapshot *self);
+gint64              gairq_air_snapshot_get_aqi              (GairqAirSnapshot *self);
+const gchar *       gairq_air_snapshot_get_city_name        (GairqAirSnapshot *self);
+const gchar *       gairq_air_snapshot_get_city_url         (GairqAirSnapshot *self);
+gboolean            gairq_air_snapshot_get_city_geo         (GairqAirSnapshot *self,
+                                                             gdouble          *latitude,
+                                                             gdouble          *longitude);
+guint               gairq_air_snapshot_get_n_attributions   (GairqAirSnapshot *self);
+const gchar *       gairq_air_snapshot_get_attribution_name (GairqAirSnapshot *self,
+                                                             guint             index);
+const gchar *       gairq_air_snapshot_get_attribution_url  (GairqAirSnapshot *self,
+                                                             guint             index);
+guint               gairq_air_snapshot_get_n_iaqi           (GairqAirSnapshot *self);
+const gchar *       gairq_air_snapshot_get_iaqi_key         (GairqAirSnapshot *self,
+                                                             guint             index);
+gboolean            gairq_air_snapshot_lookup_iaqi          (GairqAirSnapshot *self,
+                                                             const gchar      *key,
+                                                             gdouble          *value);
+gdouble             gairq_air_snapshot_get_pollutant        (GairqAirSnapshot *self,
+                                                             GairqPollutant    pollutant);
+
+/* --- GairqAirSnapshotSlot --- */
+void                gairq_air_snapshot_slot_init            (GairqAirSnapshotSlot *slot);
+void                gairq_air_snapshot_slot_clear           (GairqAirSnapshotSlot *slot);
+void                gairq_air_snapshot_slot_publish         (GairqAirSnapshotSlot *slot,
+                                                             GairqAirSnapshot     *snapshot);
+GairqAirSnapshot *  gairq_air_snapshot_slot_acquire         (GairqAirSnapshotSlot *slot);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GairqAirSnapshot, gairq_air_snapshot_unref)
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,456 @@
+/* gairq-aqi.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-aqi.h"
+#include "gairq-debug.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# include <immintrin.h>
+# define HAVE_X86_KERNELS 1
+#endif
+
+#define MAX_BANDS  8
+
+/* Every band is stored by its lower end and its slope, so a value
+ * is mapped to an index with a single multiply-add once its band
+ * is known. The slope is folded at compile time from the breakpoints.
+ */
+typedef struct
+{
+  gdouble   c_lo;
+  gdouble   i_lo;
+  gdouble   slope;
+} Band;
+
+typedef struct
+{
+  guint     n_bands;
+  gdouble   c_max;
+  gdouble   i_max;
+  Band      bands [MAX_BANDS];
+} BreakpointTable;
+
+#define BAND(_c_lo, _c_hi, _i_lo, _i_hi) \
+  { (_c_lo), (_i_lo), ((gdouble) (_i_hi) - (_i_lo)) / ((gdouble) (_c_hi) - (_c_lo)) }
+
+/* US EPA, 2024 revision.
+ * PM2.5 and PM10 in ug/m3 (24h), O3 in ppb (8h), NO2 and SO2 in ppb (1h),
+ * CO in ppm (8h).
+ */
+static const BreakpointTable us_epa [N_GAIRQ_POLLUTANTS] = {
+  [GAIRQ_POLLUTANT_PM25] = { 6, 325.4, 500, {
+    BAND (0.0, 9.0, 0, 50),       BAND (9.1, 35.4, 51, 100),
+    BAND (35.5, 55.4, 101, 150),  BAND (55.5, 125.4, 151, 200),
+    BAND (125.5, 225.4, 201, 300), BAND (225.5, 325.4, 301, 500) } },
+  [GAIRQ_POLLUTANT_PM10] = { 6, 604, 500, {
+    BAND (0, 54, 0, 50),          BAND (55, 154, 51, 100),
+    BAND (155, 254, 101, 150),    BAND (255, 354, 151, 200),
+    BAND (355, 424, 201, 300),    BAND (425, 604, 301, 500) } },
+  [GAIRQ_POLLUTANT_O3] = { 5, 200, 300, {
+    BAND (0, 54, 0, 50),          BAND (55, 70, 51, 100),
+    BAND (71, 85, 101, 150),      BAND (86, 105, 151, 200),
+    BAND (106, 200, 201, 300) } },
+  [GAIRQ_POLLUTANT_NO2] = { 6, 2049, 500, {
+    BAND (0, 53, 0, 50),          BAND (54, 100, 51, 100),
+    BAND (101, 360, 101, 150),    BAND (361, 649, 151, 200),
+    BAND (650, 1249, 201, 300),   BAND (1250, 2049, 301, 500) } },
+  [GAIRQ_POLLUTANT_SO2] = { 6, 1004, 500, {
+    BAND (0, 35, 0, 50),          BAND (36, 75, 51, 100),
+    BAND (76, 185, 101, 150),     BAND (186, 304, 151, 200),
+    BAND (305, 604, 201, 300),    BAND (605, 1004, 301, 500) } },
+  [GAIRQ_POLLUTANT_CO] = { 6, 50.4, 500, {
+    BAND (0.0, 4.4, 0, 50),       BAND (4.5, 9.4, 51, 100),
+    BAND (9.5, 12.4, 101, 150),   BAND (12.5, 15.4, 151, 200),
+    BAND (15.5, 30.4, 201, 300),  BAND (30.5, 50.4, 301, 500) } },
+};
+
+/* China HJ 633-2012.
+ * Everything in ug/m3 (24h, O3 8h) except CO in mg/m3 (24h).
+ */
+static const BreakpointTable cn_hj633 [N_GAIRQ_POLLUTANTS] = {
+  [GAIRQ_POLLUTANT_PM25] = { 7, 500, 500, {
+    BAND (0, 35, 0, 50),          BAND (35, 75, 50, 100),
+    BAND (75, 115, 100, 150),     BAND (115, 150, 150, 200),
+    BAND (150, 250, 200, 300),    BAND (250, 350, 300, 400),
+    BAND (350, 500, 400, 500) } },
+  [GAIRQ_POLLUTANT_PM10] = { 7, 600, 500, {
+    BAND (0, 50, 0, 50),          BAND (50, 150, 50, 100),
+    BAND (150, 250, 100, 150),    BAND (250, 350, 150, 200),
+    BAND (350, 420, 200, 300),    BAND (420, 500, 300, 400),
+    BAND (500, 600, 400, 500) } },
+  [GAIRQ_POLLUTANT_O3] = { 5, 800, 300, {
+    BAND (0, 100, 0, 50),         BAND (100, 160, 50, 100),
+    BAND (160, 215, 100, 150),    BAND (215, 265, 150, 200),
+    BAND (265, 800, 200, 300) } },
+  [GAIRQ_POLLUTANT_NO2] = { 7, 940, 500, {
+    BAND (0, 40, 0, 50),          BAND (40, 80, 50, 100),
+    BAND (80, 180, 100, 150),     BAND (180, 280, 150, 200),
+    BAND (280, 565, 200, 300),    BAND (565, 750, 300, 400),
+    BAND (750, 940, 400, 500) } },
+  [GAIRQ_POLLUTANT_SO2] = { 7, 2620, 500, {
+    BAND (0, 50, 0, 50),          BAND (50, 150, 50, 100),
+    BAND (150, 475, 100, 150),    BAND (475, 800, 150, 200),
+    BAND (800, 1600, 200, 300),   BAND (1600, 2100, 300, 400),
+    BAND (2100, 2620, 400, 500) } },
+  [GAIRQ_POLLUTANT_CO] = { 7, 60, 500, {
+    BAND (0, 2, 0, 50),           BAND (2, 4, 50, 100),
+    BAND (4, 14, 100, 150),       BAND (14, 24, 150, 200),
+    BAND (24, 36, 200, 300),      BAND (36, 48, 300, 400),
+    BAND (48, 60, 400, 500) } },
+};
+
+/* EU CAQI, hourly grid background index, everything in ug/m3 */
+static const BreakpointTable eu_caqi [N_GAIRQ_POLLUTANTS] = {
+  [GAIRQ_POLLUTANT_PM25] = { 4, 110, 100, {
+    BAND (0, 15, 0, 25),          BAND (15, 30, 25, 50),
+    BAND (30, 55, 50, 75),        BAND (55, 110, 75, 100) } },
+  [GAIRQ_POLLUTANT_PM10] = { 4, 180, 100, {
+    BAND (0, 25, 0, 25),          BAND (25, 50, 25, 50),
+    BAND (50, 90, 50, 75),        BAND (90, 180, 75, 100) } },
+  [GAIRQ_POLLUTANT_O3] = { 4, 240, 100, {
+    BAND (0, 60, 0, 25),          BAND (60, 120, 25, 50),
+    BAND (120, 180, 50, 75),      BAND (180, 240, 75, 100) } },
+  [GAIRQ_POLLUTANT_NO2] = { 4, 400, 100, {
+    BAND (0, 50, 0, 25),          BAND (50, 100, 25, 50),
+    BAND (100, 200, 50, 75),      BAND (200, 400, 75, 100) } },
+  [GAIRQ_POLLUTANT_SO2] = { 4, 500, 100, {
+    BAND (0, 50, 0, 25),          BAND (50, 100, 25, 50),
+    BAND (100, 350, 50, 75),      BAND (350, 500, 75, 100) } },
+  [GAIRQ_POLLUTANT_CO] = { 4, 20000, 100, {
+    BAND (0, 5000, 0, 25),        BAND (5000, 7500, 25, 50),
+    BAND (7500, 10000, 50, 75),   BAND (10000, 20000, 75, 100) } },
+};
+
+/* India NAQI.
+ * Everything in ug/m3 (24h, O3 and CO 8h) except CO in mg/m3.
+ * The "severe" band is open ended in the standard, it is closed at
+ * an upper bound here so that it keeps a finite slope.
+ */
+static const BreakpointTable in_naqi [N_GAIRQ_POLLUTANTS] = {
+  [GAIRQ_POLLUTANT_PM25] = { 6, 380, 500, {
+    BAND (0, 30, 0, 50),          BAND (30, 60, 50, 100),
+    BAND (60, 90, 100, 200),      BAND (90, 120, 200, 300),
+    BAND (120, 250, 300, 400),    BAND (250, 380, 400, 500) } },
+  [GAIRQ_POLLUTANT_PM10] = { 6, 510, 500, {
+    BAND (0, 50, 0, 50),          BAND (50, 100, 50, 100),
+    BAND (100, 250, 100, 200),    BAND (250, 350, 200, 300),
+    BAND (350, 430, 300, 400),    BAND (430, 510, 400, 500) } },
+  [GAIRQ_POLLUTANT_O3] = { 6, 1000, 500, {
+    BAND (0, 50, 0, 50),          BAND (50, 100, 50, 100),
+    BAND (100, 168, 100, 200),    BAND (168, 208, 200, 300),
+    BAND (208, 748, 300, 400),    BAND (748, 1000, 400, 500) } },
+  [GAIRQ_POLLUTANT_NO2] = { 6, 520, 500, {
+    BAND (0, 40, 0, 50),          BAND (40, 80, 50, 100),
+    BAND (80, 180, 100, 200),     BAND (180, 280, 200, 300),
+    BAND (280, 400, 300, 400),    BAND (400, 520, 400, 500) } },
+  [GAIRQ_POLLUTANT_SO2] = { 6, 2100, 500, {
+    BAND (0, 40, 0, 50),          BAND (40, 80, 50, 100),
+    BAND (80, 380, 100, 200),     BAND (380, 800, 200, 300),
+    BAND (800, 1600, 300, 400),   BAND (1600, 2100, 400, 500) } },
+  [GAIRQ_POLLUTANT_CO] = { 6, 46, 500, {
+    BAND (0, 1, 0, 50),           BAND (1, 2, 50, 100),
+    BAND (2, 10, 100, 200),       BAND (10, 17, 200, 300),
+    BAND (17, 34, 300, 400),      BAND (34, 46, 400, 500) } },
+};
+
+static const BreakpointTable * const standards [N_GAIRQ_AQI_STANDARDS] = {
+  [GAIRQ_AQI_STANDARD_US_EPA] = us_epa,
+  [GAIRQ_AQI_STANDARD_CN_HJ633] = cn_hj633,
+  [GAIRQ_AQI_STANDARD_EU_CAQI] = eu_caqi,
+  [GAIRQ_AQI_STANDARD_IN_NAQI] = in_naqi,
+};
+
+/* Scratch size of gairq_aqi_compute() for each sub-index pass */
+#define CHUNK_SIZE  512
+
+
+/* --- Kernels --- */
+static inline gdouble
+sub_index_one (const BreakpointTable *table,
+               gdouble                c)
+{
+  const Band *band = &table->bands [0];
+  guint i;
+
+  /* Negative concentrations are as meaningless as NaN */
+  if (!(c >= 0.0))
+    return NAN;
+  if (c > table->c_max)
+    return table->i_max;
+
+  for (i = 1; i < table->n_bands; i++)
+    {
+      if (c >= table->bands [i].c_lo)
+        band = &table->bands [i];
+    }
+
+  return band->i_lo + band->slope * (c - band->c_lo);
+}
+
+static void
+sub_index_scalar (const BreakpointTable *table,
+                  const gdouble         *in,
+                  gdouble               *out,
+                  gsize                  n_values)
+{
+  gsize i;
+
+  for (i = 0; i < n_values; i++)
+    out [i] = sub_index_one (table, in [i]);
+}
+
+#ifdef HAVE_X86_KERNELS
+# ifdef __SSE2__
+/* SSE2 lacks blendv, so the band is selected with and/andnot/or */
+static inline __m128d
+select_sse2 (__m128d mask,
+             __m128d a,
+             __m128d b)
+{
+  return _mm_or_pd (_mm_and_pd (mask, a), _mm_andnot_pd (mask, b));
+}
+
+static void
+sub_index_sse2 (const BreakpointTable *table,
+                const gdouble         *in,
+                gdouble               *out,
+                gsize                  n_values)
+{
+  const __m128d zero = _mm_setzero_pd ();
+  const __m128d nan = _mm_set1_pd (NAN);
+  const __m128d c_max = _mm_set1_pd (table->c_max);
+  const __m128d i_max = _mm_set1_pd (table->i_max);
+  gsize i;
+
+  for (i = 0; i + 2 <= n_values; i += 2)
+    {
+      __m128d c = _mm_loadu_pd (in + i);
+      __m128d c_lo = _mm_set1_pd (table->bands [0].c_lo);
+      __m128d i_lo = _mm_set1_pd (table->bands [0].i_lo);
+      __m128d slope = _mm_set1_pd (table->bands [0].slope);
+      __m128d r, mask;
+      guint b;
+
+      for (b = 1; b < table->n_bands; b++)
+        {
+          const Band *band = &table->bands [b];
+
+          mask = _mm_cmpge_pd (c, _mm_set1_pd (band->c_lo));
+          c_lo = select_sse2 (mask, _mm_set1_pd (band->c_lo), c_lo);
+          i_lo = select_sse2 (mask, _mm_set1_pd (band->i_lo), i_lo);
+          slope = select_sse2 (mask, _mm_set1_pd (band->slope), slope);
+        }
+
+      r = _mm_add_pd (i_lo, _mm_mul_pd (slope, _mm_sub_pd (c, c_lo)));
+      r = select_sse2 (_mm_cmpgt_pd (c, c_max), i_max, r);
+      r = select_sse2 (_mm_cmpnge_pd (c, zero), nan, r);
+
+      _mm_storeu_pd (out + i, r);
+    }
+
+  sub_index_scalar (table, in + i, out + i, n_values - i);
+}
+# endif
+
+__attribute__ ((target ("avx2")))
+static void
+sub_index_avx2 (const BreakpointTable *table,
+                const gdouble         *in,
+                gdouble               *out,
+                gsize                  n_values)
+{
+  const __m256d zero = _mm256_setzero_pd ();
+  const __m256d nan = _mm256_set1_pd (NAN);
+  const __m256d c_max = _mm256_set1_pd (table->c_max);
+  const __m256d i_max = _mm256_set1_pd (table->i_max);
+  gsize i;
+
+  for (i = 0; i + 4 <= n_values; i += 4)
+    {
+      __m256d c = _mm256_loadu_pd (in + i);
+      __m256d c_lo = _mm256_set1_pd (table->bands [0].c_lo);
+      __m256d i_lo = _mm256_set1_pd (table->bands [0].i_lo);
+      __m256d slope = _mm256_set1_pd (table->bands [0].slope);
+      __m256d r, mask;
+      guint b;
+
+      for (b = 1; b < table->n_bands; b++)
+        {
+          const Band *band = &table->bands [b];
+          __m256d lo = _mm256_set1_pd (band->c_lo);
+
+          mask = _mm256_cmp_pd (c, lo, _CMP_GE_OQ);
+          c_lo = _mm256_blendv_pd (c_lo, lo, mask);
+          i_lo = _mm256_blendv_pd (i_lo, _mm256_set1_pd (band->i_lo), mask);
+          slope = _mm256_blendv_pd (slope, _mm256_set1_pd (band->slope), mask);
+        }
+
+      r = _mm256_add_pd (i_lo, _mm256_mul_pd (slope, _mm256_sub_pd (c, c_lo)));
+      r = _mm256_blendv_pd (r, i_max, _mm256_cmp_pd (c, c_max, _CMP_GT_OQ));
+      r = _mm256_blendv_pd (r, nan, _mm256_cmp_pd (c, zero, _CMP_NGE_UQ));
+
+      _mm256_storeu_pd (out + i, r);
+    }
+
+  sub_index_scalar (table, in + i, out + i, n_values - i);
+}
+#endif
+
+/* --- Public APIs --- */
+gboolean
+gairq_aqi_kernel_is_supported (GairqAqiKernel kernel)
+{
+  switch (kernel)
+    {
+    case GAIRQ_AQI_KERNEL_AUTO:
+    case GAIRQ_AQI_KERNEL_SCALAR:
+      return TRUE;
+
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+    case GAIRQ_AQI_KERNEL_SSE2:
+      return TRUE;
+#endif
+
+#ifdef HAVE_X86_KERNELS
+    case GAIRQ_AQI_KERNEL_AVX2:
+      return __builtin_cpu_supports ("avx2");
+#endif
+
+    default:
+      return FALSE;
+    }
+}
+
+GairqAqiKernel
+gairq_aqi_kernel_get_best (void)
+{
+  static gsize best = 0;
+
+  if (g_once_init_enter (&best))
+    {
+      GairqAqiKernel kernel = GAIRQ_AQI_KERNEL_SCALAR;
+
+      if (gairq_aqi_kernel_is_supported (GAIRQ_AQI_KERNEL_AVX2))
+        kernel = GAIRQ_AQI_KERNEL_AVX2;
+      else if (gairq_aqi_kernel_is_supported (GAIRQ_AQI_KERNEL_SSE2))
+        kernel = GAIRQ_AQI_KERNEL_SSE2;
+
+      gairq_debug ("AQI kernel: %d", kernel);
+
+      /* Zero is reserved by g_once_init_leave() */
+      g_once_init_leave (&best, kernel + 1);
+    }
+
+  return best - 1;
+}
+
+void
+gairq_aqi_compute_sub_index_full (GairqAqiStandard  standard,
+                                  GairqPollutant    pollutant,
+                                  GairqAqiKernel    kernel,
+                                  const gdouble    *concentrations,
+                                  gdouble          *indices,
+                                  gsize             n_values)
+{
+  const BreakpointTable *table;
+
+  g_return_if_fail (standard < N_GAIRQ_AQI_STANDARDS);
+  g_return_if_fail (pollutant < N_GAIRQ_POLLUTANTS);
+  g_return_if_fail (gairq_aqi_kernel_is_supported (kernel));
+  g_return_if_fail (concentrations != NULL || n_values == 0);
+  g_return_if_fail (indices != NULL || n_values == 0);
+
+  table = &standards [standard][pollutant];
+
+  if (kernel == GAIRQ_AQI_KERNEL_AUTO)
+    kernel = gairq_aqi_kernel_get_best ();
+
+  switch (kernel)
+    {
+#if defined(HAVE_X86_KERNELS) && defined(__SSE2__)
+    case GAIRQ_AQI_KERNEL_SSE2:
+      sub_index_sse2 (table, concentrations, indices, n_values);
+      break;
+#endif
+
+#ifdef HAVE_X86_KERNELS
+    case GAIRQ_AQI_KERNEL_AVX2:
+      sub_index_avx2 (table, concentrations, indices, n_values);
+      break;
+#endif
+
+    default:
+      sub_index_scalar (table, concentrations, indices, n_values);
+    }
+}
+
+void
+gairq_aqi_compute_sub_index (GairqAqiStandard  standard,
+                             GairqPollutant    pollutant,
+                             const gdouble    *concentrations,
+                             gdouble          *indices,
+                             gsize             n_values)
+{
+  gairq_aqi_compute_sub_index_full (standard, pollutant,
+                                    GAIRQ_AQI_KERNEL_AUTO,
+                                    concentrations, indices, n_values);
+}
+
+void
+gairq_aqi_compute (GairqAqiStandard  standard,
+                   const gdouble    *concentrations[N_GAIRQ_POLLUTANTS],
+                   gdouble          *indices,
+                   gsize             n_values)
+{
+  gdouble scratch [CHUNK_SIZE];
+  gsize offset, i;
+  guint p;
+
+  g_return_if_fail (standard < N_GAIRQ_AQI_STANDARDS);
+  g_return_if_fail (concentrations != NULL);
+  g_return_if_fail (indices != NULL || n_values == 0);
+
+  for (i = 0; i < n_values; i++)
+    indices [i] = NAN;
+
+  /* The overall index is the worst sub-index. Work in chunks
+   * so that the scratch sub-indices stay in the L1 cache.
+   */
+  for (offset = 0; offset < n_values; offset += CHUNK_SIZE)
+    {
+      gsize len = MIN (CHUNK_SIZE, n_values - offset);
+
+      for (p = 0; p < N_GAIRQ_POLLUTANTS; p++)
+        {
+          /* A NULL column is a pollutant which is not measured */
+          if (concentrations [p] == NULL)
+            continue;
+
+          gairq_aqi_compute_sub_index (standard, p,
+                                       concentrations [p] + offset,
+                                       scratch, len);
+
+          for (i = 0; i < len; i++)
+            indices [offset + i] = fmax (indices [offset + i], scratch [i]);
+        }
+    }
+}
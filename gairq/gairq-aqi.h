@@ -0,0 +1,70 @@
+/* gairq-aqi.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_AQI_H
+#define GAIRQ_AQI_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GAIRQ_AQI_STANDARD_US_EPA,
+  GAIRQ_AQI_STANDARD_CN_HJ633,
+  GAIRQ_AQI_STANDARD_EU_CAQI,
+  GAIRQ_AQI_STANDARD_IN_NAQI,
+  N_GAIRQ_AQI_STANDARDS
+} GairqAqiStandard;
+
+typedef enum {
+  GAIRQ_AQI_KERNEL_AUTO,
+  GAIRQ_AQI_KERNEL_SCALAR,
+  GAIRQ_AQI_KERNEL_SSE2,
+  GAIRQ_AQI_KERNEL_AVX2,
+  N_GAIRQ_AQI_KERNELS
+} GairqAqiKernel;
+
+gboolean          gairq_aqi_kernel_is_supported     (GairqAqiKernel    kernel);
+GairqAqiKernel    gairq_aqi_kernel_get_best         (void);
+
+void              gairq_aqi_compute_sub_index       (GairqAqiStandard  standard,
+                                                     GairqPollutant    pollutant,
+                                                     const gdouble    *concentrations,
+                                                     gdouble          *indices,
+                                                     gsize             n_values);
+void              gairq_aqi_compute_sub_index_full  (GairqAqiStandard  standard,
+                                                     GairqPollutant    pollutant,
+                                                     GairqAqiKernel    kernel,
+                                                     const gdouble    *concentrations,
+                                                     gdouble          *indices,
+                                                     gsize             n_values);
+void              gairq_aqi_compute                 (GairqAqiStandard  standard,
+                                                     const gdouble    *concentrations[N_GAIRQ_POLLUTANTS],
+                                                     gdouble          *indices,
+                                                     gsize             n_values);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,157 @@
+/* gairq-arena.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-arena.h"
+
+#include <string.h>
+
+/* A block header followed by its bump-allocated data. The arena itself
+ * is the first block, so an arena sized right from the start is exactly
+ * one allocation and one free.
+ */
+struct _GairqArena
+{
+  GairqArena *  next;
+  gsize         size;
+  gsize         used;
+};
+
+#define HEADER_SIZE       GAIRQ_ARENA_ALIGN (sizeof (GairqArena))
+#define BLOCK_DATA(_blk)  ((gchar *) (_blk) + HEADER_SIZE)
+
+
+static GairqArena *
+gairq_arena_block_new (gsize size)
+{
+  GairqArena *block;
+
+  block = g_malloc (HEADER_SIZE + size);
+  block->next = NULL;
+  block->size = size;
+  block->used = 0;
+
+  return block;
+}
+
+static gpointer
+gairq_arena_block_alloc (GairqArena *block,
+                         gsize       size)
+{
+  gpointer ret;
+
+  if (block->size - block->used < size)
+    return NULL;
+
+  ret = BLOCK_DATA (block) + block->used;
+  block->used += size;
+
+  return ret;
+}
+
+GairqArena *
+gairq_arena_new (gsize size)
+{
+  return gairq_arena_block_new (GAIRQ_ARENA_ALIGN (size));
+}
+
+void
+gairq_arena_free (GairqArena *arena)
+{
+  while (arena)
+    {
+      GairqArena *next = arena->next;
+
+      g_free (arena);
+      arena = next;
+    }
+}
+
+gpointer
+gairq_arena_alloc (GairqArena *arena,
+                   gsize       size)
+{
+  GairqArena *block;
+  gpointer ret;
+
+  g_return_val_if_fail (arena != NULL, NULL);
+
+  size = GAIRQ_ARENA_ALIGN (size);
+
+  ret = gairq_arena_block_alloc (arena, size);
+  if (ret)
+    return ret;
+
+  /* The most recent overflow block is always linked right after the head */
+  if (arena->next)
+    {
+      ret = gairq_arena_block_alloc (arena->next, size);
+      if (ret)
+        return ret;
+    }
+
+  /* The estimate was short, chain another block rather than failing */
+  block = gairq_arena_block_new (MAX (size, arena->size));
+  block->next = arena->next;
+  arena->next = block;
+
+  return gairq_arena_block_alloc (block, size);
+}
+
+gchar *
+gairq_arena_strndup (GairqArena  *arena,
+                     const gchar *str,
+                     gsize        len)
+{
+  gchar *ret;
+
+  if (str == NULL)
+    return NULL;
+
+  ret = gairq_arena_alloc (arena, len + 1);
+  memcpy (ret, str, len);
+  ret [len] = '\0';
+
+  return ret;
+}
+
+gchar *
+gairq_arena_strdup (GairqArena  *arena,
+                    const gchar *str)
+{
+  if (str == NULL)
+    return NULL;
+
+  return gairq_arena_strndup (arena, str, strlen (str));
+}
+
+gboolean
+gairq_arena_contains (GairqArena    *arena,
+                      gconstpointer  ptr)
+{
+  for ( ; arena; arena = arena->next)
+    {
+      const gchar *start = BLOCK_DATA (arena);
+
+      if ((const gchar *) ptr >= start && (const gchar *) ptr < start + arena->size)
+        return TRUE;
+    }
+
+  return FALSE;
+}
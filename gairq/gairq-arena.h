@@ -0,0 +1,51 @@
+/* gairq-arena.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_ARENA_H
+#define GAIRQ_ARENA_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Every chunk handed out by the arena is aligned to this */
+#define GAIRQ_ARENA_ALIGN(_size) (((_size) + 7) & ~((gsize) 7))
+
+typedef struct _GairqArena GairqArena;
+
+GairqArena *  gairq_arena_new       (gsize          size);
+void          gairq_arena_free      (GairqArena    *arena);
+gpointer      gairq_arena_alloc     (GairqArena    *arena,
+                                     gsize          size);
+gchar *       gairq_arena_strdup    (GairqArena    *arena,
+                                     const gchar   *str);
+gchar *       gairq_arena_strndup   (GairqArena    *arena,
+                                     const gchar   *str,
+                                     gsize          len);
+gboolean      gairq_arena_contains  (GairqArena    *arena,
+                                     gconstpointer  ptr);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1343 @@
+/* gairq-arrow-writer.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-arrow-writer.h"
+
+#include <math.h>
+#include <string.h>
+
+/* Arrow IPC as laid out by format/Schema.fbs, Message.fbs and File.fbs
+ * upstream, metadata version V5. The flatbuffers are put together by
+ * hand, back to front like a flatc generated builder does since offsets
+ * may only point forward. Every message is
+ *
+ *   0xffffffff, metadata length, Message flatbuffer, body
+ *
+ * with the flatbuffer and each buffer of the body padded to 8 bytes.
+ */
+#define DEFAULT_BATCH_SIZE    65536
+#define MAX_BATCH_SIZE        (1 << 24)
+#define WORD_BITS             64
+#define N_WORDS(_n)           (((_n) + WORD_BITS - 1) / WORD_BITS)
+#define PAD8(_n)              (((_n) + 7) & ~((gsize) 7))
+
+#define CONTINUATION          0xffffffff
+#define FILE_MAGIC            "ARROW1"
+#define METADATA_V5           4
+#define DICTIONARY_ID         0
+
+/* union MessageHeader */
+#define HEADER_SCHEMA         1
+#define HEADER_DICTIONARY     2
+#define HEADER_RECORD_BATCH   3
+
+/* union Type */
+#define TYPE_INT              2
+#define TYPE_FLOATING_POINT   3
+#define TYPE_UTF8             5
+#define TYPE_TIMESTAMP        10
+#define TYPE_LIST             12
+
+#define PRECISION_DOUBLE      2
+#define TIME_UNIT_SECOND      0
+
+/* idx, aqi, time, latitude and longitude, then the pollutants */
+#define N_SCALAR_FIELDS       (5 + N_GAIRQ_POLLUTANTS)
+/* The attributions list and its dictionary-encoded items on top */
+#define N_NODES               (N_SCALAR_FIELDS + 2)
+#define N_BUFFERS             (2 * N_NODES)
+
+#define FB_MAX_SLOTS          8
+
+typedef struct
+{
+  guint8 *  data;
+  gsize     allocated;
+  gsize     used;       /* At the end of data, offsets count from there */
+
+  /* Fields of the table being built */
+  gsize     slots [FB_MAX_SLOTS];
+  guint     n_slots;
+  gsize     table_start;
+} FbBuilder;
+
+typedef struct
+{
+  gint64    offset;
+  gint32    metadata_length;
+  gint64    body_length;
+} Block;
+
+typedef struct
+{
+  gconstpointer   data;
+  gsize           length;
+} BodyBuffer;
+
+/* The rows of one record batch, bitmaps start on a word */
+typedef struct
+{
+  guint             n_rows;
+  const gint64 *    idx;
+  const gint64 *    aqi;
+  const gint64 *    time;
+  const gdouble *   lat;
+  const gdouble *   lng;
+  const gdouble *   columns [N_GAIRQ_POLLUTANTS];
+  const guint64 *   validity [N_GAIRQ_POLLUTANTS];
+
+  /* NULL when none of the rows has a list */
+  const guint64 *   attr_validity;
+  const gint32 *    attr_offsets;
+  const gint32 *    attr_indices;
+} RecordView;
+
+struct _GairqArrowWriter
+{
+  GObject                 parent_instance;
+
+  GMutex                  lock;
+  GOutputStream *         stream;
+  GairqArrowFormat        format;
+  guint                   batch_size;
+  gboolean                started;
+  gboolean                closed;
+  gint64                  offset;
+
+  /* Rows waiting for the next record batch */
+  GairqAirBatch *         pending;
+  GArray *                attr_validity;
+  GArray *                attr_offsets;
+  GArray *                attr_indices;
+
+  /* Attribution names, the first n_names_written of them are out */
+  GHashTable *            names_index;
+  GPtrArray *             names;
+  guint                   n_names_written;
+  gboolean                dictionary_written;
+
+  /* Bitmaps and offsets made up at write time */
+  guint64 *               scratch;
+  gsize                   scratch_words;
+  FbBuilder               builder;
+
+  /* For the footer of the file format */
+  GArray *                dictionary_blocks;
+  GArray *                record_blocks;
+
+  GairqArrowWriterStats   stats;
+};
+
+G_DEFINE_TYPE (GairqArrowWriter, gairq_arrow_writer, G_TYPE_OBJECT)
+
+static const guint8 zeros [8] = { 0, };
+
+
+/* --- Flatbuffers --- */
+static void
+fb_reset (FbBuilder *b)
+{
+  b->used = 0;
+}
+
+static guint8 *
+fb_claim (FbBuilder *b,
+          gsize      size)
+{
+  if (b->allocated - b->used < size)
+    {
+      gsize new_size = MAX (b->allocated * 2, 1024);
+      guint8 *data;
+
+      while (new_size - b->used < size)
+        new_size *= 2;
+
+      data = g_malloc (new_size);
+      if (b->used > 0)
+        memcpy (data + new_size - b->used, b->data + b->allocated - b->used, b->used);
+
+      g_free (b->data);
+      b->data = data;
+      b->allocated = new_size;
+    }
+
+  b->used += size;
+
+  return b->data + b->allocated - b->used;
+}
+
+static void
+fb_pad (FbBuilder *b,
+        gsize      size)
+{
+  if (size > 0)
+    memset (fb_claim (b, size), 0, size);
+}
+
+/* Pads so that @size more bytes end aligned to @align */
+static void
+fb_prep (FbBuilder *b,
+         gsize      align,
+         gsize      size)
+{
+  fb_pad (b, (align - (b->used + size) % align) % align);
+}
+
+static void
+fb_push_u8 (FbBuilder *b,
+            guint8     value)
+{
+  *fb_claim (b, 1) = value;
+}
+
+static void
+fb_push_u16 (FbBuilder *b,
+             guint16    value)
+{
+  fb_prep (b, 2, 2);
+  value = GUINT16_TO_LE (value);
+  memcpy (fb_claim (b, 2), &value, 2);
+}
+
+static void
+fb_push_u32 (FbBuilder *b,
+             guint32    value)
+{
+  fb_prep (b, 4, 4);
+  value = GUINT32_TO_LE (value);
+  memcpy (fb_claim (b, 4), &value, 4);
+}
+
+static void
+fb_push_u64 (FbBuilder *b,
+             guint64    value)
+{
+  fb_prep (b, 8, 8);
+  value = GUINT64_TO_LE (value);
+  memcpy (fb_claim (b, 8), &value, 8);
+}
+
+static void
+fb_push_offset (FbBuilder *b,
+                gsize      target)
+{
+  fb_prep (b, 4, 4);
+  fb_push_u32 (b, b->used + 4 - target);
+}
+
+static gsize
+fb_string (FbBuilder   *b,
+           const gchar *str)
+{
+  gsize len = strlen (str);
+
+  fb_prep (b, 4, len + 1);
+  fb_pad (b, 1);
+  memcpy (fb_claim (b, len), str, len);
+  fb_push_u32 (b, len);
+
+  return b->used;
+}
+
+static gsize
+fb_offsets (FbBuilder   *b,
+            const gsize *targets,
+            guint        n_targets)
+{
+  guint i;
+
+  fb_prep (b, 4, n_targets * 4);
+  for (i = n_targets; i-- > 0; )
+    fb_push_offset (b, targets [i]);
+  fb_push_u32 (b, n_targets);
+
+  return b->used;
+}
+
+/* A vector of structs made of @item_words 64-bit words each, which all
+ * the structs Arrow has in its metadata are.
+ */
+static gsize
+fb_structs (FbBuilder     *b,
+            const guint64 *words,
+            guint          n_items,
+            guint          item_words)
+{
+  guint i;
+
+  fb_prep (b, 4, n_items * item_words * 8);
+  fb_prep (b, 8, n_items * item_words * 8);
+  for (i = n_items * item_words; i-- > 0; )
+    fb_push_u64 (b, words [i]);
+  fb_push_u32 (b, n_items);
+
+  return b->used;
+}
+
+static void
+fb_start_table (FbBuilder *b)
+{
+  memset (b->slots, 0, sizeof b->slots);
+  b->n_slots = 0;
+  b->table_start = b->used;
+}
+
+static void
+fb_slot (FbBuilder *b,
+         guint      id)
+{
+  g_assert (id < FB_MAX_SLOTS);
+
+  b->slots [id] = b->used;
+  b->n_slots = MAX (b->n_slots, id + 1);
+}
+
+static void
+fb_add_u8 (FbBuilder *b,
+           guint      id,
+           guint8     value)
+{
+  fb_push_u8 (b, value);
+  fb_slot (b, id);
+}
+
+static void
+fb_add_u16 (FbBuilder *b,
+            guint      id,
+            guint16    value)
+{
+  fb_push_u16 (b, value);
+  fb_slot (b, id);
+}
+
+static void
+fb_add_u32 (FbBuilder *b,
+            guint      id,
+            guint32    value)
+{
+  fb_push_u32 (b, value);
+  fb_slot (b, id);
+}
+
+static void
+fb_add_u64 (FbBuilder *b,
+            guint      id,
+            guint64    value)
+{
+  fb_push_u64 (b, value);
+  fb_slot (b, id);
+}
+
+static void
+fb_add_offset (FbBuilder *b,
+               guint      id,
+               gsize      target)
+{
+  fb_push_offset (b, target);
+  fb_slot (b, id);
+}
+
+/* The vtable goes right in front of the table, never shared */
+static gsize
+fb_end_table (FbBuilder *b)
+{
+  gsize table;
+  guint32 soffset;
+  guint i;
+
+  fb_prep (b, 4, 4);
+  fb_claim (b, 4);
+  table = b->used;
+
+  for (i = b->n_slots; i-- > 0; )
+    fb_push_u16 (b, b->slots [i] ? table - b->slots [i] : 0);
+  fb_push_u16 (b, table - b->table_start);
+  fb_push_u16 (b, (b->n_slots + 2) * 2);
+
+  soffset = GUINT32_TO_LE (b->used - table);
+  memcpy (b->data + b->allocated - table, &soffset, 4);
+
+  return table;
+}
+
+/* Leaves the buffer a multiple of 8 long */
+static void
+fb_finish (FbBuilder *b,
+           gsize      root)
+{
+  fb_prep (b, 8, 4);
+  fb_push_offset (b, root);
+}
+
+static const guint8 *
+fb_get_data (FbBuilder *b)
+{
+  return b->data + b->allocated - b->used;
+}
+
+/* --- Bitmaps --- */
+static void
+bitmap_to_le (guint64 *words,
+              gsize    n_words)
+{
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  gsize i;
+
+  for (i = 0; i < n_words; i++)
+    words [i] = GUINT64_TO_LE (words [i]);
+#endif
+}
+
+/* Valid when at least @min, returns the null count */
+static guint
+bitmap_from_int64 (guint64      *words,
+                   const gint64 *values,
+                   guint         n_values,
+                   gint64        min)
+{
+  guint n_nulls = 0;
+  guint i;
+
+  memset (words, 0, N_WORDS (n_values) * sizeof (guint64));
+  for (i = 0; i < n_values; i++)
+    {
+      if (values [i] >= min)
+        words [i / WORD_BITS] |= G_GUINT64_CONSTANT (1) << (i % WORD_BITS);
+      else
+        n_nulls++;
+    }
+
+  bitmap_to_le (words, N_WORDS (n_values));
+
+  return n_nulls;
+}
+
+/* Valid unless NaN, returns the null count */
+static guint
+bitmap_from_double (guint64       *words,
+                    const gdouble *values,
+                    guint          n_values)
+{
+  guint n_nulls = 0;
+  guint i;
+
+  memset (words, 0, N_WORDS (n_values) * sizeof (guint64));
+  for (i = 0; i < n_values; i++)
+    {
+      if (!isnan (values [i]))
+        words [i / WORD_BITS] |= G_GUINT64_CONSTANT (1) << (i % WORD_BITS);
+      else
+        n_nulls++;
+    }
+
+  bitmap_to_le (words, N_WORDS (n_values));
+
+  return n_nulls;
+}
+
+static guint
+bitmap_count_nulls (const guint64 *words,
+                    guint          n_values)
+{
+  guint n_valid = 0;
+  guint w;
+
+  for (w = 0; w < N_WORDS (n_values); w++)
+    {
+      guint len = MIN (WORD_BITS, n_values - w * WORD_BITS);
+      guint64 bits = words [w];
+
+      if (len < WORD_BITS)
+        bits &= (G_GUINT64_CONSTANT (1) << len) - 1;
+
+      for ( ; bits; bits &= bits - 1)
+        n_valid++;
+    }
+
+  return n_values - n_valid;
+}
+
+/* --- GObject --- */
+static void
+gairq_arrow_writer_finalize (GObject *object)
+{
+  GairqArrowWriter *self = GAIRQ_ARROW_WRITER (object);
+
+  g_clear_object (&self->stream);
+  g_clear_object (&self->pending);
+  g_array_unref (self->attr_validity);
+  g_array_unref (self->attr_offsets);
+  g_array_unref (self->attr_indices);
+  g_hash_table_unref (self->names_index);
+  g_ptr_array_unref (self->names);
+  g_array_unref (self->dictionary_blocks);
+  g_array_unref (self->record_blocks);
+  g_free (self->scratch);
+  g_free (self->builder.data);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gairq_arrow_writer_parent_class)->finalize (object);
+}
+
+static void
+gairq_arrow_writer_class_init (GairqArrowWriterClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_arrow_writer_finalize;
+}
+
+static void
+gairq_arrow_writer_init (GairqArrowWriter *self)
+{
+  gint32 zero = 0;
+
+  g_mutex_init (&self->lock);
+
+  self->attr_validity = g_array_new (FALSE, TRUE, sizeof (guint64));
+  self->attr_offsets = g_array_new (FALSE, FALSE, sizeof (gint32));
+  self->attr_indices = g_array_new (FALSE, FALSE, sizeof (gint32));
+  g_array_append_val (self->attr_offsets, zero);
+
+  /* Names are owned by the array, the table indexes into it */
+  self->names_index = g_hash_table_new (g_str_hash, g_str_equal);
+  self->names = g_ptr_array_new_with_free_func (g_free);
+
+  self->dictionary_blocks = g_array_new (FALSE, FALSE, sizeof (Block));
+  self->record_blocks = g_array_new (FALSE, FALSE, sizeof (Block));
+}
+
+/* --- Private Methods --- */
+static gboolean
+gairq_arrow_writer_check_open (GairqArrowWriter  *self,
+                               GError           **error)
+{
+  if (self->closed)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                           "Arrow writer is already closed");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* A failed write leaves the output torn, so nothing more goes out.
+ * Must be called with the lock held.
+ */
+static gboolean
+gairq_arrow_writer_write_locked (GairqArrowWriter  *self,
+                                 gconstpointer      data,
+                                 gsize              length,
+                                 GError           **error)
+{
+  if (length == 0)
+    return TRUE;
+
+  if (!g_output_stream_write_all (self->stream, data, length, NULL, NULL, error))
+    {
+      self->closed = TRUE;
+      return FALSE;
+    }
+
+  self->offset += length;
+
+  return TRUE;
+}
+
+static gboolean
+gairq_arrow_writer_write_u32_locked (GairqArrowWriter  *self,
+                                     guint32            value,
+                                     GError           **error)
+{
+  value = GUINT32_TO_LE (value);
+
+  return gairq_arrow_writer_write_locked (self, &value, sizeof value, error);
+}
+
+/* Writes the finished Message in the builder followed by the body,
+ * @block is where it went for the footer. Must be called with the lock held.
+ */
+static gboolean
+gairq_arrow_writer_write_message_locked (GairqArrowWriter  *self,
+                                         const BodyBuffer  *buffers,
+                                         guint              n_buffers,
+                                         Block             *block,
+                                         GError           **error)
+{
+  FbBuilder *b = &self->builder;
+  guint i;
+
+  block->offset = self->offset;
+  block->metadata_length = 8 + b->used;
+  block->body_length = 0;
+
+  if (!gairq_arrow_writer_write_u32_locked (self, CONTINUATION, error) ||
+      !gairq_arrow_writer_write_u32_locked (self, b->used, error) ||
+      !gairq_arrow_writer_write_locked (self, fb_get_data (b), b->used, error))
+    return FALSE;
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      gsize padding = PAD8 (buffers [i].length) - buffers [i].length;
+
+      if (!gairq_arrow_writer_write_locked (self, buffers [i].data, buffers [i].length, error) ||
+          !gairq_arrow_writer_write_locked (self, zeros, padding, error))
+        return FALSE;
+
+      block->body_length += buffers [i].length + padding;
+    }
+
+  return TRUE;
+}
+
+/* Puts the buffer descriptions of a body in the builder, returns
+ * the body length.
+ */
+static gint64
+gairq_arrow_writer_add_buffers (GairqArrowWriter  *self,
+                                const BodyBuffer  *buffers,
+                                guint              n_buffers,
+                                gsize             *vector)
+{
+  guint64 words [2 * N_BUFFERS];
+  gint64 body_length = 0;
+  guint i;
+
+  g_assert (n_buffers <= N_BUFFERS);
+
+  for (i = 0; i < n_buffers; i++)
+    {
+      words [2 * i] = body_length;
+      words [2 * i + 1] = buffers [i].length;
+      body_length += PAD8 (buffers [i].length);
+    }
+
+  *vector = fb_structs (&self->builder, words, n_buffers, 2);
+
+  return body_length;
+}
+
+static gsize
+gairq_arrow_writer_add_message (GairqArrowWriter *self,
+                                guint8            header_type,
+                                gsize             header,
+                                gint64            body_length)
+{
+  FbBuilder *b = &self->builder;
+
+  fb_start_table (b);
+  fb_add_u64 (b, 3, body_length);
+  fb_add_offset (b, 2, header);
+  fb_add_u16 (b, 0, METADATA_V5);
+  fb_add_u8 (b, 1, header_type);
+
+  return fb_end_table (b);
+}
+
+static gsize
+fb_int_type (FbBuilder *b,
+             guint      bit_width)
+{
+  fb_start_table (b);
+  fb_add_u32 (b, 0, bit_width);
+  fb_add_u8 (b, 1, TRUE);
+
+  return fb_end_table (b);
+}
+
+static gsize
+fb_field (FbBuilder   *b,
+          const gchar *name,
+          gboolean     nullable,
+          guint8       type_type,
+          gsize        type,
+          gsize        dictionary,
+          gsize        children)
+{
+  gsize name_str = fb_string (b, name);
+
+  fb_start_table (b);
+  fb_add_offset (b, 0, name_str);
+  fb_add_offset (b, 3, type);
+  if (dictionary)
+    fb_add_offset (b, 4, dictionary);
+  fb_add_offset (b, 5, children);
+  fb_add_u8 (b, 1, nullable);
+  fb_add_u8 (b, 2, type_type);
+
+  return fb_end_table (b);
+}
+
+/* Returns the Schema table */
+static gsize
+gairq_arrow_writer_add_schema (GairqArrowWriter *self)
+{
+  FbBuilder *b = &self->builder;
+  gsize fields [N_SCALAR_FIELDS + 1];
+  gsize no_children, type, index_type, dictionary, item, children, vector;
+  guint n_fields = 0;
+  guint i;
+
+  no_children = fb_offsets (b, NULL, 0);
+
+  type = fb_int_type (b, 64);
+  fields [n_fields++] = fb_field (b, "idx", FALSE, TYPE_INT, type, 0, no_children);
+  type = fb_int_type (b, 64);
+  fields [n_fields++] = fb_field (b, "aqi", TRUE, TYPE_INT, type, 0, no_children);
+
+  vector = fb_string (b, "UTC");
+  fb_start_table (b);
+  fb_add_offset (b, 1, vector);
+  fb_add_u16 (b, 0, TIME_UNIT_SECOND);
+  type = fb_end_table (b);
+  fields [n_fields++] = fb_field (b, "time", TRUE, TYPE_TIMESTAMP, type, 0, no_children);
+
+  for (i = 0; i < 2 + N_GAIRQ_POLLUTANTS; i++)
+    {
+      const gchar *name = i == 0 ? "latitude"
+                        : i == 1 ? "longitude"
+                        : gairq_pollutant_to_string (i - 2);
+
+      fb_start_table (b);
+      fb_add_u16 (b, 0, PRECISION_DOUBLE);
+      type = fb_end_table (b);
+      fields [n_fields++] = fb_field (b, name, TRUE, TYPE_FLOATING_POINT, type, 0, no_children);
+    }
+
+  /* list<item: dictionary<int32, utf8>> */
+  index_type = fb_int_type (b, 32);
+  fb_start_table (b);
+  fb_add_u64 (b, 0, DICTIONARY_ID);
+  fb_add_offset (b, 1, index_type);
+  fb_add_u8 (b, 2, FALSE);
+  dictionary = fb_end_table (b);
+
+  fb_start_table (b);
+  type = fb_end_table (b);
+  item = fb_field (b, "item", FALSE, TYPE_UTF8, type, dictionary, no_children);
+
+  children = fb_offsets (b, &item, 1);
+  fb_start_table (b);
+  type = fb_end_table (b);
+  fields [n_fields++] = fb_field (b, "attributions", TRUE, TYPE_LIST, type, 0, children);
+
+  vector = fb_offsets (b, fields, n_fields);
+  fb_start_table (b);
+  fb_add_offset (b, 1, vector);
+  fb_add_u16 (b, 0, G_BYTE_ORDER == G_LITTLE_ENDIAN ? 0 : 1);
+
+  return fb_end_table (b);
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_arrow_writer_start_locked (GairqArrowWriter  *self,
+                                 GError           **error)
+{
+  Block block;
+  gsize schema;
+
+  if (self->started)
+    return TRUE;
+
+  self->started = TRUE;
+
+  if (self->format == GAIRQ_ARROW_FORMAT_FILE &&
+      !gairq_arrow_writer_write_locked (self, FILE_MAGIC "\0\0", 8, error))
+    return FALSE;
+
+  fb_reset (&self->builder);
+  schema = gairq_arrow_writer_add_schema (self);
+  fb_finish (&self->builder,
+             gairq_arrow_writer_add_message (self, HEADER_SCHEMA, schema, 0));
+
+  return gairq_arrow_writer_write_message_locked (self, NULL, 0, &block, error);
+}
+
+/* Sends out the names added since the last time, as a delta after the
+ * first one. Readers want a dictionary ahead of the first record batch
+ * even when it is empty. Must be called with the lock held.
+ */
+static gboolean
+gairq_arrow_writer_write_dictionary_locked (GairqArrowWriter  *self,
+                                            GError           **error)
+{
+  FbBuilder *b = &self->builder;
+  g_autoptr(GByteArray) data = NULL;
+  g_autoptr(GArray) offsets = NULL;
+  BodyBuffer buffers [3];
+  guint64 node [2];
+  gsize nodes, buffers_vector, batch, dictionary;
+  gint64 body_length;
+  guint n_names, i;
+  Block block;
+
+  if (self->dictionary_written && self->n_names_written == self->names->len)
+    return TRUE;
+
+  n_names = self->names->len - self->n_names_written;
+  data = g_byte_array_new ();
+  offsets = g_array_sized_new (FALSE, FALSE, sizeof (gint32), n_names + 1);
+
+  for (i = self->n_names_written; i <= self->names->len; i++)
+    {
+      gint32 offset = data->len;
+
+      g_array_append_val (offsets, offset);
+      if (i < self->names->len)
+        {
+          const gchar *name = g_ptr_array_index (self->names, i);
+
+          g_byte_array_append (data, (const guint8 *) name, strlen (name));
+        }
+    }
+
+  buffers [0] = (BodyBuffer) { NULL, 0 };
+  buffers [1] = (BodyBuffer) { offsets->data, offsets->len * sizeof (gint32) };
+  buffers [2] = (BodyBuffer) { data->data, data->len };
+
+  fb_reset (b);
+  node [0] = n_names;
+  node [1] = 0;
+  nodes = fb_structs (b, node, 1, 2);
+  body_length = gairq_arrow_writer_add_buffers (self, buffers, 3, &buffers_vector);
+
+  fb_start_table (b);
+  fb_add_u64 (b, 0, n_names);
+  fb_add_offset (b, 1, nodes);
+  fb_add_offset (b, 2, buffers_vector);
+  batch = fb_end_table (b);
+
+  fb_start_table (b);
+  fb_add_u64 (b, 0, DICTIONARY_ID);
+  fb_add_offset (b, 1, batch);
+  fb_add_u8 (b, 2, self->dictionary_written);
+  dictionary = fb_end_table (b);
+
+  fb_finish (b, gairq_arrow_writer_add_message (self, HEADER_DICTIONARY,
+                                                dictionary, body_length));
+
+  if (!gairq_arrow_writer_write_message_locked (self, buffers, 3, &block, error))
+    return FALSE;
+
+  g_array_append_val (self->dictionary_blocks, block);
+  self->dictionary_written = TRUE;
+  self->n_names_written = self->names->len;
+  self->stats.n_dictionary_batches++;
+
+  return TRUE;
+}
+
+static guint64 *
+gairq_arrow_writer_get_scratch (GairqArrowWriter *self,
+                                gsize             n_words)
+{
+  if (self->scratch_words < n_words)
+    {
+      g_free (self->scratch);
+      self->scratch = g_new (guint64, n_words);
+      self->scratch_words = n_words;
+    }
+
+  return self->scratch;
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_arrow_writer_write_batch_locked (GairqArrowWriter  *self,
+                                       const RecordView  *view,
+                                       GError           **error)
+{
+  FbBuilder *b = &self->builder;
+  guint n_rows = view->n_rows;
+  gsize n_words = N_WORDS (n_rows);
+  guint64 nodes_words [2 * N_NODES];
+  BodyBuffer buffers [N_BUFFERS];
+  guint64 *scratch, *bitmaps [4];
+  const guint64 *validity;
+  const gint32 *attr_offsets;
+  gsize nodes, buffers_vector, batch;
+  gint64 body_length;
+  guint n_attrs, n_nulls;
+  guint i;
+  Block block;
+
+  if (!gairq_arrow_writer_start_locked (self, error) ||
+      !gairq_arrow_writer_write_dictionary_locked (self, error))
+    return FALSE;
+
+  /* Four derived bitmaps, the pollutant ones when they need swapping,
+   * and an empty list column when no row has attributions.
+   */
+  scratch = gairq_arrow_writer_get_scratch (self, (5 + N_GAIRQ_POLLUTANTS) * n_words +
+                                                  (n_rows + 2) / 2);
+  for (i = 0; i < 4; i++)
+    bitmaps [i] = scratch + i * n_words;
+
+  /* idx */
+  nodes_words [0] = n_rows;
+  nodes_words [1] = 0;
+  buffers [0] = (BodyBuffer) { NULL, 0 };
+  buffers [1] = (BodyBuffer) { view->idx, n_rows * sizeof (gint64) };
+
+  /* aqi, time, latitude and longitude */
+  for (i = 0; i < 4; i++)
+    {
+      gconstpointer values;
+
+      switch (i)
+        {
+        case 0:
+          n_nulls = bitmap_from_int64 (bitmaps [i], view->aqi, n_rows, 0);
+          values = view->aqi;
+          break;
+
+        case 1:
+          n_nulls = bitmap_from_int64 (bitmaps [i], view->time, n_rows, 1);
+          values = view->time;
+          break;
+
+        case 2:
+          n_nulls = bitmap_from_double (bitmaps [i], view->lat, n_rows);
+          values = view->lat;
+          break;
+
+        default:
+          n_nulls = bitmap_from_double (bitmaps [i], view->lng, n_rows);
+          values = view->lng;
+          break;
+        }
+
+      nodes_words [2 * (i + 1)] = n_rows;
+      nodes_words [2 * (i + 1) + 1] = n_nulls;
+      buffers [2 * (i + 1)] = (BodyBuffer) { bitmaps [i], (n_rows + 7) / 8 };
+      buffers [2 * (i + 1) + 1] = (BodyBuffer) { values, n_rows * 8 };
+    }
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      guint node = 5 + i;
+
+      validity = view->validity [i];
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+      memcpy (scratch + (4 + i) * n_words, validity, n_words * sizeof (guint64));
+      validity = scratch + (4 + i) * n_words;
+      bitmap_to_le ((guint64 *) validity, n_words);
+#endif
+
+      nodes_words [2 * node] = n_rows;
+      nodes_words [2 * node + 1] = bitmap_count_nulls (view->validity [i], n_rows);
+      buffers [2 * node] = (BodyBuffer) { validity, (n_rows + 7) / 8 };
+      buffers [2 * node + 1] = (BodyBuffer) { view->columns [i], n_rows * 8 };
+    }
+
+  /* attributions and their items */
+  validity = view->attr_validity;
+  attr_offsets = view->attr_offsets;
+  if (validity == NULL)
+    {
+      guint64 *empty = scratch + (4 + N_GAIRQ_POLLUTANTS) * n_words;
+
+      memset (empty, 0, (n_words + (n_rows + 2) / 2) * sizeof (guint64));
+      validity = empty;
+      attr_offsets = (const gint32 *) (empty + n_words);
+      n_nulls = n_rows;
+    }
+  else
+    {
+      n_nulls = bitmap_count_nulls (validity, n_rows);
+    }
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  if (view->attr_validity != NULL)
+    {
+      guint64 *swapped = scratch + (4 + N_GAIRQ_POLLUTANTS) * n_words;
+
+      memcpy (swapped, validity, n_words * sizeof (guint64));
+      bitmap_to_le (swapped, n_words);
+      validity = swapped;
+    }
+#endif
+
+  n_attrs = attr_offsets [n_rows];
+  nodes_words [2 * N_SCALAR_FIELDS] = n_rows;
+  nodes_words [2 * N_SCALAR_FIELDS + 1] = n_nulls;
+  nodes_words [2 * N_SCALAR_FIELDS + 2] = n_attrs;
+  nodes_words [2 * N_SCALAR_FIELDS + 3] = 0;
+  buffers [2 * N_SCALAR_FIELDS] = (BodyBuffer) { validity, (n_rows + 7) / 8 };
+  buffers [2 * N_SCALAR_FIELDS + 1] = (BodyBuffer) { attr_offsets, (n_rows + 1) * sizeof (gint32) };
+  buffers [2 * N_SCALAR_FIELDS + 2] = (BodyBuffer) { NULL, 0 };
+  buffers [2 * N_SCALAR_FIELDS + 3] = (BodyBuffer) { view->attr_indices, n_attrs * sizeof (gint32) };
+
+  fb_reset (b);
+  nodes = fb_structs (b, nodes_words, N_NODES, 2);
+  body_length = gairq_arrow_writer_add_buffers (self, buffers, N_BUFFERS, &buffers_vector);
+
+  fb_start_table (b);
+  fb_add_u64 (b, 0, n_rows);
+  fb_add_offset (b, 1, nodes);
+  fb_add_offset (b, 2, buffers_vector);
+  batch = fb_end_table (b);
+
+  fb_finish (b, gairq_arrow_writer_add_message (self, HEADER_RECORD_BATCH,
+                                                batch, body_length));
+
+  if (!gairq_arrow_writer_write_message_locked (self, buffers, N_BUFFERS, &block, error))
+    return FALSE;
+
+  g_array_append_val (self->record_blocks, block);
+  self->stats.n_rows += n_rows;
+  self->stats.n_batches++;
+
+  return TRUE;
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_arrow_writer_flush_locked (GairqArrowWriter  *self,
+                                 GError           **error)
+{
+  GairqAirBatch *pending = self->pending;
+  RecordView view = { 0, };
+  gint32 zero = 0;
+  gboolean ret;
+  guint i;
+
+  view.n_rows = gairq_air_batch_get_length (pending);
+  if (view.n_rows == 0)
+    return TRUE;
+
+  view.idx = gairq_air_batch_get_idx (pending);
+  view.aqi = gairq_air_batch_get_aqi (pending);
+  view.time = gairq_air_batch_get_time (pending);
+  view.lat = gairq_air_batch_get_latitude (pending);
+  view.lng = gairq_air_batch_get_longitude (pending);
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      view.columns [i] = gairq_air_batch_get_column (pending, i);
+      view.validity [i] = gairq_air_batch_get_validity (pending, i);
+    }
+
+  g_array_set_size (self->attr_validity, N_WORDS (view.n_rows));
+  view.attr_validity = (const guint64 *) self->attr_validity->data;
+  view.attr_offsets = (const gint32 *) self->attr_offsets->data;
+  view.attr_indices = (const gint32 *) self->attr_indices->data;
+
+  ret = gairq_arrow_writer_write_batch_locked (self, &view, error);
+
+  gairq_air_batch_clear (pending);
+  g_array_set_size (self->attr_validity, 0);
+  g_array_set_size (self->attr_offsets, 0);
+  g_array_set_size (self->attr_indices, 0);
+  g_array_append_val (self->attr_offsets, zero);
+
+  return ret;
+}
+
+/* Must be called with the lock held */
+static void
+gairq_arrow_writer_stage_attributions_locked (GairqArrowWriter *self,
+                                              GSList           *attributions,
+                                              gboolean          valid)
+{
+  guint row = self->attr_offsets->len - 1;
+  gint32 end;
+
+  g_array_set_size (self->attr_validity, N_WORDS (row + 1));
+  if (valid)
+    g_array_index (self->attr_validity, guint64, row / WORD_BITS) |=
+      G_GUINT64_CONSTANT (1) << (row % WORD_BITS);
+
+  for ( ; attributions; attributions = attributions->next)
+    {
+      GairqObjectAttr *attr = attributions->data;
+      gpointer index;
+      gint32 value;
+
+      if (attr == NULL || attr->name == NULL)
+        continue;
+
+      if (!g_hash_table_lookup_extended (self->names_index, attr->name, NULL, &index))
+        {
+          gchar *name = g_strdup (attr->name);
+
+          index = GUINT_TO_POINTER (self->names->len);
+          g_ptr_array_add (self->names, name);
+          g_hash_table_insert (self->names_index, name, index);
+        }
+
+      value = GPOINTER_TO_INT (index);
+      g_array_append_val (self->attr_indices, value);
+    }
+
+  end = self->attr_indices->len;
+  g_array_append_val (self->attr_offsets, end);
+}
+
+/* --- Public APIs --- */
+GairqArrowWriter *
+gairq_arrow_writer_new (GOutputStream    *stream,
+                        GairqArrowFormat  format,
+                        guint             batch_size)
+{
+  GairqArrowWriter *self;
+
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), NULL);
+  g_return_val_if_fail (format <= GAIRQ_ARROW_FORMAT_FILE, NULL);
+
+  if (batch_size == 0)
+    batch_size = DEFAULT_BATCH_SIZE;
+
+  self = g_object_new (GAIRQ_TYPE_ARROW_WRITER, NULL);
+  self->stream = g_object_ref (stream);
+  self->format = format;
+
+  /* Whole words, so that batches go out of a GairqAirBatch in place */
+  self->batch_size = MIN (N_WORDS (batch_size) * WORD_BITS, MAX_BATCH_SIZE);
+  self->pending = gairq_air_batch_new (self->batch_size);
+
+  return self;
+}
+
+gboolean
+gairq_arrow_writer_append (GairqArrowWriter  *self,
+                           GairqAirObject    *air,
+                           GError           **error)
+{
+  gboolean ret = TRUE;
+
+  g_return_val_if_fail (GAIRQ_IS_ARROW_WRITER (self), FALSE);
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (air), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  if (!gairq_arrow_writer_check_open (self, error))
+    {
+      g_mutex_unlock (&self->lock);
+      return FALSE;
+    }
+
+  gairq_air_batch_append (self->pending, air);
+  gairq_arrow_writer_stage_attributions_locked (self, gairq_air_object_get_attributions (air), TRUE);
+
+  if (gairq_air_batch_get_length (self->pending) >= self->batch_size)
+    ret = gairq_arrow_writer_flush_locked (self, error);
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Whole batches are written straight out of @batch's columns, rows
+ * are only copied to fill up what is pending.
+ */
+gboolean
+gairq_arrow_writer_append_batch (GairqArrowWriter  *self,
+                                 GairqAirBatch     *batch,
+                                 GError           **error)
+{
+  const gint64 *idx, *aqi, *time;
+  const gdouble *lat, *lng;
+  const gdouble *columns [N_GAIRQ_POLLUTANTS];
+  const guint64 *validity [N_GAIRQ_POLLUTANTS];
+  guint n_rows, row, i;
+  gboolean ret = TRUE;
+
+  g_return_val_if_fail (GAIRQ_IS_ARROW_WRITER (self), FALSE);
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (batch), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  n_rows = gairq_air_batch_get_length (batch);
+  idx = gairq_air_batch_get_idx (batch);
+  aqi = gairq_air_batch_get_aqi (batch);
+  time = gairq_air_batch_get_time (batch);
+  lat = gairq_air_batch_get_latitude (batch);
+  lng = gairq_air_batch_get_longitude (batch);
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      columns [i] = gairq_air_batch_get_column (batch, i);
+      validity [i] = gairq_air_batch_get_validity (batch, i);
+    }
+
+  g_mutex_lock (&self->lock);
+
+  if (!gairq_arrow_writer_check_open (self, error))
+    {
+      g_mutex_unlock (&self->lock);
+      return FALSE;
+    }
+
+  for (row = 0; row < n_rows && ret; )
+    {
+      gdouble values [N_GAIRQ_POLLUTANTS];
+      guint valid_mask = 0;
+
+      if (gairq_air_batch_get_length (self->pending) == 0 &&
+          row % WORD_BITS == 0 &&
+          n_rows - row >= self->batch_size)
+        {
+          RecordView view = { 0, };
+
+          view.n_rows = self->batch_size;
+          view.idx = idx + row;
+          view.aqi = aqi + row;
+          view.time = time + row;
+          view.lat = lat + row;
+          view.lng = lng + row;
+          for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+            {
+              view.columns [i] = columns [i] + row;
+              view.validity [i] = validity [i] + row / WORD_BITS;
+            }
+
+          ret = gairq_arrow_writer_write_batch_locked (self, &view, error);
+          row += self->batch_size;
+          continue;
+        }
+
+      for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+        {
+          values [i] = columns [i][row];
+          if (validity [i][row / WORD_BITS] & (G_GUINT64_CONSTANT (1) << (row % WORD_BITS)))
+            valid_mask |= 1u << i;
+        }
+
+      gairq_air_batch_append_row (self->pending, idx [row], aqi [row], time [row],
+                                  lat [row], lng [row], values, valid_mask);
+      gairq_arrow_writer_stage_attributions_locked (self, NULL, FALSE);
+      row++;
+
+      if (gairq_air_batch_get_length (self->pending) >= self->batch_size)
+        ret = gairq_arrow_writer_flush_locked (self, error);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Writes what is pending as a record batch, even a short one */
+gboolean
+gairq_arrow_writer_flush (GairqArrowWriter  *self,
+                          GError           **error)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (GAIRQ_IS_ARROW_WRITER (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  ret = gairq_arrow_writer_check_open (self, error) &&
+        gairq_arrow_writer_flush_locked (self, error) &&
+        g_output_stream_flush (self->stream, NULL, error);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+gboolean
+gairq_arrow_writer_close (GairqArrowWriter  *self,
+                          GError           **error)
+{
+  FbBuilder *b;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (GAIRQ_IS_ARROW_WRITER (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  if (!gairq_arrow_writer_check_open (self, error) ||
+      !gairq_arrow_writer_flush_locked (self, error) ||
+      !gairq_arrow_writer_start_locked (self, error) ||
+      !gairq_arrow_writer_write_dictionary_locked (self, error))
+    goto out;
+
+  /* End-of-stream marker */
+  if (!gairq_arrow_writer_write_u32_locked (self, CONTINUATION, error) ||
+      !gairq_arrow_writer_write_u32_locked (self, 0, error))
+    goto out;
+
+  if (self->format == GAIRQ_ARROW_FORMAT_FILE)
+    {
+      GArray *lists [2] = { self->dictionary_blocks, self->record_blocks };
+      gsize vectors [2], schema, footer;
+      gint64 footer_start;
+      guint i, j;
+
+      b = &self->builder;
+      fb_reset (b);
+
+      for (i = 0; i < 2; i++)
+        {
+          g_autofree guint64 *words = g_new (guint64, 3 * MAX (lists [i]->len, 1));
+
+          for (j = 0; j < lists [i]->len; j++)
+            {
+              Block *block = &g_array_index (lists [i], Block, j);
+
+              words [3 * j] = block->offset;
+              words [3 * j + 1] = (guint32) block->metadata_length;
+              words [3 * j + 2] = block->body_length;
+            }
+
+          vectors [i] = fb_structs (b, words, lists [i]->len, 3);
+        }
+
+      schema = gairq_arrow_writer_add_schema (self);
+
+      fb_start_table (b);
+      fb_add_offset (b, 1, schema);
+      fb_add_offset (b, 2, vectors [0]);
+      fb_add_offset (b, 3, vectors [1]);
+      fb_add_u16 (b, 0, METADATA_V5);
+      footer = fb_end_table (b);
+      fb_finish (b, footer);
+
+      footer_start = self->offset;
+      if (!gairq_arrow_writer_write_locked (self, fb_get_data (b), b->used, error) ||
+          !gairq_arrow_writer_write_u32_locked (self, self->offset - footer_start, error) ||
+          !gairq_arrow_writer_write_locked (self, FILE_MAGIC, 6, error))
+        goto out;
+    }
+
+  ret = g_output_stream_flush (self->stream, NULL, error);
+
+out:
+  self->closed = TRUE;
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+void
+gairq_arrow_writer_get_stats (GairqArrowWriter      *self,
+                              GairqArrowWriterStats *stats)
+{
+  g_return_if_fail (GAIRQ_IS_ARROW_WRITER (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+  *stats = self->stats;
+  stats->n_attributions = self->names->len;
+  stats->n_bytes = self->offset;
+  g_mutex_unlock (&self->lock);
+}
@@ -0,0 +1,88 @@
+/* gairq-arrow-writer.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_ARROW_WRITER_H
+#define GAIRQ_ARROW_WRITER_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <gio/gio.h>
+
+#include <gairq/gairq-air-batch.h>
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_ARROW_WRITER (gairq_arrow_writer_get_type ())
+G_DECLARE_FINAL_TYPE (GairqArrowWriter, gairq_arrow_writer, GAIRQ, ARROW_WRITER, GObject)
+
+/* STREAM is the Arrow IPC streaming format, FILE the random access
+ * one (.arrow, Feather v2) with its footer and magic on both ends.
+ */
+typedef enum
+{
+  GAIRQ_ARROW_FORMAT_STREAM,
+  GAIRQ_ARROW_FORMAT_FILE,
+} GairqArrowFormat;
+
+typedef struct
+{
+  guint64   n_rows;
+  guint64   n_batches;
+  guint64   n_dictionary_batches;
+  guint     n_attributions;   /* Distinct names in the dictionary */
+  guint64   n_bytes;          /* Written to the stream */
+} GairqArrowWriterStats;
+
+/* Writes stations as Arrow record batches of @batch_size rows, 0 for
+ * the default, to @stream, which is left open on close. The columns are
+ *
+ *   idx                    int64
+ *   aqi                    int64, null when unknown
+ *   time                   timestamp[s, UTC], null when unknown
+ *   latitude, longitude    float64, null without a city
+ *   pm25 ... co            float64, one per GairqPollutant
+ *   attributions           list<dictionary<int32, utf8>> of the names,
+ *                          null for rows coming from a GairqAirBatch
+ *
+ * Only one batch worth of rows is held in memory at a time. New
+ * attribution names go out as delta dictionary batches.
+ */
+GairqArrowWriter *  gairq_arrow_writer_new          (GOutputStream          *stream,
+                                                     GairqArrowFormat        format,
+                                                     guint                   batch_size);
+gboolean            gairq_arrow_writer_append       (GairqArrowWriter       *self,
+                                                     GairqAirObject         *air,
+                                                     GError                **error);
+gboolean            gairq_arrow_writer_append_batch (GairqArrowWriter       *self,
+                                                     GairqAirBatch          *batch,
+                                                     GError                **error);
+gboolean            gairq_arrow_writer_flush        (GairqArrowWriter       *self,
+                                                     GError                **error);
+gboolean            gairq_arrow_writer_close        (GairqArrowWriter       *self,
+                                                     GError                **error);
+void                gairq_arrow_writer_get_stats    (GairqArrowWriter       *self,
+                                                     GairqArrowWriterStats  *stats);
+
+G_END_DECLS
+
+#endif
@@ -20,6 +20,7 @@
 
 #include "gairq-city.h"
 #include "gairq-debug.h"
+#include "gairq-request-priv.h"
 #include "gairq-utils.h"
 
 #include <ctype.h>
@@ -31,6 +32,8 @@ struct _GairqCity
 {
   GairqRequest    parent_instance;
 
+  /* Calls read the station from other threads */
+  GMutex          lock;
   GairqCityType   type;
   gchar *         city;
 };
@@ -64,6 +67,7 @@ gairq_city_finalize (GObject *object)
   GairqCity *self = GAIRQ_CITY (object);
 
   g_free (self->city);
+  g_mutex_clear (&self->lock);
 
   G_OBJECT_CLASS (gairq_city_parent_class)->finalize (object);
 }
@@ -76,6 +80,8 @@ gairq_city_set_property (GObject      *object,
 {
   GairqCity *self = GAIRQ_CITY (object);
 
+  g_mutex_lock (&self->lock);
+
   switch (prop_id)
     {
     case PROP_TYPE:
@@ -88,8 +94,15 @@ gairq_city_set_property (GObject      *object,
       break;
 
     default:
+      g_mutex_unlock (&self->lock);
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      return;
     }
+
+  g_mutex_unlock (&self->lock);
+
+  /* Whatever was cached belongs to the station asked for until now */
+  gairq_request_endpoint_changed (GAIRQ_REQUEST (self));
 }
 
 static void
@@ -100,6 +113,8 @@ gairq_city_get_property (GObject    *object,
 {
   GairqCity *self = GAIRQ_CITY (object);
 
+  g_mutex_lock (&self->lock);
+
   switch (prop_id)
     {
     case PROP_TYPE:
@@ -113,6 +128,8 @@ gairq_city_get_property (GObject    *object,
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
+
+  g_mutex_unlock (&self->lock);
 }
 
 static gboolean
@@ -126,6 +143,8 @@ gairq_city_request_set_functions (RestProxyCall  *proxy_call,
 
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  g_mutex_lock (&self->lock);
+
   switch (self->type)
     {
     case GAIRQ_CITY_TYPE_NAME:
@@ -140,6 +159,8 @@ gairq_city_request_set_functions (RestProxyCall  *proxy_call,
       ret = FALSE;
     }
 
+  g_mutex_unlock (&self->lock);
+
   if (ret)
     rest_proxy_call_set_function (proxy_call, functions);
 
@@ -189,6 +210,7 @@ gairq_city_class_init (GairqCityClass *klass)
 static void
 gairq_city_init (GairqCity *self)
 {
+  g_mutex_init (&self->lock);
   self->type = GAIRQ_CITY_TYPE_NONE;
   self->city = NULL;
 }
@@ -270,19 +292,10 @@ GairqAirObject *
 gairq_city_request_sync (GairqCity  *self,
                          GError    **error)
 {
-  JsonNode *root = NULL;
-  gpointer ret = NULL;
-
   g_return_val_if_fail (GAIRQ_IS_CITY (self), NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  root = gairq_request_call_sync (GAIRQ_REQUEST (self), error);
-  if (root)
-    ret = gairq_request_default_deserialize (root, error);
-
-  json_node_unref (root);
-
-  return ret;
+  return gairq_request_fetch_sync (GAIRQ_REQUEST (self), error);
 }
 
 void
@@ -294,10 +307,10 @@ gairq_city_request_async (GairqCity           *self,
   g_return_if_fail (GAIRQ_IS_CITY (self));
   g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
 
-  gairq_request_call_async (GAIRQ_REQUEST (self),
-                            cancellable,
-                            callback,
-                            callback_data);
+  gairq_request_fetch_async (GAIRQ_REQUEST (self),
+                             cancellable,
+                             callback,
+                             callback_data);
 }
 
 GairqAirObject *
@@ -305,15 +318,9 @@ gairq_city_request_finish (GairqCity     *self,
                            GAsyncResult  *res,
                            GError       **error)
 {
-  JsonNode *root;
-
   g_return_val_if_fail (GAIRQ_IS_CITY (self), NULL);
   g_return_val_if_fail (g_task_is_valid (res, self), NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  root = g_task_propagate_pointer (G_TASK (res), error);
-  if (root)
-    return gairq_request_default_deserialize (root, error);
-
-  return NULL;
+  return gairq_request_fetch_finish (GAIRQ_REQUEST (self), res, error);
 }
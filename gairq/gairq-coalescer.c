@@ -0,0 +1,441 @@
+/* gairq-coalescer.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-coalescer.h"
+
+/* A call from submission to delivery. The completion comes first, the
+ * batch hands it out as is.
+ */
+typedef struct
+{
+  GairqCompletion   completion;
+  GairqCoalescer *  coalescer;    /* Held until the batch is out */
+  GCancellable *    cancellable;
+  gboolean          is_call;
+} Job;
+
+struct _GairqCoalescer
+{
+  GObject           parent_instance;
+
+  GairqExecutor *   executor;
+  GSource *         source;
+
+  GMutex            lock;
+  GPtrArray *       pending;
+  guint             window;
+  guint             n_in_flight;
+  guint64           n_completions;
+  guint64           n_batches;
+  guint             max_batch;
+};
+
+/* Properties */
+enum {
+  PROP_0,
+  PROP_EXECUTOR,
+  PROP_WINDOW,
+  N_PROPERTIES
+};
+
+static GParamSpec*  properties [N_PROPERTIES];
+
+/* Signals */
+enum {
+  COMPLETED,
+  N_SIGNALS
+};
+
+static guint  signals [N_SIGNALS];
+
+G_DEFINE_TYPE (GairqCoalescer, gairq_coalescer, G_TYPE_OBJECT)
+
+
+static void
+job_free (gpointer data)
+{
+  Job *job = data;
+
+  g_object_unref (job->completion.request);
+  g_clear_pointer (&job->completion.root, json_node_unref);
+  g_clear_object (&job->completion.air);
+  g_clear_error (&job->completion.error);
+  g_clear_object (&job->cancellable);
+  g_object_unref (job->coalescer);
+  g_slice_free (Job, job);
+}
+
+static gboolean
+gairq_coalescer_dispatch (GSource     *source,
+                          GSourceFunc  callback,
+                          gpointer     user_data)
+{
+  GairqCoalescer *self = g_object_ref (user_data);
+  GPtrArray *batch;
+
+  g_mutex_lock (&self->lock);
+  batch = self->pending;
+  self->pending = g_ptr_array_new_with_free_func (job_free);
+  g_source_set_ready_time (source, -1);
+
+  if (batch->len > 0)
+    {
+      self->n_completions += batch->len;
+      self->n_batches++;
+      self->max_batch = MAX (self->max_batch, batch->len);
+    }
+  g_mutex_unlock (&self->lock);
+
+  if (batch->len > 0)
+    g_signal_emit (self, signals [COMPLETED], 0, batch);
+
+  /* The jobs' references on self go with them */
+  g_ptr_array_unref (batch);
+  g_object_unref (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs coalescer_source_funcs = {
+  NULL,
+  NULL,
+  gairq_coalescer_dispatch,
+  NULL,
+};
+
+/* --- GObject --- */
+static void
+gairq_coalescer_constructed (GObject *object)
+{
+  GairqCoalescer *self = GAIRQ_COALESCER (object);
+
+  G_OBJECT_CLASS (gairq_coalescer_parent_class)->constructed (object);
+
+  if (self->executor == NULL)
+    self->executor = g_object_ref (gairq_executor_get_default ());
+
+  self->source = g_source_new (&coalescer_source_funcs, sizeof (GSource));
+  g_source_set_callback (self->source, NULL, self, NULL);
+  g_source_set_name (self->source, "GairqCoalescer");
+  g_source_attach (self->source, g_main_context_get_thread_default ());
+}
+
+static void
+gairq_coalescer_dispose (GObject *object)
+{
+  GairqCoalescer *self = GAIRQ_COALESCER (object);
+
+  if (self->source)
+    {
+      g_source_destroy (self->source);
+      g_clear_pointer (&self->source, g_source_unref);
+    }
+  g_clear_object (&self->executor);
+
+  G_OBJECT_CLASS (gairq_coalescer_parent_class)->dispose (object);
+}
+
+static void
+gairq_coalescer_finalize (GObject *object)
+{
+  GairqCoalescer *self = GAIRQ_COALESCER (object);
+
+  /* Every job holds a reference, none are left */
+  g_ptr_array_unref (self->pending);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gairq_coalescer_parent_class)->finalize (object);
+}
+
+static void
+gairq_coalescer_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+  GairqCoalescer *self = GAIRQ_COALESCER (object);
+
+  switch (prop_id)
+    {
+    case PROP_EXECUTOR:
+      self->executor = g_value_dup_object (value);
+      break;
+
+    case PROP_WINDOW:
+      gairq_coalescer_set_window (self, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_coalescer_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+  GairqCoalescer *self = GAIRQ_COALESCER (object);
+
+  switch (prop_id)
+    {
+    case PROP_EXECUTOR:
+      g_value_set_object (value, self->executor);
+      break;
+
+    case PROP_WINDOW:
+      g_value_set_uint (value, gairq_coalescer_get_window (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_coalescer_class_init (GairqCoalescerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gairq_coalescer_constructed;
+  object_class->dispose = gairq_coalescer_dispose;
+  object_class->finalize = gairq_coalescer_finalize;
+  object_class->set_property = gairq_coalescer_set_property;
+  object_class->get_property = gairq_coalescer_get_property;
+
+  /**
+   * GairqCoalescer:executor:
+   *
+   * The #GairqExecutor calls run on, gairq_executor_get_default ()
+   * if NULL.
+   */
+  properties [PROP_EXECUTOR] =
+    g_param_spec_object ("executor", "Executor",
+                         "A GairqExecutor to run calls on",
+                         GAIRQ_TYPE_EXECUTOR,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  /**
+   * GairqCoalescer:window:
+   *
+   * How long, in ms, a batch waits for more after its first completion.
+   * 0 sends it on the next main loop iteration.
+   */
+  properties [PROP_WINDOW] =
+    g_param_spec_uint ("window", "Window",
+                       "How long a batch collects completions",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+
+  /**
+   * GairqCoalescer::completed:
+   * @completions: (element-type GairqCompletion): the batch
+   *
+   * Emitted once per batch with every call that came back since the
+   * last one, in the order they did.
+   */
+  signals [COMPLETED] =
+    g_signal_new ("completed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  0,
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 1,
+                  G_TYPE_PTR_ARRAY | G_SIGNAL_TYPE_STATIC_SCOPE);
+}
+
+static void
+gairq_coalescer_init (GairqCoalescer *self)
+{
+  g_mutex_init (&self->lock);
+  self->pending = g_ptr_array_new_with_free_func (job_free);
+  self->window = 0;
+}
+
+/* --- Private Methods --- */
+/* Queues @job for the next batch, waking the main loop only for the
+ * first of it
+ */
+static void
+gairq_coalescer_complete (GairqCoalescer *self,
+                          Job            *job)
+{
+  g_mutex_lock (&self->lock);
+
+  self->n_in_flight--;
+  g_ptr_array_add (self->pending, job);
+
+  if (self->pending->len == 1)
+    g_source_set_ready_time (self->source,
+                             self->window == 0 ? 0 :
+                               g_get_monotonic_time () +
+                               (gint64) self->window * G_TIME_SPAN_MILLISECOND);
+
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gairq_coalescer_run (gpointer data)
+{
+  Job *job = data;
+  GairqCompletion *completion = &job->completion;
+
+  if (!g_cancellable_set_error_if_cancelled (job->cancellable, &completion->error))
+    {
+      if (job->is_call)
+        completion->root = gairq_request_call_sync (completion->request, &completion->error);
+      else
+        completion->air = gairq_request_poll_sync (completion->request, &completion->flags,
+                                                   &completion->error);
+
+      if (completion->root == NULL && completion->air == NULL && completion->error == NULL)
+        g_set_error (&completion->error, G_IO_ERROR, G_IO_ERROR_FAILED, "No response");
+    }
+
+  gairq_coalescer_complete (job->coalescer, job);
+}
+
+static void
+gairq_coalescer_submit (GairqCoalescer *self,
+                        GairqRequest   *request,
+                        GCancellable   *cancellable,
+                        gpointer        tag,
+                        gboolean        is_call)
+{
+  Job *job;
+
+  job = g_slice_new0 (Job);
+  job->completion.request = g_object_ref (request);
+  job->completion.tag = tag;
+  job->coalescer = g_object_ref (self);
+  job->cancellable = cancellable ? g_object_ref (cancellable) : NULL;
+  job->is_call = is_call;
+
+  g_mutex_lock (&self->lock);
+  self->n_in_flight++;
+  g_mutex_unlock (&self->lock);
+
+  /* Turned away, it goes out with the error in the next batch */
+  if (!gairq_executor_push (self->executor, gairq_request_get_priority (request),
+                            gairq_coalescer_run, job, NULL, 0, &job->completion.error))
+    gairq_coalescer_complete (self, job);
+}
+
+/* --- Public APIs --- */
+GairqCoalescer *
+gairq_coalescer_new (GairqExecutor *executor,
+                     guint          window_ms)
+{
+  g_return_val_if_fail (executor == NULL || GAIRQ_IS_EXECUTOR (executor), NULL);
+
+  return g_object_new (GAIRQ_TYPE_COALESCER,
+                       "executor", executor,
+                       "window", window_ms,
+                       NULL);
+}
+
+GairqExecutor *
+gairq_coalescer_get_executor (GairqCoalescer *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_COALESCER (self), NULL);
+
+  return self->executor;
+}
+
+/* Applies from the next batch on */
+void
+gairq_coalescer_set_window (GairqCoalescer *self,
+                            guint           window_ms)
+{
+  gboolean changed;
+
+  g_return_if_fail (GAIRQ_IS_COALESCER (self));
+
+  g_mutex_lock (&self->lock);
+  changed = self->window != window_ms;
+  self->window = window_ms;
+  g_mutex_unlock (&self->lock);
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_WINDOW]);
+}
+
+guint
+gairq_coalescer_get_window (GairqCoalescer *self)
+{
+  guint ret;
+
+  g_return_val_if_fail (GAIRQ_IS_COALESCER (self), 0);
+
+  g_mutex_lock (&self->lock);
+  ret = self->window;
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* gairq_request_call_sync () on the executor, the result going out with
+ * the next batch tagged with @tag
+ */
+void
+gairq_coalescer_call (GairqCoalescer *self,
+                      GairqRequest   *request,
+                      GCancellable   *cancellable,
+                      gpointer        tag)
+{
+  g_return_if_fail (GAIRQ_IS_COALESCER (self));
+  g_return_if_fail (GAIRQ_IS_REQUEST (request));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  gairq_coalescer_submit (self, request, cancellable, tag, TRUE);
+}
+
+/* The same for gairq_request_poll_sync () */
+void
+gairq_coalescer_poll (GairqCoalescer *self,
+                      GairqRequest   *request,
+                      GCancellable   *cancellable,
+                      gpointer        tag)
+{
+  g_return_if_fail (GAIRQ_IS_COALESCER (self));
+  g_return_if_fail (GAIRQ_IS_REQUEST (request));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  gairq_coalescer_submit (self, request, cancellable, tag, FALSE);
+}
+
+void
+gairq_coalescer_get_stats (GairqCoalescer      *self,
+                           GairqCoalescerStats *stats)
+{
+  g_return_if_fail (GAIRQ_IS_COALESCER (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+  stats->n_in_flight = self->n_in_flight;
+  stats->n_pending = self->pending->len;
+  stats->n_completions = self->n_completions;
+  stats->n_batches = self->n_batches;
+  stats->max_batch = self->max_batch;
+  g_mutex_unlock (&self->lock);
+}
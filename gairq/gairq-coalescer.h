@@ -0,0 +1,87 @@
+/* gairq-coalescer.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_COALESCER_H
+#define GAIRQ_COALESCER_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <gio/gio.h>
+
+#include <gairq/gairq-executor.h>
+#include <gairq/gairq-request.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_COALESCER (gairq_coalescer_get_type ())
+G_DECLARE_FINAL_TYPE (GairqCoalescer, gairq_coalescer, GAIRQ, COALESCER, GObject)
+
+typedef struct _GairqCompletion GairqCompletion;
+typedef struct _GairqCoalescerStats GairqCoalescerStats;
+
+/* What one call came back with. It is freed once the batch is handed
+ * out, steal what is to be kept.
+ */
+struct _GairqCompletion
+{
+  GairqRequest *      request;
+  gpointer            tag;
+  JsonNode *          root;     /* From gairq_coalescer_call () */
+  GairqAirObject *    air;      /* From gairq_coalescer_poll () */
+  GairqResultFlags    flags;
+  GError *            error;    /* Set when neither is */
+};
+
+struct _GairqCoalescerStats
+{
+  guint     n_in_flight;    /* Calls not back yet */
+  guint     n_pending;      /* Back, waiting for the next batch */
+  guint64   n_completions;  /* Handed out */
+  guint64   n_batches;      /* Each one a single wakeup of the main loop */
+  guint     max_batch;
+};
+
+/* Collects finished calls and hands them out together through
+ * GairqCoalescer::completed, on the thread-default main context it was
+ * made on. A window of 0 sends them once per main loop iteration, more
+ * holds the batch back that many ms after the first one came in.
+ */
+GairqCoalescer *  gairq_coalescer_new           (GairqExecutor       *executor,
+                                                 guint                window_ms);
+GairqExecutor *   gairq_coalescer_get_executor  (GairqCoalescer      *self);
+void              gairq_coalescer_set_window    (GairqCoalescer      *self,
+                                                 guint                window_ms);
+guint             gairq_coalescer_get_window    (GairqCoalescer      *self);
+void              gairq_coalescer_call          (GairqCoalescer      *self,
+                                                 GairqRequest        *request,
+                                                 GCancellable        *cancellable,
+                                                 gpointer             tag);
+void              gairq_coalescer_poll          (GairqCoalescer      *self,
+                                                 GairqRequest        *request,
+                                                 GCancellable        *cancellable,
+                                                 gpointer             tag);
+void              gairq_coalescer_get_stats     (GairqCoalescer      *self,
+                                                 GairqCoalescerStats *stats);
+
+G_END_DECLS
+
+#endif
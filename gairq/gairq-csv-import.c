@@ -0,0 +1,755 @@
+/* gairq-csv-import.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-csv-import.h"
+#include "gairq-utils.h"
+
+#include <gio/gio.h>
+#include <math.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+# include <emmintrin.h>
+# define HAVE_SSE2_SCAN 1
+#endif
+
+/* The body of the file is cut into chunks ending right after a newline,
+ * one thread each, and a thread never looks past its own chunk. Within
+ * a chunk, delimiters are found 64 bytes at a time into a bit mask, so
+ * walking the fields is a count of trailing zeros apiece. Cells are
+ * parsed in place and every chunk appends its rows straight to a batch
+ * of its own, nothing is allocated per field or per row.
+ *
+ * The store wants rows in time order. Large files go in windows of
+ * WINDOW_DAYS days, so only one window of rows is held at a time.
+ */
+#define MIN_CHUNK_SIZE    (64 << 10)
+#define MAX_COLUMNS       64
+#define MAX_NUMBER_LEN    31
+#define MIN_ROW_LEN       6         /* "1/1/1\n" */
+#define WINDOW_DAYS       (1 << 16)
+#define DAY               86400
+
+typedef struct
+{
+  gint64    time;
+  guint     valid_mask;
+  gdouble   values [N_GAIRQ_POLLUTANTS];
+} Row;
+
+typedef struct
+{
+  guint     n_columns;
+  gint      date_column;
+  gint      pollutants [MAX_COLUMNS];   /* -1 for columns passed over */
+} Layout;
+
+typedef struct
+{
+  const Layout *  layout;
+  const gchar *   start;
+  const gchar *   end;
+  gint64          idx;
+  gint64          from;       /* Rows dated outside [from, to) are passed over */
+  gint64          to;
+  GairqAirBatch * batch;      /* NULL to only look at the dates */
+  guint64         n_rows;
+  guint64         n_invalid;
+  guint64         n_readings;
+  gint64          first;      /* Earliest and latest date taken */
+  gint64          last;
+} Chunk;
+
+typedef struct
+{
+  GMappedFile *   map;
+  const gchar *   body;
+  const gchar *   end;
+  Layout          layout;
+  guint           n_chunks;
+  Chunk *         chunks;
+  GThread **      threads;
+
+  /* Sums over the chunks of the last pass */
+  guint64         n_rows;
+  guint64         n_invalid;
+  guint64         n_readings;
+  gint64          first;
+  gint64          last;
+} Import;
+
+typedef struct
+{
+  const gchar *   block;
+  const gchar *   end;
+  guint64         mask;
+} Scanner;
+
+
+static inline guint
+count_trailing_zeros (guint64 mask)
+{
+#ifdef __GNUC__
+  return __builtin_ctzll (mask);
+#else
+  guint n = 0;
+
+  while (!(mask & 1))
+    {
+      mask >>= 1;
+      n++;
+    }
+
+  return n;
+#endif
+}
+
+/* Bit i set for a comma or a newline at @p [i] */
+static inline guint64
+delimiter_mask (const gchar *p,
+                gsize        len)
+{
+  guint64 mask = 0;
+  gsize i;
+
+#ifdef HAVE_SSE2_SCAN
+  if (len >= 64)
+    {
+      const __m128i comma = _mm_set1_epi8 (',');
+      const __m128i newline = _mm_set1_epi8 ('\n');
+
+      for (i = 0; i < 4; i++)
+        {
+          __m128i v = _mm_loadu_si128 ((const __m128i *) (p + i * 16));
+          guint bits = _mm_movemask_epi8 (_mm_or_si128 (_mm_cmpeq_epi8 (v, comma),
+                                                        _mm_cmpeq_epi8 (v, newline)));
+
+          mask |= (guint64) bits << (i * 16);
+        }
+
+      return mask;
+    }
+#endif
+
+  len = MIN (len, 64);
+  for (i = 0; i < len; i++)
+    if (p [i] == ',' || p [i] == '\n')
+      mask |= G_GUINT64_CONSTANT (1) << i;
+
+  return mask;
+}
+
+static void
+scanner_init (Scanner     *scanner,
+              const gchar *start,
+              const gchar *end)
+{
+  scanner->block = start;
+  scanner->end = end;
+  scanner->mask = delimiter_mask (start, end - start);
+}
+
+static inline const gchar *
+scanner_next (Scanner *scanner)
+{
+  const gchar *ret;
+
+  while (scanner->mask == 0)
+    {
+      scanner->block += 64;
+      if (scanner->block >= scanner->end)
+        return NULL;
+
+      scanner->mask = delimiter_mask (scanner->block, scanner->end - scanner->block);
+    }
+
+  ret = scanner->block + count_trailing_zeros (scanner->mask);
+  scanner->mask &= scanner->mask - 1;
+
+  return ret;
+}
+
+static inline void
+trim (const gchar **start,
+      const gchar **end)
+{
+  while (*start < *end && (**start == ' ' || **start == '\t' || **start == '"'))
+    (*start)++;
+  while (*end > *start && ((*end) [-1] == ' ' || (*end) [-1] == '\t' ||
+                           (*end) [-1] == '\r' || (*end) [-1] == '"'))
+    (*end)--;
+}
+
+static inline gboolean
+read_uint (const gchar **p,
+           const gchar  *end,
+           guint         max_digits,
+           gint64       *value)
+{
+  const gchar *start = *p;
+
+  *value = 0;
+  while (*p < end && g_ascii_isdigit (**p) && (guint) (*p - start) < max_digits)
+    {
+      *value = *value * 10 + (**p - '0');
+      (*p)++;
+    }
+
+  return *p > start;
+}
+
+/* "2019/11/20" or "2019-11-20", anything after a space or a 'T' is
+ * the time of day and dropped.
+ */
+static gboolean
+parse_date (const gchar *p,
+            const gchar *end,
+            gint64      *time)
+{
+  static const guint8 days_in_month [] = { 31, 29, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  gint64 y, m, d;
+
+  if (!read_uint (&p, end, 4, &y) || p >= end || (*p != '/' && *p != '-'))
+    return FALSE;
+  p++;
+  if (!read_uint (&p, end, 2, &m) || p >= end || (*p != '/' && *p != '-'))
+    return FALSE;
+  p++;
+  if (!read_uint (&p, end, 2, &d) || (p < end && *p != ' ' && *p != 'T'))
+    return FALSE;
+
+  if (m < 1 || m > 12 || d < 1 || d > days_in_month [m - 1] ||
+      (m == 2 && d == 29 && (y % 4 != 0 || (y % 100 == 0 && y % 400 != 0))))
+    return FALSE;
+
+  *time = gairq_days_from_civil (y, m, d) * DAY;
+
+  return TRUE;
+}
+
+/* Plain decimals are read exactly without a copy, anything fancier
+ * goes through g_ascii_strtod ().
+ */
+static gboolean
+parse_number (const gchar *p,
+              const gchar *end,
+              gdouble     *value)
+{
+  static const gdouble powers [] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+    1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18,
+  };
+  const gchar *start = p;
+  gchar buffer [MAX_NUMBER_LEN + 1];
+  gboolean negative = FALSE;
+  gint64 mantissa = 0;
+  guint n_digits = 0, n_decimals = 0;
+  gchar *endptr;
+
+  if (p < end && *p == '-')
+    {
+      negative = TRUE;
+      p++;
+    }
+
+  for ( ; p < end && g_ascii_isdigit (*p) && n_digits < 18; p++, n_digits++)
+    mantissa = mantissa * 10 + (*p - '0');
+
+  if (p < end && *p == '.')
+    for (p++; p < end && g_ascii_isdigit (*p) && n_digits < 18; p++, n_digits++, n_decimals++)
+      mantissa = mantissa * 10 + (*p - '0');
+
+  if (p == end && n_digits > 0)
+    {
+      *value = (negative ? -mantissa : mantissa) / powers [n_decimals];
+      return TRUE;
+    }
+
+  if (end - start == 0 || end - start > MAX_NUMBER_LEN)
+    return FALSE;
+
+  memcpy (buffer, start, end - start);
+  buffer [end - start] = '\0';
+  *value = g_ascii_strtod (buffer, &endptr);
+
+  return endptr == buffer + (end - start) && isfinite (*value);
+}
+
+static gboolean
+layout_parse (Layout       *layout,
+              const gchar  *start,
+              const gchar  *end,
+              GError      **error)
+{
+  const gchar *field = start;
+
+  layout->n_columns = 0;
+  layout->date_column = -1;
+
+  while (field <= end && layout->n_columns < MAX_COLUMNS)
+    {
+      const gchar *field_end = memchr (field, ',', end - field);
+      gchar name [MAX_NUMBER_LEN + 1];
+      GairqPollutant pollutant;
+      const gchar *a = field, *b;
+      guint column = layout->n_columns++;
+      guint i;
+
+      if (field_end == NULL)
+        field_end = end;
+      b = field_end;
+      trim (&a, &b);
+
+      layout->pollutants [column] = -1;
+      if (b - a <= MAX_NUMBER_LEN)
+        {
+          for (i = 0; a + i < b; i++)
+            name [i] = g_ascii_tolower (a [i]);
+          name [i] = '\0';
+
+          if (strcmp (name, "date") == 0)
+            layout->date_column = column;
+          else if (gairq_pollutant_from_string (name, &pollutant))
+            layout->pollutants [column] = pollutant;
+        }
+
+      field = field_end + 1;
+    }
+
+  if (layout->date_column < 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "No date column in the header");
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+static inline void
+row_reset (Row *row)
+{
+  row->time = G_MININT64;
+  row->valid_mask = 0;
+}
+
+/* The AQI of a row is its highest reading, or -1 without any */
+static inline void
+chunk_take_row (Chunk     *chunk,
+                const Row *row)
+{
+  gdouble aqi = -1;
+  guint p;
+
+  if (row->time < chunk->from || row->time >= chunk->to)
+    return;
+
+  chunk->n_rows++;
+  chunk->first = MIN (chunk->first, row->time);
+  chunk->last = MAX (chunk->last, row->time);
+
+  if (chunk->batch == NULL)
+    return;
+
+  for (p = 0; p < N_GAIRQ_POLLUTANTS; p++)
+    if (row->valid_mask & (1u << p))
+      {
+        aqi = MAX (aqi, row->values [p]);
+        chunk->n_readings++;
+      }
+
+  gairq_air_batch_append_row (chunk->batch, chunk->idx, aqi < 0 ? -1 : (gint64) round (aqi),
+                              row->time, NAN, NAN, row->values, row->valid_mask);
+}
+
+static gpointer
+chunk_parse (gpointer data)
+{
+  Chunk *chunk = data;
+  const Layout *layout = chunk->layout;
+  const gchar *field = chunk->start;
+  gboolean has_date = FALSE;
+  guint column = 0;
+  Scanner scanner;
+  Row row;
+
+  scanner_init (&scanner, chunk->start, chunk->end);
+  row_reset (&row);
+
+  for (;;)
+    {
+      const gchar *delim = scanner_next (&scanner);
+      const gchar *a = field, *b = delim ? delim : chunk->end;
+
+      if (delim == NULL && field == chunk->end && column == 0)
+        break;
+
+      trim (&a, &b);
+      if (column < layout->n_columns)
+        {
+          gint pollutant = layout->pollutants [column];
+
+          if ((gint) column == layout->date_column)
+            has_date = parse_date (a, b, &row.time);
+          else if (pollutant >= 0 && parse_number (a, b, &row.values [pollutant]))
+            row.valid_mask |= 1u << pollutant;
+        }
+
+      if (delim == NULL || *delim == '\n')
+        {
+          if (has_date)
+            chunk_take_row (chunk, &row);
+          else if (column > 0 || a < b)
+            chunk->n_invalid++;
+
+          row_reset (&row);
+          has_date = FALSE;
+          column = 0;
+
+          if (delim == NULL)
+            break;
+        }
+      else
+        {
+          column++;
+        }
+
+      field = delim + 1;
+    }
+
+  return NULL;
+}
+
+/* Maps @path, reads the header and cuts the body into chunks */
+static gboolean
+csv_import_open (Import               *import,
+                 const gchar          *path,
+                 gint64                idx,
+                 guint                 n_threads,
+                 GairqCsvImportStats  *stats,
+                 GError              **error)
+{
+  const gchar *data, *header_end;
+  guint i;
+
+  memset (import, 0, sizeof (Import));
+
+  import->map = g_mapped_file_new (path, FALSE, error);
+  if (import->map == NULL)
+    return FALSE;
+
+  /* Empty files map to NULL */
+  data = g_mapped_file_get_contents (import->map);
+  if (data == NULL)
+    data = "";
+  import->end = data + g_mapped_file_get_length (import->map);
+  stats->n_bytes = import->end - data;
+
+  if (import->end - data >= 3 && memcmp (data, "\xef\xbb\xbf", 3) == 0)
+    data += 3;
+
+  header_end = memchr (data, '\n', import->end - data);
+  if (header_end == NULL)
+    header_end = import->end;
+  import->body = MIN (header_end + 1, import->end);
+
+  if (!layout_parse (&import->layout, data, header_end, error))
+    {
+      g_clear_pointer (&import->map, g_mapped_file_unref);
+      return FALSE;
+    }
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  import->n_chunks = CLAMP ((import->end - import->body) / MIN_CHUNK_SIZE, 1, n_threads);
+  import->chunks = g_new0 (Chunk, import->n_chunks);
+  import->threads = g_new0 (GThread *, import->n_chunks);
+  stats->n_threads = import->n_chunks;
+
+  for (i = 0; i < import->n_chunks; i++)
+    {
+      Chunk *chunk = &import->chunks [i];
+      const gchar *start = i ? chunk [-1].end : import->body;
+      const gchar *nominal = import->body + (import->end - import->body) * (i + 1) / import->n_chunks;
+      const gchar *newline;
+
+      nominal = MAX (nominal, start);
+      newline = i + 1 < import->n_chunks ? memchr (nominal, '\n', import->end - nominal) : NULL;
+
+      chunk->layout = &import->layout;
+      chunk->idx = idx;
+      chunk->start = start;
+      chunk->end = newline ? newline + 1 : import->end;
+    }
+
+  return TRUE;
+}
+
+/* Parses every chunk for the rows dated in [@from, @to), chunk 0 on
+ * the calling thread.
+ */
+static void
+csv_import_run (Import *import,
+                gint64  from,
+                gint64  to)
+{
+  guint i;
+
+  for (i = 0; i < import->n_chunks; i++)
+    {
+      Chunk *chunk = &import->chunks [i];
+
+      chunk->from = from;
+      chunk->to = to;
+      chunk->n_rows = chunk->n_invalid = chunk->n_readings = 0;
+      chunk->first = G_MAXINT64;
+      chunk->last = G_MININT64;
+    }
+
+  for (i = 1; i < import->n_chunks; i++)
+    import->threads [i] = g_thread_new ("gairq-csv-import", chunk_parse, &import->chunks [i]);
+  chunk_parse (&import->chunks [0]);
+
+  import->n_rows = import->n_invalid = import->n_readings = 0;
+  import->first = G_MAXINT64;
+  import->last = G_MININT64;
+
+  for (i = 0; i < import->n_chunks; i++)
+    {
+      Chunk *chunk = &import->chunks [i];
+
+      if (i > 0)
+        g_thread_join (import->threads [i]);
+
+      import->n_rows += chunk->n_rows;
+      import->n_invalid += chunk->n_invalid;
+      import->n_readings += chunk->n_readings;
+      import->first = MIN (import->first, chunk->first);
+      import->last = MAX (import->last, chunk->last);
+    }
+}
+
+/* Moves the rows of the other chunks after those of chunk 0, which
+ * keeps them in file order.
+ */
+static void
+csv_import_merge (Import *import)
+{
+  guint i;
+
+  for (i = 1; i < import->n_chunks; i++)
+    {
+      gairq_air_batch_append_batch (import->chunks [0].batch, import->chunks [i].batch);
+      gairq_air_batch_clear (import->chunks [i].batch);
+    }
+}
+
+static void
+csv_import_clear (Import *import)
+{
+  guint i;
+
+  for (i = 0; i < import->n_chunks; i++)
+    g_clear_object (&import->chunks [i].batch);
+
+  g_clear_pointer (&import->chunks, g_free);
+  g_clear_pointer (&import->threads, g_free);
+  g_clear_pointer (&import->map, g_mapped_file_unref);
+}
+
+static gint
+compare_times (gconstpointer a,
+               gconstpointer b,
+               gpointer      user_data)
+{
+  const gint64 *time = user_data;
+  gint64 ta = time [*(const guint *) a], tb = time [*(const guint *) b];
+
+  return ta < tb ? -1 : ta > tb;
+}
+
+/* Appends the readings of @batch in time order, @order is scratch */
+static gboolean
+csv_import_store_batch (GairqSeriesStore     *store,
+                        gint64                idx,
+                        GairqAirBatch        *batch,
+                        GArray               *order,
+                        gint64               *latest,
+                        GairqCsvImportStats  *stats,
+                        GError              **error)
+{
+  const gint64 *time = gairq_air_batch_get_time (batch);
+  const gdouble *columns [N_GAIRQ_POLLUTANTS];
+  guint i, p;
+
+  for (p = 0; p < N_GAIRQ_POLLUTANTS; p++)
+    columns [p] = gairq_air_batch_get_column (batch, p);
+
+  g_array_set_size (order, gairq_air_batch_get_length (batch));
+  for (i = 0; i < order->len; i++)
+    g_array_index (order, guint, i) = i;
+  g_array_sort_with_data (order, compare_times, (gpointer) time);
+
+  for (i = 0; i < order->len; i++)
+    {
+      guint row = g_array_index (order, guint, i);
+
+      for (p = 0; p < N_GAIRQ_POLLUTANTS; p++)
+        {
+          if (!gairq_air_batch_is_valid (batch, p, row))
+            continue;
+
+          if (time [row] <= latest [p])
+            {
+              stats->n_skipped++;
+              continue;
+            }
+
+          if (!gairq_series_store_append (store, idx, p, time [row], columns [p][row], error))
+            return FALSE;
+
+          latest [p] = time [row];
+          stats->n_readings++;
+        }
+    }
+
+  return TRUE;
+}
+
+/* --- Public APIs --- */
+
+/* Appends one batch row a day in file order. The first chunk goes
+ * straight into @batch, the others are copied in after it column by
+ * column.
+ */
+gboolean
+gairq_csv_import_batch (const gchar          *path,
+                        gint64                idx,
+                        guint                 n_threads,
+                        GairqAirBatch        *batch,
+                        GairqCsvImportStats  *stats,
+                        GError              **error)
+{
+  GairqCsvImportStats local = { 0, };
+  Import import;
+  guint i;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (GAIRQ_IS_AIR_BATCH (batch), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!csv_import_open (&import, path, idx, n_threads, &local, error))
+    return FALSE;
+
+  import.chunks [0].batch = g_object_ref (batch);
+  for (i = 1; i < import.n_chunks; i++)
+    import.chunks [i].batch = gairq_air_batch_new ((import.chunks [i].end - import.chunks [i].start) / 32);
+
+  csv_import_run (&import, G_MININT64, G_MAXINT64);
+  csv_import_merge (&import);
+
+  local.n_rows = import.n_rows;
+  local.n_invalid = import.n_invalid;
+  local.n_readings = import.n_readings;
+
+  csv_import_clear (&import);
+
+  if (stats)
+    *stats = local;
+
+  return TRUE;
+}
+
+/* Rows are put in time order first, since exports need not be. Readings
+ * no newer than what the store already has for the series are skipped,
+ * so importing the same file twice is harmless.
+ *
+ * A file that may hold more than WINDOW_DAYS rows is first scanned for
+ * its range of dates, then parsed once a window. Each pass reads the
+ * whole file, but never holds more than a window of rows.
+ */
+gboolean
+gairq_csv_import_store (const gchar          *path,
+                        gint64                idx,
+                        guint                 n_threads,
+                        GairqSeriesStore     *store,
+                        GairqCsvImportStats  *stats,
+                        GError              **error)
+{
+  GairqCsvImportStats local = { 0, };
+  g_autoptr(GArray) order = NULL;
+  gint64 latest [N_GAIRQ_POLLUTANTS];
+  gint64 first = 0, n_windows = 1, w;
+  gboolean ret = TRUE;
+  Import import;
+  guint i, p;
+
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (store), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (!csv_import_open (&import, path, idx, n_threads, &local, error))
+    return FALSE;
+
+  if ((import.end - import.body) / MIN_ROW_LEN > WINDOW_DAYS)
+    {
+      csv_import_run (&import, G_MININT64, G_MAXINT64);
+      if (import.n_rows > 0)
+        {
+          first = import.first;
+          n_windows = (import.last - first) / ((gint64) WINDOW_DAYS * DAY) + 1;
+        }
+    }
+
+  for (i = 0; i < import.n_chunks; i++)
+    import.chunks [i].batch = gairq_air_batch_new (0);
+
+  for (p = 0; p < N_GAIRQ_POLLUTANTS; p++)
+    {
+      GairqSeriesSample sample;
+
+      latest [p] = gairq_series_store_get_latest (store, idx, p, &sample) ? sample.time : G_MININT64;
+    }
+
+  order = g_array_new (FALSE, FALSE, sizeof (guint));
+
+  for (w = 0; w < n_windows && ret; w++)
+    {
+      gint64 from = w == 0 ? G_MININT64 : first + w * WINDOW_DAYS * DAY;
+      gint64 to = w + 1 == n_windows ? G_MAXINT64 : first + (w + 1) * WINDOW_DAYS * DAY;
+
+      csv_import_run (&import, from, to);
+      csv_import_merge (&import);
+
+      /* Every pass comes across the same undated rows */
+      local.n_rows += import.n_rows;
+      local.n_invalid = import.n_invalid;
+
+      ret = csv_import_store_batch (store, idx, import.chunks [0].batch, order, latest, &local, error);
+      gairq_air_batch_clear (import.chunks [0].batch);
+    }
+
+  csv_import_clear (&import);
+
+  if (ret && stats)
+    *stats = local;
+
+  return ret;
+}
@@ -0,0 +1,72 @@
+/* gairq-csv-import.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_CSV_IMPORT_H
+#define GAIRQ_CSV_IMPORT_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+#include <gairq/gairq-air-batch.h>
+#include <gairq/gairq-series-store.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  guint64   n_bytes;
+  guint64   n_rows;       /* With a date, readings or not */
+  guint64   n_invalid;    /* Rows without a readable date */
+  guint64   n_readings;   /* Taken in */
+  guint64   n_skipped;    /* Readings the store had a newer one for */
+  guint     n_threads;
+} GairqCsvImportStats;
+
+/* Historical exports as aqicn.org publishes them for a station, a header
+ * of "date" and pollutant names then one day a row, e.g.
+ *
+ *   date, pm25, pm10, o3, no2, so2, co
+ *   2019/11/20, 57, 33, 11, 21, , 1
+ *
+ * Days are taken as UTC midnight, columns gairq does not know about
+ * and empty cells are passed over. The file is memory-mapped and parsed
+ * in chunks of at least 64 KiB on up to @n_threads threads, 0 for one
+ * per processor. Large files go into the store a window of days at a
+ * time rather than all at once.
+ */
+gboolean  gairq_csv_import_batch  (const gchar          *path,
+                                   gint64                idx,
+                                   guint                 n_threads,
+                                   GairqAirBatch        *batch,
+                                   GairqCsvImportStats  *stats,
+                                   GError              **error);
+gboolean  gairq_csv_import_store  (const gchar          *path,
+                                   gint64                idx,
+                                   guint                 n_threads,
+                                   GairqSeriesStore     *store,
+                                   GairqCsvImportStats  *stats,
+                                   GError              **error);
+
+G_END_DECLS
+
+#endif
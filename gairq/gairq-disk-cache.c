@@ -0,0 +1,693 @@
+/* gairq-disk-cache.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-disk-cache.h"
+#include "gairq-debug.h"
+#include "gairq-utils.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The file is a header followed by records, each one a RecordHeader, the
+ * key, the payload and padding up to eight bytes. A record only counts
+ * if its header checks out, so a write torn by a crash is cut off the
+ * next time the file is opened. Payloads are checked on first lookup.
+ */
+#define FILE_MAGIC          "GAIRQDC"
+#define FILE_VERSION        1
+#define FILE_HEADER_SIZE    16
+#define RECORD_MAGIC        0x52434447  /* "GDCR" */
+#define RECORD_SIZE(_key_len, _payload_len) \
+  ((sizeof (RecordHeader) + (gsize) (_key_len) + (_payload_len) + 7) & ~((gsize) 7))
+
+/* Past this much, the file is rewritten once most of it is dead records */
+#define COMPACT_MIN_SIZE    (1 << 20)
+
+typedef struct
+{
+  guint32   magic;
+  guint32   key_length;
+  guint32   payload_length;
+  guint32   reserved;
+  gint64    stored_at;
+  guint64   checksum;       /* Of the key and payload */
+  guint64   header_check;   /* Of the fields above */
+} RecordHeader;
+
+typedef struct
+{
+  gsize     offset;         /* Into the mapping, if it came from there */
+  gsize     size;
+  gint64    stored_at;
+  guint64   checksum;
+  guint32   key_length;
+  guint32   payload_length;
+  GBytes *  payload;        /* Only once checked, or if stored since */
+} Entry;
+
+struct _GairqDiskCache
+{
+  GObject       parent_instance;
+
+  gchar *       path;
+  gint          fd;
+
+  /* What the file held when opened, records stored since are in memory */
+  GMappedFile * map;
+  GBytes *      map_bytes;
+
+  GMutex        lock;
+  GHashTable *  index;
+  guint64       file_size;
+  guint64       live_size;
+};
+
+/* Properties */
+enum {
+  PROP_0,
+  PROP_PATH,
+  N_PROPERTIES
+};
+
+static GParamSpec*  properties [N_PROPERTIES];
+
+G_DEFINE_TYPE (GairqDiskCache, gairq_disk_cache, G_TYPE_OBJECT)
+
+
+static void
+entry_free (gpointer data)
+{
+  Entry *entry = data;
+
+  g_clear_pointer (&entry->payload, g_bytes_unref);
+  g_slice_free (Entry, entry);
+}
+
+/* --- GObject --- */
+static void
+gairq_disk_cache_close (GairqDiskCache *self)
+{
+  g_clear_pointer (&self->map_bytes, g_bytes_unref);
+  g_clear_pointer (&self->map, g_mapped_file_unref);
+
+  if (self->fd >= 0)
+    {
+      close (self->fd);
+      self->fd = -1;
+    }
+}
+
+static void
+gairq_disk_cache_finalize (GObject *object)
+{
+  GairqDiskCache *self = GAIRQ_DISK_CACHE (object);
+
+  gairq_disk_cache_close (self);
+  g_hash_table_destroy (self->index);
+  g_mutex_clear (&self->lock);
+  g_free (self->path);
+
+  G_OBJECT_CLASS (gairq_disk_cache_parent_class)->finalize (object);
+}
+
+static void
+gairq_disk_cache_set_property (GObject      *object,
+                               guint         prop_id,
+                               const GValue *value,
+                               GParamSpec   *pspec)
+{
+  GairqDiskCache *self = GAIRQ_DISK_CACHE (object);
+
+  switch (prop_id)
+    {
+    case PROP_PATH:
+      self->path = g_value_dup_string (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_disk_cache_get_property (GObject    *object,
+                               guint       prop_id,
+                               GValue     *value,
+                               GParamSpec *pspec)
+{
+  GairqDiskCache *self = GAIRQ_DISK_CACHE (object);
+
+  switch (prop_id)
+    {
+    case PROP_PATH:
+      g_value_set_string (value, self->path);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_disk_cache_class_init (GairqDiskCacheClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_disk_cache_finalize;
+  object_class->set_property = gairq_disk_cache_set_property;
+  object_class->get_property = gairq_disk_cache_get_property;
+
+  /**
+   * GairqDiskCache:path:
+   *
+   * The file the cache lives in, created if missing.
+   */
+  properties [PROP_PATH] =
+    g_param_spec_string ("path", "Path",
+                         "The cache file",
+                         NULL,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+static void
+gairq_disk_cache_init (GairqDiskCache *self)
+{
+  self->fd = -1;
+  self->map = NULL;
+  self->map_bytes = NULL;
+  self->index = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, entry_free);
+  self->file_size = 0;
+  self->live_size = 0;
+  g_mutex_init (&self->lock);
+}
+
+/* --- Private Methods --- */
+static gboolean
+write_all (gint           fd,
+           gconstpointer  data,
+           gsize          length,
+           GError       **error)
+{
+  const gchar *p = data;
+
+  while (length > 0)
+    {
+      gssize n = write (fd, p, length);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        {
+          gint saved_errno = errno;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Failed to write the cache: %s", g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      p += n;
+      length -= n;
+    }
+
+  return TRUE;
+}
+
+/* Lays a record out in one block so that it goes in with one write */
+static gpointer
+record_new (const gchar   *key,
+            gconstpointer  payload,
+            gsize          payload_length,
+            gint64         stored_at,
+            RecordHeader  *header)
+{
+  gsize key_length = strlen (key);
+  gchar *record;
+
+  header->magic = RECORD_MAGIC;
+  header->key_length = key_length;
+  header->payload_length = payload_length;
+  header->reserved = 0;
+  header->stored_at = stored_at;
+
+  record = g_malloc0 (RECORD_SIZE (key_length, payload_length));
+  memcpy (record + sizeof (RecordHeader), key, key_length);
+  memcpy (record + sizeof (RecordHeader) + key_length, payload, payload_length);
+
+  header->checksum = gairq_hash64 (record + sizeof (RecordHeader),
+                                   key_length + payload_length, 0);
+  header->header_check = gairq_hash64 (header, G_STRUCT_OFFSET (RecordHeader, header_check), 0);
+  memcpy (record, header, sizeof (RecordHeader));
+
+  return record;
+}
+
+/* Must be called with the lock held */
+static void
+gairq_disk_cache_insert_locked (GairqDiskCache *self,
+                                gchar          *key,
+                                Entry          *entry)
+{
+  Entry *old = g_hash_table_lookup (self->index, key);
+
+  if (old)
+    self->live_size -= old->size;
+  self->live_size += entry->size;
+
+  g_hash_table_replace (self->index, key, entry);
+}
+
+/* Must be called with the lock held. Only record headers are read, the
+ * payloads stay on disk until they are looked up.
+ */
+static gsize
+gairq_disk_cache_scan_locked (GairqDiskCache *self)
+{
+  const gchar *data = g_mapped_file_get_contents (self->map);
+  gsize size = g_mapped_file_get_length (self->map);
+  gsize pos = FILE_HEADER_SIZE;
+
+  while (size - pos >= sizeof (RecordHeader))
+    {
+      RecordHeader header;
+      Entry *entry;
+      gsize record_size;
+
+      memcpy (&header, data + pos, sizeof header);
+      if (header.magic != RECORD_MAGIC ||
+          header.header_check != gairq_hash64 (&header, G_STRUCT_OFFSET (RecordHeader, header_check), 0))
+        break;
+
+      record_size = RECORD_SIZE (header.key_length, header.payload_length);
+      if (record_size > size - pos)
+        break;
+
+      entry = g_slice_new0 (Entry);
+      entry->offset = pos;
+      entry->size = record_size;
+      entry->stored_at = header.stored_at;
+      entry->checksum = header.checksum;
+      entry->key_length = header.key_length;
+      entry->payload_length = header.payload_length;
+
+      gairq_disk_cache_insert_locked (self,
+                                      g_strndup (data + pos + sizeof (RecordHeader), header.key_length),
+                                      entry);
+
+      pos += record_size;
+    }
+
+  return pos;
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_disk_cache_open_locked (GairqDiskCache  *self,
+                              GError         **error)
+{
+  struct stat st;
+  gsize end;
+
+  self->fd = g_open (self->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (self->fd < 0 || fstat (self->fd, &st) < 0)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to open %s: %s", self->path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  g_hash_table_remove_all (self->index);
+  self->live_size = 0;
+
+  if (st.st_size == 0)
+    {
+      gchar header [FILE_HEADER_SIZE] = FILE_MAGIC;
+      guint32 version = FILE_VERSION;
+
+      memcpy (header + 8, &version, sizeof version);
+      if (!write_all (self->fd, header, sizeof header, error))
+        return FALSE;
+
+      self->file_size = FILE_HEADER_SIZE;
+      return TRUE;
+    }
+
+  self->map = g_mapped_file_new_from_fd (self->fd, FALSE, error);
+  if (self->map == NULL)
+    return FALSE;
+  self->map_bytes = g_mapped_file_get_bytes (self->map);
+
+  if (g_mapped_file_get_length (self->map) < FILE_HEADER_SIZE ||
+      memcmp (g_mapped_file_get_contents (self->map), FILE_MAGIC, sizeof FILE_MAGIC) != 0 ||
+      *(guint32 *) (g_mapped_file_get_contents (self->map) + 8) != FILE_VERSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s is not a response cache", self->path);
+      return FALSE;
+    }
+
+  end = gairq_disk_cache_scan_locked (self);
+  if (end < (gsize) st.st_size)
+    {
+      /* Whatever follows the last good record never made it in whole */
+      gairq_debug ("Dropping %" G_GSIZE_FORMAT " torn bytes off %s",
+                   (gsize) st.st_size - end, self->path);
+
+      if (ftruncate (self->fd, end) < 0)
+        {
+          gint saved_errno = errno;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Failed to truncate %s: %s", self->path, g_strerror (saved_errno));
+          return FALSE;
+        }
+    }
+
+  self->file_size = end;
+
+  return TRUE;
+}
+
+/* Must be called with the lock held. Hands out the payload, checking it
+ * against its checksum the first time; a bad one is forgotten.
+ */
+static GBytes *
+gairq_disk_cache_get_payload_locked (GairqDiskCache *self,
+                                     const gchar    *key,
+                                     Entry          *entry)
+{
+  const gchar *record;
+
+  if (entry->payload)
+    return g_bytes_ref (entry->payload);
+
+  record = g_mapped_file_get_contents (self->map) + entry->offset + sizeof (RecordHeader);
+  if (gairq_hash64 (record, entry->key_length + entry->payload_length, 0) != entry->checksum)
+    {
+      gairq_debug ("Corrupt record for %s in %s", key, self->path);
+
+      self->live_size -= entry->size;
+      g_hash_table_remove (self->index, key);
+
+      return NULL;
+    }
+
+  /* No copy, a view into the mapping */
+  entry->payload = g_bytes_new_from_bytes (self->map_bytes,
+                                           entry->offset + sizeof (RecordHeader) + entry->key_length,
+                                           entry->payload_length);
+
+  return g_bytes_ref (entry->payload);
+}
+
+/* Must be called with the lock held. Writes the live records to a new
+ * file which then takes the old one's place, so a crash halfway through
+ * leaves the old file as it was.
+ */
+static gboolean
+gairq_disk_cache_compact_locked (GairqDiskCache  *self,
+                                 GError         **error)
+{
+  gchar header [FILE_HEADER_SIZE] = FILE_MAGIC;
+  guint32 version = FILE_VERSION;
+  gchar *tmp_path;
+  GHashTableIter iter;
+  gpointer key, value;
+  gboolean ret = FALSE;
+  GList *keys, *l;
+  gint fd;
+
+  tmp_path = g_strconcat (self->path, ".tmp", NULL);
+  fd = g_open (tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to open %s: %s", tmp_path, g_strerror (saved_errno));
+      g_free (tmp_path);
+      return FALSE;
+    }
+
+  memcpy (header + 8, &version, sizeof version);
+  if (!write_all (fd, header, sizeof header, error))
+    goto out;
+
+  /* Corrupt records drop out of the index while being written */
+  keys = g_hash_table_get_keys (self->index);
+  for (l = keys; l; l = l->next)
+    {
+      Entry *entry = g_hash_table_lookup (self->index, l->data);
+      RecordHeader record_header;
+      GBytes *payload;
+      gpointer record;
+      gboolean written;
+
+      payload = gairq_disk_cache_get_payload_locked (self, l->data, entry);
+      if (payload == NULL)
+        continue;
+
+      record = record_new (l->data,
+                           g_bytes_get_data (payload, NULL), g_bytes_get_size (payload),
+                           entry->stored_at, &record_header);
+      written = write_all (fd, record,
+                           RECORD_SIZE (record_header.key_length, record_header.payload_length),
+                           error);
+
+      g_free (record);
+      g_bytes_unref (payload);
+
+      if (!written)
+        {
+          g_list_free (keys);
+          goto out;
+        }
+    }
+  g_list_free (keys);
+
+  if (fsync (fd) < 0 || g_rename (tmp_path, self->path) < 0)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to replace %s: %s", self->path, g_strerror (saved_errno));
+      goto out;
+    }
+
+  gairq_disk_cache_close (self);
+  ret = gairq_disk_cache_open_locked (self, error);
+
+  /* Every record was just checked on its way out */
+  if (ret)
+    {
+      g_hash_table_iter_init (&iter, self->index);
+      while (g_hash_table_iter_next (&iter, &key, &value))
+        ((Entry *) value)->payload =
+          g_bytes_new_from_bytes (self->map_bytes,
+                                  ((Entry *) value)->offset + sizeof (RecordHeader) +
+                                  ((Entry *) value)->key_length,
+                                  ((Entry *) value)->payload_length);
+    }
+
+out:
+  close (fd);
+  g_unlink (tmp_path);
+  g_free (tmp_path);
+
+  return ret;
+}
+
+/* --- Public APIs --- */
+GairqDiskCache *
+gairq_disk_cache_new (const gchar  *path,
+                      GError      **error)
+{
+  GairqDiskCache *self;
+  gboolean opened;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  self = g_object_new (GAIRQ_TYPE_DISK_CACHE, "path", path, NULL);
+
+  g_mutex_lock (&self->lock);
+  opened = gairq_disk_cache_open_locked (self, error);
+  g_mutex_unlock (&self->lock);
+
+  if (!opened)
+    g_clear_object (&self);
+
+  return self;
+}
+
+const gchar *
+gairq_disk_cache_get_path (GairqDiskCache *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_DISK_CACHE (self), NULL);
+
+  return self->path;
+}
+
+/* Appends @payload as the latest response for @key */
+gboolean
+gairq_disk_cache_store (GairqDiskCache  *self,
+                        const gchar     *key,
+                        GBytes          *payload,
+                        GError         **error)
+{
+  RecordHeader header;
+  gconstpointer data;
+  gpointer record;
+  gboolean ret;
+  Entry *entry;
+  gsize length;
+
+  g_return_val_if_fail (GAIRQ_IS_DISK_CACHE (self), FALSE);
+  g_return_val_if_fail (key != NULL, FALSE);
+  g_return_val_if_fail (payload != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  data = g_bytes_get_data (payload, &length);
+  record = record_new (key, data, length, g_get_real_time (), &header);
+
+  entry = g_slice_new0 (Entry);
+  entry->size = RECORD_SIZE (header.key_length, length);
+  entry->stored_at = header.stored_at;
+  entry->checksum = header.checksum;
+  entry->key_length = header.key_length;
+  entry->payload_length = length;
+
+  g_mutex_lock (&self->lock);
+
+  ret = self->fd >= 0 && write_all (self->fd, record, entry->size, error);
+  if (ret)
+    {
+      /* A copy, @payload may well hold on to a whole REST call */
+      entry->payload = g_bytes_new (data, length);
+      self->file_size += entry->size;
+      gairq_disk_cache_insert_locked (self, g_strdup (key), entry);
+
+      if (self->file_size > COMPACT_MIN_SIZE && self->live_size < self->file_size / 2)
+        {
+          GError *local_error = NULL;
+
+          if (!gairq_disk_cache_compact_locked (self, &local_error))
+            {
+              gairq_debug ("Failed to compact %s: %s", self->path, local_error->message);
+              g_clear_error (&local_error);
+            }
+        }
+    }
+  else
+    {
+      if (self->fd < 0)
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                     "%s is closed", self->path);
+      entry_free (entry);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  g_free (record);
+
+  return ret;
+}
+
+/* The latest payload stored for @key, and when in real time */
+GBytes *
+gairq_disk_cache_lookup (GairqDiskCache *self,
+                         const gchar    *key,
+                         gint64         *stored_at)
+{
+  GBytes *ret = NULL;
+  Entry *entry;
+
+  g_return_val_if_fail (GAIRQ_IS_DISK_CACHE (self), NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+
+  entry = g_hash_table_lookup (self->index, key);
+  if (entry)
+    {
+      if (stored_at)
+        *stored_at = entry->stored_at;
+      ret = gairq_disk_cache_get_payload_locked (self, key, entry);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Rewrites the file with the latest record of each key only */
+gboolean
+gairq_disk_cache_compact (GairqDiskCache  *self,
+                          GError         **error)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (GAIRQ_IS_DISK_CACHE (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  ret = gairq_disk_cache_compact_locked (self, error);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+guint
+gairq_disk_cache_get_n_entries (GairqDiskCache *self)
+{
+  guint ret;
+
+  g_return_val_if_fail (GAIRQ_IS_DISK_CACHE (self), 0);
+
+  g_mutex_lock (&self->lock);
+  ret = g_hash_table_size (self->index);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Bytes the file takes up, dead records included */
+guint64
+gairq_disk_cache_get_size (GairqDiskCache *self)
+{
+  guint64 ret;
+
+  g_return_val_if_fail (GAIRQ_IS_DISK_CACHE (self), 0);
+
+  g_mutex_lock (&self->lock);
+  ret = self->file_size;
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
@@ -0,0 +1,55 @@
+/* gairq-disk-cache.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_DISK_CACHE_H
+#define GAIRQ_DISK_CACHE_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_DISK_CACHE (gairq_disk_cache_get_type ())
+G_DECLARE_FINAL_TYPE (GairqDiskCache, gairq_disk_cache, GAIRQ, DISK_CACHE, GObject)
+
+/* Responses by endpoint key in an append-only file, the latest record of
+ * a key wins. Only one process may have a file open at a time.
+ */
+GairqDiskCache *  gairq_disk_cache_new            (const gchar     *path,
+                                                   GError         **error);
+const gchar *     gairq_disk_cache_get_path       (GairqDiskCache  *self);
+gboolean          gairq_disk_cache_store          (GairqDiskCache  *self,
+                                                   const gchar     *key,
+                                                   GBytes          *payload,
+                                                   GError         **error);
+GBytes *          gairq_disk_cache_lookup         (GairqDiskCache  *self,
+                                                   const gchar     *key,
+                                                   gint64          *stored_at);
+gboolean          gairq_disk_cache_compact        (GairqDiskCache  *self,
+                                                   GError         **error);
+guint             gairq_disk_cache_get_n_entries  (GairqDiskCache  *self);
+guint64           gairq_disk_cache_get_size       (GairqDiskCache  *self);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,753 @@
+/* gairq-executor.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-executor.h"
+
+#define DEFAULT_MAX_THREADS       16
+#define DEFAULT_IDLE_TIMEOUT_MS   10000
+#define DEFAULT_AGING_MS          500
+
+/* Queueing delays are summarized to within 1% */
+#define WAIT_ACCURACY             0.01
+
+typedef struct
+{
+  GairqExecutorFunc   func;
+  gpointer            data;
+  GDestroyNotify      notify;
+  GairqPriority       priority;
+  gint64              queued_at;
+} Job;
+
+/* What the workers share. It outlives the executor until the last
+ * worker is gone, so nobody has to wait for them on the way out.
+ */
+typedef struct
+{
+  GMutex              lock;
+  GCond               work_cond;      /* A job was queued, or it's over */
+  GCond               space_cond;     /* A job left the queue */
+  GQueue              queues [N_GAIRQ_PRIORITIES];
+
+  guint               min_threads;
+  guint               max_threads;
+  guint               max_queued;
+  gint64              idle_timeout;   /* In microseconds */
+  gint64              aging;          /* Likewise, 0 for none */
+
+  guint               n_idle;
+  gboolean            shutdown;
+
+  /* Start times summed over live workers and running jobs, so that the
+   * time they have been at it so far is one multiplication away
+   */
+  gint64              threads_since;
+  gint64              busy_since;
+
+  GairqExecutorStats  stats;
+  GairqSketch *       waits [N_GAIRQ_PRIORITIES];
+} Pool;
+
+typedef struct
+{
+  Pool *              pool;
+  gint64              started_at;
+} Worker;
+
+typedef struct
+{
+  GTask *             task;
+  GTaskThreadFunc     func;
+} TaskJob;
+
+struct _GairqExecutor
+{
+  GObject   parent_instance;
+
+  Pool *    pool;
+};
+
+/* Properties */
+enum {
+  PROP_0,
+  PROP_MIN_THREADS,
+  PROP_MAX_THREADS,
+  PROP_MAX_QUEUED,
+  PROP_IDLE_TIMEOUT,
+  PROP_AGING,
+  N_PROPERTIES
+};
+
+static GParamSpec*  properties [N_PROPERTIES];
+
+G_DEFINE_TYPE (GairqExecutor, gairq_executor, G_TYPE_OBJECT)
+
+
+static void
+pool_free (Pool *pool)
+{
+  guint i;
+
+  for (i = 0; i < N_GAIRQ_PRIORITIES; i++)
+    gairq_sketch_free (pool->waits [i]);
+
+  g_mutex_clear (&pool->lock);
+  g_cond_clear (&pool->work_cond);
+  g_cond_clear (&pool->space_cond);
+  g_slice_free (Pool, pool);
+}
+
+/* Must be called with the lock held. Each class is FIFO, so only the
+ * heads compete. Every class behind the first one pushes a job's turn
+ * back by the aging, which is how long it takes to catch up with them.
+ */
+static Job *
+pool_pop_locked (Pool *pool)
+{
+  GairqPriority priority, best = N_GAIRQ_PRIORITIES;
+  gint64 best_turn = G_MAXINT64;
+  gboolean aged = FALSE;
+  Job *job;
+
+  for (priority = 0; priority < N_GAIRQ_PRIORITIES; priority++)
+    {
+      gint64 turn;
+
+      job = g_queue_peek_head (&pool->queues [priority]);
+      if (job == NULL)
+        continue;
+
+      if (pool->aging == 0)
+        turn = priority;
+      else
+        turn = job->queued_at + priority * pool->aging;
+
+      if (turn < best_turn)
+        {
+          aged = best != N_GAIRQ_PRIORITIES;
+          best = priority;
+          best_turn = turn;
+        }
+    }
+
+  if (best == N_GAIRQ_PRIORITIES)
+    return NULL;
+
+  if (aged)
+    pool->stats.priorities [best].n_aged++;
+
+  return g_queue_pop_head (&pool->queues [best]);
+}
+
+static gpointer
+pool_worker (gpointer data)
+{
+  Worker *worker = data;
+  Pool *pool = worker->pool;
+  gboolean free_pool;
+  gint64 now;
+
+  g_mutex_lock (&pool->lock);
+
+  for (;;)
+    {
+      Job *job = pool_pop_locked (pool);
+      GairqPriorityStats *class_stats;
+      gint64 started_at, wait;
+
+      /* Queued jobs run before shutting down */
+      if (job == NULL)
+        {
+          gboolean timed_out = FALSE;
+
+          if (pool->shutdown)
+            break;
+
+          pool->n_idle++;
+          if (pool->stats.n_threads > pool->min_threads)
+            timed_out = !g_cond_wait_until (&pool->work_cond, &pool->lock,
+                                            g_get_monotonic_time () + pool->idle_timeout);
+          else
+            g_cond_wait (&pool->work_cond, &pool->lock);
+          pool->n_idle--;
+
+          /* A spare worker that had nothing to do for a while goes away */
+          if (timed_out && pool->stats.n_queued == 0 &&
+              pool->stats.n_threads > pool->min_threads)
+            break;
+
+          continue;
+        }
+
+      started_at = g_get_monotonic_time ();
+      wait = started_at - job->queued_at;
+      class_stats = &pool->stats.priorities [job->priority];
+
+      pool->stats.n_queued--;
+      pool->stats.n_busy++;
+      pool->stats.wait_time += wait;
+      class_stats->n_queued--;
+      class_stats->wait_time += wait;
+      class_stats->max_wait = MAX (class_stats->max_wait, wait);
+      gairq_sketch_add (pool->waits [job->priority], wait);
+      pool->busy_since += started_at;
+      g_cond_signal (&pool->space_cond);
+      g_mutex_unlock (&pool->lock);
+
+      job->func (job->data);
+      if (job->notify)
+        job->notify (job->data);
+      g_slice_free (Job, job);
+
+      now = g_get_monotonic_time ();
+      g_mutex_lock (&pool->lock);
+      pool->stats.n_busy--;
+      pool->stats.n_completed++;
+      class_stats->n_completed++;
+      pool->stats.busy_time += now - started_at;
+      pool->busy_since -= started_at;
+    }
+
+  now = g_get_monotonic_time ();
+  pool->stats.n_threads--;
+  pool->stats.thread_time += now - worker->started_at;
+  pool->threads_since -= worker->started_at;
+  free_pool = pool->shutdown && pool->stats.n_threads == 0;
+  g_mutex_unlock (&pool->lock);
+
+  if (free_pool)
+    pool_free (pool);
+  g_slice_free (Worker, worker);
+
+  return NULL;
+}
+
+/* Must be called with the lock held */
+static void
+pool_spawn_locked (Pool *pool)
+{
+  Worker *worker;
+
+  worker = g_slice_new (Worker);
+  worker->pool = pool;
+  worker->started_at = g_get_monotonic_time ();
+
+  pool->stats.n_threads++;
+  pool->threads_since += worker->started_at;
+
+  g_thread_unref (g_thread_new ("gairq-executor", pool_worker, worker));
+}
+
+static void
+task_job_run (gpointer data)
+{
+  TaskJob *job = data;
+
+  if (g_task_return_error_if_cancelled (job->task))
+    return;
+
+  job->func (job->task,
+             g_task_get_source_object (job->task),
+             g_task_get_task_data (job->task),
+             g_task_get_cancellable (job->task));
+}
+
+static void
+task_job_free (gpointer data)
+{
+  TaskJob *job = data;
+
+  g_object_unref (job->task);
+  g_slice_free (TaskJob, job);
+}
+
+/* --- GObject --- */
+static void
+gairq_executor_constructed (GObject *object)
+{
+  GairqExecutor *self = GAIRQ_EXECUTOR (object);
+  Pool *pool = self->pool;
+
+  G_OBJECT_CLASS (gairq_executor_parent_class)->constructed (object);
+
+  pool->min_threads = MIN (pool->min_threads, pool->max_threads);
+
+  g_mutex_lock (&pool->lock);
+  while (pool->stats.n_threads < pool->min_threads)
+    pool_spawn_locked (pool);
+  g_mutex_unlock (&pool->lock);
+}
+
+static void
+gairq_executor_finalize (GObject *object)
+{
+  GairqExecutor *self = GAIRQ_EXECUTOR (object);
+  Pool *pool = self->pool;
+  gboolean free_pool;
+
+  /* The workers let go of the pool themselves, the last one frees it */
+  g_mutex_lock (&pool->lock);
+  pool->shutdown = TRUE;
+  free_pool = pool->stats.n_threads == 0;
+  g_cond_broadcast (&pool->work_cond);
+  g_mutex_unlock (&pool->lock);
+
+  if (free_pool)
+    pool_free (pool);
+
+  G_OBJECT_CLASS (gairq_executor_parent_class)->finalize (object);
+}
+
+static void
+gairq_executor_set_property (GObject      *object,
+                             guint         prop_id,
+                             const GValue *value,
+                             GParamSpec   *pspec)
+{
+  GairqExecutor *self = GAIRQ_EXECUTOR (object);
+
+  switch (prop_id)
+    {
+    case PROP_MIN_THREADS:
+      self->pool->min_threads = g_value_get_uint (value);
+      break;
+
+    case PROP_MAX_THREADS:
+      self->pool->max_threads = g_value_get_uint (value);
+      break;
+
+    case PROP_MAX_QUEUED:
+      self->pool->max_queued = g_value_get_uint (value);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      gairq_executor_set_idle_timeout (self, g_value_get_uint (value));
+      break;
+
+    case PROP_AGING:
+      gairq_executor_set_aging (self, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_executor_get_property (GObject    *object,
+                             guint       prop_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+  GairqExecutor *self = GAIRQ_EXECUTOR (object);
+
+  switch (prop_id)
+    {
+    case PROP_MIN_THREADS:
+      g_value_set_uint (value, self->pool->min_threads);
+      break;
+
+    case PROP_MAX_THREADS:
+      g_value_set_uint (value, self->pool->max_threads);
+      break;
+
+    case PROP_MAX_QUEUED:
+      g_value_set_uint (value, self->pool->max_queued);
+      break;
+
+    case PROP_IDLE_TIMEOUT:
+      g_value_set_uint (value, gairq_executor_get_idle_timeout (self));
+      break;
+
+    case PROP_AGING:
+      g_value_set_uint (value, gairq_executor_get_aging (self));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_executor_class_init (GairqExecutorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gairq_executor_constructed;
+  object_class->finalize = gairq_executor_finalize;
+  object_class->set_property = gairq_executor_set_property;
+  object_class->get_property = gairq_executor_get_property;
+
+  /**
+   * GairqExecutor:min-threads:
+   *
+   * Workers started right away and kept around however idle.
+   */
+  properties [PROP_MIN_THREADS] =
+    g_param_spec_uint ("min-threads", "Min threads",
+                       "How many workers are always around",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  /**
+   * GairqExecutor:max-threads:
+   *
+   * The most workers running jobs at once.
+   */
+  properties [PROP_MAX_THREADS] =
+    g_param_spec_uint ("max-threads", "Max threads",
+                       "How many workers there may be at most",
+                       1, G_MAXUINT, DEFAULT_MAX_THREADS,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  /**
+   * GairqExecutor:max-queued:
+   *
+   * The most jobs waiting for a worker before more are turned away,
+   * 0 lets the queue grow without limit.
+   */
+  properties [PROP_MAX_QUEUED] =
+    g_param_spec_uint ("max-queued", "Max queued",
+                       "How many jobs may wait for a worker",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  /**
+   * GairqExecutor:idle-timeout:
+   *
+   * Milliseconds a worker past GairqExecutor:min-threads waits for a
+   * job before it exits.
+   */
+  properties [PROP_IDLE_TIMEOUT] =
+    g_param_spec_uint ("idle-timeout", "Idle timeout",
+                       "How long a spare worker waits for a job in ms",
+                       0, G_MAXUINT, DEFAULT_IDLE_TIMEOUT_MS,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqExecutor:aging:
+   *
+   * Milliseconds a queued job waits before it goes ahead of the next
+   * higher class, so that lower ones never starve. 0 keeps the classes
+   * strictly apart.
+   */
+  properties [PROP_AGING] =
+    g_param_spec_uint ("aging", "Aging",
+                       "How long a job waits to move up a class in ms",
+                       0, G_MAXUINT, DEFAULT_AGING_MS,
+                       G_PARAM_READWRITE);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+static void
+gairq_executor_init (GairqExecutor *self)
+{
+  Pool *pool;
+  guint i;
+
+  pool = self->pool = g_slice_new0 (Pool);
+  g_mutex_init (&pool->lock);
+  g_cond_init (&pool->work_cond);
+  g_cond_init (&pool->space_cond);
+  pool->max_threads = DEFAULT_MAX_THREADS;
+  pool->idle_timeout = DEFAULT_IDLE_TIMEOUT_MS * G_TIME_SPAN_MILLISECOND;
+  pool->aging = DEFAULT_AGING_MS * G_TIME_SPAN_MILLISECOND;
+
+  for (i = 0; i < N_GAIRQ_PRIORITIES; i++)
+    {
+      g_queue_init (&pool->queues [i]);
+      pool->waits [i] = gairq_sketch_new (WAIT_ACCURACY);
+    }
+}
+
+/* --- Public APIs --- */
+GairqExecutor *
+gairq_executor_new (guint min_threads,
+                    guint max_threads,
+                    guint max_queued)
+{
+  g_return_val_if_fail (max_threads > 0, NULL);
+  g_return_val_if_fail (min_threads <= max_threads, NULL);
+
+  return g_object_new (GAIRQ_TYPE_EXECUTOR,
+                       "min-threads", min_threads,
+                       "max-threads", max_threads,
+                       "max-queued", max_queued,
+                       NULL);
+}
+
+/* The one requests run on unless told otherwise, separate from GLib's
+ * own pool. It never goes away.
+ */
+GairqExecutor *
+gairq_executor_get_default (void)
+{
+  static GairqExecutor *executor = NULL;
+
+  if (g_once_init_enter (&executor))
+    g_once_init_leave (&executor,
+                       gairq_executor_new (0, MAX (DEFAULT_MAX_THREADS,
+                                                   g_get_num_processors ()), 0));
+
+  return executor;
+}
+
+/* Queues @func to run on a worker at @priority, @notify is called on
+ * @data after.
+ * With the queue full, it waits up to @timeout microseconds for room,
+ * a negative one waiting for good. Turned away, @data stays the
+ * caller's and G_IO_ERROR_BUSY is set.
+ */
+gboolean
+gairq_executor_push (GairqExecutor      *self,
+                     GairqPriority       priority,
+                     GairqExecutorFunc   func,
+                     gpointer            data,
+                     GDestroyNotify      notify,
+                     gint64              timeout,
+                     GError            **error)
+{
+  Pool *pool;
+  Job *job;
+  gint64 deadline;
+
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), FALSE);
+  g_return_val_if_fail (priority < N_GAIRQ_PRIORITIES, FALSE);
+  g_return_val_if_fail (func != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  pool = self->pool;
+  deadline = timeout > 0 ? g_get_monotonic_time () + timeout : 0;
+
+  g_mutex_lock (&pool->lock);
+
+  while (pool->max_queued > 0 && pool->stats.n_queued >= pool->max_queued)
+    {
+      if (timeout < 0)
+        g_cond_wait (&pool->space_cond, &pool->lock);
+      else if (timeout > 0 && g_get_monotonic_time () < deadline)
+        g_cond_wait_until (&pool->space_cond, &pool->lock, deadline);
+      else
+        {
+          pool->stats.n_rejected++;
+          g_mutex_unlock (&pool->lock);
+
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_BUSY,
+                       "Too many jobs queued (%u)", pool->max_queued);
+
+          return FALSE;
+        }
+    }
+
+  job = g_slice_new (Job);
+  job->func = func;
+  job->data = data;
+  job->notify = notify;
+  job->priority = priority;
+  job->queued_at = g_get_monotonic_time ();
+
+  g_queue_push_tail (&pool->queues [priority], job);
+  pool->stats.n_queued++;
+  pool->stats.priorities [priority].n_queued++;
+  pool->stats.n_submitted++;
+  pool->stats.max_queued = MAX (pool->stats.max_queued, pool->stats.n_queued);
+
+  /* Idle workers count down as they wake up, more jobs than that need
+   * another one if there is room for it
+   */
+  if (pool->stats.n_queued > pool->n_idle && pool->stats.n_threads < pool->max_threads)
+    pool_spawn_locked (pool);
+  g_cond_signal (&pool->work_cond);
+
+  g_mutex_unlock (&pool->lock);
+
+  return TRUE;
+}
+
+/* Like g_task_run_in_thread (), on one of our workers. It never waits,
+ * with the queue full @task returns G_IO_ERROR_BUSY instead and FALSE
+ * tells so.
+ */
+gboolean
+gairq_executor_run_in_thread (GairqExecutor   *self,
+                              GairqPriority    priority,
+                              GTask           *task,
+                              GTaskThreadFunc  task_func)
+{
+  GError *error = NULL;
+  TaskJob *job;
+
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), FALSE);
+  g_return_val_if_fail (G_IS_TASK (task), FALSE);
+  g_return_val_if_fail (task_func != NULL, FALSE);
+
+  job = g_slice_new (TaskJob);
+  job->task = g_object_ref (task);
+  job->func = task_func;
+
+  if (!gairq_executor_push (self, priority, task_job_run, job, task_job_free, 0, &error))
+    {
+      g_task_return_error (task, error);
+      task_job_free (job);
+
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+guint
+gairq_executor_get_min_threads (GairqExecutor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), 0);
+
+  return self->pool->min_threads;
+}
+
+guint
+gairq_executor_get_max_threads (GairqExecutor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), 0);
+
+  return self->pool->max_threads;
+}
+
+guint
+gairq_executor_get_max_queued (GairqExecutor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), 0);
+
+  return self->pool->max_queued;
+}
+
+void
+gairq_executor_set_idle_timeout (GairqExecutor *self,
+                                 guint          timeout_ms)
+{
+  gint64 timeout = (gint64) timeout_ms * G_TIME_SPAN_MILLISECOND;
+  gboolean changed;
+
+  g_return_if_fail (GAIRQ_IS_EXECUTOR (self));
+
+  g_mutex_lock (&self->pool->lock);
+  changed = self->pool->idle_timeout != timeout;
+  self->pool->idle_timeout = timeout;
+  g_mutex_unlock (&self->pool->lock);
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_IDLE_TIMEOUT]);
+}
+
+guint
+gairq_executor_get_idle_timeout (GairqExecutor *self)
+{
+  guint ret;
+
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), 0);
+
+  g_mutex_lock (&self->pool->lock);
+  ret = self->pool->idle_timeout / G_TIME_SPAN_MILLISECOND;
+  g_mutex_unlock (&self->pool->lock);
+
+  return ret;
+}
+
+void
+gairq_executor_set_aging (GairqExecutor *self,
+                          guint          aging_ms)
+{
+  gint64 aging = (gint64) aging_ms * G_TIME_SPAN_MILLISECOND;
+  gboolean changed;
+
+  g_return_if_fail (GAIRQ_IS_EXECUTOR (self));
+
+  g_mutex_lock (&self->pool->lock);
+  changed = self->pool->aging != aging;
+  self->pool->aging = aging;
+  g_mutex_unlock (&self->pool->lock);
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_AGING]);
+}
+
+guint
+gairq_executor_get_aging (GairqExecutor *self)
+{
+  guint ret;
+
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), 0);
+
+  g_mutex_lock (&self->pool->lock);
+  ret = self->pool->aging / G_TIME_SPAN_MILLISECOND;
+  g_mutex_unlock (&self->pool->lock);
+
+  return ret;
+}
+
+void
+gairq_executor_get_stats (GairqExecutor      *self,
+                          GairqExecutorStats *stats)
+{
+  Pool *pool;
+  gint64 now;
+
+  g_return_if_fail (GAIRQ_IS_EXECUTOR (self));
+  g_return_if_fail (stats != NULL);
+
+  pool = self->pool;
+  now = g_get_monotonic_time ();
+
+  g_mutex_lock (&pool->lock);
+  *stats = pool->stats;
+  stats->busy_time += now * pool->stats.n_busy - pool->busy_since;
+  stats->thread_time += now * pool->stats.n_threads - pool->threads_since;
+  g_mutex_unlock (&pool->lock);
+}
+
+/* How long jobs of @priority were queued before they started, in
+ * microseconds, for percentiles. Free it with gairq_sketch_free ().
+ */
+GairqSketch *
+gairq_executor_get_wait_sketch (GairqExecutor *self,
+                                GairqPriority  priority)
+{
+  GairqSketch *ret;
+
+  g_return_val_if_fail (GAIRQ_IS_EXECUTOR (self), NULL);
+  g_return_val_if_fail (priority < N_GAIRQ_PRIORITIES, NULL);
+
+  g_mutex_lock (&self->pool->lock);
+  ret = gairq_sketch_copy (self->pool->waits [priority]);
+  g_mutex_unlock (&self->pool->lock);
+
+  return ret;
+}
+
+gdouble
+gairq_executor_stats_get_utilization (const GairqExecutorStats *stats)
+{
+  g_return_val_if_fail (stats != NULL, 0.0);
+
+  if (stats->thread_time <= 0)
+    return 0.0;
+
+  return (gdouble) stats->busy_time / stats->thread_time;
+}
@@ -0,0 +1,121 @@
+/* gairq-executor.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_EXECUTOR_H
+#define GAIRQ_EXECUTOR_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <gio/gio.h>
+
+#include <gairq/gairq-sketch.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_EXECUTOR (gairq_executor_get_type ())
+G_DECLARE_FINAL_TYPE (GairqExecutor, gairq_executor, GAIRQ, EXECUTOR, GObject)
+
+typedef void (*GairqExecutorFunc) (gpointer data);
+
+/* INTERACTIVE is for someone waiting on the answer, BULK for background
+ * work over many stations nobody waits on in particular.
+ */
+typedef enum {
+  GAIRQ_PRIORITY_INTERACTIVE,
+  GAIRQ_PRIORITY_NORMAL,
+  GAIRQ_PRIORITY_BULK,
+  N_GAIRQ_PRIORITIES
+} GairqPriority;
+
+typedef struct _GairqPriorityStats GairqPriorityStats;
+typedef struct _GairqExecutorStats GairqExecutorStats;
+
+/* Times are in microseconds */
+struct _GairqPriorityStats
+{
+  guint     n_queued;       /* Jobs waiting for a worker */
+  guint64   n_completed;    /* Jobs that ran */
+  guint64   n_aged;         /* Of which went ahead of a higher class */
+  gint64    wait_time;      /* Spent queued, summed over started jobs */
+  gint64    max_wait;       /* The longest a started job was queued */
+};
+
+/* Times are in microseconds. Utilization is busy_time over thread_time,
+ * the share of worker time spent running jobs rather than waiting.
+ */
+struct _GairqExecutorStats
+{
+  guint     n_threads;      /* Workers alive */
+  guint     n_busy;         /* Of which are running a job */
+  guint     n_queued;       /* Jobs waiting for a worker */
+  guint     max_queued;     /* The most ever waiting at once */
+  guint64   n_submitted;    /* Jobs accepted */
+  guint64   n_completed;    /* Jobs that ran */
+  guint64   n_rejected;     /* Jobs turned away by a full queue */
+  gint64    wait_time;      /* Spent queued, summed over started jobs */
+  gint64    busy_time;      /* Spent running jobs, summed over workers */
+  gint64    thread_time;    /* Spent alive, summed over workers */
+
+  GairqPriorityStats  priorities [N_GAIRQ_PRIORITIES];
+};
+
+/* A worker pool of its own, between @min_threads and @max_threads wide.
+ * Past @max_queued jobs waiting, 0 for no limit, more are turned away
+ * with G_IO_ERROR_BUSY. Queued jobs still run once the last reference
+ * is gone, the workers exit after.
+ *
+ * Higher priorities go first, but a job waiting longer than the
+ * GairqExecutor:aging for each class it is behind goes ahead of them.
+ */
+GairqExecutor *  gairq_executor_new                   (guint min_threads,
+                                                       guint max_threads,
+                                                       guint max_queued);
+GairqExecutor *  gairq_executor_get_default           (void);
+gboolean         gairq_executor_push                  (GairqExecutor      *self,
+                                                       GairqPriority       priority,
+                                                       GairqExecutorFunc   func,
+                                                       gpointer            data,
+                                                       GDestroyNotify      notify,
+                                                       gint64              timeout,
+                                                       GError            **error);
+gboolean         gairq_executor_run_in_thread         (GairqExecutor   *self,
+                                                       GairqPriority    priority,
+                                                       GTask           *task,
+                                                       GTaskThreadFunc  task_func);
+guint            gairq_executor_get_min_threads       (GairqExecutor *self);
+guint            gairq_executor_get_max_threads       (GairqExecutor *self);
+guint            gairq_executor_get_max_queued        (GairqExecutor *self);
+void             gairq_executor_set_idle_timeout      (GairqExecutor *self,
+                                                       guint          timeout_ms);
+guint            gairq_executor_get_idle_timeout      (GairqExecutor *self);
+void             gairq_executor_set_aging             (GairqExecutor *self,
+                                                       guint          aging_ms);
+guint            gairq_executor_get_aging             (GairqExecutor *self);
+void             gairq_executor_get_stats             (GairqExecutor      *self,
+                                                       GairqExecutorStats *stats);
+GairqSketch *    gairq_executor_get_wait_sketch       (GairqExecutor *self,
+                                                       GairqPriority  priority);
+gdouble          gairq_executor_stats_get_utilization (const GairqExecutorStats *stats);
+
+G_END_DECLS
+
+#endif
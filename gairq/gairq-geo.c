@@ -20,6 +20,7 @@
 
 #include "gairq-debug.h"
 #include "gairq-geo.h"
+#include "gairq-request-priv.h"
 #include "gairq-utils.h"
 
 #include <json-glib/json-glib.h>
@@ -29,6 +30,8 @@ struct _GairqGeo
 {
   GairqRequest  parent_instance;
 
+  /* Calls read the position from other threads */
+  GMutex        lock;
   GairqGeoType  type;
   gchar *       lat;
   gchar *       lng;
@@ -65,6 +68,7 @@ gairq_geo_finalize (GObject *object)
 
   g_free (self->lat);
   g_free (self->lng);
+  g_mutex_clear (&self->lock);
 
   G_OBJECT_CLASS (gairq_geo_parent_class)->finalize (object);
 }
@@ -77,6 +81,8 @@ gairq_geo_set_property (GObject      *object,
 {
   GairqGeo *self = GAIRQ_GEO (object);
 
+  g_mutex_lock (&self->lock);
+
   switch (prop_id)
     {
     case PROP_TYPE:
@@ -94,8 +100,15 @@ gairq_geo_set_property (GObject      *object,
       break;
 
     default:
+      g_mutex_unlock (&self->lock);
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      return;
     }
+
+  g_mutex_unlock (&self->lock);
+
+  /* Whatever was cached belongs to the station asked for until now */
+  gairq_request_endpoint_changed (GAIRQ_REQUEST (self));
 }
 
 static void
@@ -106,6 +119,8 @@ gairq_geo_get_property (GObject    *object,
 {
   GairqGeo *self = GAIRQ_GEO (object);
 
+  g_mutex_lock (&self->lock);
+
   switch (prop_id)
     {
     case PROP_TYPE:
@@ -123,6 +138,8 @@ gairq_geo_get_property (GObject    *object,
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
+
+  g_mutex_unlock (&self->lock);
 }
 
 static gboolean
@@ -136,6 +153,8 @@ gairq_geo_request_set_functions (RestProxyCall  *proxy_call,
 
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  g_mutex_lock (&self->lock);
+
   switch (self->type)
     {
     case GAIRQ_GEO_TYPE_IP:
@@ -153,6 +172,8 @@ gairq_geo_request_set_functions (RestProxyCall  *proxy_call,
       ret = FALSE;
     }
 
+  g_mutex_unlock (&self->lock);
+
   if (ret)
     rest_proxy_call_set_function (proxy_call, functions);
 
@@ -208,6 +229,7 @@ gairq_geo_class_init (GairqGeoClass *klass)
 static void
 gairq_geo_init (GairqGeo *self)
 {
+  g_mutex_init (&self->lock);
   self->type = GAIRQ_GEO_TYPE_NONE;
   self->lat = NULL;
   self->lng = NULL;
@@ -272,19 +294,10 @@ GairqAirObject *
 gairq_geo_request_sync (GairqGeo  *self,
                         GError   **error)
 {
-  JsonNode *root = NULL;
-  gpointer ret = NULL;
-
   g_return_val_if_fail (GAIRQ_IS_GEO (self), NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  root = gairq_request_call_sync (GAIRQ_REQUEST (self), error);
-  if (root)
-    ret = gairq_request_default_deserialize (root, error);
-
-  json_node_unref (root);
-
-  return ret;
+  return gairq_request_fetch_sync (GAIRQ_REQUEST (self), error);
 }
 
 void
@@ -296,10 +309,10 @@ gairq_geo_request_async (GairqGeo            *self,
   g_return_if_fail (GAIRQ_IS_GEO (self));
   g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
 
-  gairq_request_call_async (GAIRQ_REQUEST (self),
-                            cancellable,
-                            callback,
-                            callback_data);
+  gairq_request_fetch_async (GAIRQ_REQUEST (self),
+                             cancellable,
+                             callback,
+                             callback_data);
 }
 
 GairqAirObject *
@@ -307,15 +320,9 @@ gairq_geo_request_finish (GairqGeo      *self,
                           GAsyncResult  *res,
                           GError       **error)
 {
-  JsonNode *root;
-
   g_return_val_if_fail (GAIRQ_IS_GEO (self), NULL);
   g_return_val_if_fail (g_task_is_valid (res, self), NULL);
   g_return_val_if_fail (error == NULL || *error == NULL, NULL);
 
-  root = g_task_propagate_pointer (G_TASK (res), error);
-  if (root)
-    return gairq_request_default_deserialize (root, error);
-
-  return NULL;
+  return gairq_request_fetch_finish (GAIRQ_REQUEST (self), res, error);
 }
@@ -0,0 +1,209 @@
+/* gairq-intern.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-intern.h"
+
+#include <string.h>
+
+/* The string is stored inline, right after its reference count */
+typedef struct
+{
+  guint   ref_count;
+  gsize   size;
+  gchar   str [];
+} InternEntry;
+
+static GMutex       pool_lock;
+static GHashTable * pool = NULL;
+static gint         n_alive = 0;
+static GairqInternStats pool_stats;
+
+
+/* Must be called with pool_lock held. Only an exact pointer, the one
+ * handed out by the pool, counts as interned; an equal string does not.
+ */
+static InternEntry *
+gairq_intern_lookup_locked (const gchar *str)
+{
+  InternEntry *entry;
+
+  if (pool == NULL)
+    return NULL;
+
+  entry = g_hash_table_lookup (pool, str);
+  if (entry == NULL || entry->str != str)
+    return NULL;
+
+  return entry;
+}
+
+static void
+gairq_intern_hit_locked (InternEntry *entry)
+{
+  entry->ref_count++;
+
+  pool_stats.n_requests++;
+  pool_stats.n_hits++;
+  pool_stats.bytes_saved += entry->size;
+}
+
+/* No string can be interned while the pool is empty, so callers freeing
+ * plain strings don't pay for the lock in that case.
+ */
+static gboolean
+gairq_intern_is_empty (void)
+{
+  return g_atomic_int_get (&n_alive) == 0;
+}
+
+/* Returns the pooled copy of @str, to be given back with
+ * gairq_intern_release ()
+ */
+const gchar *
+gairq_intern_string (const gchar *str)
+{
+  InternEntry *entry;
+
+  if (str == NULL)
+    return NULL;
+
+  g_mutex_lock (&pool_lock);
+
+  if (G_UNLIKELY (pool == NULL))
+    pool = g_hash_table_new (g_str_hash, g_str_equal);
+
+  entry = g_hash_table_lookup (pool, str);
+  if (entry)
+    gairq_intern_hit_locked (entry);
+  else
+    {
+      gsize size = strlen (str) + 1;
+
+      entry = g_malloc (sizeof (InternEntry) + size);
+      entry->ref_count = 1;
+      entry->size = size;
+      memcpy (entry->str, str, size);
+
+      g_hash_table_insert (pool, entry->str, entry);
+      g_atomic_int_inc (&n_alive);
+
+      pool_stats.n_requests++;
+      pool_stats.n_strings++;
+      pool_stats.bytes_used += size;
+    }
+
+  g_mutex_unlock (&pool_lock);
+
+  return entry->str;
+}
+
+/* Drops a reference on @str if it came from the pool. FALSE means it
+ * is a plain string the caller still has to free.
+ */
+gboolean
+gairq_intern_release (const gchar *str)
+{
+  InternEntry *entry;
+
+  if (str == NULL || gairq_intern_is_empty ())
+    return FALSE;
+
+  g_mutex_lock (&pool_lock);
+
+  entry = gairq_intern_lookup_locked (str);
+  if (entry)
+    {
+      if (--entry->ref_count == 0)
+        {
+          g_hash_table_remove (pool, entry->str);
+          g_atomic_int_add (&n_alive, -1);
+
+          pool_stats.n_strings--;
+          pool_stats.bytes_used -= entry->size;
+          g_free (entry);
+        }
+      else
+        pool_stats.bytes_saved -= entry->size;
+    }
+
+  g_mutex_unlock (&pool_lock);
+
+  return entry != NULL;
+}
+
+/* Takes one more reference on @str if it came from the pool, this is
+ * how copies share it instead of duplicating it.
+ */
+gboolean
+gairq_intern_ref (const gchar *str)
+{
+  InternEntry *entry;
+
+  if (str == NULL || gairq_intern_is_empty ())
+    return FALSE;
+
+  g_mutex_lock (&pool_lock);
+
+  entry = gairq_intern_lookup_locked (str);
+  if (entry)
+    gairq_intern_hit_locked (entry);
+
+  g_mutex_unlock (&pool_lock);
+
+  return entry != NULL;
+}
+
+gboolean
+gairq_intern_contains (const gchar *str)
+{
+  gboolean ret;
+
+  if (str == NULL || gairq_intern_is_empty ())
+    return FALSE;
+
+  g_mutex_lock (&pool_lock);
+  ret = gairq_intern_lookup_locked (str) != NULL;
+  g_mutex_unlock (&pool_lock);
+
+  return ret;
+}
+
+void
+gairq_intern_get_stats (GairqInternStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&pool_lock);
+  *stats = pool_stats;
+  g_mutex_unlock (&pool_lock);
+}
+
+/* The share of requests served by an already pooled string */
+gdouble
+gairq_intern_get_dedup_ratio (void)
+{
+  GairqInternStats stats;
+
+  gairq_intern_get_stats (&stats);
+  if (stats.n_requests == 0)
+    return 0;
+
+  return (gdouble) stats.n_hits / stats.n_requests;
+}
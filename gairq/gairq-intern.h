@@ -0,0 +1,52 @@
+/* gairq-intern.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_INTERN_H
+#define GAIRQ_INTERN_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GairqInternStats GairqInternStats;
+
+struct _GairqInternStats
+{
+  guint64   n_requests;   /* Strings asked for, copies included */
+  guint64   n_hits;       /* Of which were already in the pool */
+  guint     n_strings;    /* Unique strings alive */
+  gsize     bytes_used;   /* Held by the unique strings */
+  gsize     bytes_saved;  /* Held by duplicates if not interned */
+};
+
+const gchar * gairq_intern_string           (const gchar      *str);
+gboolean      gairq_intern_release          (const gchar      *str);
+gboolean      gairq_intern_ref              (const gchar      *str);
+gboolean      gairq_intern_contains         (const gchar      *str);
+void          gairq_intern_get_stats        (GairqInternStats *stats);
+gdouble       gairq_intern_get_dedup_ratio  (void);
+
+G_END_DECLS
+
+#endif
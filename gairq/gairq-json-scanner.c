@@ -0,0 +1,503 @@
+/* gairq-json-scanner.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-json-scanner.h"
+
+#include <string.h>
+
+/* Deeper documents than this are refused rather than recursed into */
+#define MAX_DEPTH       64
+/* Longest number literal accepted, sign and exponent included */
+#define MAX_NUMBER_LEN  63
+
+
+static gboolean
+gairq_json_scanner_fail (GairqJsonScanner *scanner)
+{
+  scanner->failed = TRUE;
+
+  return FALSE;
+}
+
+static void
+gairq_json_scanner_skip_whitespace (GairqJsonScanner *scanner)
+{
+  while (scanner->pos < scanner->end &&
+         (*scanner->pos == ' ' || *scanner->pos == '\t' ||
+          *scanner->pos == '\n' || *scanner->pos == '\r'))
+    scanner->pos++;
+}
+
+static gint
+hex_value (gchar ch)
+{
+  if (ch >= '0' && ch <= '9')
+    return ch - '0';
+  if (ch >= 'a' && ch <= 'f')
+    return ch - 'a' + 10;
+  if (ch >= 'A' && ch <= 'F')
+    return ch - 'A' + 10;
+
+  return -1;
+}
+
+/* Reads the 4 hex digits of a \u escape, @ptr points right after 'u' */
+static gboolean
+read_hex4 (const gchar *ptr,
+           const gchar *end,
+           gunichar    *value)
+{
+  gunichar ret = 0;
+  guint i;
+
+  if (end - ptr < 4)
+    return FALSE;
+
+  for (i = 0; i < 4; i++)
+    {
+      gint digit = hex_value (ptr [i]);
+
+      if (digit < 0)
+        return FALSE;
+      ret = (ret << 4) | digit;
+    }
+
+  *value = ret;
+
+  return TRUE;
+}
+
+/* Validates a number literal and copies it out, since the buffer may
+ * continue with characters strtod () would happily eat, e.g. "0x1".
+ */
+static gboolean
+gairq_json_scanner_scan_number (GairqJsonScanner *scanner,
+                                gchar             buffer [MAX_NUMBER_LEN + 1],
+                                gboolean         *is_integer)
+{
+  gchar *ptr = scanner->pos;
+  gboolean integer = TRUE;
+  gsize len;
+
+  if (ptr < scanner->end && *ptr == '-')
+    ptr++;
+  if (ptr >= scanner->end || !g_ascii_isdigit (*ptr))
+    return gairq_json_scanner_fail (scanner);
+  while (ptr < scanner->end && g_ascii_isdigit (*ptr))
+    ptr++;
+
+  if (ptr < scanner->end && *ptr == '.')
+    {
+      integer = FALSE;
+      ptr++;
+      if (ptr >= scanner->end || !g_ascii_isdigit (*ptr))
+        return gairq_json_scanner_fail (scanner);
+      while (ptr < scanner->end && g_ascii_isdigit (*ptr))
+        ptr++;
+    }
+
+  if (ptr < scanner->end && (*ptr == 'e' || *ptr == 'E'))
+    {
+      integer = FALSE;
+      ptr++;
+      if (ptr < scanner->end && (*ptr == '+' || *ptr == '-'))
+        ptr++;
+      if (ptr >= scanner->end || !g_ascii_isdigit (*ptr))
+        return gairq_json_scanner_fail (scanner);
+      while (ptr < scanner->end && g_ascii_isdigit (*ptr))
+        ptr++;
+    }
+
+  len = ptr - scanner->pos;
+  if (len > MAX_NUMBER_LEN)
+    return gairq_json_scanner_fail (scanner);
+
+  memcpy (buffer, scanner->pos, len);
+  buffer [len] = '\0';
+
+  scanner->pos = ptr;
+  *is_integer = integer;
+
+  return TRUE;
+}
+
+static gboolean
+gairq_json_scanner_expect_literal (GairqJsonScanner *scanner,
+                                   const gchar      *literal)
+{
+  gsize len = strlen (literal);
+
+  if ((gsize) (scanner->end - scanner->pos) < len ||
+      memcmp (scanner->pos, literal, len) != 0)
+    return gairq_json_scanner_fail (scanner);
+
+  scanner->pos += len;
+
+  return TRUE;
+}
+
+void
+gairq_json_scanner_init (GairqJsonScanner *scanner,
+                         gchar            *data,
+                         gsize             length)
+{
+  g_return_if_fail (scanner != NULL);
+  g_return_if_fail (data != NULL);
+
+  scanner->pos = data;
+  scanner->end = data + length;
+  scanner->depth = 0;
+  scanner->first = 0;
+  scanner->failed = FALSE;
+}
+
+GairqJsonType
+gairq_json_scanner_peek (GairqJsonScanner *scanner)
+{
+  if (scanner->failed)
+    return GAIRQ_JSON_INVALID;
+
+  gairq_json_scanner_skip_whitespace (scanner);
+  if (scanner->pos >= scanner->end)
+    return GAIRQ_JSON_INVALID;
+
+  switch (*scanner->pos)
+    {
+    case '{':
+      return GAIRQ_JSON_OBJECT;
+    case '[':
+      return GAIRQ_JSON_ARRAY;
+    case '"':
+      return GAIRQ_JSON_STRING;
+    case 't':
+    case 'f':
+      return GAIRQ_JSON_BOOLEAN;
+    case 'n':
+      return GAIRQ_JSON_NULL;
+    case '-':
+      return GAIRQ_JSON_NUMBER;
+    default:
+      if (g_ascii_isdigit (*scanner->pos))
+        return GAIRQ_JSON_NUMBER;
+    }
+
+  return GAIRQ_JSON_INVALID;
+}
+
+static gboolean
+gairq_json_scanner_begin (GairqJsonScanner *scanner,
+                          GairqJsonType     type)
+{
+  if (gairq_json_scanner_peek (scanner) != type ||
+      scanner->depth >= MAX_DEPTH)
+    return gairq_json_scanner_fail (scanner);
+
+  scanner->pos++;
+  scanner->first |= G_GUINT64_CONSTANT (1) << scanner->depth;
+  scanner->depth++;
+
+  return TRUE;
+}
+
+/* Returns TRUE if one more item follows, FALSE on the closing @close
+ * or on failure, which the caller tells apart with scanner->failed.
+ */
+static gboolean
+gairq_json_scanner_next (GairqJsonScanner *scanner,
+                         gchar             close)
+{
+  guint64 level;
+
+  if (scanner->failed)
+    return FALSE;
+
+  gairq_json_scanner_skip_whitespace (scanner);
+  if (scanner->pos >= scanner->end || scanner->depth == 0)
+    return gairq_json_scanner_fail (scanner);
+
+  if (*scanner->pos == close)
+    {
+      scanner->pos++;
+      scanner->depth--;
+      return FALSE;
+    }
+
+  /* No separator is expected before the first item */
+  level = G_GUINT64_CONSTANT (1) << (scanner->depth - 1);
+  if (scanner->first & level)
+    scanner->first &= ~level;
+  else if (*scanner->pos == ',')
+    scanner->pos++;
+  else
+    return gairq_json_scanner_fail (scanner);
+
+  return TRUE;
+}
+
+gboolean
+gairq_json_scanner_begin_object (GairqJsonScanner *scanner)
+{
+  return gairq_json_scanner_begin (scanner, GAIRQ_JSON_OBJECT);
+}
+
+static gboolean
+gairq_json_scanner_expect_colon (GairqJsonScanner *scanner)
+{
+  gairq_json_scanner_skip_whitespace (scanner);
+  if (scanner->pos >= scanner->end || *scanner->pos != ':')
+    return gairq_json_scanner_fail (scanner);
+  scanner->pos++;
+
+  return TRUE;
+}
+
+/* Validates a string and moves past it, leaving the buffer untouched */
+static gboolean
+gairq_json_scanner_pass_string (GairqJsonScanner *scanner)
+{
+  const gchar *ptr;
+  gunichar ch;
+
+  if (gairq_json_scanner_peek (scanner) != GAIRQ_JSON_STRING)
+    return gairq_json_scanner_fail (scanner);
+
+  for (ptr = scanner->pos + 1; ptr < scanner->end; )
+    {
+      if (*ptr == '"')
+        {
+          scanner->pos = (gchar *) ptr + 1;
+          return TRUE;
+        }
+
+      if ((guchar) *ptr < 0x20)
+        break;
+
+      if (*ptr++ != '\\')
+        continue;
+
+      if (ptr >= scanner->end)
+        break;
+
+      if (*ptr == 'u')
+        {
+          if (!read_hex4 (ptr + 1, scanner->end, &ch))
+            break;
+          ptr += 5;
+        }
+      else if (*ptr != '\0' && strchr ("\"\\/bfnrt", *ptr))
+        ptr++;
+      else
+        break;
+    }
+
+  return gairq_json_scanner_fail (scanner);
+}
+
+gboolean
+gairq_json_scanner_next_member (GairqJsonScanner  *scanner,
+                                gchar            **key)
+{
+  if (!gairq_json_scanner_next (scanner, '}'))
+    return FALSE;
+
+  if (!gairq_json_scanner_read_string (scanner, key))
+    return FALSE;
+
+  return gairq_json_scanner_expect_colon (scanner);
+}
+
+gboolean
+gairq_json_scanner_begin_array (GairqJsonScanner *scanner)
+{
+  return gairq_json_scanner_begin (scanner, GAIRQ_JSON_ARRAY);
+}
+
+gboolean
+gairq_json_scanner_next_element (GairqJsonScanner *scanner)
+{
+  return gairq_json_scanner_next (scanner, ']');
+}
+
+gboolean
+gairq_json_scanner_read_string (GairqJsonScanner  *scanner,
+                                gchar            **str)
+{
+  gchar *start, *src, *dest;
+
+  if (gairq_json_scanner_peek (scanner) != GAIRQ_JSON_STRING)
+    return gairq_json_scanner_fail (scanner);
+
+  start = src = dest = scanner->pos + 1;
+
+  /* Unescaping never grows a string, so @dest never overtakes @src */
+  while (src < scanner->end)
+    {
+      gunichar ch;
+
+      if (*src == '"')
+        {
+          *dest = '\0';
+          scanner->pos = src + 1;
+          *str = start;
+          return TRUE;
+        }
+
+      if ((guchar) *src < 0x20)
+        break;
+
+      if (*src != '\\')
+        {
+          *dest++ = *src++;
+          continue;
+        }
+
+      if (++src >= scanner->end)
+        break;
+
+      switch (*src++)
+        {
+        case '"':  *dest++ = '"';  break;
+        case '\\': *dest++ = '\\'; break;
+        case '/':  *dest++ = '/';  break;
+        case 'b':  *dest++ = '\b'; break;
+        case 'f':  *dest++ = '\f'; break;
+        case 'n':  *dest++ = '\n'; break;
+        case 'r':  *dest++ = '\r'; break;
+        case 't':  *dest++ = '\t'; break;
+
+        case 'u':
+          if (!read_hex4 (src, scanner->end, &ch))
+            return gairq_json_scanner_fail (scanner);
+          src += 4;
+
+          if (ch >= 0xd800 && ch <= 0xdbff)
+            {
+              gunichar low;
+
+              if (scanner->end - src >= 2 && src [0] == '\\' && src [1] == 'u' &&
+                  read_hex4 (src + 2, scanner->end, &low) &&
+                  low >= 0xdc00 && low <= 0xdfff)
+                {
+                  ch = 0x10000 + ((ch - 0xd800) << 10) + (low - 0xdc00);
+                  src += 6;
+                }
+              else
+                ch = 0xfffd;
+            }
+          else if ((ch >= 0xdc00 && ch <= 0xdfff) || ch == 0)
+            {
+              /* A lone low surrogate or an embedded NUL */
+              ch = 0xfffd;
+            }
+
+          dest += g_unichar_to_utf8 (ch, dest);
+          break;
+
+        default:
+          return gairq_json_scanner_fail (scanner);
+        }
+    }
+
+  return gairq_json_scanner_fail (scanner);
+}
+
+gboolean
+gairq_json_scanner_read_number (GairqJsonScanner *scanner,
+                                gdouble          *value,
+                                gboolean         *is_integer)
+{
+  gchar buffer [MAX_NUMBER_LEN + 1];
+  gboolean integer;
+
+  if (gairq_json_scanner_peek (scanner) != GAIRQ_JSON_NUMBER ||
+      !gairq_json_scanner_scan_number (scanner, buffer, &integer))
+    return gairq_json_scanner_fail (scanner);
+
+  if (value)
+    *value = g_ascii_strtod (buffer, NULL);
+  if (is_integer)
+    *is_integer = integer;
+
+  return TRUE;
+}
+
+gboolean
+gairq_json_scanner_read_int (GairqJsonScanner *scanner,
+                             gint64           *value)
+{
+  gchar buffer [MAX_NUMBER_LEN + 1];
+  gboolean integer;
+
+  if (gairq_json_scanner_peek (scanner) != GAIRQ_JSON_NUMBER ||
+      !gairq_json_scanner_scan_number (scanner, buffer, &integer) ||
+      !integer)
+    return gairq_json_scanner_fail (scanner);
+
+  *value = g_ascii_strtoll (buffer, NULL, 10);
+
+  return TRUE;
+}
+
+/* Unlike the readers, skipping never writes to the buffer, so a skipped
+ * value can still be read later on by another scanner.
+ */
+gboolean
+gairq_json_scanner_skip (GairqJsonScanner *scanner)
+{
+  switch (gairq_json_scanner_peek (scanner))
+    {
+    case GAIRQ_JSON_OBJECT:
+      if (!gairq_json_scanner_begin_object (scanner))
+        return FALSE;
+      while (gairq_json_scanner_next (scanner, '}'))
+        {
+          if (!gairq_json_scanner_pass_string (scanner) ||
+              !gairq_json_scanner_expect_colon (scanner) ||
+              !gairq_json_scanner_skip (scanner))
+            return FALSE;
+        }
+      break;
+
+    case GAIRQ_JSON_ARRAY:
+      if (!gairq_json_scanner_begin_array (scanner))
+        return FALSE;
+      while (gairq_json_scanner_next_element (scanner))
+        gairq_json_scanner_skip (scanner);
+      break;
+
+    case GAIRQ_JSON_STRING:
+      return gairq_json_scanner_pass_string (scanner);
+
+    case GAIRQ_JSON_NUMBER:
+      return gairq_json_scanner_read_number (scanner, NULL, NULL);
+
+    case GAIRQ_JSON_BOOLEAN:
+      return gairq_json_scanner_expect_literal (scanner,
+                                                *scanner->pos == 't' ? "true" : "false");
+
+    case GAIRQ_JSON_NULL:
+      return gairq_json_scanner_expect_literal (scanner, "null");
+
+    default:
+      return gairq_json_scanner_fail (scanner);
+    }
+
+  return !scanner->failed;
+}
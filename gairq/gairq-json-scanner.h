@@ -0,0 +1,75 @@
+/* gairq-json-scanner.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_JSON_SCANNER_H
+#define GAIRQ_JSON_SCANNER_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef enum {
+  GAIRQ_JSON_INVALID,
+  GAIRQ_JSON_OBJECT,
+  GAIRQ_JSON_ARRAY,
+  GAIRQ_JSON_STRING,
+  GAIRQ_JSON_NUMBER,
+  GAIRQ_JSON_BOOLEAN,
+  GAIRQ_JSON_NULL,
+} GairqJsonType;
+
+/* A pull scanner working in place over a NUL-terminated, writable buffer.
+ * Strings are unescaped and terminated where they are, so everything it
+ * hands out points into the buffer and lives as long as the buffer does.
+ */
+typedef struct
+{
+  gchar *   pos;
+  gchar *   end;
+  guint     depth;
+  guint64   first;    /* Bit n: level n has no item yet */
+  gboolean  failed;
+} GairqJsonScanner;
+
+void            gairq_json_scanner_init          (GairqJsonScanner  *scanner,
+                                                  gchar             *data,
+                                                  gsize              length);
+GairqJsonType   gairq_json_scanner_peek          (GairqJsonScanner  *scanner);
+gboolean        gairq_json_scanner_begin_object  (GairqJsonScanner  *scanner);
+gboolean        gairq_json_scanner_next_member   (GairqJsonScanner  *scanner,
+                                                  gchar            **key);
+gboolean        gairq_json_scanner_begin_array   (GairqJsonScanner  *scanner);
+gboolean        gairq_json_scanner_next_element  (GairqJsonScanner  *scanner);
+gboolean        gairq_json_scanner_read_string   (GairqJsonScanner  *scanner,
+                                                  gchar            **str);
+gboolean        gairq_json_scanner_read_number   (GairqJsonScanner  *scanner,
+                                                  gdouble           *value,
+                                                  gboolean          *is_integer);
+gboolean        gairq_json_scanner_read_int      (GairqJsonScanner  *scanner,
+                                                  gint64            *value);
+gboolean        gairq_json_scanner_skip          (GairqJsonScanner  *scanner);
+
+G_END_DECLS
+
+#endif
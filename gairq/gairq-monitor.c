@@ -0,0 +1,1034 @@
+/* gairq-monitor.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-monitor.h"
+#include "gairq-debug.h"
+
+#include <math.h>
+
+/* A station sits in the heap while waiting for its turn and is out of it
+ * while its fetch is in flight, it goes back in once that is done.
+ */
+typedef struct
+{
+  guint           id;
+  GairqRequest *  request;
+  GairqMonitor *  monitor;
+  gint64          interval;
+  gint64          due;
+  guint           heap_index;
+
+  gboolean        in_flight;
+  gboolean        removed;
+
+  gboolean        has_sample;
+  gint64          aqi;
+  gdouble         values [N_GAIRQ_POLLUTANTS];
+
+  /* What adaptive mode learnt, all in microseconds */
+  gint64          delay;
+  gint64          observed;
+  gint64          period;
+  gint64          lag;
+  guint           misses;
+
+  /* For the requests saved against polling every interval */
+  guint64         n_fetches;
+  gint64          active_since;
+  gint64          active_total;
+} Station;
+
+#define NOT_IN_HEAP G_MAXUINT
+
+typedef struct
+{
+  GHashTable *    stations;
+  GPtrArray *     heap;
+  guint           next_id;
+
+  GSource *       source;
+  GCancellable *  cancellable;
+  GRand *         rand;
+
+  gdouble         jitter;
+  guint           max_in_flight;
+  guint           n_in_flight;
+
+  gboolean        adaptive;
+  guint           max_backoff;
+  guint64         n_requests;
+  gint64          saved_removed;
+
+  GairqAggregator * aggregator;
+} GairqMonitorPrivate;
+
+/* Properties */
+enum {
+  PROP_0,
+  PROP_JITTER,
+  PROP_MAX_IN_FLIGHT,
+  PROP_ADAPTIVE,
+  PROP_MAX_BACKOFF,
+  PROP_AGGREGATOR,
+  N_PROPERTIES
+};
+
+static GParamSpec*  properties [N_PROPERTIES];
+
+/* Signals */
+enum {
+  CHANGED,
+  N_SIGNALS
+};
+
+static guint  signals [N_SIGNALS];
+
+G_DEFINE_TYPE_WITH_PRIVATE (GairqMonitor, gairq_monitor, G_TYPE_OBJECT)
+
+#define GET_PRIVATE(_obj) gairq_monitor_get_instance_private (GAIRQ_MONITOR (_obj))
+
+
+/* --- Station --- */
+static Station *
+station_new (GairqMonitor *monitor,
+             guint         id,
+             GairqRequest *request,
+             guint         interval_ms)
+{
+  Station *station;
+  guint i;
+
+  station = g_slice_new0 (Station);
+  station->id = id;
+  station->request = g_object_ref (request);
+  station->monitor = monitor;
+  station->interval = (gint64) interval_ms * G_TIME_SPAN_MILLISECOND;
+  station->heap_index = NOT_IN_HEAP;
+  station->aqi = -1;
+  station->delay = station->interval;
+  station->lag = G_MAXINT64 / 2;
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    station->values [i] = NAN;
+
+  return station;
+}
+
+static void
+station_free (Station *station)
+{
+  g_object_unref (station->request);
+  g_slice_free (Station, station);
+}
+
+static gboolean
+value_equal (gdouble a,
+             gdouble b)
+{
+  return a == b || (isnan (a) && isnan (b));
+}
+
+/* Takes the new sample in, TRUE if anything worth telling changed */
+static gboolean
+station_update (Station        *station,
+                GairqAirObject *air)
+{
+  GHashTable *iaqi = gairq_air_object_get_iaqi (air);
+  gboolean changed = !station->has_sample;
+  gint64 aqi;
+  guint i;
+
+  aqi = gairq_air_object_get_aqi (air);
+  if (aqi != station->aqi)
+    changed = TRUE;
+  station->aqi = aqi;
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      gdouble *value = NULL;
+      gdouble v;
+
+      if (iaqi)
+        value = g_hash_table_lookup (iaqi, gairq_pollutant_to_string (i));
+
+      v = value ? *value : NAN;
+      if (!value_equal (v, station->values [i]))
+        changed = TRUE;
+      station->values [i] = v;
+    }
+
+  station->has_sample = TRUE;
+
+  return changed;
+}
+
+static void
+station_deactivate (Station *station,
+                    gint64   now)
+{
+  if (station->active_since)
+    station->active_total += now - station->active_since;
+  station->active_since = 0;
+}
+
+/* Fetches the fixed interval would have made so far, less the actual ones */
+static gint64
+station_get_saved (Station *station,
+                   gint64   now)
+{
+  gint64 active = station->active_total;
+
+  if (station->active_since)
+    active += now - station->active_since;
+
+  return active / station->interval - (gint64) station->n_fetches;
+}
+
+/* Learns when the station publishes and returns when to ask it next. A
+ * new observation refines the period and the lag between the measurement
+ * time and when it is seen, the next poll goes right after the expected
+ * one. Nothing new backs off exponentially, so dormant stations cost
+ * less and less. Without timestamps a changed sample counts as new.
+ */
+static gint64
+station_adapt (Station        *station,
+               GairqAirObject *air,
+               gboolean        changed,
+               guint           max_backoff)
+{
+  gint64 now = g_get_real_time ();
+  gint64 observed = 0;
+  gint64 delay;
+  gboolean fresh;
+
+  if (air)
+    observed = gairq_air_object_get_time (air) * G_USEC_PER_SEC;
+
+  if (observed > 0)
+    fresh = observed > station->observed;
+  else
+    {
+      fresh = changed;
+      observed = now;
+    }
+
+  if (fresh)
+    {
+      if (station->observed > 0)
+        {
+          gint64 delta = observed - station->observed;
+
+          station->period = station->period ? (3 * station->period + delta) / 4 : delta;
+        }
+
+      /* Creeps up a little so that one lucky poll is not final */
+      station->lag = MIN (station->lag + G_USEC_PER_SEC, now - observed);
+      station->observed = observed;
+      station->misses = 0;
+
+      if (station->period > 0)
+        delay = observed + station->period + station->lag + station->period / 20 - now;
+      else
+        delay = station->interval;
+    }
+  else
+    {
+      delay = station->interval << MIN (station->misses, 20);
+      station->misses++;
+    }
+
+  /* Never more often than polling at the interval would */
+  delay = CLAMP (delay, station->interval, station->interval * max_backoff);
+  station->delay = delay;
+
+  return delay;
+}
+
+/* --- Heap, ordered by due time --- */
+static inline Station *
+heap_get (GPtrArray *heap,
+          guint      index)
+{
+  return g_ptr_array_index (heap, index);
+}
+
+static void
+heap_set (GPtrArray *heap,
+          guint      index,
+          Station   *station)
+{
+  heap->pdata [index] = station;
+  station->heap_index = index;
+}
+
+static void
+heap_sift_up (GPtrArray *heap,
+              guint      index)
+{
+  Station *station = heap_get (heap, index);
+
+  while (index > 0)
+    {
+      guint parent = (index - 1) / 2;
+
+      if (heap_get (heap, parent)->due <= station->due)
+        break;
+
+      heap_set (heap, index, heap_get (heap, parent));
+      index = parent;
+    }
+
+  heap_set (heap, index, station);
+}
+
+static void
+heap_sift_down (GPtrArray *heap,
+                guint      index)
+{
+  Station *station = heap_get (heap, index);
+
+  for (;;)
+    {
+      guint child = 2 * index + 1;
+
+      if (child >= heap->len)
+        break;
+      if (child + 1 < heap->len &&
+          heap_get (heap, child + 1)->due < heap_get (heap, child)->due)
+        child++;
+      if (station->due <= heap_get (heap, child)->due)
+        break;
+
+      heap_set (heap, index, heap_get (heap, child));
+      index = child;
+    }
+
+  heap_set (heap, index, station);
+}
+
+static void
+heap_push (GPtrArray *heap,
+           Station   *station)
+{
+  g_ptr_array_add (heap, station);
+  heap_set (heap, heap->len - 1, station);
+  heap_sift_up (heap, heap->len - 1);
+}
+
+static void
+heap_remove (GPtrArray *heap,
+             Station   *station)
+{
+  guint index = station->heap_index;
+  Station *last;
+
+  last = g_ptr_array_remove_index (heap, heap->len - 1);
+  station->heap_index = NOT_IN_HEAP;
+
+  if (last == station)
+    return;
+
+  heap_set (heap, index, last);
+  heap_sift_up (heap, index);
+  heap_sift_down (heap, last->heap_index);
+}
+
+/* --- Scheduling --- */
+static void
+gairq_monitor_rearm (GairqMonitor *self)
+{
+  GairqMonitorPrivate *priv = GET_PRIVATE (self);
+
+  if (priv->source == NULL)
+    return;
+
+  /* A completion rearms it once there is room again */
+  if (priv->heap->len == 0 || priv->n_in_flight >= priv->max_in_flight)
+    g_source_set_ready_time (priv->source, -1);
+  else
+    g_source_set_ready_time (priv->source, heap_get (priv->heap, 0)->due);
+}
+
+/* Spreads the stations over ±jitter of their interval so ones added at
+ * the same time do not keep hitting the server at the same time. Learnt
+ * delays are only ever pushed a bit later, they are right after an update.
+ */
+static void
+gairq_monitor_schedule (GairqMonitor *self,
+                        Station      *station,
+                        gint64        now,
+                        gboolean      first)
+{
+  GairqMonitorPrivate *priv = GET_PRIVATE (self);
+  gdouble factor;
+
+  if (first)
+    factor = g_rand_double (priv->rand);
+  else if (priv->adaptive)
+    factor = 1.0 + priv->jitter * g_rand_double (priv->rand) / 10;
+  else
+    factor = 1.0 + priv->jitter * g_rand_double_range (priv->rand, -1.0, 1.0);
+
+  station->due = now + (gint64) ((first || !priv->adaptive ? station->interval : station->delay) * factor);
+  heap_push (priv->heap, station);
+}
+
+static void
+gairq_monitor_fetch_cb (GObject      *source_object,
+                        GAsyncResult *res,
+                        gpointer      user_data)
+{
+  Station *station = user_data;
+  GairqMonitor *self = station->monitor;
+  GairqMonitorPrivate *priv = GET_PRIVATE (self);
+  GairqResultFlags flags = GAIRQ_RESULT_FLAGS_NONE;
+  GError *error = NULL;
+  GairqAirObject *air;
+  gboolean changed, cancelled;
+
+  air = GAIRQ_MONITOR_GET_CLASS (self)->fetch_finish (self, station->request, res,
+                                                      &flags, &error);
+  cancelled = g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+
+  /* A fetch cut short by gairq_monitor_stop () tells nothing about the
+   * station, it must not count as a miss and back it off.
+   */
+  changed = air && !(flags & GAIRQ_RESULT_FLAGS_UNCHANGED) && station_update (station, air);
+  if (priv->adaptive && !station->removed && !cancelled)
+    station_adapt (station, air, changed, priv->max_backoff);
+
+  /* Before the signal, so handlers see the aggregates with it */
+  if (air && priv->aggregator && !station->removed)
+    gairq_aggregator_push (priv->aggregator, air);
+
+  /* Still in flight for handlers removing it, it is freed below then */
+  if (changed && !station->removed)
+    g_signal_emit (self, signals [CHANGED], 0, station->request, air);
+
+  if (error && !cancelled)
+    gairq_debug ("Station %u: %s", station->id, error->message);
+
+  priv->n_in_flight--;
+  station->in_flight = FALSE;
+
+  if (station->removed)
+    station_free (station);
+  else if (priv->source)
+    gairq_monitor_schedule (self, station, g_get_monotonic_time (), FALSE);
+
+  gairq_monitor_rearm (self);
+
+  g_clear_object (&air);
+  g_clear_error (&error);
+  g_object_unref (self);
+}
+
+static gboolean
+gairq_monitor_dispatch (GSource     *source,
+                        GSourceFunc  callback,
+                        gpointer     user_data)
+{
+  GairqMonitor *self = user_data;
+  GairqMonitorPrivate *priv = GET_PRIVATE (self);
+  gint64 now = g_get_monotonic_time ();
+
+  while (priv->heap->len > 0 &&
+         priv->n_in_flight < priv->max_in_flight &&
+         heap_get (priv->heap, 0)->due <= now)
+    {
+      Station *station = heap_get (priv->heap, 0);
+
+      heap_remove (priv->heap, station);
+      station->in_flight = TRUE;
+      station->n_fetches++;
+      priv->n_in_flight++;
+      priv->n_requests++;
+
+      /* Dropped by the completion */
+      g_object_ref (self);
+      GAIRQ_MONITOR_GET_CLASS (self)->fetch_async (self, station->request,
+                                                   priv->cancellable,
+                                                   gairq_monitor_fetch_cb,
+                                                   station);
+    }
+
+  gairq_monitor_rearm (self);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static GSourceFuncs monitor_source_funcs = {
+  NULL,
+  NULL,
+  gairq_monitor_dispatch,
+  NULL,
+};
+
+/* --- GairqMonitorClass --- */
+static void
+gairq_monitor_real_fetch_async (GairqMonitor        *self,
+                                GairqRequest        *request,
+                                GCancellable        *cancellable,
+                                GAsyncReadyCallback  callback,
+                                gpointer             user_data)
+{
+  gairq_request_poll_async (request, cancellable, callback, user_data);
+}
+
+static GairqAirObject *
+gairq_monitor_real_fetch_finish (GairqMonitor      *self,
+                                 GairqRequest      *request,
+                                 GAsyncResult      *res,
+                                 GairqResultFlags  *result_flags,
+                                 GError           **error)
+{
+  return gairq_request_poll_finish (request, res, result_flags, error);
+}
+
+/* --- GObject --- */
+static void
+gairq_monitor_dispose (GObject *object)
+{
+  GairqMonitorPrivate *priv = GET_PRIVATE (object);
+  GHashTableIter iter;
+  gpointer value;
+
+  gairq_monitor_stop (GAIRQ_MONITOR (object));
+
+  g_hash_table_iter_init (&iter, priv->stations);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Station *station = value;
+
+      if (station->in_flight)
+        station->removed = TRUE;
+      else
+        station_free (station);
+      g_hash_table_iter_remove (&iter);
+    }
+
+  g_clear_object (&priv->aggregator);
+
+  G_OBJECT_CLASS (gairq_monitor_parent_class)->dispose (object);
+}
+
+static void
+gairq_monitor_finalize (GObject *object)
+{
+  GairqMonitorPrivate *priv = GET_PRIVATE (object);
+
+  g_hash_table_unref (priv->stations);
+  g_ptr_array_unref (priv->heap);
+  g_rand_free (priv->rand);
+
+  G_OBJECT_CLASS (gairq_monitor_parent_class)->finalize (object);
+}
+
+static void
+gairq_monitor_set_property (GObject      *object,
+                            guint         prop_id,
+                            const GValue *value,
+                            GParamSpec   *pspec)
+{
+  GairqMonitor *self = GAIRQ_MONITOR (object);
+
+  switch (prop_id)
+    {
+    case PROP_JITTER:
+      gairq_monitor_set_jitter (self, g_value_get_double (value));
+      break;
+
+    case PROP_MAX_IN_FLIGHT:
+      gairq_monitor_set_max_in_flight (self, g_value_get_uint (value));
+      break;
+
+    case PROP_ADAPTIVE:
+      gairq_monitor_set_adaptive (self, g_value_get_boolean (value));
+      break;
+
+    case PROP_MAX_BACKOFF:
+      gairq_monitor_set_max_backoff (self, g_value_get_uint (value));
+      break;
+
+    case PROP_AGGREGATOR:
+      gairq_monitor_set_aggregator (self, g_value_get_object (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_monitor_get_property (GObject    *object,
+                            guint       prop_id,
+                            GValue     *value,
+                            GParamSpec *pspec)
+{
+  GairqMonitorPrivate *priv = GET_PRIVATE (object);
+
+  switch (prop_id)
+    {
+    case PROP_JITTER:
+      g_value_set_double (value, priv->jitter);
+      break;
+
+    case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint (value, priv->max_in_flight);
+      break;
+
+    case PROP_ADAPTIVE:
+      g_value_set_boolean (value, priv->adaptive);
+      break;
+
+    case PROP_MAX_BACKOFF:
+      g_value_set_uint (value, priv->max_backoff);
+      break;
+
+    case PROP_AGGREGATOR:
+      g_value_set_object (value, priv->aggregator);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_monitor_class_init (GairqMonitorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->dispose = gairq_monitor_dispose;
+  object_class->finalize = gairq_monitor_finalize;
+  object_class->set_property = gairq_monitor_set_property;
+  object_class->get_property = gairq_monitor_get_property;
+
+  klass->fetch_async = gairq_monitor_real_fetch_async;
+  klass->fetch_finish = gairq_monitor_real_fetch_finish;
+
+  /**
+   * GairqMonitor:jitter:
+   *
+   * Fraction of a station's interval its refreshes are spread over.
+   */
+  properties [PROP_JITTER] =
+    g_param_spec_double ("jitter", "Jitter",
+                         "Random spread of the refresh intervals",
+                         0.0, 1.0, 0.1,
+                         G_PARAM_READWRITE);
+
+  /**
+   * GairqMonitor:max-in-flight:
+   *
+   * Fetches allowed at the same time, the rest wait for their turn.
+   */
+  properties [PROP_MAX_IN_FLIGHT] =
+    g_param_spec_uint ("max-in-flight", "Max in flight",
+                       "Maximum number of fetches at the same time",
+                       1, G_MAXUINT, 64,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqMonitor:adaptive:
+   *
+   * Whether each station's interval follows its learnt update period
+   * instead, never going below the interval it was added with.
+   */
+  properties [PROP_ADAPTIVE] =
+    g_param_spec_boolean ("adaptive", "Adaptive",
+                          "Learn when stations update and poll accordingly",
+                          FALSE,
+                          G_PARAM_READWRITE);
+
+  /**
+   * GairqMonitor:max-backoff:
+   *
+   * How many times its interval a station not updating is left alone
+   * for at most, in adaptive mode.
+   */
+  properties [PROP_MAX_BACKOFF] =
+    g_param_spec_uint ("max-backoff", "Max backoff",
+                       "Longest delay as a multiple of the interval",
+                       1, 1 << 20, 16,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqMonitor:aggregator:
+   *
+   * Fed every reading fetched, changed or not, for NowCast and rolling
+   * means of each station.
+   */
+  properties [PROP_AGGREGATOR] =
+    g_param_spec_object ("aggregator", "Aggregator",
+                         "A GairqAggregator readings are pushed to",
+                         GAIRQ_TYPE_AGGREGATOR,
+                         G_PARAM_READWRITE);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+
+  /**
+   * GairqMonitor::changed:
+   * @request: the station's #GairqRequest
+   * @air: the new #GairqAirObject
+   *
+   * Emitted when the AQI or a pollutant value of a station changed,
+   * and for its very first sample.
+   */
+  signals [CHANGED] =
+    g_signal_new ("changed",
+                  G_TYPE_FROM_CLASS (klass),
+                  G_SIGNAL_RUN_LAST,
+                  G_STRUCT_OFFSET (GairqMonitorClass, changed),
+                  NULL, NULL, NULL,
+                  G_TYPE_NONE, 2,
+                  GAIRQ_TYPE_REQUEST,
+                  GAIRQ_TYPE_AIR_OBJECT);
+}
+
+static void
+gairq_monitor_init (GairqMonitor *self)
+{
+  GairqMonitorPrivate *priv = GET_PRIVATE (self);
+
+  priv->stations = g_hash_table_new (NULL, NULL);
+  priv->heap = g_ptr_array_new ();
+  priv->next_id = 1;
+  priv->source = NULL;
+  priv->cancellable = NULL;
+  priv->rand = g_rand_new ();
+  priv->jitter = 0.1;
+  priv->max_in_flight = 64;
+  priv->n_in_flight = 0;
+  priv->adaptive = FALSE;
+  priv->max_backoff = 16;
+  priv->n_requests = 0;
+  priv->saved_removed = 0;
+  priv->aggregator = NULL;
+}
+
+/* --- Public APIs --- */
+GairqMonitor *
+gairq_monitor_new (void)
+{
+  return g_object_new (GAIRQ_TYPE_MONITOR, NULL);
+}
+
+guint
+gairq_monitor_add (GairqMonitor *self,
+                   GairqRequest *request,
+                   guint         interval_ms)
+{
+  GairqMonitorPrivate *priv;
+  Station *station;
+
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (request), 0);
+  g_return_val_if_fail (interval_ms > 0, 0);
+
+  priv = GET_PRIVATE (self);
+
+  station = station_new (self, priv->next_id++, request, interval_ms);
+  g_hash_table_insert (priv->stations, GUINT_TO_POINTER (station->id), station);
+
+  if (priv->source)
+    {
+      station->active_since = g_get_monotonic_time ();
+      gairq_monitor_schedule (self, station, station->active_since, TRUE);
+      gairq_monitor_rearm (self);
+    }
+
+  return station->id;
+}
+
+gboolean
+gairq_monitor_remove (GairqMonitor *self,
+                      guint         station_id)
+{
+  GairqMonitorPrivate *priv;
+  Station *station;
+
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), FALSE);
+
+  priv = GET_PRIVATE (self);
+
+  station = g_hash_table_lookup (priv->stations, GUINT_TO_POINTER (station_id));
+  if (station == NULL)
+    return FALSE;
+
+  g_hash_table_remove (priv->stations, GUINT_TO_POINTER (station_id));
+  priv->saved_removed += station_get_saved (station, g_get_monotonic_time ());
+
+  if (station->heap_index != NOT_IN_HEAP)
+    heap_remove (priv->heap, station);
+
+  /* The completion frees it then */
+  if (station->in_flight)
+    station->removed = TRUE;
+  else
+    station_free (station);
+
+  gairq_monitor_rearm (self);
+
+  return TRUE;
+}
+
+guint
+gairq_monitor_get_n_stations (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+
+  return g_hash_table_size (GET_PRIVATE (self)->stations);
+}
+
+guint
+gairq_monitor_get_n_in_flight (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+
+  return GET_PRIVATE (self)->n_in_flight;
+}
+
+/* Runs on the thread-default main context of the caller */
+void
+gairq_monitor_start (GairqMonitor *self)
+{
+  GairqMonitorPrivate *priv;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now;
+
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+
+  priv = GET_PRIVATE (self);
+  if (priv->source)
+    return;
+
+  priv->cancellable = g_cancellable_new ();
+
+  priv->source = g_source_new (&monitor_source_funcs, sizeof (GSource));
+  g_source_set_callback (priv->source, NULL, self, NULL);
+  g_source_set_name (priv->source, "GairqMonitor");
+  g_source_attach (priv->source, g_main_context_get_thread_default ());
+
+  now = g_get_monotonic_time ();
+
+  g_hash_table_iter_init (&iter, priv->stations);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Station *station = value;
+
+      station->active_since = now;
+      if (!station->in_flight && station->heap_index == NOT_IN_HEAP)
+        gairq_monitor_schedule (self, station, now, TRUE);
+    }
+
+  gairq_monitor_rearm (self);
+}
+
+void
+gairq_monitor_stop (GairqMonitor *self)
+{
+  GairqMonitorPrivate *priv;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now;
+
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+
+  priv = GET_PRIVATE (self);
+  if (priv->source == NULL)
+    return;
+
+  g_source_destroy (priv->source);
+  g_clear_pointer (&priv->source, g_source_unref);
+
+  /* In-flight fetches still complete, just cancelled */
+  g_cancellable_cancel (priv->cancellable);
+  g_clear_object (&priv->cancellable);
+
+  while (priv->heap->len > 0)
+    heap_remove (priv->heap, heap_get (priv->heap, 0));
+
+  now = g_get_monotonic_time ();
+  g_hash_table_iter_init (&iter, priv->stations);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    station_deactivate (value, now);
+}
+
+gboolean
+gairq_monitor_is_running (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), FALSE);
+
+  return GET_PRIVATE (self)->source != NULL;
+}
+
+void
+gairq_monitor_set_jitter (GairqMonitor *self,
+                          gdouble       jitter)
+{
+  GairqMonitorPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+  g_return_if_fail (jitter >= 0.0 && jitter <= 1.0);
+
+  priv = GET_PRIVATE (self);
+  if (priv->jitter == jitter)
+    return;
+
+  priv->jitter = jitter;
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_JITTER]);
+}
+
+gdouble
+gairq_monitor_get_jitter (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0.0);
+
+  return GET_PRIVATE (self)->jitter;
+}
+
+void
+gairq_monitor_set_max_in_flight (GairqMonitor *self,
+                                 guint         max_in_flight)
+{
+  GairqMonitorPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+  g_return_if_fail (max_in_flight > 0);
+
+  priv = GET_PRIVATE (self);
+  if (priv->max_in_flight == max_in_flight)
+    return;
+
+  priv->max_in_flight = max_in_flight;
+  gairq_monitor_rearm (self);
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_MAX_IN_FLIGHT]);
+}
+
+guint
+gairq_monitor_get_max_in_flight (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+
+  return GET_PRIVATE (self)->max_in_flight;
+}
+
+void
+gairq_monitor_set_adaptive (GairqMonitor *self,
+                            gboolean      adaptive)
+{
+  GairqMonitorPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+
+  priv = GET_PRIVATE (self);
+  adaptive = !!adaptive;
+  if (priv->adaptive == adaptive)
+    return;
+
+  priv->adaptive = adaptive;
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_ADAPTIVE]);
+}
+
+gboolean
+gairq_monitor_get_adaptive (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), FALSE);
+
+  return GET_PRIVATE (self)->adaptive;
+}
+
+void
+gairq_monitor_set_max_backoff (GairqMonitor *self,
+                               guint         max_backoff)
+{
+  GairqMonitorPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+  g_return_if_fail (max_backoff > 0);
+
+  priv = GET_PRIVATE (self);
+  if (priv->max_backoff == max_backoff)
+    return;
+
+  priv->max_backoff = max_backoff;
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_MAX_BACKOFF]);
+}
+
+guint
+gairq_monitor_get_max_backoff (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+
+  return GET_PRIVATE (self)->max_backoff;
+}
+
+void
+gairq_monitor_set_aggregator (GairqMonitor    *self,
+                              GairqAggregator *aggregator)
+{
+  g_return_if_fail (GAIRQ_IS_MONITOR (self));
+  g_return_if_fail (aggregator == NULL || GAIRQ_IS_AGGREGATOR (aggregator));
+
+  if (g_set_object (&GET_PRIVATE (self)->aggregator, aggregator))
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_AGGREGATOR]);
+}
+
+GairqAggregator *
+gairq_monitor_get_aggregator (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), NULL);
+
+  return GET_PRIVATE (self)->aggregator;
+}
+
+guint64
+gairq_monitor_get_n_requests (GairqMonitor *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+
+  return GET_PRIVATE (self)->n_requests;
+}
+
+/* Against polling every station at its interval the whole time it was
+ * monitored, removed stations included. Negative if more were made.
+ */
+gint64
+gairq_monitor_get_n_requests_saved (GairqMonitor *self)
+{
+  GairqMonitorPrivate *priv;
+  GHashTableIter iter;
+  gpointer value;
+  gint64 now, saved;
+
+  g_return_val_if_fail (GAIRQ_IS_MONITOR (self), 0);
+
+  priv = GET_PRIVATE (self);
+  now = g_get_monotonic_time ();
+  saved = priv->saved_removed;
+
+  g_hash_table_iter_init (&iter, priv->stations);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    saved += station_get_saved (value, now);
+
+  return saved;
+}
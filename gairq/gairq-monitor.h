@@ -0,0 +1,98 @@
+/* gairq-monitor.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_MONITOR_H
+#define GAIRQ_MONITOR_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+#include <gio/gio.h>
+
+#include <gairq/gairq-aggregator.h>
+#include <gairq/gairq-air-object.h>
+#include <gairq/gairq-request.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_MONITOR (gairq_monitor_get_type ())
+G_DECLARE_DERIVABLE_TYPE (GairqMonitor, gairq_monitor, GAIRQ, MONITOR, GObject)
+
+struct _GairqMonitorClass
+{
+  GObjectClass      parent_class;
+
+  /* Default to gairq_request_poll_async () and _finish () */
+  void              (*fetch_async)  (GairqMonitor         *self,
+                                     GairqRequest         *request,
+                                     GCancellable         *cancellable,
+                                     GAsyncReadyCallback   callback,
+                                     gpointer              user_data);
+  GairqAirObject *  (*fetch_finish) (GairqMonitor         *self,
+                                     GairqRequest         *request,
+                                     GAsyncResult         *res,
+                                     GairqResultFlags     *result_flags,
+                                     GError              **error);
+
+  /* Signals */
+  void              (*changed)      (GairqMonitor         *self,
+                                     GairqRequest         *request,
+                                     GairqAirObject       *air);
+
+  gpointer          _reserved1;
+  gpointer          _reserved2;
+  gpointer          _reserved3;
+  gpointer          _reserved4;
+};
+
+GairqMonitor *    gairq_monitor_new                  (void);
+guint             gairq_monitor_add                  (GairqMonitor *self,
+                                                      GairqRequest *request,
+                                                      guint         interval_ms);
+gboolean          gairq_monitor_remove               (GairqMonitor *self,
+                                                      guint         station_id);
+guint             gairq_monitor_get_n_stations       (GairqMonitor *self);
+guint             gairq_monitor_get_n_in_flight      (GairqMonitor *self);
+void              gairq_monitor_start                (GairqMonitor *self);
+void              gairq_monitor_stop                 (GairqMonitor *self);
+gboolean          gairq_monitor_is_running           (GairqMonitor *self);
+void              gairq_monitor_set_jitter           (GairqMonitor *self,
+                                                      gdouble       jitter);
+gdouble           gairq_monitor_get_jitter           (GairqMonitor *self);
+void              gairq_monitor_set_max_in_flight    (GairqMonitor *self,
+                                                      guint         max_in_flight);
+guint             gairq_monitor_get_max_in_flight    (GairqMonitor *self);
+void              gairq_monitor_set_adaptive         (GairqMonitor *self,
+                                                      gboolean      adaptive);
+gboolean          gairq_monitor_get_adaptive         (GairqMonitor *self);
+void              gairq_monitor_set_max_backoff      (GairqMonitor *self,
+                                                      guint         max_backoff);
+guint             gairq_monitor_get_max_backoff      (GairqMonitor *self);
+void              gairq_monitor_set_aggregator       (GairqMonitor    *self,
+                                                      GairqAggregator *aggregator);
+GairqAggregator * gairq_monitor_get_aggregator       (GairqMonitor    *self);
+guint64           gairq_monitor_get_n_requests       (GairqMonitor *self);
+gint64            gairq_monitor_get_n_requests_saved (GairqMonitor *self);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,535 @@
+/* gairq-ndjson.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-ndjson.h"
+#include "gairq-request.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <json-glib/json-glib.h>
+
+/* Lines are written out once this much is buffered */
+#define BUFFER_SIZE       (64 * 1024)
+#define MIN_CHUNK_SIZE    (1 << 20)
+
+struct _GairqNdjsonWriter
+{
+  GObject           parent_instance;
+
+  GMutex            lock;
+  GOutputStream *   stream;
+  GString *         buffer;
+  GairqNdjsonStats  stats;
+};
+
+typedef struct
+{
+  const gchar *         start;
+  const gchar *         end;
+  GairqAirObjectFlags   flags;
+  GPtrArray *           objects;
+  guint64               n_lines;
+  guint64               n_invalid;
+} Chunk;
+
+G_DEFINE_TYPE (GairqNdjsonWriter, gairq_ndjson_writer, G_TYPE_OBJECT)
+
+
+/* --- Emitter --- */
+static void
+append_int64 (GString *out,
+              gint64   value)
+{
+  gchar digits [24];
+  gchar *p = digits + sizeof digits;
+  guint64 magnitude = value < 0 ? -(guint64) value : (guint64) value;
+
+  do
+    {
+      *--p = '0' + magnitude % 10;
+      magnitude /= 10;
+    }
+  while (magnitude);
+
+  if (value < 0)
+    *--p = '-';
+
+  g_string_append_len (out, p, digits + sizeof digits - p);
+}
+
+/* The shortest of %.15g and %.17g that reads back the same */
+static void
+append_double (GString *out,
+               gdouble  value)
+{
+  gchar buf [G_ASCII_DTOSTR_BUF_SIZE];
+
+  if (!isfinite (value))
+    {
+      g_string_append_len (out, "null", 4);
+      return;
+    }
+
+  if (value == floor (value) && fabs (value) < 1e15)
+    {
+      append_int64 (out, (gint64) value);
+      return;
+    }
+
+  g_ascii_formatd (buf, sizeof buf, "%.15g", value);
+  if (g_ascii_strtod (buf, NULL) != value)
+    g_ascii_formatd (buf, sizeof buf, "%.17g", value);
+
+  g_string_append (out, buf);
+}
+
+static void
+append_string (GString     *out,
+               const gchar *str)
+{
+  const gchar *run, *p;
+
+  if (str == NULL)
+    {
+      g_string_append_len (out, "null", 4);
+      return;
+    }
+
+  g_string_append_c (out, '"');
+
+  /* Copy runs that need no escaping in one go */
+  for (run = p = str; *p; p++)
+    {
+      guchar c = *p;
+
+      if (c >= 0x20 && c != '"' && c != '\\')
+        continue;
+
+      g_string_append_len (out, run, p - run);
+      switch (c)
+        {
+        case '"':
+          g_string_append_len (out, "\\\"", 2);
+          break;
+
+        case '\\':
+          g_string_append_len (out, "\\\\", 2);
+          break;
+
+        case '\n':
+          g_string_append_len (out, "\\n", 2);
+          break;
+
+        case '\r':
+          g_string_append_len (out, "\\r", 2);
+          break;
+
+        case '\t':
+          g_string_append_len (out, "\\t", 2);
+          break;
+
+        default:
+          g_string_append_printf (out, "\\u%04x", c);
+          break;
+        }
+      run = p + 1;
+    }
+
+  g_string_append_len (out, run, p - run);
+  g_string_append_c (out, '"');
+}
+
+static gint
+compare_keys (gconstpointer a,
+              gconstpointer b)
+{
+  return strcmp (*(const gchar * const *) a, *(const gchar * const *) b);
+}
+
+static void
+append_air (GString        *out,
+            GairqAirObject *air)
+{
+  GairqObjectCity *city = gairq_air_object_get_city (air);
+  GHashTable *iaqi = gairq_air_object_get_iaqi (air);
+  GSList *attrs = gairq_air_object_get_attributions (air);
+  gint64 aqi = gairq_air_object_get_aqi (air);
+
+  g_string_append (out, "{\"status\":\"ok\",\"data\":{\"idx\":");
+  append_int64 (out, gairq_air_object_get_idx (air));
+
+  g_string_append (out, ",\"aqi\":");
+  if (aqi < 0)
+    g_string_append_len (out, "\"-\"", 3);
+  else
+    append_int64 (out, aqi);
+
+  g_string_append (out, ",\"time\":{\"v\":");
+  append_int64 (out, gairq_air_object_get_time (air));
+  g_string_append_c (out, '}');
+
+  if (attrs)
+    {
+      g_string_append (out, ",\"attributions\":[");
+      for ( ; attrs; attrs = attrs->next)
+        {
+          GairqObjectAttr *attr = attrs->data;
+
+          g_string_append (out, "{\"name\":");
+          append_string (out, attr->name);
+          g_string_append (out, ",\"url\":");
+          append_string (out, attr->url);
+          g_string_append (out, attrs->next ? "}," : "}");
+        }
+      g_string_append_c (out, ']');
+    }
+
+  if (city)
+    {
+      g_string_append (out, ",\"city\":{\"name\":");
+      append_string (out, city->name);
+      g_string_append (out, ",\"url\":");
+      append_string (out, city->url);
+      g_string_append (out, ",\"geo\":[");
+      append_double (out, city->geo.latitude);
+      g_string_append_c (out, ',');
+      append_double (out, city->geo.longitude);
+      g_string_append (out, "]}");
+    }
+
+  if (iaqi)
+    {
+      g_autofree gpointer *keys = NULL;
+      guint n_keys, i;
+      gboolean first = TRUE;
+
+      /* Sorted, so that the same station makes the same line */
+      keys = g_hash_table_get_keys_as_array (iaqi, &n_keys);
+      qsort (keys, n_keys, sizeof (gpointer), compare_keys);
+
+      g_string_append (out, ",\"iaqi\":{");
+      for (i = 0; i < n_keys; i++)
+        {
+          gdouble *value = g_hash_table_lookup (iaqi, keys [i]);
+
+          /* JSON has no NaN */
+          if (!isfinite (*value))
+            continue;
+
+          if (!first)
+            g_string_append_c (out, ',');
+          first = FALSE;
+
+          append_string (out, keys [i]);
+          g_string_append (out, ":{\"v\":");
+          append_double (out, *value);
+          g_string_append_c (out, '}');
+        }
+      g_string_append_c (out, '}');
+    }
+
+  g_string_append (out, "}}\n");
+}
+
+/* --- Reader --- */
+static GairqAirObject *
+read_line (JsonParser          *parser,
+           const gchar         *line,
+           gsize                length,
+           GairqAirObjectFlags  flags)
+{
+  GairqAirObject *air = NULL;
+  JsonObject *object;
+  JsonNode *root, *status, *data;
+
+  if (flags & GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY)
+    {
+      GBytes *bytes = g_bytes_new_static (line, length);
+
+      air = gairq_request_deserialize_bytes (bytes, flags, NULL);
+      g_bytes_unref (bytes);
+
+      return air;
+    }
+
+  if (!json_parser_load_from_data (parser, line, length, NULL))
+    return NULL;
+
+  /* Make sure it is a response before handing it over */
+  root = json_parser_get_root (parser);
+  if (root == NULL || !JSON_NODE_HOLDS_OBJECT (root))
+    return NULL;
+
+  object = json_node_get_object (root);
+  status = json_object_get_member (object, "status");
+  data = json_object_get_member (object, "data");
+  if (status == NULL || json_node_get_value_type (status) != G_TYPE_STRING ||
+      g_strcmp0 (json_node_get_string (status), "ok") != 0 ||
+      data == NULL || !JSON_NODE_HOLDS_OBJECT (data))
+    return NULL;
+
+  return gairq_air_object_new_from_data (data, flags);
+}
+
+static gpointer
+chunk_parse (gpointer data)
+{
+  Chunk *chunk = data;
+  g_autoptr(JsonParser) parser = NULL;
+  const gchar *line = chunk->start;
+
+  if (!(chunk->flags & GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY))
+    parser = json_parser_new ();
+
+  while (line < chunk->end)
+    {
+      const gchar *newline = memchr (line, '\n', chunk->end - line);
+      const gchar *end = newline ? newline : chunk->end;
+      const gchar *p = line;
+      GairqAirObject *air;
+
+      while (p < end && g_ascii_isspace (*p))
+        p++;
+
+      if (p < end)
+        {
+          chunk->n_lines++;
+
+          air = read_line (parser, p, end - p, chunk->flags);
+          if (air)
+            g_ptr_array_add (chunk->objects, air);
+          else
+            chunk->n_invalid++;
+        }
+
+      line = end + 1;
+    }
+
+  return NULL;
+}
+
+/* --- GObject --- */
+static void
+gairq_ndjson_writer_finalize (GObject *object)
+{
+  GairqNdjsonWriter *self = GAIRQ_NDJSON_WRITER (object);
+
+  /* Whatever is left goes out, errors have nobody to go to by now */
+  if (self->buffer->len > 0)
+    g_output_stream_write_all (self->stream, self->buffer->str, self->buffer->len,
+                               NULL, NULL, NULL);
+
+  g_string_free (self->buffer, TRUE);
+  g_clear_object (&self->stream);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gairq_ndjson_writer_parent_class)->finalize (object);
+}
+
+static void
+gairq_ndjson_writer_class_init (GairqNdjsonWriterClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_ndjson_writer_finalize;
+}
+
+static void
+gairq_ndjson_writer_init (GairqNdjsonWriter *self)
+{
+  g_mutex_init (&self->lock);
+  self->buffer = g_string_sized_new (BUFFER_SIZE + 1024);
+}
+
+/* --- Private Methods --- */
+/* Must be called with the lock held */
+static gboolean
+gairq_ndjson_writer_drain_locked (GairqNdjsonWriter  *self,
+                                  GError            **error)
+{
+  gboolean ret;
+
+  if (self->buffer->len == 0)
+    return TRUE;
+
+  ret = g_output_stream_write_all (self->stream, self->buffer->str, self->buffer->len,
+                                   NULL, NULL, error);
+  g_string_truncate (self->buffer, 0);
+
+  return ret;
+}
+
+/* --- Public APIs --- */
+GairqNdjsonWriter *
+gairq_ndjson_writer_new (GOutputStream *stream)
+{
+  GairqNdjsonWriter *self;
+
+  g_return_val_if_fail (G_IS_OUTPUT_STREAM (stream), NULL);
+
+  self = g_object_new (GAIRQ_TYPE_NDJSON_WRITER, NULL);
+  self->stream = g_object_ref (stream);
+
+  return self;
+}
+
+gboolean
+gairq_ndjson_writer_append (GairqNdjsonWriter  *self,
+                            GairqAirObject     *air,
+                            GError            **error)
+{
+  gboolean ret = TRUE;
+  gsize before;
+
+  g_return_val_if_fail (GAIRQ_IS_NDJSON_WRITER (self), FALSE);
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (air), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  before = self->buffer->len;
+  append_air (self->buffer, air);
+  self->stats.n_bytes += self->buffer->len - before;
+  self->stats.n_lines++;
+
+  if (self->buffer->len >= BUFFER_SIZE)
+    ret = gairq_ndjson_writer_drain_locked (self, error);
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+gboolean
+gairq_ndjson_writer_flush (GairqNdjsonWriter  *self,
+                           GError            **error)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (GAIRQ_IS_NDJSON_WRITER (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  ret = gairq_ndjson_writer_drain_locked (self, error) &&
+        g_output_stream_flush (self->stream, NULL, error);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+void
+gairq_ndjson_writer_get_stats (GairqNdjsonWriter *self,
+                               GairqNdjsonStats  *stats)
+{
+  g_return_if_fail (GAIRQ_IS_NDJSON_WRITER (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+  *stats = self->stats;
+  g_mutex_unlock (&self->lock);
+}
+
+GPtrArray *
+gairq_ndjson_read (const gchar          *path,
+                   GairqAirObjectFlags   flags,
+                   guint                 n_threads,
+                   GairqNdjsonStats     *stats,
+                   GError              **error)
+{
+  g_autofree GThread **threads = NULL;
+  g_autofree Chunk *chunks = NULL;
+  GairqNdjsonStats local_stats;
+  GMappedFile *map;
+  const gchar *data, *end;
+  GPtrArray *objects;
+  guint i, n_chunks;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (stats == NULL)
+    stats = &local_stats;
+  memset (stats, 0, sizeof *stats);
+
+  map = g_mapped_file_new (path, FALSE, error);
+  if (map == NULL)
+    return NULL;
+
+  /* Empty files map to NULL */
+  data = g_mapped_file_get_contents (map);
+  if (data == NULL)
+    data = "";
+  end = data + g_mapped_file_get_length (map);
+  stats->n_bytes = end - data;
+
+  if (n_threads == 0)
+    n_threads = g_get_num_processors ();
+  n_chunks = CLAMP ((end - data) / MIN_CHUNK_SIZE, 1, n_threads);
+
+  chunks = g_new0 (Chunk, n_chunks);
+  threads = g_new0 (GThread *, n_chunks);
+
+  for (i = 0; i < n_chunks; i++)
+    {
+      const gchar *start = i ? chunks [i - 1].end : data;
+      const gchar *nominal = data + (end - data) * (i + 1) / n_chunks;
+      const gchar *newline;
+
+      nominal = MAX (nominal, start);
+      newline = i + 1 < n_chunks ? memchr (nominal, '\n', end - nominal) : NULL;
+
+      chunks [i].start = start;
+      chunks [i].end = newline ? newline + 1 : end;
+      chunks [i].flags = flags;
+      chunks [i].objects = g_ptr_array_new_with_free_func (g_object_unref);
+    }
+
+  for (i = 1; i < n_chunks; i++)
+    threads [i] = g_thread_new ("gairq-ndjson-read", chunk_parse, &chunks [i]);
+  chunk_parse (&chunks [0]);
+
+  objects = chunks [0].objects;
+  stats->n_lines = chunks [0].n_lines;
+  stats->n_invalid = chunks [0].n_invalid;
+
+  for (i = 1; i < n_chunks; i++)
+    {
+      guint j;
+
+      g_thread_join (threads [i]);
+
+      /* The objects change hands, only the array goes away */
+      for (j = 0; j < chunks [i].objects->len; j++)
+        g_ptr_array_add (objects, g_ptr_array_index (chunks [i].objects, j));
+      g_ptr_array_set_free_func (chunks [i].objects, NULL);
+      g_ptr_array_unref (chunks [i].objects);
+
+      stats->n_lines += chunks [i].n_lines;
+      stats->n_invalid += chunks [i].n_invalid;
+    }
+
+  stats->n_threads = n_chunks;
+
+  g_mapped_file_unref (map);
+
+  return objects;
+}
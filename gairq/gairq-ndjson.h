@@ -0,0 +1,76 @@
+/* gairq-ndjson.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_NDJSON_H
+#define GAIRQ_NDJSON_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <gio/gio.h>
+
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_NDJSON_WRITER (gairq_ndjson_writer_get_type ())
+G_DECLARE_FINAL_TYPE (GairqNdjsonWriter, gairq_ndjson_writer, GAIRQ, NDJSON_WRITER, GObject)
+
+typedef struct
+{
+  guint64   n_bytes;
+  guint64   n_lines;      /* Blank ones aside */
+  guint64   n_invalid;    /* Lines that did not read as a station */
+  guint     n_threads;
+} GairqNdjsonStats;
+
+/* One station a line, each line a response just as the API sends it,
+ *
+ *   {"status":"ok","data":{"idx":4143,"aqi":57,"time":{"v":...},...}}
+ *
+ * so that a line replays through gairq_request_deserialize_bytes () as
+ * well. An unknown aqi goes out as "-" like the API does. Lines are put
+ * together in a buffer of the writer's own and written out as it fills
+ * up, on flush and when the writer goes away, @stream is left open.
+ */
+GairqNdjsonWriter * gairq_ndjson_writer_new       (GOutputStream        *stream);
+gboolean            gairq_ndjson_writer_append    (GairqNdjsonWriter    *self,
+                                                   GairqAirObject       *air,
+                                                   GError              **error);
+gboolean            gairq_ndjson_writer_flush     (GairqNdjsonWriter    *self,
+                                                   GError              **error);
+void                gairq_ndjson_writer_get_stats (GairqNdjsonWriter    *self,
+                                                   GairqNdjsonStats     *stats);
+
+/* Reads back every station of the file in file order, @flags as for
+ * gairq_request_deserialize (). The file is memory-mapped and parsed on
+ * @n_threads threads, 0 for one per processor. Lines that are not a
+ * station are counted and passed over.
+ */
+GPtrArray *         gairq_ndjson_read             (const gchar          *path,
+                                                   GairqAirObjectFlags   flags,
+                                                   guint                 n_threads,
+                                                   GairqNdjsonStats     *stats,
+                                                   GError              **error);
+
+G_END_DECLS
+
+#endif
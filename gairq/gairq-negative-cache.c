@@ -0,0 +1,263 @@
+/* gairq-negative-cache.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-negative-cache.h"
+#include "gairq-utils.h"
+
+#include <string.h>
+
+/* 64 Kbit and four probes keep false positives under 0.3% with 4096 keys,
+ * the most remembered at once before everything is dropped.
+ */
+#define BLOOM_BITS    (1 << 16)
+#define BLOOM_PROBES  4
+#define MAX_KEYS      4096
+
+static GMutex       cache_lock;
+static GHashTable * cache = NULL;
+static guint        n_dead = 0;
+
+/* Only ever written with cache_lock held, read without it */
+static gint         bloom [BLOOM_BITS / 32];
+
+static gsize        n_lookups;
+static gsize        n_filtered;
+static gsize        n_hits;
+static gsize        n_false_positives;
+
+
+/* Double hashing, the probes come out of the two halves of one hash */
+#define BLOOM_PROBE(_hash, _i) \
+  ((guint) (((_hash) & 0xffffffff) + (_i) * (((_hash) >> 32) | 1)) % BLOOM_BITS)
+
+static void
+bloom_set (gint    *bits,
+           guint64  hash)
+{
+  guint i;
+
+  for (i = 0; i < BLOOM_PROBES; i++)
+    {
+      guint bit = BLOOM_PROBE (hash, i);
+
+      bits [bit / 32] |= 1u << (bit % 32);
+    }
+}
+
+static gboolean
+bloom_test (guint64 hash)
+{
+  guint i;
+
+  for (i = 0; i < BLOOM_PROBES; i++)
+    {
+      guint bit = BLOOM_PROBE (hash, i);
+
+      if (!(g_atomic_int_get (&bloom [bit / 32]) & (1u << (bit % 32))))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+static guint64
+key_hash (const gchar *key)
+{
+  return gairq_hash64 (key, strlen (key), 0);
+}
+
+/* Must be called with cache_lock held. Bits can't be taken out of the
+ * filter one key at a time, so it gets rebuilt from the live keys once
+ * enough of them are gone. A word only loses the bits of removed keys,
+ * lock-free readers never miss a live one.
+ */
+static void
+gairq_negative_cache_rebuild_locked (void)
+{
+  gint bits [BLOOM_BITS / 32] = { 0, };
+  GHashTableIter iter;
+  gpointer key;
+  guint i;
+
+  if (cache)
+    {
+      g_hash_table_iter_init (&iter, cache);
+      while (g_hash_table_iter_next (&iter, &key, NULL))
+        bloom_set (bits, key_hash (key));
+    }
+
+  for (i = 0; i < G_N_ELEMENTS (bits); i++)
+    g_atomic_int_set (&bloom [i], bits [i]);
+
+  n_dead = 0;
+}
+
+static gboolean
+gairq_negative_cache_is_expired (gpointer key,
+                                 gpointer value,
+                                 gpointer user_data)
+{
+  return *(gint64 *) value <= *(gint64 *) user_data;
+}
+
+/* Must be called with cache_lock held */
+static void
+gairq_negative_cache_forget_locked (void)
+{
+  n_dead += g_hash_table_size (cache);
+  g_hash_table_remove_all (cache);
+}
+
+/* Remembers @key as bad for @ttl_ms, meant for endpoints the server
+ * answered with an error that won't go away by asking again.
+ */
+void
+gairq_negative_cache_add (const gchar *key,
+                          guint        ttl_ms)
+{
+  gint64 *expires;
+  guint64 hash;
+  guint i;
+
+  g_return_if_fail (key != NULL);
+
+  if (ttl_ms == 0)
+    return;
+
+  expires = g_new (gint64, 1);
+  *expires = g_get_monotonic_time () + (gint64) ttl_ms * G_TIME_SPAN_MILLISECOND;
+
+  g_mutex_lock (&cache_lock);
+
+  if (G_UNLIKELY (cache == NULL))
+    cache = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  if (g_hash_table_size (cache) >= MAX_KEYS &&
+      !g_hash_table_contains (cache, key))
+    {
+      gint64 now = g_get_monotonic_time ();
+
+      n_dead += g_hash_table_foreach_remove (cache, gairq_negative_cache_is_expired, &now);
+
+      /* Still full of live keys, start over rather than saturate the filter */
+      if (g_hash_table_size (cache) >= MAX_KEYS)
+        gairq_negative_cache_forget_locked ();
+    }
+
+  g_hash_table_replace (cache, g_strdup (key), expires);
+
+  if (n_dead > g_hash_table_size (cache))
+    gairq_negative_cache_rebuild_locked ();
+  else
+    {
+      hash = key_hash (key);
+      for (i = 0; i < BLOOM_PROBES; i++)
+        {
+          guint bit = BLOOM_PROBE (hash, i);
+
+          g_atomic_int_or ((guint *) &bloom [bit / 32], 1u << (bit % 32));
+        }
+    }
+
+  g_mutex_unlock (&cache_lock);
+}
+
+/* Whether @key is known bad. Most keys never were, the filter tells so
+ * without taking the lock.
+ */
+gboolean
+gairq_negative_cache_contains (const gchar *key)
+{
+  gboolean ret = FALSE;
+  gint64 *expires;
+
+  if (key == NULL)
+    return FALSE;
+
+  g_atomic_pointer_add (&n_lookups, 1);
+
+  if (!bloom_test (key_hash (key)))
+    {
+      g_atomic_pointer_add (&n_filtered, 1);
+      return FALSE;
+    }
+
+  g_mutex_lock (&cache_lock);
+
+  expires = cache ? g_hash_table_lookup (cache, key) : NULL;
+  if (expires && *expires > g_get_monotonic_time ())
+    ret = TRUE;
+  else if (expires)
+    {
+      g_hash_table_remove (cache, key);
+      n_dead++;
+    }
+
+  g_mutex_unlock (&cache_lock);
+
+  g_atomic_pointer_add (ret ? &n_hits : &n_false_positives, 1);
+
+  return ret;
+}
+
+/* Forgets @key, say once the station it points to shows up */
+gboolean
+gairq_negative_cache_remove (const gchar *key)
+{
+  gboolean ret = FALSE;
+
+  if (key == NULL)
+    return FALSE;
+
+  g_mutex_lock (&cache_lock);
+  if (cache && g_hash_table_remove (cache, key))
+    {
+      n_dead++;
+      ret = TRUE;
+    }
+  g_mutex_unlock (&cache_lock);
+
+  return ret;
+}
+
+void
+gairq_negative_cache_clear (void)
+{
+  g_mutex_lock (&cache_lock);
+  if (cache)
+    gairq_negative_cache_forget_locked ();
+  gairq_negative_cache_rebuild_locked ();
+  g_mutex_unlock (&cache_lock);
+}
+
+void
+gairq_negative_cache_get_stats (GairqNegativeCacheStats *stats)
+{
+  g_return_if_fail (stats != NULL);
+
+  stats->n_lookups = (gsize) g_atomic_pointer_get (&n_lookups);
+  stats->n_filtered = (gsize) g_atomic_pointer_get (&n_filtered);
+  stats->n_hits = (gsize) g_atomic_pointer_get (&n_hits);
+  stats->n_false_positives = (gsize) g_atomic_pointer_get (&n_false_positives);
+
+  g_mutex_lock (&cache_lock);
+  stats->n_keys = cache ? g_hash_table_size (cache) : 0;
+  g_mutex_unlock (&cache_lock);
+}
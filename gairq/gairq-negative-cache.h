@@ -0,0 +1,52 @@
+/* gairq-negative-cache.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_NEGATIVE_CACHE_H
+#define GAIRQ_NEGATIVE_CACHE_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GairqNegativeCacheStats GairqNegativeCacheStats;
+
+struct _GairqNegativeCacheStats
+{
+  guint64   n_lookups;          /* Keys checked */
+  guint64   n_filtered;         /* Of which the Bloom filter ruled out alone */
+  guint64   n_hits;             /* Of which were known bad and rejected */
+  guint64   n_false_positives;  /* Passed the filter, not in the table */
+  guint     n_keys;             /* Bad keys remembered, expired ones included */
+};
+
+void      gairq_negative_cache_add        (const gchar             *key,
+                                           guint                    ttl_ms);
+gboolean  gairq_negative_cache_contains   (const gchar             *key);
+gboolean  gairq_negative_cache_remove     (const gchar             *key);
+void      gairq_negative_cache_clear      (void);
+void      gairq_negative_cache_get_stats  (GairqNegativeCacheStats *stats);
+
+G_END_DECLS
+
+#endif
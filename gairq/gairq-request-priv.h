@@ -25,6 +25,26 @@
 # error "Only <gairq/gairq.h> can be included directly."
 #endif
 
+#include "gairq-request.h"
+
+G_BEGIN_DECLS
+
 #define API_URL "https://api.waqi.info"
 
+/* Requests and deserializes with the GairqRequest:object-flags */
+GairqAirObject *  gairq_request_fetch_sync    (GairqRequest        *self,
+                                               GError             **error);
+void              gairq_request_fetch_async   (GairqRequest        *self,
+                                               GCancellable        *cancellable,
+                                               GAsyncReadyCallback  callback,
+                                               gpointer             callback_data);
+GairqAirObject *  gairq_request_fetch_finish  (GairqRequest        *self,
+                                               GAsyncResult        *res,
+                                               GError             **error);
+
+/* For subclasses, once a property picking the endpoint changed */
+void              gairq_request_endpoint_changed  (GairqRequest    *self);
+
+G_END_DECLS
+
 #endif
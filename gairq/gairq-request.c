@@ -20,18 +20,84 @@
 
 #include "gairq-request.h"
 #include "gairq-request-priv.h"
+#include "gairq-air-object-priv.h"
+#include "gairq-debug.h"
+#include "gairq-json-scanner.h"
+#include "gairq-negative-cache.h"
+#include "gairq-utils.h"
 #include "gairq-version.h"
 
+#include <string.h>
+
+/* A request is shared between threads as it is. The proxy and token are
+ * set once at construction. Settings, the endpoint generation, the disk
+ * cache and the executor are read with atomics, so a call takes no lock
+ * but last_lock, and that one only around the last object. It is never
+ * held across a round-trip.
+ */
 typedef struct
 {
-  RestProxy * proxy;
-  gchar *     token;
+  RestProxy *           proxy;
+  gchar *               base_url;
+  gchar *               token;
+  GairqAirObjectFlags   object_flags;
+  gboolean              skip_unchanged;
+
+  /* Fingerprint of the last good response and what it turned into,
+   * always from the current endpoint. A response to one asked before
+   * the endpoint changed is not kept.
+   */
+  GMutex                last_lock;
+  guint                 endpoint;
+  guint64               last_hash;
+  gsize                 last_length;
+  GairqAirObject *      last;
+  gint64                last_time;
+  gboolean              refreshing;
+
+  /* Stale-while-revalidate, in ms. refresh_ahead goes under last_lock */
+  guint                 cache_ttl;
+  gdouble               refresh_ahead;
+  guint                 serve_stale;
+
+  /* How long an unknown station is remembered, in ms */
+  guint                 negative_ttl;
+
+  /* Keeps responses across restarts, read once to warm the cache.
+   * warmed goes under last_lock
+   */
+  GairqDiskCache *      disk_cache;
+  gboolean              warmed;
+
+  /* Runs the async calls, the shared gairq one if NULL */
+  GairqExecutor *       executor;
+  GairqPriority         priority;
+
+  /* Serializes setting disk_cache and executor. Callers read them without
+   * a reference, so the ones replaced are kept in retired for as long as
+   * the request lives
+   */
+  GMutex                set_lock;
+  GPtrArray *           retired;
+
+  /* Statistics, each counter bumped with a 64-bit atomic */
+  GairqRequestStats     stats;
 } GairqRequestPrivate;
 
 /* Properties */
 enum {
   PROP_0,
+  PROP_BASE_URL,
   PROP_TOKEN,
+  PROP_OBJECT_FLAGS,
+  PROP_SKIP_UNCHANGED,
+  PROP_CACHE_TTL,
+  PROP_REFRESH_AHEAD,
+  PROP_SERVE_STALE,
+  PROP_NEGATIVE_TTL,
+  PROP_DISK_CACHE,
+  PROP_EXECUTOR,
+  PROP_PRIORITY,
   N_PROPERTIES
 };
 
@@ -41,9 +107,16 @@ G_DEFINE_TYPE_WITH_PRIVATE (GairqRequest, gairq_request, G_TYPE_OBJECT)
 
 #define GAIRQ_REQUEST_ERROR (gairq_request_error_quark ())
 
+/* An unknown station won't show up by asking again, unlike the rest */
+enum {
+  GAIRQ_REQUEST_ERROR_RESPONSE,
+  GAIRQ_REQUEST_ERROR_UNKNOWN_STATION,
+};
+
 #define GET_PRIVATE(_obj) gairq_request_get_instance_private (GAIRQ_REQUEST (_obj))
 
 
+
 /* --- GairqRequestError --- */
 static GQuark
 gairq_request_error_quark (void)
@@ -51,13 +124,38 @@ gairq_request_error_quark (void)
   return g_quark_from_static_string ("gairq-request-error-quark");
 }
 
+static void
+gairq_request_set_response_error (GError      **error,
+                                  const gchar  *message)
+{
+  g_set_error (error, GAIRQ_REQUEST_ERROR,
+               g_strcmp0 (message, "Unknown station") == 0 ?
+                 GAIRQ_REQUEST_ERROR_UNKNOWN_STATION : GAIRQ_REQUEST_ERROR_RESPONSE,
+               "Error-Response: %s", message);
+}
+
 /* --- GObject --- */
+static void
+gairq_request_constructed (GObject *object)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (object);
+
+  G_OBJECT_CLASS (gairq_request_parent_class)->constructed (object);
+
+  /* One proxy serves every thread, its synchronous session is made for it */
+  priv->proxy = rest_proxy_new (priv->base_url ? priv->base_url : API_URL, FALSE);
+  rest_proxy_set_user_agent (priv->proxy, "Gairq/" GAIRQ_VERSION_S);
+}
+
 static void
 gairq_request_dispose (GObject *object)
 {
   GairqRequestPrivate *priv = GET_PRIVATE (object);
 
   g_clear_object (&priv->proxy);
+  g_clear_object (&priv->last);
+  g_clear_object (&priv->disk_cache);
+  g_clear_object (&priv->executor);
 
   G_OBJECT_CLASS (gairq_request_parent_class)->dispose (object);
 }
@@ -67,7 +165,11 @@ gairq_request_finalize (GObject *object)
 {
   GairqRequestPrivate *priv = GET_PRIVATE (object);
 
+  g_free (priv->base_url);
   g_free (priv->token);
+  g_mutex_clear (&priv->last_lock);
+  g_mutex_clear (&priv->set_lock);
+  g_ptr_array_unref (priv->retired);
 
   G_OBJECT_CLASS (gairq_request_parent_class)->finalize (object);
 }
@@ -82,11 +184,52 @@ gairq_request_set_property (GObject      *object,
 
   switch (prop_id)
     {
+    case PROP_BASE_URL:
+      g_free (priv->base_url);
+      priv->base_url = g_value_dup_string (value);
+      break;
+
     case PROP_TOKEN:
       g_free (priv->token);
       priv->token = g_value_dup_string (value);
       break;
 
+    case PROP_OBJECT_FLAGS:
+      gairq_request_set_object_flags (GAIRQ_REQUEST (object), g_value_get_uint (value));
+      break;
+
+    case PROP_SKIP_UNCHANGED:
+      gairq_request_set_skip_unchanged (GAIRQ_REQUEST (object), g_value_get_boolean (value));
+      break;
+
+    case PROP_CACHE_TTL:
+      gairq_request_set_cache_ttl (GAIRQ_REQUEST (object), g_value_get_uint (value));
+      break;
+
+    case PROP_REFRESH_AHEAD:
+      gairq_request_set_refresh_ahead (GAIRQ_REQUEST (object), g_value_get_double (value));
+      break;
+
+    case PROP_SERVE_STALE:
+      gairq_request_set_serve_stale (GAIRQ_REQUEST (object), g_value_get_uint (value));
+      break;
+
+    case PROP_NEGATIVE_TTL:
+      gairq_request_set_negative_ttl (GAIRQ_REQUEST (object), g_value_get_uint (value));
+      break;
+
+    case PROP_DISK_CACHE:
+      gairq_request_set_disk_cache (GAIRQ_REQUEST (object), g_value_get_object (value));
+      break;
+
+    case PROP_EXECUTOR:
+      gairq_request_set_executor (GAIRQ_REQUEST (object), g_value_get_object (value));
+      break;
+
+    case PROP_PRIORITY:
+      gairq_request_set_priority (GAIRQ_REQUEST (object), g_value_get_uint (value));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -102,10 +245,50 @@ gairq_request_get_property (GObject    *object,
 
   switch (prop_id)
     {
+    case PROP_BASE_URL:
+      g_value_set_string (value, priv->base_url);
+      break;
+
     case PROP_TOKEN:
       g_value_set_string (value, priv->token);
       break;
 
+    case PROP_OBJECT_FLAGS:
+      g_value_set_uint (value, gairq_request_get_object_flags (GAIRQ_REQUEST (object)));
+      break;
+
+    case PROP_SKIP_UNCHANGED:
+      g_value_set_boolean (value, gairq_request_get_skip_unchanged (GAIRQ_REQUEST (object)));
+      break;
+
+    case PROP_CACHE_TTL:
+      g_value_set_uint (value, gairq_request_get_cache_ttl (GAIRQ_REQUEST (object)));
+      break;
+
+    case PROP_REFRESH_AHEAD:
+      g_value_set_double (value, gairq_request_get_refresh_ahead (GAIRQ_REQUEST (object)));
+      break;
+
+    case PROP_SERVE_STALE:
+      g_value_set_uint (value, gairq_request_get_serve_stale (GAIRQ_REQUEST (object)));
+      break;
+
+    case PROP_NEGATIVE_TTL:
+      g_value_set_uint (value, gairq_request_get_negative_ttl (GAIRQ_REQUEST (object)));
+      break;
+
+    case PROP_DISK_CACHE:
+      g_value_set_object (value, g_atomic_pointer_get (&priv->disk_cache));
+      break;
+
+    case PROP_EXECUTOR:
+      g_value_set_object (value, g_atomic_pointer_get (&priv->executor));
+      break;
+
+    case PROP_PRIORITY:
+      g_value_set_uint (value, gairq_request_get_priority (GAIRQ_REQUEST (object)));
+      break;
+
     default:
       G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
     }
@@ -129,11 +312,16 @@ gairq_request_set_parameters (RestProxyCall  *proxy_call,
   g_assert_not_reached ();
 }
 
+static GBytes * gairq_request_real_fetch_payload (GairqRequest  *self,
+                                                  GError       **error);
+static gchar *  gairq_request_real_get_key       (GairqRequest  *self);
+
 static void
 gairq_request_class_init (GairqRequestClass *klass)
 {
   GObjectClass *object_class = G_OBJECT_CLASS (klass);
 
+  object_class->constructed = gairq_request_constructed;
   object_class->dispose = gairq_request_dispose;
   object_class->finalize = gairq_request_finalize;
   object_class->set_property = gairq_request_set_property;
@@ -141,6 +329,19 @@ gairq_request_class_init (GairqRequestClass *klass)
 
   klass->set_functions = gairq_request_set_functions;
   klass->set_parameters = gairq_request_set_parameters;
+  klass->fetch_payload = gairq_request_real_fetch_payload;
+  klass->get_key = gairq_request_real_get_key;
+
+  /**
+   * GairqRequest:base-url:
+   *
+   * Where the API lives, the public one if NULL.
+   */
+  properties [PROP_BASE_URL] =
+    g_param_spec_string ("base-url", "Base URL",
+                         "The URL of the API server",
+                         NULL,
+                         (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 
   /**
    * GairqRequest:token:
@@ -152,6 +353,115 @@ gairq_request_class_init (GairqRequestClass *klass)
                          NULL,
                          (G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY));
 
+  /**
+   * GairqRequest:object-flags:
+   *
+   * #GairqAirObjectFlags used to build objects out of responses.
+   */
+  properties [PROP_OBJECT_FLAGS] =
+    g_param_spec_uint ("object-flags", "Object flags",
+                       "Flags for deserializing the responses",
+                       0, G_MAXUINT,
+                       GAIRQ_AIR_OBJECT_FLAGS_NONE,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:skip-unchanged:
+   *
+   * Whether a response byte-identical to the previous one hands back
+   * the previous #GairqAirObject instead of deserializing it again.
+   */
+  properties [PROP_SKIP_UNCHANGED] =
+    g_param_spec_boolean ("skip-unchanged", "Skip unchanged",
+                          "Reuse the last object for unchanged responses",
+                          FALSE,
+                          G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:cache-ttl:
+   *
+   * Milliseconds the last object is handed out for without asking the
+   * server again, 0 disables caching.
+   */
+  properties [PROP_CACHE_TTL] =
+    g_param_spec_uint ("cache-ttl", "Cache TTL",
+                       "How long the last object stays fresh in ms",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:refresh-ahead:
+   *
+   * Fraction of the TTL after which a cache hit also refreshes the
+   * object in the background, so that it never gets to expire.
+   */
+  properties [PROP_REFRESH_AHEAD] =
+    g_param_spec_double ("refresh-ahead", "Refresh ahead",
+                         "Fraction of the TTL to start refreshing at",
+                         0.0, 1.0, 0.8,
+                         G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:serve-stale:
+   *
+   * Milliseconds past the TTL an expired object is still handed out
+   * for, flagged stale, while it is being refreshed.
+   */
+  properties [PROP_SERVE_STALE] =
+    g_param_spec_uint ("serve-stale", "Serve stale",
+                       "How long past the TTL to serve a stale object in ms",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:negative-ttl:
+   *
+   * Milliseconds an endpoint the server doesn't know is remembered for,
+   * so that asking again fails right away. 0 disables it.
+   */
+  properties [PROP_NEGATIVE_TTL] =
+    g_param_spec_uint ("negative-ttl", "Negative TTL",
+                       "How long an unknown station is remembered in ms",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:disk-cache:
+   *
+   * Where every good response is kept. On the first poll, the one kept
+   * from an earlier run is served if GairqRequest:cache-ttl allows.
+   */
+  properties [PROP_DISK_CACHE] =
+    g_param_spec_object ("disk-cache", "Disk cache",
+                         "A GairqDiskCache responses persist in",
+                         GAIRQ_TYPE_DISK_CACHE,
+                         G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:executor:
+   *
+   * The #GairqExecutor async calls and background refreshes run on,
+   * gairq_executor_get_default () if NULL.
+   */
+  properties [PROP_EXECUTOR] =
+    g_param_spec_object ("executor", "Executor",
+                         "A GairqExecutor to run async calls on",
+                         GAIRQ_TYPE_EXECUTOR,
+                         G_PARAM_READWRITE);
+
+  /**
+   * GairqRequest:priority:
+   *
+   * The #GairqPriority async calls queue at on the executor. Background
+   * refreshes always go at GAIRQ_PRIORITY_BULK.
+   */
+  properties [PROP_PRIORITY] =
+    g_param_spec_uint ("priority", "Priority",
+                       "The class async calls are queued in",
+                       0, N_GAIRQ_PRIORITIES - 1,
+                       GAIRQ_PRIORITY_NORMAL,
+                       G_PARAM_READWRITE);
+
   g_object_class_install_properties (object_class, N_PROPERTIES, properties);
 }
 
@@ -160,57 +470,103 @@ gairq_request_init (GairqRequest *self)
 {
   GairqRequestPrivate *priv = GET_PRIVATE (self);
 
+  priv->base_url = NULL;
   priv->token = NULL;
-  priv->proxy = rest_proxy_new (API_URL, FALSE);
-  rest_proxy_set_user_agent (priv->proxy, "Gairq/" GAIRQ_VERSION_S);
+  priv->object_flags = GAIRQ_AIR_OBJECT_FLAGS_NONE;
+  priv->skip_unchanged = FALSE;
+  g_mutex_init (&priv->last_lock);
+  g_mutex_init (&priv->set_lock);
+  priv->endpoint = 0;
+  priv->last_hash = 0;
+  priv->last_length = 0;
+  priv->last = NULL;
+  priv->last_time = 0;
+  priv->refreshing = FALSE;
+  priv->cache_ttl = 0;
+  priv->refresh_ahead = 0.8;
+  priv->serve_stale = 0;
+  priv->negative_ttl = 0;
+  priv->disk_cache = NULL;
+  priv->warmed = FALSE;
+  priv->executor = NULL;
+  priv->priority = GAIRQ_PRIORITY_NORMAL;
+  priv->retired = g_ptr_array_new_with_free_func (g_object_unref);
 }
 
 /* --- Private Methods --- */
-static void
-gairq_request_call_io_thread (GTask        *task,
-                              gpointer      source_object,
-                              gpointer      task_data,
-                              GCancellable *cancellable)
+/* Reads a setting kept in ms, in microseconds */
+static gint64
+atomic_ms_to_us (guint *ms)
 {
-  GairqRequest *self = GAIRQ_REQUEST (source_object);
-  GError *error = NULL;
-  JsonNode *root;
+  return (gint64) (guint) g_atomic_int_get (ms) * G_TIME_SPAN_MILLISECOND;
+}
 
-  root = gairq_request_call_sync (self, &error);
-  if (root)
-    g_task_return_pointer (task, root, g_object_unref);
-  else
-    {
-      if (error)
-        g_task_return_error (task, error);
+/* Publishes @object in @slot. Whoever still reads the one it replaces
+ * without a reference can go on using it, @self keeps it.
+ */
+static gboolean
+gairq_request_swap_object_locked (GairqRequest *self,
+                                  gpointer     *slot,
+                                  gpointer      object)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  gpointer old = *slot;
 
-      /* If both, root and error are NULL, what should we do? */
-    }
+  if (old == object)
+    return FALSE;
+
+  g_atomic_pointer_set (slot, object ? g_object_ref (object) : NULL);
+  if (old)
+    g_ptr_array_add (priv->retired, old);
+
+  return TRUE;
 }
 
-/* --- Public APIs --- */
-GairqRequest *
-gairq_request_new (const gchar *access_token)
+/* Bumps a counter of GairqRequestStats, 64 bits wide on every host */
+#define STATS_ADD(_field, _n) \
+  __atomic_fetch_add (&(_field), (_n), __ATOMIC_RELAXED)
+#define STATS_GET(_field) \
+  __atomic_load_n (&(_field), __ATOMIC_RELAXED)
+
+/* Tells responses to the current endpoint from older ones */
+static guint
+gairq_request_get_endpoint (GairqRequest *self)
 {
-  g_return_val_if_fail (access_token != NULL, NULL);
+  return g_atomic_int_get (&GET_PRIVATE (self)->endpoint);
+}
 
-  return g_object_new (GAIRQ_TYPE_REQUEST,
-                       "token", access_token,
-                       NULL);
+/* Counts a round-trip in, returns when it started */
+static gint64
+gairq_request_begin_call (GairqRequest *self)
+{
+  g_atomic_int_inc (&GET_PRIVATE (self)->stats.n_in_flight);
+
+  return g_get_monotonic_time ();
 }
 
-JsonNode *
-gairq_request_call_sync (GairqRequest  *self,
-                         GError       **error)
+static void
+gairq_request_end_call (GairqRequest *self,
+                        gint64        started,
+                        gsize         length,
+                        gboolean      failed)
 {
-  GairqRequestPrivate *priv;
-  RestProxyCall *proxy_call;
-  JsonNode *ret = NULL;
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  gint64 elapsed = g_get_monotonic_time () - started;
 
-  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  g_atomic_int_add (&priv->stats.n_in_flight, -1);
+  STATS_ADD (priv->stats.n_calls, 1);
+  if (failed)
+    STATS_ADD (priv->stats.n_failed, 1);
+  STATS_ADD (priv->stats.bytes_received, length);
+  STATS_ADD (priv->stats.call_time, elapsed);
+}
 
-  priv = GET_PRIVATE (self);
+static RestProxyCall *
+gairq_request_invoke (GairqRequest  *self,
+                      GError       **error)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  RestProxyCall *proxy_call;
 
   proxy_call = rest_proxy_new_call (priv->proxy);
   rest_proxy_call_set_method (proxy_call, "GET");
@@ -227,87 +583,1050 @@ gairq_request_call_sync (GairqRequest  *self,
   rest_proxy_call_add_param (proxy_call, "token", priv->token);
 
   if (rest_proxy_call_sync (proxy_call, error))
-    {
-      const gchar *payload;
-      JsonParser *parser;
+    return proxy_call;
 
-      payload = rest_proxy_call_get_payload (proxy_call);
-      parser = json_parser_new ();
+out_error:
+  g_object_unref (proxy_call);
 
-      if (json_parser_load_from_data (parser, payload, -1, error))
-        ret = json_parser_steal_root (parser);
+  return NULL;
+}
 
-      g_object_unref (parser);
-    }
+static GBytes *
+gairq_request_real_fetch_payload (GairqRequest  *self,
+                                  GError       **error)
+{
+  RestProxyCall *proxy_call;
 
-out_error:
-  g_object_unref (proxy_call);
+  proxy_call = gairq_request_invoke (self, error);
+  if (proxy_call == NULL)
+    return NULL;
 
-  return ret;
+  /* The call owns the payload, keep it around instead of copying */
+  return g_bytes_new_with_free_func (rest_proxy_call_get_payload (proxy_call),
+                                     rest_proxy_call_get_payload_length (proxy_call),
+                                     g_object_unref, proxy_call);
 }
 
-void
-gairq_request_call_async (GairqRequest        *self,
-                          GCancellable        *cancellable,
-                          GAsyncReadyCallback  callback,
-                          gpointer             callback_data)
+static gchar *
+gairq_request_real_get_key (GairqRequest *self)
 {
-  GTask *task;
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  RestProxyCall *proxy_call;
+  gchar *ret = NULL;
 
-  g_return_if_fail (GAIRQ_IS_REQUEST (self));
-  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+  /* Both subclasses put the station in the path, parameters don't count */
+  proxy_call = rest_proxy_new_call (priv->proxy);
+  if (GAIRQ_REQUEST_GET_CLASS (self)->set_functions (proxy_call, self, NULL))
+    ret = g_strdup (rest_proxy_call_get_function (proxy_call));
 
-  task = g_task_new (self,
-                     cancellable,
-                     callback,
-                     callback_data);
-  g_task_run_in_thread (task, gairq_request_call_io_thread);
+  g_object_unref (proxy_call);
 
-  g_object_unref (task);
+  return ret;
 }
 
-JsonNode *
-gairq_request_call_finish (GairqRequest  *self,
-                           GAsyncResult  *res,
-                           GError       **error)
+/* Zero-copy path, @data is a NUL-terminated copy of the payload which
+ * gets taken over and ends up shared by the object's strings.
+ */
+static GairqAirObject *
+gairq_request_deserialize_in_place (gchar                *data,
+                                    gsize                 length,
+                                    GairqAirObjectFlags   flags,
+                                    GError              **error)
 {
-  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
-  g_return_val_if_fail (g_task_is_valid (res, self), NULL);
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  GairqJsonScanner scanner;
+  GairqAirObject *air = NULL;
+  gchar *status = NULL;
+  gchar *message = NULL;
+  gchar *key;
+  GBytes *payload;
 
-  return g_task_propagate_pointer (G_TASK (res), error);
+  gairq_json_scanner_init (&scanner, data, length);
+  payload = g_bytes_new_take (data, length + 1);
+
+  if (gairq_json_scanner_begin_object (&scanner))
+    {
+      while (gairq_json_scanner_next_member (&scanner, &key))
+        {
+          GairqJsonType type = gairq_json_scanner_peek (&scanner);
+
+          if (g_strcmp0 ("status", key) == 0 && type == GAIRQ_JSON_STRING)
+            gairq_json_scanner_read_string (&scanner, &status);
+          else if (g_strcmp0 ("data", key) == 0 && type == GAIRQ_JSON_OBJECT)
+            {
+              g_clear_object (&air);
+              air = gairq_air_object_new_from_scanner (&scanner, payload, flags);
+            }
+          else if (g_strcmp0 ("data", key) == 0 && type == GAIRQ_JSON_STRING)
+            gairq_json_scanner_read_string (&scanner, &message);
+          else
+            gairq_json_scanner_skip (&scanner);
+        }
+    }
+
+  if (scanner.failed)
+    {
+      g_clear_object (&air);
+      g_set_error (error, GAIRQ_REQUEST_ERROR, GAIRQ_REQUEST_ERROR_RESPONSE,
+                   "Malformed response at offset %" G_GSIZE_FORMAT,
+                   (gsize) (scanner.pos - data));
+    }
+  else if (g_strcmp0 (status, "ok") != 0 || air == NULL)
+    {
+      g_clear_object (&air);
+      gairq_request_set_response_error (error, message);
+    }
+
+  g_bytes_unref (payload);
+
+  return air;
 }
 
-GairqAirObject *
-gairq_request_default_deserialize (JsonNode  *root,
-                                   GError   **error)
+static GairqAirObject *
+gairq_request_deserialize_payload (const gchar          *payload,
+                                   gsize                 length,
+                                   GairqAirObjectFlags   flags,
+                                   GError              **error)
 {
-  JsonObject *object;
-  JsonNode *status, *data;
-  const gchar *status_msg;
-  gpointer ret = NULL;
+  GairqAirObject *ret = NULL;
 
-  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+  if (flags & GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY)
+    {
+      /* The only copy made, everything else refers to it */
+      gchar *data = g_malloc (length + 1);
 
-  object = json_node_get_object (root);
-  status = json_object_get_member (object, "status");
-  data = json_object_get_member (object, "data");
+      memcpy (data, payload, length);
+      data [length] = '\0';
 
-  status_msg = json_node_get_string (status);
-  if (g_strcmp0 (status_msg, "ok") == 0)
+      ret = gairq_request_deserialize_in_place (data, length, flags, error);
+    }
+  else
     {
-      ret = GAIRQ_AIR_OBJECT (json_gobject_deserialize (GAIRQ_TYPE_AIR_OBJECT, data));
+      JsonParser *parser = json_parser_new ();
+
+      if (json_parser_load_from_data (parser, payload, length, error))
+        ret = gairq_request_deserialize (json_parser_get_root (parser), flags, error);
+
+      g_object_unref (parser);
     }
-  else /* Set up new error message */
+
+  return ret;
+}
+
+/* Deserializes a response, or hands back the last object if it is the
+ * same response all over again.
+ */
+static GairqAirObject *
+gairq_request_process (GairqRequest      *self,
+                       guint              endpoint,
+                       const gchar       *payload,
+                       gsize              length,
+                       GairqResultFlags  *result_flags,
+                       GError           **error)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  gboolean skip_unchanged = g_atomic_int_get (&priv->skip_unchanged);
+  gboolean keep = skip_unchanged || g_atomic_int_get (&priv->cache_ttl) > 0;
+  GairqAirObject *ret = NULL;
+  guint64 hash = 0;
+
+  if (result_flags)
+    *result_flags = GAIRQ_RESULT_FLAGS_NONE;
+
+  if (skip_unchanged)
     {
-      if (error)
+      hash = gairq_hash64 (payload, length, 0);
+
+      g_mutex_lock (&priv->last_lock);
+      if (priv->last && priv->last_hash == hash && priv->last_length == length)
         {
-          const gchar *error_msg = json_node_get_string (data);
+          ret = g_object_ref (priv->last);
+          priv->last_time = g_get_monotonic_time ();
+        }
+      g_mutex_unlock (&priv->last_lock);
+
+      if (ret)
+        {
+          STATS_ADD (priv->stats.n_unchanged, 1);
+          if (result_flags)
+            *result_flags |= GAIRQ_RESULT_FLAGS_UNCHANGED;
+          return ret;
+        }
+    }
+
+  ret = gairq_request_deserialize_payload (payload, length,
+                                           g_atomic_int_get (&priv->object_flags), error);
 
-          g_set_error (error, GAIRQ_REQUEST_ERROR, 0,
-                       "Error-Response: %s", error_msg);
+  if (ret && keep)
+    {
+      g_mutex_lock (&priv->last_lock);
+      if (priv->endpoint == endpoint)
+        {
+          g_set_object (&priv->last, ret);
+          priv->last_hash = hash;
+          priv->last_length = length;
+          priv->last_time = g_get_monotonic_time ();
         }
+      g_mutex_unlock (&priv->last_lock);
     }
 
   return ret;
 }
+
+static GairqAirObject *
+gairq_request_fetch_upstream (GairqRequest      *self,
+                              GairqResultFlags  *result_flags,
+                              GError           **error)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  guint negative_ttl = g_atomic_int_get (&priv->negative_ttl);
+  guint endpoint = gairq_request_get_endpoint (self);
+  GairqDiskCache *disk_cache = NULL;
+  GairqAirObject *ret;
+  GError *local_error = NULL;
+  GBytes *payload;
+  gconstpointer data;
+  gchar *negative_key = NULL;
+  gchar *key = NULL;
+  gint64 started;
+  gsize length;
+
+  /* Known to be unknown, don't spend a round-trip on being told again.
+   * Stations are only unknown to the server that was asked.
+   */
+  if (negative_ttl > 0)
+    {
+      key = GAIRQ_REQUEST_GET_CLASS (self)->get_key (self);
+      if (key)
+        negative_key = g_strconcat (gairq_request_get_base_url (self), key, NULL);
+      if (gairq_negative_cache_contains (negative_key))
+        {
+          g_set_error (error, GAIRQ_REQUEST_ERROR, GAIRQ_REQUEST_ERROR_UNKNOWN_STATION,
+                       "Error-Response: Unknown station");
+          g_free (negative_key);
+          g_free (key);
+          return NULL;
+        }
+    }
+
+  started = gairq_request_begin_call (self);
+  payload = GAIRQ_REQUEST_GET_CLASS (self)->fetch_payload (self, error);
+  if (payload == NULL)
+    {
+      gairq_request_end_call (self, started, 0, TRUE);
+      g_free (negative_key);
+      g_free (key);
+      return NULL;
+    }
+
+  data = g_bytes_get_data (payload, &length);
+  gairq_request_end_call (self, started, length, FALSE);
+  ret = gairq_request_process (self, endpoint, data, length, result_flags, &local_error);
+
+  if (negative_key && g_error_matches (local_error, GAIRQ_REQUEST_ERROR,
+                                       GAIRQ_REQUEST_ERROR_UNKNOWN_STATION))
+    gairq_negative_cache_add (negative_key, negative_ttl);
+  if (local_error)
+    g_propagate_error (error, local_error);
+
+  if (ret && gairq_request_get_endpoint (self) == endpoint)
+    disk_cache = g_atomic_pointer_get (&priv->disk_cache);
+
+  if (disk_cache)
+    {
+      if (key == NULL)
+        key = GAIRQ_REQUEST_GET_CLASS (self)->get_key (self);
+      if (key && !gairq_disk_cache_store (disk_cache, key, payload, &local_error))
+        {
+          gairq_debug ("Failed to store the response: %s", local_error->message);
+          g_clear_error (&local_error);
+        }
+    }
+
+  g_bytes_unref (payload);
+  g_free (negative_key);
+  g_free (key);
+
+  return ret;
+}
+
+/* Fills the empty cache with what an earlier run kept on disk. Its age
+ * carries over, a restart doesn't make a response any fresher.
+ */
+static void
+gairq_request_warm_from_disk (GairqRequest *self)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  GairqDiskCache *disk_cache = NULL;
+  GairqAirObject *air;
+  GBytes *payload = NULL;
+  gchar *key = NULL;
+  gint64 stored_at, age;
+  guint endpoint;
+
+  g_mutex_lock (&priv->last_lock);
+  if (!priv->warmed && priv->last == NULL)
+    disk_cache = g_atomic_pointer_get (&priv->disk_cache);
+  priv->warmed = TRUE;
+  endpoint = priv->endpoint;
+  g_mutex_unlock (&priv->last_lock);
+
+  if (disk_cache == NULL)
+    return;
+
+  key = GAIRQ_REQUEST_GET_CLASS (self)->get_key (self);
+  if (key)
+    payload = gairq_disk_cache_lookup (disk_cache, key, &stored_at);
+
+  if (payload)
+    {
+      age = g_get_real_time () - stored_at;
+      if (age >= 0 && age < atomic_ms_to_us (&priv->cache_ttl) +
+                            atomic_ms_to_us (&priv->serve_stale))
+        {
+          gconstpointer data;
+          gsize length;
+
+          data = g_bytes_get_data (payload, &length);
+          air = gairq_request_process (self, endpoint, data, length, NULL, NULL);
+          if (air)
+            {
+              g_mutex_lock (&priv->last_lock);
+              if (priv->last == air)
+                priv->last_time = g_get_monotonic_time () - age;
+              g_mutex_unlock (&priv->last_lock);
+
+              g_object_unref (air);
+            }
+        }
+
+      g_bytes_unref (payload);
+    }
+
+  g_free (key);
+}
+
+static gboolean
+gairq_request_run_in_thread (GairqRequest    *self,
+                             GairqPriority    priority,
+                             GTask           *task,
+                             GTaskThreadFunc  task_func)
+{
+  GairqExecutor *executor = g_atomic_pointer_get (&GET_PRIVATE (self)->executor);
+
+  return gairq_executor_run_in_thread (executor ? executor : gairq_executor_get_default (),
+                                       priority, task, task_func);
+}
+
+static void
+gairq_request_refresh_thread (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+  GairqRequest *self = GAIRQ_REQUEST (source_object);
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  GairqAirObject *air;
+  GError *error = NULL;
+
+  /* A failure keeps serving what there is until it runs out */
+  air = gairq_request_fetch_upstream (self, NULL, &error);
+  if (air == NULL)
+    {
+      gairq_debug ("Failed to refresh: %s", error ? error->message : "unknown");
+      g_clear_error (&error);
+    }
+  g_clear_object (&air);
+
+  g_mutex_lock (&priv->last_lock);
+  priv->refreshing = FALSE;
+  g_mutex_unlock (&priv->last_lock);
+
+  g_task_return_boolean (task, TRUE);
+}
+
+/* Hands out the last object while it is fresh enough, kicking off a
+ * background refresh once it nears or passes the TTL.
+ */
+static GairqAirObject *
+gairq_request_lookup_cache (GairqRequest     *self,
+                            GairqResultFlags *result_flags)
+{
+  GairqRequestPrivate *priv = GET_PRIVATE (self);
+  GairqAirObject *ret = NULL;
+  gboolean refresh = FALSE;
+  gint64 ttl, age;
+
+  ttl = atomic_ms_to_us (&priv->cache_ttl);
+  if (ttl == 0)
+    return NULL;
+
+  gairq_request_warm_from_disk (self);
+
+  g_mutex_lock (&priv->last_lock);
+  age = g_get_monotonic_time () - priv->last_time;
+
+  if (priv->last && age < ttl + atomic_ms_to_us (&priv->serve_stale))
+    {
+      ret = g_object_ref (priv->last);
+
+      if (result_flags)
+        {
+          *result_flags |= GAIRQ_RESULT_FLAGS_CACHED;
+          if (age >= ttl)
+            *result_flags |= GAIRQ_RESULT_FLAGS_STALE;
+        }
+
+      if (age >= ttl * priv->refresh_ahead && !priv->refreshing)
+        refresh = priv->refreshing = TRUE;
+    }
+  g_mutex_unlock (&priv->last_lock);
+
+  if (refresh)
+    {
+      GTask *task = g_task_new (self, NULL, NULL, NULL);
+
+      g_task_set_source_tag (task, gairq_request_refresh_thread);
+
+      /* Nobody waits on it. Turned away, the next hit gets to try again */
+      if (!gairq_request_run_in_thread (self, GAIRQ_PRIORITY_BULK, task,
+                                        gairq_request_refresh_thread))
+        {
+          g_mutex_lock (&priv->last_lock);
+          priv->refreshing = FALSE;
+          g_mutex_unlock (&priv->last_lock);
+        }
+      g_object_unref (task);
+    }
+
+  return ret;
+}
+
+typedef struct
+{
+  GairqAirObject *    air;
+  GairqResultFlags    flags;
+} PollResult;
+
+static void
+poll_result_free (PollResult *result)
+{
+  g_clear_object (&result->air);
+  g_slice_free (PollResult, result);
+}
+
+static void
+gairq_request_poll_io_thread (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+  GairqRequest *self = GAIRQ_REQUEST (source_object);
+  GError *error = NULL;
+  PollResult *result;
+
+  result = g_slice_new0 (PollResult);
+  result->air = gairq_request_poll_sync (self, &result->flags, &error);
+
+  if (result->air)
+    g_task_return_pointer (task, result, (GDestroyNotify) poll_result_free);
+  else
+    {
+      poll_result_free (result);
+      g_task_return_error (task, error);
+    }
+}
+
+static void
+gairq_request_call_io_thread (GTask        *task,
+                              gpointer      source_object,
+                              gpointer      task_data,
+                              GCancellable *cancellable)
+{
+  GairqRequest *self = GAIRQ_REQUEST (source_object);
+  GError *error = NULL;
+  JsonNode *root;
+
+  root = gairq_request_call_sync (self, &error);
+  if (root)
+    g_task_return_pointer (task, root, (GDestroyNotify) json_node_unref);
+  else
+    {
+      /* The task has to be returned either way */
+      if (error == NULL)
+        g_set_error (&error, G_IO_ERROR, G_IO_ERROR_FAILED, "No response");
+
+      g_task_return_error (task, error);
+    }
+}
+
+/* --- Private APIs --- */
+/* Drops what was cached for the endpoint a subclass asked until now.
+ * Responses still on their way from it are not kept either.
+ */
+void
+gairq_request_endpoint_changed (GairqRequest *self)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+
+  priv = GET_PRIVATE (self);
+
+  g_mutex_lock (&priv->last_lock);
+  g_atomic_int_inc (&priv->endpoint);
+  g_clear_object (&priv->last);
+  priv->last_hash = 0;
+  priv->last_length = 0;
+  priv->last_time = 0;
+  priv->warmed = FALSE;
+  g_mutex_unlock (&priv->last_lock);
+}
+
+/* --- Public APIs --- */
+GairqRequest *
+gairq_request_new (const gchar *access_token)
+{
+  g_return_val_if_fail (access_token != NULL, NULL);
+
+  return g_object_new (GAIRQ_TYPE_REQUEST,
+                       "token", access_token,
+                       NULL);
+}
+
+JsonNode *
+gairq_request_call_sync (GairqRequest  *self,
+                         GError       **error)
+{
+  RestProxyCall *proxy_call;
+  JsonNode *ret = NULL;
+  gint64 started;
+
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  started = gairq_request_begin_call (self);
+  proxy_call = gairq_request_invoke (self, error);
+  gairq_request_end_call (self, started,
+                          proxy_call ? rest_proxy_call_get_payload_length (proxy_call) : 0,
+                          proxy_call == NULL);
+  if (proxy_call)
+    {
+      const gchar *payload;
+      JsonParser *parser;
+
+      payload = rest_proxy_call_get_payload (proxy_call);
+      parser = json_parser_new ();
+
+      if (json_parser_load_from_data (parser, payload, -1, error))
+        ret = json_parser_steal_root (parser);
+
+      g_object_unref (parser);
+      g_object_unref (proxy_call);
+    }
+
+  return ret;
+}
+
+void
+gairq_request_call_async (GairqRequest        *self,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             callback_data)
+{
+  GTask *task;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self,
+                     cancellable,
+                     callback,
+                     callback_data);
+  gairq_request_run_in_thread (self, g_atomic_int_get (&GET_PRIVATE (self)->priority), task,
+                               gairq_request_call_io_thread);
+
+  g_object_unref (task);
+}
+
+JsonNode *
+gairq_request_call_finish (GairqRequest  *self,
+                           GAsyncResult  *res,
+                           GError       **error)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (res, self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  return g_task_propagate_pointer (G_TASK (res), error);
+}
+
+void
+gairq_request_set_object_flags (GairqRequest        *self,
+                                GairqAirObjectFlags  flags)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+
+  priv = GET_PRIVATE (self);
+  if ((GairqAirObjectFlags) g_atomic_int_get (&priv->object_flags) == flags)
+    return;
+
+  g_atomic_int_set (&priv->object_flags, flags);
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_OBJECT_FLAGS]);
+}
+
+GairqAirObjectFlags
+gairq_request_get_object_flags (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), GAIRQ_AIR_OBJECT_FLAGS_NONE);
+
+  return g_atomic_int_get (&GET_PRIVATE (self)->object_flags);
+}
+
+void
+gairq_request_set_skip_unchanged (GairqRequest *self,
+                                  gboolean      skip_unchanged)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+
+  priv = GET_PRIVATE (self);
+  skip_unchanged = !!skip_unchanged;
+  if (g_atomic_int_get (&priv->skip_unchanged) == skip_unchanged)
+    return;
+
+  g_atomic_int_set (&priv->skip_unchanged, skip_unchanged);
+  if (!skip_unchanged && g_atomic_int_get (&priv->cache_ttl) == 0)
+    {
+      g_mutex_lock (&priv->last_lock);
+      g_clear_object (&priv->last);
+      g_mutex_unlock (&priv->last_lock);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_SKIP_UNCHANGED]);
+}
+
+gboolean
+gairq_request_get_skip_unchanged (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), FALSE);
+
+  return g_atomic_int_get (&GET_PRIVATE (self)->skip_unchanged);
+}
+
+void
+gairq_request_set_cache_ttl (GairqRequest *self,
+                             guint         ttl_ms)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+
+  priv = GET_PRIVATE (self);
+  if ((guint) g_atomic_int_get (&priv->cache_ttl) == ttl_ms)
+    return;
+
+  g_atomic_int_set (&priv->cache_ttl, ttl_ms);
+  if (ttl_ms == 0 && !g_atomic_int_get (&priv->skip_unchanged))
+    {
+      g_mutex_lock (&priv->last_lock);
+      g_clear_object (&priv->last);
+      g_mutex_unlock (&priv->last_lock);
+    }
+
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_CACHE_TTL]);
+}
+
+guint
+gairq_request_get_cache_ttl (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), 0);
+
+  return g_atomic_int_get (&GET_PRIVATE (self)->cache_ttl);
+}
+
+void
+gairq_request_set_refresh_ahead (GairqRequest *self,
+                                 gdouble       refresh_ahead)
+{
+  GairqRequestPrivate *priv;
+  gboolean changed;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (refresh_ahead >= 0.0 && refresh_ahead <= 1.0);
+
+  priv = GET_PRIVATE (self);
+
+  g_mutex_lock (&priv->last_lock);
+  changed = priv->refresh_ahead != refresh_ahead;
+  priv->refresh_ahead = refresh_ahead;
+  g_mutex_unlock (&priv->last_lock);
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_REFRESH_AHEAD]);
+}
+
+gdouble
+gairq_request_get_refresh_ahead (GairqRequest *self)
+{
+  GairqRequestPrivate *priv;
+  gdouble ret;
+
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), 0.0);
+
+  priv = GET_PRIVATE (self);
+
+  g_mutex_lock (&priv->last_lock);
+  ret = priv->refresh_ahead;
+  g_mutex_unlock (&priv->last_lock);
+
+  return ret;
+}
+
+void
+gairq_request_set_serve_stale (GairqRequest *self,
+                               guint         stale_ms)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+
+  priv = GET_PRIVATE (self);
+  if ((guint) g_atomic_int_get (&priv->serve_stale) == stale_ms)
+    return;
+
+  g_atomic_int_set (&priv->serve_stale, stale_ms);
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_SERVE_STALE]);
+}
+
+guint
+gairq_request_get_serve_stale (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), 0);
+
+  return g_atomic_int_get (&GET_PRIVATE (self)->serve_stale);
+}
+
+void
+gairq_request_set_negative_ttl (GairqRequest *self,
+                                guint         ttl_ms)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+
+  priv = GET_PRIVATE (self);
+  if ((guint) g_atomic_int_get (&priv->negative_ttl) == ttl_ms)
+    return;
+
+  g_atomic_int_set (&priv->negative_ttl, ttl_ms);
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_NEGATIVE_TTL]);
+}
+
+guint
+gairq_request_get_negative_ttl (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), 0);
+
+  return g_atomic_int_get (&GET_PRIVATE (self)->negative_ttl);
+}
+
+void
+gairq_request_set_disk_cache (GairqRequest   *self,
+                              GairqDiskCache *disk_cache)
+{
+  GairqRequestPrivate *priv;
+  gboolean changed;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (disk_cache == NULL || GAIRQ_IS_DISK_CACHE (disk_cache));
+
+  priv = GET_PRIVATE (self);
+
+  g_mutex_lock (&priv->set_lock);
+  changed = gairq_request_swap_object_locked (self, (gpointer *) &priv->disk_cache, disk_cache);
+  g_mutex_unlock (&priv->set_lock);
+
+  if (changed)
+    {
+      g_mutex_lock (&priv->last_lock);
+      priv->warmed = FALSE;
+      g_mutex_unlock (&priv->last_lock);
+    }
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_DISK_CACHE]);
+}
+
+GairqDiskCache *
+gairq_request_get_disk_cache (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+
+  return g_atomic_pointer_get (&GET_PRIVATE (self)->disk_cache);
+}
+
+void
+gairq_request_set_executor (GairqRequest  *self,
+                            GairqExecutor *executor)
+{
+  GairqRequestPrivate *priv;
+  gboolean changed;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (executor == NULL || GAIRQ_IS_EXECUTOR (executor));
+
+  priv = GET_PRIVATE (self);
+
+  g_mutex_lock (&priv->set_lock);
+  changed = gairq_request_swap_object_locked (self, (gpointer *) &priv->executor, executor);
+  g_mutex_unlock (&priv->set_lock);
+
+  if (changed)
+    g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_EXECUTOR]);
+}
+
+GairqExecutor *
+gairq_request_get_executor (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+
+  return g_atomic_pointer_get (&GET_PRIVATE (self)->executor);
+}
+
+void
+gairq_request_set_priority (GairqRequest  *self,
+                            GairqPriority  priority)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (priority < N_GAIRQ_PRIORITIES);
+
+  priv = GET_PRIVATE (self);
+  if ((GairqPriority) g_atomic_int_get (&priv->priority) == priority)
+    return;
+
+  g_atomic_int_set (&priv->priority, priority);
+  g_object_notify_by_pspec (G_OBJECT (self), properties [PROP_PRIORITY]);
+}
+
+GairqPriority
+gairq_request_get_priority (GairqRequest *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), GAIRQ_PRIORITY_NORMAL);
+
+  return g_atomic_int_get (&GET_PRIVATE (self)->priority);
+}
+
+const gchar *
+gairq_request_get_base_url (GairqRequest *self)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+
+  priv = GET_PRIVATE (self);
+
+  return priv->base_url ? priv->base_url : API_URL;
+}
+
+void
+gairq_request_get_stats (GairqRequest      *self,
+                         GairqRequestStats *stats)
+{
+  GairqRequestPrivate *priv;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (stats != NULL);
+
+  priv = GET_PRIVATE (self);
+
+  /* Each counter is read on its own, they may be a call apart */
+  stats->n_in_flight = g_atomic_int_get (&priv->stats.n_in_flight);
+  stats->n_calls = STATS_GET (priv->stats.n_calls);
+  stats->n_failed = STATS_GET (priv->stats.n_failed);
+  stats->n_polls = STATS_GET (priv->stats.n_polls);
+  stats->n_cached = STATS_GET (priv->stats.n_cached);
+  stats->n_unchanged = STATS_GET (priv->stats.n_unchanged);
+  stats->bytes_received = STATS_GET (priv->stats.bytes_received);
+  stats->call_time = STATS_GET (priv->stats.call_time);
+}
+
+GairqAirObject *
+gairq_request_process_payload (GairqRequest      *self,
+                               GBytes            *payload,
+                               GairqResultFlags  *result_flags,
+                               GError           **error)
+{
+  gconstpointer data;
+  gsize length;
+
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+  g_return_val_if_fail (payload != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  data = g_bytes_get_data (payload, &length);
+
+  return gairq_request_process (self, gairq_request_get_endpoint (self),
+                                data, length, result_flags, error);
+}
+
+GairqAirObject *
+gairq_request_poll_sync (GairqRequest      *self,
+                         GairqResultFlags  *result_flags,
+                         GError           **error)
+{
+  GairqRequestPrivate *priv;
+  GairqAirObject *ret;
+
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  priv = GET_PRIVATE (self);
+
+  if (result_flags)
+    *result_flags = GAIRQ_RESULT_FLAGS_NONE;
+
+  ret = gairq_request_lookup_cache (self, result_flags);
+
+  STATS_ADD (priv->stats.n_polls, 1);
+  if (ret)
+    STATS_ADD (priv->stats.n_cached, 1);
+
+  if (ret)
+    return ret;
+
+  return gairq_request_fetch_upstream (self, result_flags, error);
+}
+
+void
+gairq_request_poll_async (GairqRequest        *self,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             callback_data)
+{
+  GTask *task;
+
+  g_return_if_fail (GAIRQ_IS_REQUEST (self));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (self, cancellable, callback, callback_data);
+  g_task_set_source_tag (task, gairq_request_poll_async);
+  gairq_request_run_in_thread (self, g_atomic_int_get (&GET_PRIVATE (self)->priority), task,
+                               gairq_request_poll_io_thread);
+
+  g_object_unref (task);
+}
+
+GairqAirObject *
+gairq_request_poll_finish (GairqRequest      *self,
+                           GAsyncResult      *res,
+                           GairqResultFlags  *result_flags,
+                           GError           **error)
+{
+  PollResult *result;
+  GairqAirObject *ret;
+
+  g_return_val_if_fail (GAIRQ_IS_REQUEST (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (res, self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (result_flags)
+    *result_flags = GAIRQ_RESULT_FLAGS_NONE;
+
+  result = g_task_propagate_pointer (G_TASK (res), error);
+  if (result == NULL)
+    return NULL;
+
+  if (result_flags)
+    *result_flags = result->flags;
+  ret = g_steal_pointer (&result->air);
+  poll_result_free (result);
+
+  return ret;
+}
+
+GairqAirObject *
+gairq_request_default_deserialize (JsonNode  *root,
+                                   GError   **error)
+{
+  return gairq_request_deserialize (root, GAIRQ_AIR_OBJECT_FLAGS_NONE, error);
+}
+
+GairqAirObject *
+gairq_request_deserialize (JsonNode             *root,
+                           GairqAirObjectFlags   flags,
+                           GError              **error)
+{
+  JsonObject *object;
+  JsonNode *status, *data;
+  const gchar *status_msg;
+  gpointer ret = NULL;
+
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  object = json_node_get_object (root);
+  status = json_object_get_member (object, "status");
+  data = json_object_get_member (object, "data");
+
+  status_msg = json_node_get_string (status);
+  if (g_strcmp0 (status_msg, "ok") == 0)
+    {
+      ret = gairq_air_object_new_from_data (data, flags);
+    }
+  else /* Set up new error message */
+    {
+      if (error)
+        {
+          const gchar *error_msg = json_node_get_string (data);
+
+          gairq_request_set_response_error (error, error_msg);
+        }
+    }
+
+  return ret;
+}
+
+GairqAirObject *
+gairq_request_deserialize_bytes (GBytes               *payload,
+                                 GairqAirObjectFlags   flags,
+                                 GError              **error)
+{
+  gconstpointer data;
+  gsize length;
+
+  g_return_val_if_fail (payload != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  data = g_bytes_get_data (payload, &length);
+
+  return gairq_request_deserialize_payload (data, length, flags, error);
+}
+
+/* --- Fetch, request and deserialize in one go --- */
+GairqAirObject *
+gairq_request_fetch_sync (GairqRequest  *self,
+                          GError       **error)
+{
+  return gairq_request_poll_sync (self, NULL, error);
+}
+
+void
+gairq_request_fetch_async (GairqRequest        *self,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             callback_data)
+{
+  gairq_request_poll_async (self, cancellable, callback, callback_data);
+}
+
+GairqAirObject *
+gairq_request_fetch_finish (GairqRequest  *self,
+                            GAsyncResult  *res,
+                            GError       **error)
+{
+  return gairq_request_poll_finish (self, res, NULL, error);
+}
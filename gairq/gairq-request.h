@@ -31,12 +31,41 @@
 #include <rest/rest-proxy.h>
 
 #include <gairq/gairq-air-object.h>
+#include <gairq/gairq-disk-cache.h>
+#include <gairq/gairq-executor.h>
 
 G_BEGIN_DECLS
 
 #define GAIRQ_TYPE_REQUEST (gairq_request_get_type ())
 G_DECLARE_DERIVABLE_TYPE (GairqRequest, gairq_request, GAIRQ, REQUEST, GObject)
 
+/* UNCHANGED tells the response was the same as the previous one and the
+ * object is the one handed out back then, see GairqRequest:skip-unchanged.
+ * CACHED means no request was waited for, see GairqRequest:cache-ttl, and
+ * STALE that the object outlived the TTL while a refresh is under way.
+ */
+typedef enum {
+  GAIRQ_RESULT_FLAGS_NONE       = 0,
+  GAIRQ_RESULT_FLAGS_UNCHANGED  = 1 << 0,
+  GAIRQ_RESULT_FLAGS_CACHED     = 1 << 1,
+  GAIRQ_RESULT_FLAGS_STALE      = 1 << 2,
+} GairqResultFlags;
+
+typedef struct _GairqRequestStats GairqRequestStats;
+
+/* Times are in microseconds */
+struct _GairqRequestStats
+{
+  guint     n_in_flight;      /* Round-trips under way */
+  guint64   n_calls;          /* Round-trips made */
+  guint64   n_failed;         /* Of which got no response back */
+  guint64   n_polls;
+  guint64   n_cached;         /* Polls answered from the cache */
+  guint64   n_unchanged;      /* Responses the same as the last one */
+  guint64   bytes_received;
+  gint64    call_time;        /* Spent waiting on responses, summed */
+};
+
 struct _GairqRequestClass
 {
   GObjectClass  parent_class;
@@ -48,12 +77,24 @@ struct _GairqRequestClass
                                    gpointer        user_data,
                                    GError        **error);
 
-  gpointer      _reserved1;
-  gpointer      _reserved2;
+  /* Gets the raw response, the default makes the REST call */
+  GBytes *      (*fetch_payload)  (GairqRequest   *self,
+                                   GError        **error);
+
+  /* Names the endpoint for the negative cache, the default is the
+   * function path set_functions() picks
+   */
+  gchar *       (*get_key)        (GairqRequest   *self);
+
   gpointer      _reserved3;
   gpointer      _reserved4;
 };
 
+/* One request may be used from many threads at once: calls, polls and
+ * the setters are all safe to run concurrently, no request per thread is
+ * needed. The threads share its proxy and connections. A setting changed
+ * while calls are running applies from the next one to read it on.
+ */
 GairqRequest *    gairq_request_new                 (const gchar *access_token);
 JsonNode *        gairq_request_call_sync           (GairqRequest  *self,
                                                      GError       **error);
@@ -64,8 +105,59 @@ void              gairq_request_call_async          (GairqRequest        *self,
 JsonNode *        gairq_request_call_finish         (GairqRequest  *self,
                                                      GAsyncResult  *res,
                                                      GError       **error);
+void              gairq_request_set_object_flags    (GairqRequest        *self,
+                                                     GairqAirObjectFlags  flags);
+GairqAirObjectFlags gairq_request_get_object_flags  (GairqRequest *self);
+void              gairq_request_set_skip_unchanged  (GairqRequest *self,
+                                                     gboolean      skip_unchanged);
+gboolean          gairq_request_get_skip_unchanged  (GairqRequest *self);
+void              gairq_request_set_cache_ttl       (GairqRequest *self,
+                                                     guint         ttl_ms);
+guint             gairq_request_get_cache_ttl       (GairqRequest *self);
+void              gairq_request_set_refresh_ahead   (GairqRequest *self,
+                                                     gdouble       refresh_ahead);
+gdouble           gairq_request_get_refresh_ahead   (GairqRequest *self);
+void              gairq_request_set_serve_stale     (GairqRequest *self,
+                                                     guint         stale_ms);
+guint             gairq_request_get_serve_stale     (GairqRequest *self);
+void              gairq_request_set_negative_ttl    (GairqRequest *self,
+                                                     guint         ttl_ms);
+guint             gairq_request_get_negative_ttl    (GairqRequest *self);
+void              gairq_request_set_disk_cache      (GairqRequest   *self,
+                                                     GairqDiskCache *disk_cache);
+GairqDiskCache *  gairq_request_get_disk_cache      (GairqRequest   *self);
+void              gairq_request_set_executor        (GairqRequest  *self,
+                                                     GairqExecutor *executor);
+GairqExecutor *   gairq_request_get_executor        (GairqRequest  *self);
+void              gairq_request_set_priority        (GairqRequest  *self,
+                                                     GairqPriority  priority);
+GairqPriority     gairq_request_get_priority        (GairqRequest  *self);
+const gchar *     gairq_request_get_base_url        (GairqRequest  *self);
+void              gairq_request_get_stats           (GairqRequest      *self,
+                                                     GairqRequestStats *stats);
+GairqAirObject *  gairq_request_poll_sync           (GairqRequest      *self,
+                                                     GairqResultFlags  *result_flags,
+                                                     GError           **error);
+void              gairq_request_poll_async          (GairqRequest        *self,
+                                                     GCancellable        *cancellable,
+                                                     GAsyncReadyCallback  callback,
+                                                     gpointer             callback_data);
+GairqAirObject *  gairq_request_poll_finish         (GairqRequest      *self,
+                                                     GAsyncResult      *res,
+                                                     GairqResultFlags  *result_flags,
+                                                     GError           **error);
+GairqAirObject *  gairq_request_process_payload     (GairqRequest      *self,
+                                                     GBytes            *payload,
+                                                     GairqResultFlags  *result_flags,
+                                                     GError           **error);
 GairqAirObject *  gairq_request_default_deserialize (JsonNode  *root,
                                                      GError   **error);
+GairqAirObject *  gairq_request_deserialize         (JsonNode             *root,
+                                                     GairqAirObjectFlags   flags,
+                                                     GError              **error);
+GairqAirObject *  gairq_request_deserialize_bytes   (GBytes               *payload,
+                                                     GairqAirObjectFlags   flags,
+                                                     GError              **error);
 
 G_END_DECLS
 
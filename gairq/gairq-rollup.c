@@ -0,0 +1,961 @@
+/* gairq-rollup.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-rollup.h"
+#include "gairq-executor.h"
+#include "gairq-utils.h"
+
+#include <math.h>
+
+/* Every series keeps one sorted array of buckets per resolution. Readings
+ * mostly come in time order, so a push usually updates or appends the
+ * last bucket of each. A range is covered by the coarsest buckets that
+ * fit inside it: the months in its middle, the days before and after
+ * them, and for min/max/sum/count the hours at its very ends. A year
+ * then reads a few dozen buckets whatever the sampling rate.
+ *
+ * Hours and days are only kept for their retention behind the latest
+ * bucket of the series, months for good. The ends of a range reaching
+ * further back are read from the store's raw readings instead.
+ */
+#define SERIES_KEY(_idx, _pollutant) ((_idx) * N_GAIRQ_POLLUTANTS + (_pollutant))
+
+#define HOUR                3600
+#define DAY                 86400
+#define STATIONS_PER_THREAD 8
+
+#define DEFAULT_HOUR_RETENTION  (31 * DAY)
+#define DEFAULT_DAY_RETENTION   (366 * DAY)
+
+/* Keeps the calendar math far from overflowing on open ended ranges */
+#define TIME_LIMIT          (G_GINT64_CONSTANT (1) << 40)
+
+typedef struct
+{
+  gint64          start;
+  gdouble         min;
+  gdouble         max;
+  gdouble         sum;
+  guint64         count;
+  GairqSketch *   sketch;     /* Days and months only */
+} Bucket;
+
+typedef struct
+{
+  gint64          key;
+  gint64          idx;
+  GairqPollutant  pollutant;
+  GArray *        levels [N_GAIRQ_ROLLUP_RESOLUTIONS];
+  gint64          horizon [N_GAIRQ_ROLLUP_RESOLUTIONS];   /* Buckets before it were dropped */
+} Series;
+
+/* What one part of a query gathered over its share of the stations */
+typedef struct
+{
+  GairqRollup *       self;
+  const gint64 *      idx;
+  guint               n_idx;
+  guint               first;
+  guint               step;
+  GairqPollutant      pollutant;
+  gint64              from;
+  gint64              to;
+  GairqRollupBucket   bucket;
+  GairqSketch *       sketch;     /* NULL when only the bucket is wanted */
+  guint64             n_read;
+  guint64             n_samples;  /* Read from the store */
+} Collect;
+
+/* A query over many stations split into parts for the executor. Jobs
+ * and the caller claim parts one at a time, the caller taking whatever
+ * no worker got to, so it only ever waits on parts already running and
+ * never on a free worker.
+ */
+typedef struct
+{
+  gint          ref_count;
+  Collect *     parts;
+  guint         n_parts;
+  gint          next;         /* The next part to claim */
+  guint         n_done;
+  GMutex        lock;
+  GCond         cond;
+} Split;
+
+struct _GairqRollup
+{
+  GObject             parent_instance;
+
+  GMutex              lock;
+  GHashTable *        series;
+  gdouble             accuracy;
+  gint64              retention [N_GAIRQ_ROLLUP_RESOLUTIONS];   /* 0 to keep every bucket */
+  GairqSeriesStore *  store;
+  GairqExecutor *     executor;
+  guint64             n_buckets;
+  guint64             n_buckets_read;
+  guint64             n_samples_read;
+};
+
+G_DEFINE_TYPE (GairqRollup, gairq_rollup, G_TYPE_OBJECT)
+
+
+static inline gint64
+floor_div (gint64 a,
+           gint64 b)
+{
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+
+static inline gint64
+floor_to (gint64 time,
+          gint64 unit)
+{
+  return floor_div (time, unit) * unit;
+}
+
+static inline gint64
+ceil_to (gint64 time,
+         gint64 unit)
+{
+  return -floor_to (-time, unit);
+}
+
+static gint64
+month_floor (gint64 time)
+{
+  gint64 days = floor_div (time, DAY), y;
+  guint m, d;
+
+  gairq_civil_from_days (days, &y, &m, &d);
+
+  return (days - (d - 1)) * DAY;
+}
+
+static gint64
+month_ceil (gint64 time)
+{
+  gint64 start = month_floor (time), y;
+  guint m, d;
+
+  if (start == time)
+    return time;
+
+  gairq_civil_from_days (start / DAY, &y, &m, &d);
+
+  return m == 12 ? gairq_days_from_civil (y + 1, 1, 1) * DAY : gairq_days_from_civil (y, m + 1, 1) * DAY;
+}
+
+static gint64
+bucket_start (GairqRollupResolution resolution,
+              gint64                time)
+{
+  switch (resolution)
+    {
+    case GAIRQ_ROLLUP_HOUR:
+      return floor_to (time, HOUR);
+    case GAIRQ_ROLLUP_DAY:
+      return floor_to (time, DAY);
+    case GAIRQ_ROLLUP_MONTH:
+    default:
+      return month_floor (time);
+    }
+}
+
+static void
+bucket_clear (gpointer data)
+{
+  Bucket *bucket = data;
+
+  g_clear_pointer (&bucket->sketch, gairq_sketch_free);
+}
+
+static Series *
+series_new (gint64         idx,
+            GairqPollutant pollutant)
+{
+  Series *series = g_slice_new0 (Series);
+  guint i;
+
+  series->key = SERIES_KEY (idx, pollutant);
+  series->idx = idx;
+  series->pollutant = pollutant;
+  for (i = 0; i < N_GAIRQ_ROLLUP_RESOLUTIONS; i++)
+    {
+      series->levels [i] = g_array_new (FALSE, FALSE, sizeof (Bucket));
+      g_array_set_clear_func (series->levels [i], bucket_clear);
+      series->horizon [i] = G_MININT64;
+    }
+
+  return series;
+}
+
+static void
+series_free (gpointer data)
+{
+  Series *series = data;
+  guint i;
+
+  for (i = 0; i < N_GAIRQ_ROLLUP_RESOLUTIONS; i++)
+    g_array_unref (series->levels [i]);
+
+  g_slice_free (Series, series);
+}
+
+/* Index of the first bucket starting at or after @start */
+static guint
+level_search (GArray *level,
+              gint64  start)
+{
+  guint lo = 0, hi = level->len;
+
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (level, Bucket, mid).start < start)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static void
+bucket_add (GairqRollupBucket *bucket,
+            gdouble            min,
+            gdouble            max,
+            gdouble            sum,
+            guint64            count)
+{
+  if (count == 0)
+    return;
+
+  bucket->min = bucket->count ? MIN (bucket->min, min) : min;
+  bucket->max = bucket->count ? MAX (bucket->max, max) : max;
+  bucket->sum += sum;
+  bucket->count += count;
+}
+
+/* Folds the buckets of @level starting within [from, to) into @collect */
+static void
+level_collect (GArray  *level,
+               gint64   from,
+               gint64   to,
+               Collect *collect)
+{
+  guint i;
+
+  for (i = level_search (level, from); i < level->len; i++)
+    {
+      Bucket *bucket = &g_array_index (level, Bucket, i);
+
+      if (bucket->start >= to)
+        break;
+
+      bucket_add (&collect->bucket, bucket->min, bucket->max, bucket->sum, bucket->count);
+      if (collect->sketch && bucket->sketch)
+        gairq_sketch_merge (collect->sketch, bucket->sketch);
+      collect->n_read++;
+    }
+}
+
+/* Folds the stored readings of @series within [from, to) into @collect */
+static void
+store_collect (GairqSeriesStore *store,
+               Series           *series,
+               gint64            from,
+               gint64            to,
+               Collect          *collect)
+{
+  g_autoptr(GArray) samples = NULL;
+  guint i;
+
+  samples = gairq_series_store_query (store, series->idx, series->pollutant, from, to);
+
+  for (i = 0; i < samples->len; i++)
+    {
+      gdouble value = g_array_index (samples, GairqSeriesSample, i).value;
+
+      if (isnan (value))
+        continue;
+
+      bucket_add (&collect->bucket, value, value, value, 1);
+      if (collect->sketch)
+        gairq_sketch_add (collect->sketch, value);
+    }
+
+  collect->n_samples += samples->len;
+}
+
+/* Like level_collect (), but what the level dropped past its retention
+ * is read back from the store when there is one.
+ */
+static void
+series_level_collect (Series                *series,
+                      GairqRollupResolution  resolution,
+                      gint64                 from,
+                      gint64                 to,
+                      Collect               *collect)
+{
+  gint64 horizon = series->horizon [resolution];
+
+  if (from < horizon && collect->self->store)
+    store_collect (collect->self->store, series, from, MIN (to, horizon), collect);
+
+  level_collect (series->levels [resolution], MAX (from, horizon), to, collect);
+}
+
+static void
+series_collect (Series  *series,
+                Collect *collect)
+{
+  gint64 from = CLAMP (collect->from, -TIME_LIMIT, TIME_LIMIT);
+  gint64 to = CLAMP (collect->to, -TIME_LIMIT, TIME_LIMIT);
+  gint64 m1, m2;
+
+  if (collect->sketch == NULL)
+    {
+      gint64 d1, d2;
+
+      from = floor_to (from, HOUR);
+      to = ceil_to (to, HOUR);
+      d1 = ceil_to (from, DAY);
+      d2 = floor_to (to, DAY);
+
+      if (d1 >= d2)
+        {
+          series_level_collect (series, GAIRQ_ROLLUP_HOUR, from, to, collect);
+          return;
+        }
+
+      series_level_collect (series, GAIRQ_ROLLUP_HOUR, from, d1, collect);
+      series_level_collect (series, GAIRQ_ROLLUP_HOUR, d2, to, collect);
+      from = d1;
+      to = d2;
+    }
+  else
+    {
+      from = floor_to (from, DAY);
+      to = ceil_to (to, DAY);
+    }
+
+  m1 = month_ceil (from);
+  m2 = month_floor (to);
+
+  if (m1 < m2)
+    {
+      series_level_collect (series, GAIRQ_ROLLUP_DAY, from, m1, collect);
+      series_level_collect (series, GAIRQ_ROLLUP_MONTH, m1, m2, collect);
+      series_level_collect (series, GAIRQ_ROLLUP_DAY, m2, to, collect);
+    }
+  else
+    {
+      series_level_collect (series, GAIRQ_ROLLUP_DAY, from, to, collect);
+    }
+}
+
+/* Only reads, the caller holds the lock for all parts */
+static void
+collect_run (Collect *collect)
+{
+  guint i;
+
+  for (i = collect->first; i < collect->n_idx; i += collect->step)
+    {
+      gint64 key = SERIES_KEY (collect->idx [i], collect->pollutant);
+      Series *series = g_hash_table_lookup (collect->self->series, &key);
+
+      if (series)
+        series_collect (series, collect);
+    }
+}
+
+static Split *
+split_ref (Split *split)
+{
+  g_atomic_int_inc (&split->ref_count);
+
+  return split;
+}
+
+static void
+split_unref (gpointer data)
+{
+  Split *split = data;
+
+  if (!g_atomic_int_dec_and_test (&split->ref_count))
+    return;
+
+  g_free (split->parts);
+  g_mutex_clear (&split->lock);
+  g_cond_clear (&split->cond);
+  g_slice_free (Split, split);
+}
+
+/* Runs on the executor and on the caller alike */
+static void
+split_run (gpointer data)
+{
+  Split *split = data;
+  guint i;
+
+  while ((i = (guint) g_atomic_int_add (&split->next, 1)) < split->n_parts)
+    {
+      collect_run (&split->parts [i]);
+
+      g_mutex_lock (&split->lock);
+      if (++split->n_done == split->n_parts)
+        g_cond_signal (&split->cond);
+      g_mutex_unlock (&split->lock);
+    }
+}
+
+/* --- GObject --- */
+static void
+gairq_rollup_finalize (GObject *object)
+{
+  GairqRollup *self = GAIRQ_ROLLUP (object);
+
+  g_hash_table_destroy (self->series);
+  g_clear_object (&self->store);
+  g_clear_object (&self->executor);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gairq_rollup_parent_class)->finalize (object);
+}
+
+static void
+gairq_rollup_class_init (GairqRollupClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_rollup_finalize;
+}
+
+static void
+gairq_rollup_init (GairqRollup *self)
+{
+  self->series = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, series_free);
+  self->retention [GAIRQ_ROLLUP_HOUR] = DEFAULT_HOUR_RETENTION;
+  self->retention [GAIRQ_ROLLUP_DAY] = DEFAULT_DAY_RETENTION;
+  g_mutex_init (&self->lock);
+}
+
+/* --- Private Methods --- */
+
+/* Must be called with the lock held. Drops the buckets of @resolution
+ * past its retention behind the latest one. When @lazy, only once they
+ * are a good share of the level, so that pushes drop them in bulk.
+ */
+static void
+gairq_rollup_prune_locked (GairqRollup           *self,
+                           Series                *series,
+                           GairqRollupResolution  resolution,
+                           gboolean               lazy)
+{
+  GArray *level = series->levels [resolution];
+  gint64 horizon;
+  guint n;
+
+  if (self->retention [resolution] == 0 || level->len == 0)
+    return;
+
+  horizon = bucket_start (resolution, g_array_index (level, Bucket, level->len - 1).start -
+                                      self->retention [resolution]);
+  n = level_search (level, horizon);
+  if (n == 0 || (lazy && n < level->len / 4))
+    return;
+
+  g_array_remove_range (level, 0, n);
+  series->horizon [resolution] = MAX (series->horizon [resolution], horizon);
+  self->n_buckets -= n;
+}
+
+/* Must be called with the lock held */
+static void
+gairq_rollup_push_locked (GairqRollup    *self,
+                          gint64          idx,
+                          GairqPollutant  pollutant,
+                          gint64          time,
+                          gdouble         value)
+{
+  gint64 key = SERIES_KEY (idx, pollutant);
+  Series *series;
+  guint i;
+
+  series = g_hash_table_lookup (self->series, &key);
+  if (series == NULL)
+    {
+      series = series_new (idx, pollutant);
+      g_hash_table_insert (self->series, &series->key, series);
+    }
+
+  time = CLAMP (time, -TIME_LIMIT, TIME_LIMIT);
+
+  for (i = 0; i < N_GAIRQ_ROLLUP_RESOLUTIONS; i++)
+    {
+      GArray *level = series->levels [i];
+      gint64 start = bucket_start (i, time);
+      Bucket *bucket = NULL;
+      guint pos = level->len;
+      gboolean latest = FALSE;
+
+      /* Already past the retention of the level */
+      if (start < series->horizon [i])
+        continue;
+
+      /* In order is the common case, look at the last bucket first */
+      if (level->len > 0 && g_array_index (level, Bucket, level->len - 1).start >= start)
+        pos = level_search (level, start);
+
+      if (pos < level->len)
+        bucket = &g_array_index (level, Bucket, pos);
+
+      if (bucket == NULL || bucket->start != start)
+        {
+          Bucket new_bucket = { start, value, value, 0, 0, NULL };
+
+          if (i != GAIRQ_ROLLUP_HOUR)
+            new_bucket.sketch = gairq_sketch_new (self->accuracy);
+
+          g_array_insert_val (level, pos, new_bucket);
+          bucket = &g_array_index (level, Bucket, pos);
+          self->n_buckets++;
+          latest = pos + 1 == level->len;
+        }
+
+      bucket->min = MIN (bucket->min, value);
+      bucket->max = MAX (bucket->max, value);
+      bucket->sum += value;
+      bucket->count++;
+      if (bucket->sketch)
+        gairq_sketch_add (bucket->sketch, value);
+
+      /* Only a new latest bucket moves the horizon */
+      if (latest)
+        gairq_rollup_prune_locked (self, series, i, TRUE);
+    }
+}
+
+/* Must be called with the lock held */
+static void
+gairq_rollup_collect_locked (GairqRollup *self,
+                             Collect     *collect)
+{
+  GairqExecutor *executor;
+  Split *split;
+  guint i, n_parts;
+
+  n_parts = CLAMP (collect->n_idx / STATIONS_PER_THREAD, 1, g_get_num_processors ());
+  collect->first = 0;
+  collect->step = n_parts;
+
+  if (n_parts == 1)
+    {
+      collect_run (collect);
+      self->n_buckets_read += collect->n_read;
+      self->n_samples_read += collect->n_samples;
+      return;
+    }
+
+  split = g_slice_new0 (Split);
+  split->ref_count = 1;
+  split->parts = g_new (Collect, n_parts);
+  split->n_parts = n_parts;
+  g_mutex_init (&split->lock);
+  g_cond_init (&split->cond);
+
+  for (i = 0; i < n_parts; i++)
+    {
+      split->parts [i] = *collect;
+      split->parts [i].first = i;
+      if (i > 0 && collect->sketch)
+        split->parts [i].sketch = gairq_sketch_new (self->accuracy);
+    }
+
+  /* With the queue full, the caller goes through the parts by itself */
+  executor = self->executor ? self->executor : gairq_executor_get_default ();
+  for (i = 1; i < n_parts; i++)
+    if (!gairq_executor_push (executor, GAIRQ_PRIORITY_INTERACTIVE, split_run,
+                              split_ref (split), split_unref, 0, NULL))
+      {
+        split_unref (split);
+        break;
+      }
+
+  split_run (split);
+
+  g_mutex_lock (&split->lock);
+  while (split->n_done < split->n_parts)
+    g_cond_wait (&split->cond, &split->lock);
+  g_mutex_unlock (&split->lock);
+
+  *collect = split->parts [0];
+  for (i = 1; i < n_parts; i++)
+    {
+      Collect *part = &split->parts [i];
+
+      bucket_add (&collect->bucket, part->bucket.min, part->bucket.max,
+                  part->bucket.sum, part->bucket.count);
+      if (collect->sketch)
+        {
+          gairq_sketch_merge (collect->sketch, part->sketch);
+          gairq_sketch_free (part->sketch);
+        }
+      collect->n_read += part->n_read;
+      collect->n_samples += part->n_samples;
+    }
+
+  self->n_buckets_read += collect->n_read;
+  self->n_samples_read += collect->n_samples;
+
+  split_unref (split);
+}
+
+/* --- Public APIs --- */
+GairqRollup *
+gairq_rollup_new (gdouble relative_accuracy)
+{
+  GairqRollup *self;
+
+  g_return_val_if_fail (relative_accuracy > 0 && relative_accuracy < 1, NULL);
+
+  self = g_object_new (GAIRQ_TYPE_ROLLUP, NULL);
+  self->accuracy = relative_accuracy;
+
+  return self;
+}
+
+/* Hours and days are kept for a month and a year by default, a
+ * @retention of 0 keeps every bucket. Months are always kept. Buckets
+ * already past the new retention go at once.
+ */
+void
+gairq_rollup_set_retention (GairqRollup           *self,
+                            GairqRollupResolution  resolution,
+                            gint64                 retention)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_if_fail (GAIRQ_IS_ROLLUP (self));
+  g_return_if_fail (resolution == GAIRQ_ROLLUP_HOUR || resolution == GAIRQ_ROLLUP_DAY);
+  g_return_if_fail (retention >= 0);
+
+  g_mutex_lock (&self->lock);
+
+  self->retention [resolution] = retention;
+
+  g_hash_table_iter_init (&iter, self->series);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    gairq_rollup_prune_locked (self, value, resolution, FALSE);
+
+  g_mutex_unlock (&self->lock);
+}
+
+gint64
+gairq_rollup_get_retention (GairqRollup           *self,
+                            GairqRollupResolution  resolution)
+{
+  gint64 ret;
+
+  g_return_val_if_fail (GAIRQ_IS_ROLLUP (self), 0);
+  g_return_val_if_fail (resolution < N_GAIRQ_ROLLUP_RESOLUTIONS, 0);
+
+  g_mutex_lock (&self->lock);
+  ret = self->retention [resolution];
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* The store holding every reading pushed, for the ends of ranges that
+ * reach past the retention of hours or days. Without one, they only
+ * take in what the coarser buckets cover.
+ */
+void
+gairq_rollup_set_store (GairqRollup      *self,
+                        GairqSeriesStore *store)
+{
+  g_return_if_fail (GAIRQ_IS_ROLLUP (self));
+  g_return_if_fail (store == NULL || GAIRQ_IS_SERIES_STORE (store));
+
+  g_mutex_lock (&self->lock);
+  g_set_object (&self->store, store);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Queries over many stations run on @executor, NULL for
+ * gairq_executor_get_default ().
+ */
+void
+gairq_rollup_set_executor (GairqRollup   *self,
+                           GairqExecutor *executor)
+{
+  g_return_if_fail (GAIRQ_IS_ROLLUP (self));
+  g_return_if_fail (executor == NULL || GAIRQ_IS_EXECUTOR (executor));
+
+  g_mutex_lock (&self->lock);
+  g_set_object (&self->executor, executor);
+  g_mutex_unlock (&self->lock);
+}
+
+/* Readings may come in any order, but each has to come once */
+void
+gairq_rollup_push (GairqRollup    *self,
+                   gint64          idx,
+                   GairqPollutant  pollutant,
+                   gint64          time,
+                   gdouble         value)
+{
+  g_return_if_fail (GAIRQ_IS_ROLLUP (self));
+  g_return_if_fail (pollutant < N_GAIRQ_POLLUTANTS);
+
+  if (isnan (value))
+    return;
+
+  g_mutex_lock (&self->lock);
+  gairq_rollup_push_locked (self, idx, pollutant, time, value);
+  g_mutex_unlock (&self->lock);
+}
+
+void
+gairq_rollup_push_air (GairqRollup    *self,
+                       GairqAirObject *air)
+{
+  GHashTable *iaqi;
+  gint64 idx, time;
+  guint i;
+
+  g_return_if_fail (GAIRQ_IS_ROLLUP (self));
+  g_return_if_fail (GAIRQ_IS_AIR_OBJECT (air));
+
+  iaqi = gairq_air_object_get_iaqi (air);
+  if (iaqi == NULL)
+    return;
+
+  idx = gairq_air_object_get_idx (air);
+  time = gairq_air_object_get_time (air);
+
+  g_mutex_lock (&self->lock);
+
+  for (i = 0; i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      gdouble *value = g_hash_table_lookup (iaqi, gairq_pollutant_to_string (i));
+
+      if (value && !isnan (*value))
+        gairq_rollup_push_locked (self, idx, i, time, *value);
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+/* Takes in every stored reading of the series, for a rollup made after
+ * the readings were. Returns how many there were.
+ */
+guint64
+gairq_rollup_load (GairqRollup      *self,
+                   GairqSeriesStore *store,
+                   gint64            idx,
+                   GairqPollutant    pollutant)
+{
+  g_autoptr(GArray) samples = NULL;
+  guint i;
+
+  g_return_val_if_fail (GAIRQ_IS_ROLLUP (self), 0);
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (store), 0);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, 0);
+
+  samples = gairq_series_store_query (store, idx, pollutant, G_MININT64, G_MAXINT64);
+
+  g_mutex_lock (&self->lock);
+
+  for (i = 0; i < samples->len; i++)
+    {
+      GairqSeriesSample *sample = &g_array_index (samples, GairqSeriesSample, i);
+
+      if (!isnan (sample->value))
+        gairq_rollup_push_locked (self, idx, pollutant, sample->time, sample->value);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return samples->len;
+}
+
+/* The buckets of @resolution starting within [from, to), in time order */
+GArray *
+gairq_rollup_query (GairqRollup           *self,
+                    gint64                 idx,
+                    GairqPollutant         pollutant,
+                    GairqRollupResolution  resolution,
+                    gint64                 from,
+                    gint64                 to)
+{
+  gint64 key = SERIES_KEY (idx, pollutant);
+  GArray *ret;
+  Series *series;
+  guint i;
+
+  g_return_val_if_fail (GAIRQ_IS_ROLLUP (self), NULL);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NULL);
+  g_return_val_if_fail (resolution < N_GAIRQ_ROLLUP_RESOLUTIONS, NULL);
+
+  ret = g_array_new (FALSE, FALSE, sizeof (GairqRollupBucket));
+
+  g_mutex_lock (&self->lock);
+
+  series = g_hash_table_lookup (self->series, &key);
+  if (series)
+    {
+      GArray *level = series->levels [resolution];
+
+      for (i = level_search (level, from); i < level->len; i++)
+        {
+          Bucket *bucket = &g_array_index (level, Bucket, i);
+          GairqRollupBucket out = {
+            bucket->start, bucket->min, bucket->max, bucket->sum, bucket->count
+          };
+
+          if (bucket->start >= to)
+            break;
+
+          g_array_append_val (ret, out);
+        }
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Min, max, sum and count of @pollutant over [from, to) across stations
+ * @idx, or FALSE with no reading in there.
+ */
+gboolean
+gairq_rollup_aggregate (GairqRollup       *self,
+                        const gint64      *idx,
+                        guint              n_idx,
+                        GairqPollutant     pollutant,
+                        gint64             from,
+                        gint64             to,
+                        GairqRollupBucket *bucket)
+{
+  Collect collect = { 0, };
+
+  g_return_val_if_fail (GAIRQ_IS_ROLLUP (self), FALSE);
+  g_return_val_if_fail (idx != NULL || n_idx == 0, FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+  g_return_val_if_fail (bucket != NULL, FALSE);
+
+  collect.self = self;
+  collect.idx = idx;
+  collect.n_idx = n_idx;
+  collect.pollutant = pollutant;
+  collect.from = from;
+  collect.to = to;
+  collect.bucket.min = collect.bucket.max = NAN;
+
+  g_mutex_lock (&self->lock);
+  gairq_rollup_collect_locked (self, &collect);
+  g_mutex_unlock (&self->lock);
+
+  *bucket = collect.bucket;
+  bucket->start = from;
+
+  return bucket->count > 0;
+}
+
+/* The sketch of every reading of @pollutant over [from, to) across
+ * stations @idx, to take quantiles of.
+ */
+GairqSketch *
+gairq_rollup_sketch (GairqRollup    *self,
+                     const gint64   *idx,
+                     guint           n_idx,
+                     GairqPollutant  pollutant,
+                     gint64          from,
+                     gint64          to)
+{
+  Collect collect = { 0, };
+
+  g_return_val_if_fail (GAIRQ_IS_ROLLUP (self), NULL);
+  g_return_val_if_fail (idx != NULL || n_idx == 0, NULL);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NULL);
+
+  collect.self = self;
+  collect.idx = idx;
+  collect.n_idx = n_idx;
+  collect.pollutant = pollutant;
+  collect.from = from;
+  collect.to = to;
+  collect.sketch = gairq_sketch_new (self->accuracy);
+
+  g_mutex_lock (&self->lock);
+  gairq_rollup_collect_locked (self, &collect);
+  g_mutex_unlock (&self->lock);
+
+  return collect.sketch;
+}
+
+void
+gairq_rollup_get_stats (GairqRollup      *self,
+                        GairqRollupStats *stats)
+{
+  GHashTableIter iter;
+  gpointer value;
+  guint i, j;
+
+  g_return_if_fail (GAIRQ_IS_ROLLUP (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+
+  stats->n_series = g_hash_table_size (self->series);
+  stats->n_buckets = self->n_buckets;
+  stats->n_buckets_read = self->n_buckets_read;
+  stats->n_samples_read = self->n_samples_read;
+  stats->size = 0;
+
+  g_hash_table_iter_init (&iter, self->series);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Series *series = value;
+
+      stats->size += sizeof (Series);
+      for (i = 0; i < N_GAIRQ_ROLLUP_RESOLUTIONS; i++)
+        {
+          GArray *level = series->levels [i];
+
+          stats->size += level->len * sizeof (Bucket);
+          for (j = 0; j < level->len; j++)
+            {
+              Bucket *bucket = &g_array_index (level, Bucket, j);
+
+              if (bucket->sketch)
+                stats->size += gairq_sketch_get_size (bucket->sketch);
+            }
+        }
+    }
+
+  g_mutex_unlock (&self->lock);
+}
@@ -0,0 +1,124 @@
+/* gairq-rollup.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_ROLLUP_H
+#define GAIRQ_ROLLUP_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+#include <gairq/gairq-air-object.h>
+#include <gairq/gairq-executor.h>
+#include <gairq/gairq-series-store.h>
+#include <gairq/gairq-sketch.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_ROLLUP (gairq_rollup_get_type ())
+G_DECLARE_FINAL_TYPE (GairqRollup, gairq_rollup, GAIRQ, ROLLUP, GObject)
+
+/* Calendar buckets are in UTC */
+typedef enum {
+  GAIRQ_ROLLUP_HOUR,
+  GAIRQ_ROLLUP_DAY,
+  GAIRQ_ROLLUP_MONTH,
+  N_GAIRQ_ROLLUP_RESOLUTIONS
+} GairqRollupResolution;
+
+typedef struct
+{
+  gint64    start;
+  gdouble   min;
+  gdouble   max;
+  gdouble   sum;
+  guint64   count;
+} GairqRollupBucket;
+
+typedef struct
+{
+  guint     n_series;
+  guint64   n_buckets;
+  guint64   n_buckets_read;   /* By range queries, since the rollup was made */
+  guint64   n_samples_read;   /* From the store, for ranges past the retention */
+  gsize     size;             /* In memory, in bytes */
+} GairqRollupStats;
+
+/* Hourly, daily and monthly min, max, sum and count of every series, with
+ * a quantile sketch on the daily and monthly ones, kept up to date as
+ * readings come in. A range query takes whole months where it can and
+ * only goes down to days and hours at its ends; ranges widen to whole
+ * hours, or whole days for sketches. Queries over many stations are
+ * split into jobs on a GairqExecutor.
+ *
+ * Hours and days are only kept for a while behind the latest reading of
+ * each series, so memory stays bounded however long the rollup lives.
+ * Given the store the readings go to, ranges reaching further back
+ * still come out exact, gairq_rollup_load () rebuilds the rollup from
+ * it after a restart.
+ */
+GairqRollup * gairq_rollup_new           (gdouble                relative_accuracy);
+void          gairq_rollup_set_retention (GairqRollup           *self,
+                                          GairqRollupResolution  resolution,
+                                          gint64                 retention);
+gint64        gairq_rollup_get_retention (GairqRollup           *self,
+                                          GairqRollupResolution  resolution);
+void          gairq_rollup_set_store     (GairqRollup           *self,
+                                          GairqSeriesStore      *store);
+void          gairq_rollup_set_executor  (GairqRollup           *self,
+                                          GairqExecutor         *executor);
+void          gairq_rollup_push          (GairqRollup           *self,
+                                          gint64                 idx,
+                                          GairqPollutant         pollutant,
+                                          gint64                 time,
+                                          gdouble                value);
+void          gairq_rollup_push_air      (GairqRollup           *self,
+                                          GairqAirObject        *air);
+guint64       gairq_rollup_load          (GairqRollup           *self,
+                                          GairqSeriesStore      *store,
+                                          gint64                 idx,
+                                          GairqPollutant         pollutant);
+GArray *      gairq_rollup_query         (GairqRollup           *self,
+                                          gint64                 idx,
+                                          GairqPollutant         pollutant,
+                                          GairqRollupResolution  resolution,
+                                          gint64                 from,
+                                          gint64                 to);
+gboolean      gairq_rollup_aggregate     (GairqRollup           *self,
+                                          const gint64          *idx,
+                                          guint                  n_idx,
+                                          GairqPollutant         pollutant,
+                                          gint64                 from,
+                                          gint64                 to,
+                                          GairqRollupBucket     *bucket);
+GairqSketch * gairq_rollup_sketch        (GairqRollup           *self,
+                                          const gint64          *idx,
+                                          guint                  n_idx,
+                                          GairqPollutant         pollutant,
+                                          gint64                 from,
+                                          gint64                 to);
+void          gairq_rollup_get_stats     (GairqRollup           *self,
+                                          GairqRollupStats      *stats);
+
+G_END_DECLS
+
+#endif
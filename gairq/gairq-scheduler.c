@@ -0,0 +1,681 @@
+/* gairq-scheduler.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-scheduler.h"
+
+#include <math.h>
+
+#define DEFAULT_MAX_IN_FLIGHT   16
+#define DEFAULT_WEIGHT          1
+
+/* Throughput is a moving average over about this many seconds */
+#define THROUGHPUT_WINDOW       5.0
+
+typedef struct
+{
+  gchar *           name;
+  guint             weight;
+  guint             max_in_flight;
+
+  /* Calls waiting for a turn, in the order they came in */
+  GQueue            calls;
+
+  /* Calls it may still start this round, topped up by its weight when
+   * its turn comes. An idle tenant saves nothing up.
+   */
+  guint             deficit;
+  gboolean          has_turn;
+  gboolean          active;
+
+  gdouble           rate;
+  gint64            rate_time;
+
+  GairqTenantStats  stats;
+} Tenant;
+
+typedef struct
+{
+  GTask *           task;
+  GairqRequest *    request;
+  Tenant *          tenant;
+  gint64            queued_at;
+  gulong            cancelled_id;
+  GairqResultFlags  flags;
+  GError *          error;
+} Call;
+
+struct _GairqScheduler
+{
+  GObject           parent_instance;
+
+  GairqExecutor *   executor;
+  guint             max_in_flight;
+
+  GMutex            lock;
+  GHashTable *      tenants;
+  GQueue            active;         /* Tenants with calls waiting, round robin */
+  guint             n_in_flight;
+
+  /* The executor turned a call away, the next completion makes room */
+  gboolean          stalled;
+};
+
+/* Properties */
+enum {
+  PROP_0,
+  PROP_EXECUTOR,
+  PROP_MAX_IN_FLIGHT,
+  N_PROPERTIES
+};
+
+static GParamSpec*  properties [N_PROPERTIES];
+
+G_DEFINE_TYPE (GairqScheduler, gairq_scheduler, G_TYPE_OBJECT)
+
+
+static void
+tenant_free (gpointer data)
+{
+  Tenant *tenant = data;
+
+  g_free (tenant->name);
+  g_slice_free (Tenant, tenant);
+}
+
+static void
+call_free (gpointer data)
+{
+  Call *call = data;
+
+  g_object_unref (call->request);
+  g_clear_error (&call->error);
+  g_slice_free (Call, call);
+}
+
+static void
+call_disconnect (Call *call)
+{
+  g_cancellable_disconnect (g_task_get_cancellable (call->task), call->cancelled_id);
+  call->cancelled_id = 0;
+}
+
+static gdouble
+tenant_rate_at (Tenant *tenant,
+                gint64  now)
+{
+  gdouble elapsed = (gdouble) (now - tenant->rate_time) / G_USEC_PER_SEC;
+
+  return tenant->rate * exp (-elapsed / THROUGHPUT_WINDOW);
+}
+
+static gboolean
+tenant_is_capped (Tenant *tenant)
+{
+  return tenant->max_in_flight > 0 && tenant->stats.n_in_flight >= tenant->max_in_flight;
+}
+
+/* --- GObject --- */
+static void
+gairq_scheduler_constructed (GObject *object)
+{
+  GairqScheduler *self = GAIRQ_SCHEDULER (object);
+
+  G_OBJECT_CLASS (gairq_scheduler_parent_class)->constructed (object);
+
+  if (self->executor == NULL)
+    self->executor = g_object_ref (gairq_executor_get_default ());
+}
+
+static void
+gairq_scheduler_dispose (GObject *object)
+{
+  GairqScheduler *self = GAIRQ_SCHEDULER (object);
+
+  g_clear_object (&self->executor);
+
+  G_OBJECT_CLASS (gairq_scheduler_parent_class)->dispose (object);
+}
+
+static void
+gairq_scheduler_finalize (GObject *object)
+{
+  GairqScheduler *self = GAIRQ_SCHEDULER (object);
+
+  /* Queued calls hold a reference through their task, none are left */
+  g_hash_table_destroy (self->tenants);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gairq_scheduler_parent_class)->finalize (object);
+}
+
+static void
+gairq_scheduler_set_property (GObject      *object,
+                              guint         prop_id,
+                              const GValue *value,
+                              GParamSpec   *pspec)
+{
+  GairqScheduler *self = GAIRQ_SCHEDULER (object);
+
+  switch (prop_id)
+    {
+    case PROP_EXECUTOR:
+      self->executor = g_value_dup_object (value);
+      break;
+
+    case PROP_MAX_IN_FLIGHT:
+      self->max_in_flight = g_value_get_uint (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_scheduler_get_property (GObject    *object,
+                              guint       prop_id,
+                              GValue     *value,
+                              GParamSpec *pspec)
+{
+  GairqScheduler *self = GAIRQ_SCHEDULER (object);
+
+  switch (prop_id)
+    {
+    case PROP_EXECUTOR:
+      g_value_set_object (value, self->executor);
+      break;
+
+    case PROP_MAX_IN_FLIGHT:
+      g_value_set_uint (value, self->max_in_flight);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_scheduler_class_init (GairqSchedulerClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gairq_scheduler_constructed;
+  object_class->dispose = gairq_scheduler_dispose;
+  object_class->finalize = gairq_scheduler_finalize;
+  object_class->set_property = gairq_scheduler_set_property;
+  object_class->get_property = gairq_scheduler_get_property;
+
+  /**
+   * GairqScheduler:executor:
+   *
+   * The #GairqExecutor calls run on once it is their turn,
+   * gairq_executor_get_default () if NULL.
+   */
+  properties [PROP_EXECUTOR] =
+    g_param_spec_object ("executor", "Executor",
+                         "A GairqExecutor to run calls on",
+                         GAIRQ_TYPE_EXECUTOR,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  /**
+   * GairqScheduler:max-in-flight:
+   *
+   * The most calls handed to the executor at once, over all tenants.
+   * It stands for the upstream capacity they share.
+   */
+  properties [PROP_MAX_IN_FLIGHT] =
+    g_param_spec_uint ("max-in-flight", "Max in flight",
+                       "How many calls may run at once",
+                       1, G_MAXUINT, DEFAULT_MAX_IN_FLIGHT,
+                       G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+static void
+gairq_scheduler_init (GairqScheduler *self)
+{
+  g_mutex_init (&self->lock);
+  self->tenants = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, tenant_free);
+  g_queue_init (&self->active);
+  self->max_in_flight = DEFAULT_MAX_IN_FLIGHT;
+}
+
+/* --- Private Methods --- */
+/* Must be called with the lock held */
+static Tenant *
+gairq_scheduler_ensure_tenant_locked (GairqScheduler *self,
+                                      const gchar    *name)
+{
+  Tenant *tenant;
+
+  tenant = g_hash_table_lookup (self->tenants, name);
+  if (tenant)
+    return tenant;
+
+  tenant = g_slice_new0 (Tenant);
+  tenant->name = g_strdup (name);
+  tenant->weight = DEFAULT_WEIGHT;
+  tenant->rate_time = g_get_monotonic_time ();
+  g_queue_init (&tenant->calls);
+  g_hash_table_insert (self->tenants, tenant->name, tenant);
+
+  return tenant;
+}
+
+/* Must be called with the lock held, once @tenant has no calls waiting */
+static void
+gairq_scheduler_deactivate_locked (GairqScheduler *self,
+                                   Tenant         *tenant)
+{
+  g_queue_remove (&self->active, tenant);
+  tenant->active = FALSE;
+  tenant->has_turn = FALSE;
+  tenant->deficit = 0;
+}
+
+/* Must be called with the lock held */
+static void
+gairq_scheduler_complete_locked (GairqScheduler *self,
+                                 Tenant         *tenant,
+                                 gboolean        failed)
+{
+  gint64 now = g_get_monotonic_time ();
+
+  tenant->rate = tenant_rate_at (tenant, now) + 1.0 / THROUGHPUT_WINDOW;
+  tenant->rate_time = now;
+
+  tenant->stats.n_completed++;
+  if (failed)
+    tenant->stats.n_failed++;
+}
+
+static void
+gairq_scheduler_run (gpointer data);
+
+/* Must be called with the lock held. A call the executor turns away
+ * goes back to the head of its queue, to wait for one of ours to finish.
+ * With none of them running there is nothing to wait for, it is put on
+ * @rejected instead, to fail once the lock is dropped. Either way no
+ * more calls are started for now.
+ */
+static gboolean
+gairq_scheduler_start_locked (GairqScheduler  *self,
+                              Tenant          *tenant,
+                              GSList         **rejected)
+{
+  Call *call = g_queue_pop_head (&tenant->calls);
+  GError *error = NULL;
+  gint64 wait;
+
+  if (!gairq_executor_push (self->executor, gairq_request_get_priority (call->request),
+                            gairq_scheduler_run, call, NULL, 0, &error))
+    {
+      if (self->n_in_flight > 0)
+        {
+          g_queue_push_head (&tenant->calls, call);
+          g_error_free (error);
+          self->stalled = TRUE;
+        }
+      else
+        {
+          tenant->stats.n_queued--;
+          gairq_scheduler_complete_locked (self, tenant, TRUE);
+          call->error = error;
+          *rejected = g_slist_prepend (*rejected, call);
+        }
+
+      return FALSE;
+    }
+
+  wait = g_get_monotonic_time () - call->queued_at;
+  tenant->stats.n_queued--;
+  tenant->stats.wait_time += wait;
+  tenant->stats.max_wait = MAX (tenant->stats.max_wait, wait);
+
+  tenant->stats.n_in_flight++;
+  self->n_in_flight++;
+
+  return TRUE;
+}
+
+/* Must be called with the lock held. Deficit round robin, where every
+ * call costs the same: the tenant up front starts as many calls as its
+ * deficit allows and goes to the back. One at its own cap is passed
+ * over and loses the rest of its turn.
+ */
+static void
+gairq_scheduler_dispatch_locked (GairqScheduler  *self,
+                                 GSList         **rejected)
+{
+  guint n_passed = 0;
+
+  if (self->stalled)
+    return;
+
+  while (self->n_in_flight < self->max_in_flight && n_passed < self->active.length)
+    {
+      Tenant *tenant = g_queue_peek_head (&self->active);
+
+      if (tenant_is_capped (tenant))
+        {
+          tenant->deficit = 0;
+          tenant->has_turn = FALSE;
+          g_queue_push_tail (&self->active, g_queue_pop_head (&self->active));
+          n_passed++;
+          continue;
+        }
+
+      n_passed = 0;
+      if (!tenant->has_turn)
+        {
+          tenant->deficit += tenant->weight;
+          tenant->has_turn = TRUE;
+        }
+
+      while (tenant->deficit > 0 && !g_queue_is_empty (&tenant->calls) &&
+             self->n_in_flight < self->max_in_flight && !tenant_is_capped (tenant))
+        {
+          if (!gairq_scheduler_start_locked (self, tenant, rejected))
+            return;
+          tenant->deficit--;
+        }
+
+      if (g_queue_is_empty (&tenant->calls))
+        gairq_scheduler_deactivate_locked (self, tenant);
+      else if (tenant->deficit == 0 || tenant_is_capped (tenant))
+        {
+          tenant->has_turn = FALSE;
+          tenant->deficit = 0;
+          g_queue_push_tail (&self->active, g_queue_pop_head (&self->active));
+        }
+
+      /* Otherwise it's out of capacity, the tenant picks up from here */
+    }
+}
+
+static void
+gairq_scheduler_fail (GSList *rejected)
+{
+  GSList *l;
+
+  for (l = rejected; l; l = l->next)
+    {
+      Call *call = l->data;
+      GTask *task = call->task;
+
+      call_disconnect (call);
+      g_task_return_error (task, g_steal_pointer (&call->error));
+      g_object_unref (task);
+    }
+
+  g_slist_free (rejected);
+}
+
+static void
+gairq_scheduler_run (gpointer data)
+{
+  Call *call = data;
+  GTask *task = call->task;
+  GairqScheduler *self = g_task_get_source_object (task);
+  GairqAirObject *air = NULL;
+  GSList *rejected = NULL;
+  GError *error = NULL;
+
+  call_disconnect (call);
+
+  if (!g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), &error))
+    air = gairq_request_poll_sync (call->request, &call->flags, &error);
+
+  /* Its slot goes to whoever is next before the result goes out */
+  g_mutex_lock (&self->lock);
+  call->tenant->stats.n_in_flight--;
+  self->n_in_flight--;
+  gairq_scheduler_complete_locked (self, call->tenant, air == NULL);
+  self->stalled = FALSE;
+  gairq_scheduler_dispatch_locked (self, &rejected);
+  g_mutex_unlock (&self->lock);
+
+  gairq_scheduler_fail (rejected);
+
+  if (air)
+    g_task_return_pointer (task, air, g_object_unref);
+  else
+    g_task_return_error (task, error);
+  g_object_unref (task);
+}
+
+static gboolean
+gairq_scheduler_return_cancelled (gpointer data)
+{
+  GTask *task = data;
+  GError *error = NULL;
+
+  call_disconnect (g_task_get_task_data (task));
+  g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), &error);
+  g_task_return_error (task, error);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* A call still waiting for its turn leaves the queue as soon as it is
+ * cancelled, one already started finds out in gairq_scheduler_run ().
+ */
+static void
+gairq_scheduler_cancelled (GCancellable *cancellable,
+                           gpointer      data)
+{
+  GTask *task = data;
+  GairqScheduler *self = g_task_get_source_object (task);
+  Call *call = g_task_get_task_data (task);
+  gboolean dequeued = FALSE;
+  GSource *source;
+
+  g_mutex_lock (&self->lock);
+  if (call->tenant && g_queue_remove (&call->tenant->calls, call))
+    {
+      dequeued = TRUE;
+      call->tenant->stats.n_queued--;
+      gairq_scheduler_complete_locked (self, call->tenant, TRUE);
+      if (g_queue_is_empty (&call->tenant->calls))
+        gairq_scheduler_deactivate_locked (self, call->tenant);
+    }
+  g_mutex_unlock (&self->lock);
+
+  if (!dequeued)
+    return;
+
+  /* Not from this handler, disconnecting it waits for it to return */
+  source = g_idle_source_new ();
+  g_source_set_callback (source, gairq_scheduler_return_cancelled, task, g_object_unref);
+  g_source_attach (source, g_task_get_context (task));
+  g_source_unref (source);
+}
+
+/* --- Public APIs --- */
+GairqScheduler *
+gairq_scheduler_new (GairqExecutor *executor,
+                     guint          max_in_flight)
+{
+  g_return_val_if_fail (executor == NULL || GAIRQ_IS_EXECUTOR (executor), NULL);
+  g_return_val_if_fail (max_in_flight > 0, NULL);
+
+  return g_object_new (GAIRQ_TYPE_SCHEDULER,
+                       "executor", executor,
+                       "max-in-flight", max_in_flight,
+                       NULL);
+}
+
+GairqExecutor *
+gairq_scheduler_get_executor (GairqScheduler *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_SCHEDULER (self), NULL);
+
+  return self->executor;
+}
+
+guint
+gairq_scheduler_get_max_in_flight (GairqScheduler *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_SCHEDULER (self), 0);
+
+  return self->max_in_flight;
+}
+
+/* Gives @tenant a share of @weight, and a cap of @max_in_flight calls
+ * at once, 0 for none. A tenant first seen in a call gets a weight of
+ * one and no cap.
+ */
+void
+gairq_scheduler_set_tenant (GairqScheduler *self,
+                            const gchar    *tenant,
+                            guint           weight,
+                            guint           max_in_flight)
+{
+  GSList *rejected = NULL;
+  Tenant *entry;
+
+  g_return_if_fail (GAIRQ_IS_SCHEDULER (self));
+  g_return_if_fail (tenant != NULL);
+  g_return_if_fail (weight > 0);
+
+  g_mutex_lock (&self->lock);
+  entry = gairq_scheduler_ensure_tenant_locked (self, tenant);
+  entry->weight = weight;
+  entry->deficit = MIN (entry->deficit, weight);
+  entry->max_in_flight = max_in_flight;
+
+  /* A higher cap may let queued calls go right away */
+  gairq_scheduler_dispatch_locked (self, &rejected);
+  g_mutex_unlock (&self->lock);
+
+  gairq_scheduler_fail (rejected);
+}
+
+gboolean
+gairq_scheduler_get_tenant_stats (GairqScheduler   *self,
+                                  const gchar      *tenant,
+                                  GairqTenantStats *stats)
+{
+  Tenant *entry;
+
+  g_return_val_if_fail (GAIRQ_IS_SCHEDULER (self), FALSE);
+  g_return_val_if_fail (tenant != NULL, FALSE);
+  g_return_val_if_fail (stats != NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  entry = g_hash_table_lookup (self->tenants, tenant);
+  if (entry)
+    {
+      *stats = entry->stats;
+      stats->weight = entry->weight;
+      stats->max_in_flight = entry->max_in_flight;
+      stats->throughput = tenant_rate_at (entry, g_get_monotonic_time ());
+    }
+  g_mutex_unlock (&self->lock);
+
+  return entry != NULL;
+}
+
+/* gairq_request_poll_async () on behalf of @tenant, once it is its turn */
+void
+gairq_scheduler_poll_async (GairqScheduler      *self,
+                            const gchar         *tenant,
+                            GairqRequest        *request,
+                            GCancellable        *cancellable,
+                            GAsyncReadyCallback  callback,
+                            gpointer             callback_data)
+{
+  GSList *rejected = NULL;
+  Tenant *entry;
+  Call *call;
+
+  g_return_if_fail (GAIRQ_IS_SCHEDULER (self));
+  g_return_if_fail (tenant != NULL);
+  g_return_if_fail (GAIRQ_IS_REQUEST (request));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  /* The queue holds on to the task until the call is started */
+  call = g_slice_new0 (Call);
+  call->request = g_object_ref (request);
+  call->task = g_task_new (self, cancellable, callback, callback_data);
+  g_task_set_source_tag (call->task, gairq_scheduler_poll_async);
+  g_task_set_task_data (call->task, call, call_free);
+
+  if (g_task_return_error_if_cancelled (call->task))
+    {
+      g_object_unref (call->task);
+      return;
+    }
+
+  /* Not under the lock, the handler takes it */
+  if (cancellable)
+    call->cancelled_id = g_cancellable_connect (cancellable,
+                                                G_CALLBACK (gairq_scheduler_cancelled),
+                                                g_object_ref (call->task),
+                                                g_object_unref);
+
+  g_mutex_lock (&self->lock);
+
+  entry = gairq_scheduler_ensure_tenant_locked (self, tenant);
+  call->tenant = entry;
+  call->queued_at = g_get_monotonic_time ();
+  g_queue_push_tail (&entry->calls, call);
+  entry->stats.n_queued++;
+  entry->stats.n_submitted++;
+
+  if (!entry->active)
+    {
+      entry->active = TRUE;
+      g_queue_push_tail (&self->active, entry);
+    }
+
+  gairq_scheduler_dispatch_locked (self, &rejected);
+
+  g_mutex_unlock (&self->lock);
+
+  gairq_scheduler_fail (rejected);
+}
+
+GairqAirObject *
+gairq_scheduler_poll_finish (GairqScheduler    *self,
+                             GAsyncResult      *res,
+                             GairqResultFlags  *result_flags,
+                             GError           **error)
+{
+  GairqAirObject *ret;
+  Call *call;
+
+  g_return_val_if_fail (GAIRQ_IS_SCHEDULER (self), NULL);
+  g_return_val_if_fail (g_task_is_valid (res, self), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  if (result_flags)
+    *result_flags = GAIRQ_RESULT_FLAGS_NONE;
+
+  ret = g_task_propagate_pointer (G_TASK (res), error);
+  if (ret && result_flags)
+    {
+      call = g_task_get_task_data (G_TASK (res));
+      *result_flags = call->flags;
+    }
+
+  return ret;
+}
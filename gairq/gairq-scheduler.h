@@ -0,0 +1,83 @@
+/* gairq-scheduler.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_SCHEDULER_H
+#define GAIRQ_SCHEDULER_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <gio/gio.h>
+
+#include <gairq/gairq-executor.h>
+#include <gairq/gairq-request.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_SCHEDULER (gairq_scheduler_get_type ())
+G_DECLARE_FINAL_TYPE (GairqScheduler, gairq_scheduler, GAIRQ, SCHEDULER, GObject)
+
+typedef struct _GairqTenantStats GairqTenantStats;
+
+/* Times are in microseconds */
+struct _GairqTenantStats
+{
+  guint     weight;
+  guint     max_in_flight;  /* 0 for no cap of its own */
+  guint     n_queued;       /* Calls waiting for their turn */
+  guint     n_in_flight;    /* Calls handed to the executor */
+  guint64   n_submitted;
+  guint64   n_completed;    /* Of which came back, failed or not */
+  guint64   n_failed;
+  gint64    wait_time;      /* Spent waiting for a turn, summed */
+  gint64    max_wait;       /* The longest a call waited for its turn */
+  gdouble   throughput;     /* Completions per second, of late */
+};
+
+/* Shares at most @max_in_flight calls at once between tenants, in
+ * proportion to their weights (deficit round robin). A tenant never has
+ * more than its own cap in flight, whatever capacity is left.
+ */
+GairqScheduler *  gairq_scheduler_new               (GairqExecutor       *executor,
+                                                     guint                max_in_flight);
+GairqExecutor *   gairq_scheduler_get_executor      (GairqScheduler      *self);
+guint             gairq_scheduler_get_max_in_flight (GairqScheduler      *self);
+void              gairq_scheduler_set_tenant        (GairqScheduler      *self,
+                                                     const gchar         *tenant,
+                                                     guint                weight,
+                                                     guint                max_in_flight);
+gboolean          gairq_scheduler_get_tenant_stats  (GairqScheduler      *self,
+                                                     const gchar         *tenant,
+                                                     GairqTenantStats    *stats);
+void              gairq_scheduler_poll_async        (GairqScheduler      *self,
+                                                     const gchar         *tenant,
+                                                     GairqRequest        *request,
+                                                     GCancellable        *cancellable,
+                                                     GAsyncReadyCallback  callback,
+                                                     gpointer             callback_data);
+GairqAirObject *  gairq_scheduler_poll_finish       (GairqScheduler      *self,
+                                                     GAsyncResult        *res,
+                                                     GairqResultFlags    *result_flags,
+                                                     GError             **error);
+
+G_END_DECLS
+
+#endif
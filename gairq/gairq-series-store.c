@@ -0,0 +1,1332 @@
+/* gairq-series-store.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-series-store.h"
+#include "gairq-debug.h"
+#include "gairq-utils.h"
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* The file is a run of BLOCK_SIZE blocks, the first one only holding the
+ * file magic. Every other block belongs to one series: a BlockHeader
+ * with its first sample and time range, then a bit stream of the rest,
+ * Gorilla style. Timestamps go in as the delta of their delta, so an
+ * hourly series takes one bit for the time. Values go in as the XOR
+ * with the previous one, except that readings with a few decimals, as
+ * stations report them, are scaled to integers and go in as deltas;
+ * their XORs would be all mantissa.
+ *
+ * A block is one sector, rewriting the open block of a series in place
+ * on flush is then a write the device does not tear.
+ */
+#define FILE_MAGIC          "GAIRQTS"
+#define FILE_VERSION        1
+#define BLOCK_SIZE          512
+#define BLOCK_MAGIC         0x53544447  /* "GDTS" */
+#define BLOCK_DATA_SIZE     (BLOCK_SIZE - sizeof (BlockHeader))
+#define BLOCK_DATA_BITS     ((guint32) BLOCK_DATA_SIZE * 8)
+
+#define SCALE_MAX_DIGITS    4
+#define SCALE_XOR           (SCALE_MAX_DIGITS + 1)
+#define SCALE_MAX_INTEGER   (G_GINT64_CONSTANT (1) << 50)
+
+#define SERIES_KEY(_idx, _pollutant) ((_idx) * N_GAIRQ_POLLUTANTS + (_pollutant))
+
+typedef struct
+{
+  guint32   magic;
+  guint16   pollutant;
+  guint16   scale;          /* Decimal digits of the values, or SCALE_XOR */
+  gint64    idx;
+  gint64    first_time;
+  gint64    last_time;
+  gdouble   first_value;
+  guint32   n_samples;
+  guint32   n_bits;
+  guint64   data_check;     /* Of the bytes in use */
+  guint64   header_check;   /* Of the fields above */
+} BlockHeader;
+
+typedef struct
+{
+  BlockHeader header;
+  guint8      data [BLOCK_SIZE - sizeof (BlockHeader)];
+} Block;
+
+G_STATIC_ASSERT (sizeof (Block) == BLOCK_SIZE);
+
+/* The sample last encoded, which the next one is written against */
+typedef struct
+{
+  gint64    time;
+  gint64    delta;
+  guint64   value;          /* Bits of the double, or the scaled integer */
+  guint     leading;        /* Zero bits around the last XOR written out */
+  guint     trailing;
+  gboolean  has_window;
+} Cursor;
+
+typedef struct
+{
+  guint8 *  data;
+  guint32   pos;
+  gboolean  overflow;
+} BitWriter;
+
+typedef struct
+{
+  const guint8 *  data;
+  guint32         pos;
+  guint32         limit;
+  gboolean        overrun;
+} BitReader;
+
+typedef struct
+{
+  guint64   offset;
+  gint64    first_time;
+  gint64    last_time;
+} BlockRef;
+
+typedef struct
+{
+  gint64            key;
+  GArray *          blocks;         /* BlockRef of the closed blocks, in time order */
+  Block *           open;           /* The one still being appended to */
+  guint64           open_offset;
+  gboolean          dirty;
+  Cursor            cursor;
+  gboolean          has_latest;
+  GairqSeriesSample latest;
+} Series;
+
+struct _GairqSeriesStore
+{
+  GObject       parent_instance;
+
+  gchar *       path;
+  gint          fd;
+  GMappedFile * map;
+
+  GMutex        lock;
+  GHashTable *  series;
+  guint64       file_size;
+  guint64       n_samples;
+  guint64       n_blocks_decoded;
+};
+
+/* Properties */
+enum {
+  PROP_0,
+  PROP_PATH,
+  N_PROPERTIES
+};
+
+static GParamSpec*  properties [N_PROPERTIES];
+
+G_DEFINE_TYPE (GairqSeriesStore, gairq_series_store, G_TYPE_OBJECT)
+
+
+static void
+series_free (gpointer data)
+{
+  Series *series = data;
+
+  g_array_unref (series->blocks);
+  g_free (series->open);
+  g_slice_free (Series, series);
+}
+
+/* --- Bit streams --- */
+static inline guint
+count_leading_zeros (guint64 x)
+{
+#if defined(__GNUC__)
+  return __builtin_clzll (x);
+#else
+  guint n = 0;
+
+  for ( ; !(x & (G_GUINT64_CONSTANT (1) << 63)); x <<= 1)
+    n++;
+  return n;
+#endif
+}
+
+static inline guint
+count_trailing_zeros (guint64 x)
+{
+#if defined(__GNUC__)
+  return __builtin_ctzll (x);
+#else
+  guint n = 0;
+
+  for ( ; !(x & 1); x >>= 1)
+    n++;
+  return n;
+#endif
+}
+
+static inline guint64
+double_to_bits (gdouble value)
+{
+  guint64 bits;
+
+  memcpy (&bits, &value, sizeof bits);
+  return bits;
+}
+
+static inline gdouble
+bits_to_double (guint64 bits)
+{
+  gdouble value;
+
+  memcpy (&value, &bits, sizeof value);
+  return value;
+}
+
+/* Most significant bit first. Once something does not fit nothing more
+ * is written, the caller rolls back.
+ */
+static void
+bits_put (BitWriter *writer,
+          guint64    value,
+          guint      n_bits)
+{
+  if (writer->overflow || writer->pos + n_bits > BLOCK_DATA_BITS)
+    {
+      writer->overflow = TRUE;
+      return;
+    }
+
+  while (n_bits > 0)
+    {
+      guint room = 8 - (writer->pos & 7);
+      guint take = MIN (room, n_bits);
+      guint bits = (value >> (n_bits - take)) & ((1u << take) - 1);
+
+      writer->data [writer->pos >> 3] |= bits << (room - take);
+      writer->pos += take;
+      n_bits -= take;
+    }
+}
+
+static guint64
+bits_get (BitReader *reader,
+          guint      n_bits)
+{
+  guint64 ret = 0;
+
+  if (reader->overrun || reader->pos + n_bits > reader->limit)
+    {
+      reader->overrun = TRUE;
+      return 0;
+    }
+
+  while (n_bits > 0)
+    {
+      guint room = 8 - (reader->pos & 7);
+      guint take = MIN (room, n_bits);
+
+      ret = (ret << take) | ((reader->data [reader->pos >> 3] >> (room - take)) & ((1u << take) - 1));
+      reader->pos += take;
+      n_bits -= take;
+    }
+
+  return ret;
+}
+
+/* Zeroes everything from bit @pos on */
+static void
+bits_clear_from (guint8  *data,
+                 guint32  pos)
+{
+  if (pos & 7)
+    data [pos >> 3] &= 0xff << (8 - (pos & 7));
+
+  pos = (pos + 7) >> 3;
+  memset (data + pos, 0, BLOCK_DATA_SIZE - pos);
+}
+
+/* --- Block encoding --- */
+typedef struct
+{
+  guint     n_buckets;
+  guint     bits [4];
+} Buckets;
+
+/* The last bucket holds the raw value */
+static const Buckets time_buckets = { 4, { 7, 9, 12, 32 } };
+static const Buckets value_buckets = { 4, { 4, 7, 12, 64 } };
+
+static const gdouble powers_of_ten [SCALE_MAX_DIGITS + 1] = { 1, 10, 100, 1000, 10000 };
+
+/* The fewest decimal digits @value goes back to exactly from */
+static guint
+value_get_scale (gdouble value)
+{
+  guint digits;
+
+  for (digits = 0; digits <= SCALE_MAX_DIGITS; digits++)
+    {
+      gdouble scaled = nearbyint (value * powers_of_ten [digits]);
+
+      if (fabs (scaled) < SCALE_MAX_INTEGER &&
+          double_to_bits ((gdouble) (gint64) scaled / powers_of_ten [digits]) == double_to_bits (value))
+        return digits;
+    }
+
+  return SCALE_XOR;
+}
+
+static inline guint64
+value_to_cursor (guint   scale,
+                 gdouble value)
+{
+  if (scale == SCALE_XOR)
+    return double_to_bits (value);
+
+  return (guint64) (gint64) nearbyint (value * powers_of_ten [scale]);
+}
+
+static inline gdouble
+value_from_cursor (guint   scale,
+                   guint64 value)
+{
+  if (scale == SCALE_XOR)
+    return bits_to_double (value);
+
+  return (gdouble) (gint64) value / powers_of_ten [scale];
+}
+
+/* A single zero for zero. Otherwise a one per bucket up to the one @v
+ * fits, a zero unless that is the last, and @v biased into its width.
+ */
+static gboolean
+encode_signed (BitWriter     *writer,
+               const Buckets *buckets,
+               gint64         v)
+{
+  guint last = buckets->n_buckets - 1;
+  guint width = buckets->bits [last];
+  guint i;
+
+  if (v == 0)
+    {
+      bits_put (writer, 0, 1);
+      return TRUE;
+    }
+
+  for (i = 0; i < last; i++)
+    {
+      gint64 bias = (G_GINT64_CONSTANT (1) << (buckets->bits [i] - 1)) - 1;
+
+      if (v >= -bias && v <= bias + 1)
+        {
+          bits_put (writer, (1u << (i + 2)) - 2, i + 2);
+          bits_put (writer, v + bias, buckets->bits [i]);
+          return TRUE;
+        }
+    }
+
+  if (width < 64 &&
+      (v < -(G_GINT64_CONSTANT (1) << (width - 1)) || v >= (G_GINT64_CONSTANT (1) << (width - 1))))
+    return FALSE;
+
+  bits_put (writer, (1u << (last + 1)) - 1, last + 1);
+  bits_put (writer, (guint64) v, width);
+
+  return TRUE;
+}
+
+static gint64
+decode_signed (BitReader     *reader,
+               const Buckets *buckets)
+{
+  guint last = buckets->n_buckets - 1;
+  guint width = buckets->bits [last];
+  guint64 raw;
+  guint i;
+
+  if (bits_get (reader, 1) == 0)
+    return 0;
+
+  for (i = 0; i < last; i++)
+    if (bits_get (reader, 1) == 0)
+      return (gint64) bits_get (reader, buckets->bits [i]) -
+             ((G_GINT64_CONSTANT (1) << (buckets->bits [i] - 1)) - 1);
+
+  raw = bits_get (reader, width);
+  if (width < 64 && (raw >> (width - 1)) & 1)
+    raw |= ~G_GUINT64_CONSTANT (0) << width;
+
+  return (gint64) raw;
+}
+
+static gboolean
+encode_time (BitWriter *writer,
+             Cursor    *cursor,
+             gint64     time)
+{
+  gint64 delta = time - cursor->time;
+
+  if (!encode_signed (writer, &time_buckets, delta - cursor->delta))
+    return FALSE;
+
+  cursor->time = time;
+  cursor->delta = delta;
+
+  return TRUE;
+}
+
+static void
+decode_time (BitReader *reader,
+             Cursor    *cursor)
+{
+  cursor->delta += decode_signed (reader, &time_buckets);
+  cursor->time += cursor->delta;
+}
+
+/* Only the bits between the leading and trailing zeros of the XOR go
+ * in, and when they fall inside the previous window not even its size.
+ */
+static void
+encode_value (BitWriter *writer,
+              Cursor    *cursor,
+              guint      scale,
+              gdouble    value)
+{
+  guint64 bits = value_to_cursor (scale, value);
+  guint64 x = bits ^ cursor->value;
+  guint leading, trailing, length;
+
+  if (scale != SCALE_XOR)
+    {
+      encode_signed (writer, &value_buckets, (gint64) (bits - cursor->value));
+      cursor->value = bits;
+      return;
+    }
+
+  cursor->value = bits;
+
+  if (x == 0)
+    {
+      bits_put (writer, 0, 1);
+      return;
+    }
+
+  leading = MIN (count_leading_zeros (x), 31);
+  trailing = count_trailing_zeros (x);
+
+  if (cursor->has_window && leading >= cursor->leading && trailing >= cursor->trailing)
+    {
+      bits_put (writer, 0x2, 2);
+      bits_put (writer, x >> cursor->trailing, 64 - cursor->leading - cursor->trailing);
+      return;
+    }
+
+  length = 64 - leading - trailing;
+  bits_put (writer, 0x3, 2);
+  bits_put (writer, leading, 5);
+  bits_put (writer, length - 1, 6);
+  bits_put (writer, x >> trailing, length);
+
+  cursor->leading = leading;
+  cursor->trailing = trailing;
+  cursor->has_window = TRUE;
+}
+
+static void
+decode_value (BitReader *reader,
+              Cursor    *cursor,
+              guint      scale)
+{
+  guint length;
+
+  if (scale != SCALE_XOR)
+    {
+      cursor->value += (guint64) decode_signed (reader, &value_buckets);
+      return;
+    }
+
+  if (bits_get (reader, 1) == 0)
+    return;
+
+  if (bits_get (reader, 1) == 1)
+    {
+      cursor->leading = bits_get (reader, 5);
+      length = bits_get (reader, 6) + 1;
+      if (cursor->leading + length > 64)
+        {
+          reader->overrun = TRUE;
+          return;
+        }
+      cursor->trailing = 64 - cursor->leading - length;
+      cursor->has_window = TRUE;
+    }
+  else if (!cursor->has_window)
+    {
+      reader->overrun = TRUE;
+      return;
+    }
+
+  cursor->value ^= bits_get (reader, 64 - cursor->leading - cursor->trailing) << cursor->trailing;
+}
+
+static void
+block_init (Block          *block,
+            gint64          idx,
+            GairqPollutant  pollutant,
+            guint           scale,
+            gint64          time,
+            gdouble         value,
+            Cursor         *cursor)
+{
+  memset (block, 0, sizeof (Block));
+  block->header.magic = BLOCK_MAGIC;
+  block->header.pollutant = pollutant;
+  block->header.scale = scale;
+  block->header.idx = idx;
+  block->header.first_time = time;
+  block->header.last_time = time;
+  block->header.first_value = value;
+  block->header.n_samples = 1;
+
+  memset (cursor, 0, sizeof (Cursor));
+  cursor->time = time;
+  cursor->value = value_to_cursor (scale, value);
+}
+
+static gboolean
+block_header_is_valid (const BlockHeader *header)
+{
+  return header->magic == BLOCK_MAGIC &&
+         header->header_check == gairq_hash64 (header, G_STRUCT_OFFSET (BlockHeader, header_check), 0) &&
+         header->pollutant < N_GAIRQ_POLLUTANTS &&
+         header->scale <= SCALE_XOR &&
+         header->n_samples > 0 &&
+         header->n_bits <= BLOCK_DATA_BITS &&
+         header->first_time <= header->last_time;
+}
+
+static gboolean
+block_data_is_valid (const Block *block)
+{
+  return block->header.data_check == gairq_hash64 (block->data, (block->header.n_bits + 7) / 8, 0);
+}
+
+/* Adds the samples in [@from, @to) to @samples, if given, and leaves
+ * @cursor at the last one. Stops early once past @to, the cursor is
+ * then only good for that far.
+ */
+static gboolean
+block_decode (const Block *block,
+              gint64       from,
+              gint64       to,
+              GArray      *samples,
+              Cursor      *cursor)
+{
+  BitReader reader = { block->data, 0, block->header.n_bits, FALSE };
+  GairqSeriesSample sample;
+  guint32 i;
+
+  memset (cursor, 0, sizeof (Cursor));
+  cursor->time = block->header.first_time;
+  cursor->value = value_to_cursor (block->header.scale, block->header.first_value);
+
+  for (i = 0; i < block->header.n_samples; i++)
+    {
+      if (i > 0)
+        {
+          decode_time (&reader, cursor);
+          decode_value (&reader, cursor, block->header.scale);
+          if (reader.overrun)
+            return FALSE;
+        }
+
+      if (samples == NULL || cursor->time < from)
+        continue;
+      if (cursor->time >= to)
+        break;
+
+      sample.time = cursor->time;
+      sample.value = value_from_cursor (block->header.scale, cursor->value);
+      g_array_append_val (samples, sample);
+    }
+
+  return TRUE;
+}
+
+static gboolean block_append (Block   *block,
+                              Cursor  *cursor,
+                              gint64   time,
+                              gdouble  value);
+
+/* Encodes the block over with more digits, or as XORs, to take @value */
+static gboolean
+block_rescale (Block   *block,
+               Cursor  *cursor,
+               guint    scale,
+               gint64   time,
+               gdouble  value)
+{
+  GairqSeriesSample *samples;
+  GArray *decoded;
+  Block saved;
+  Cursor saved_cursor = *cursor;
+  gboolean ret = TRUE;
+  guint i;
+
+  memcpy (&saved, block, sizeof (Block));
+
+  decoded = g_array_sized_new (FALSE, FALSE, sizeof (GairqSeriesSample), block->header.n_samples);
+  block_decode (block, G_MININT64, G_MAXINT64, decoded, cursor);
+  samples = (GairqSeriesSample *) decoded->data;
+
+  block_init (block, block->header.idx, block->header.pollutant, scale,
+              samples [0].time, samples [0].value, cursor);
+  for (i = 1; ret && i < decoded->len; i++)
+    ret = block_append (block, cursor, samples [i].time, samples [i].value);
+  if (ret)
+    ret = block_append (block, cursor, time, value);
+
+  if (!ret)
+    {
+      memcpy (block, &saved, sizeof (Block));
+      *cursor = saved_cursor;
+    }
+
+  g_array_unref (decoded);
+
+  return ret;
+}
+
+/* Leaves the block and @cursor as they were if the sample does not fit */
+static gboolean
+block_append (Block   *block,
+              Cursor  *cursor,
+              gint64   time,
+              gdouble  value)
+{
+  BitWriter writer = { block->data, block->header.n_bits, FALSE };
+  Cursor saved = *cursor;
+  guint scale = value_get_scale (value);
+
+  if (scale > block->header.scale)
+    return block_rescale (block, cursor, scale, time, value);
+
+  if (!encode_time (&writer, cursor, time))
+    writer.overflow = TRUE;
+  else
+    encode_value (&writer, cursor, block->header.scale, value);
+
+  if (writer.overflow)
+    {
+      bits_clear_from (block->data, block->header.n_bits);
+      *cursor = saved;
+      return FALSE;
+    }
+
+  block->header.n_bits = writer.pos;
+  block->header.n_samples++;
+  block->header.last_time = time;
+
+  return TRUE;
+}
+
+static void
+block_seal (Block *block)
+{
+  block->header.data_check = gairq_hash64 (block->data, (block->header.n_bits + 7) / 8, 0);
+  block->header.header_check = gairq_hash64 (&block->header,
+                                             G_STRUCT_OFFSET (BlockHeader, header_check), 0);
+}
+
+/* --- GObject --- */
+static gboolean gairq_series_store_flush_locked (GairqSeriesStore  *self,
+                                                 GError           **error);
+
+static void
+gairq_series_store_finalize (GObject *object)
+{
+  GairqSeriesStore *self = GAIRQ_SERIES_STORE (object);
+  GError *error = NULL;
+
+  if (self->fd >= 0)
+    {
+      if (!gairq_series_store_flush_locked (self, &error))
+        {
+          g_warning ("Failed to flush %s: %s", self->path, error->message);
+          g_clear_error (&error);
+        }
+      close (self->fd);
+    }
+
+  g_clear_pointer (&self->map, g_mapped_file_unref);
+  g_hash_table_destroy (self->series);
+  g_mutex_clear (&self->lock);
+  g_free (self->path);
+
+  G_OBJECT_CLASS (gairq_series_store_parent_class)->finalize (object);
+}
+
+static void
+gairq_series_store_set_property (GObject      *object,
+                                 guint         prop_id,
+                                 const GValue *value,
+                                 GParamSpec   *pspec)
+{
+  GairqSeriesStore *self = GAIRQ_SERIES_STORE (object);
+
+  switch (prop_id)
+    {
+    case PROP_PATH:
+      self->path = g_value_dup_string (value);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_series_store_get_property (GObject    *object,
+                                 guint       prop_id,
+                                 GValue     *value,
+                                 GParamSpec *pspec)
+{
+  GairqSeriesStore *self = GAIRQ_SERIES_STORE (object);
+
+  switch (prop_id)
+    {
+    case PROP_PATH:
+      g_value_set_string (value, self->path);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+gairq_series_store_class_init (GairqSeriesStoreClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gairq_series_store_finalize;
+  object_class->set_property = gairq_series_store_set_property;
+  object_class->get_property = gairq_series_store_get_property;
+
+  /**
+   * GairqSeriesStore:path:
+   *
+   * The file the readings live in, created if missing.
+   */
+  properties [PROP_PATH] =
+    g_param_spec_string ("path", "Path",
+                         "The store file",
+                         NULL,
+                         G_PARAM_READWRITE | G_PARAM_CONSTRUCT_ONLY);
+
+  g_object_class_install_properties (object_class, N_PROPERTIES, properties);
+}
+
+static void
+gairq_series_store_init (GairqSeriesStore *self)
+{
+  self->fd = -1;
+  self->map = NULL;
+  self->series = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, series_free);
+  self->file_size = 0;
+  self->n_samples = 0;
+  self->n_blocks_decoded = 0;
+  g_mutex_init (&self->lock);
+}
+
+/* --- Private Methods --- */
+static gboolean
+pwrite_all (gint           fd,
+            gconstpointer  data,
+            gsize          length,
+            guint64        offset,
+            GError       **error)
+{
+  const gchar *p = data;
+
+  while (length > 0)
+    {
+      gssize n = pwrite (fd, p, length, offset);
+
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        {
+          gint saved_errno = errno;
+
+          g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                       "Failed to write the store: %s", g_strerror (saved_errno));
+          return FALSE;
+        }
+
+      p += n;
+      length -= n;
+      offset += n;
+    }
+
+  return TRUE;
+}
+
+/* Must be called with the lock held */
+static Series *
+gairq_series_store_get_series_locked (GairqSeriesStore *self,
+                                      gint64            idx,
+                                      GairqPollutant    pollutant,
+                                      gboolean          create)
+{
+  gint64 key = SERIES_KEY (idx, pollutant);
+  Series *series;
+
+  series = g_hash_table_lookup (self->series, &key);
+  if (series || !create)
+    return series;
+
+  series = g_slice_new0 (Series);
+  series->key = key;
+  series->blocks = g_array_new (FALSE, FALSE, sizeof (BlockRef));
+  g_hash_table_insert (self->series, &series->key, series);
+
+  return series;
+}
+
+/* Must be called with the lock held. Maps the file again if the block
+ * was written after it was last mapped.
+ */
+static const Block *
+gairq_series_store_get_block_locked (GairqSeriesStore *self,
+                                     guint64           offset)
+{
+  if (self->map == NULL || offset + BLOCK_SIZE > g_mapped_file_get_length (self->map))
+    {
+      GError *error = NULL;
+
+      g_clear_pointer (&self->map, g_mapped_file_unref);
+      self->map = g_mapped_file_new_from_fd (self->fd, FALSE, &error);
+      if (self->map == NULL)
+        {
+          gairq_debug ("Failed to map %s: %s", self->path, error->message);
+          g_clear_error (&error);
+          return NULL;
+        }
+
+      if (offset + BLOCK_SIZE > g_mapped_file_get_length (self->map))
+        return NULL;
+    }
+
+  return (const Block *) (g_mapped_file_get_contents (self->map) + offset);
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_series_store_write_open_locked (GairqSeriesStore  *self,
+                                      Series            *series,
+                                      GError           **error)
+{
+  block_seal (series->open);
+  if (!pwrite_all (self->fd, series->open, BLOCK_SIZE, series->open_offset, error))
+    return FALSE;
+
+  /* Do not count on a private mapping seeing the new contents */
+  if (self->map && series->open_offset < g_mapped_file_get_length (self->map))
+    g_clear_pointer (&self->map, g_mapped_file_unref);
+
+  series->dirty = FALSE;
+
+  return TRUE;
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_series_store_close_open_locked (GairqSeriesStore  *self,
+                                      Series            *series,
+                                      GError           **error)
+{
+  BlockRef ref;
+
+  if (series->dirty && !gairq_series_store_write_open_locked (self, series, error))
+    return FALSE;
+
+  ref.offset = series->open_offset;
+  ref.first_time = series->open->header.first_time;
+  ref.last_time = series->open->header.last_time;
+  g_array_append_val (series->blocks, ref);
+
+  g_clear_pointer (&series->open, g_free);
+
+  return TRUE;
+}
+
+/* Must be called with the lock held. Picks the latest block of @series
+ * back up for appending, or failing that at least the latest sample.
+ */
+static void
+gairq_series_store_reopen_series_locked (GairqSeriesStore *self,
+                                         Series           *series)
+{
+  BlockRef *ref = &g_array_index (series->blocks, BlockRef, series->blocks->len - 1);
+  const Block *block;
+  Cursor cursor;
+
+  series->has_latest = TRUE;
+  series->latest.time = ref->last_time;
+  series->latest.value = NAN;
+
+  block = gairq_series_store_get_block_locked (self, ref->offset);
+  if (block == NULL || !block_data_is_valid (block) ||
+      !block_decode (block, 0, 0, NULL, &cursor))
+    {
+      gairq_debug ("Corrupt block at %" G_GUINT64_FORMAT " in %s", ref->offset, self->path);
+      return;
+    }
+
+  series->latest.value = value_from_cursor (block->header.scale, cursor.value);
+
+  series->open = g_new (Block, 1);
+  memcpy (series->open, block, sizeof (Block));
+  series->open_offset = ref->offset;
+  series->cursor = cursor;
+  series->dirty = FALSE;
+
+  g_array_set_size (series->blocks, series->blocks->len - 1);
+}
+
+/* Must be called with the lock held. Only block headers are checked,
+ * the data of a block is once it is decoded.
+ */
+static gboolean
+gairq_series_store_open_locked (GairqSeriesStore  *self,
+                                GError           **error)
+{
+  GHashTableIter iter;
+  gpointer value;
+  const gchar *data;
+  struct stat st;
+  guint64 offset;
+  gsize length;
+
+  self->fd = g_open (self->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (self->fd < 0 || fstat (self->fd, &st) < 0)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to open %s: %s", self->path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  if (st.st_size == 0)
+    {
+      gchar header [BLOCK_SIZE] = FILE_MAGIC;
+      guint32 version = FILE_VERSION;
+
+      memcpy (header + 8, &version, sizeof version);
+      if (!pwrite_all (self->fd, header, sizeof header, 0, error))
+        return FALSE;
+
+      self->file_size = BLOCK_SIZE;
+      return TRUE;
+    }
+
+  self->map = g_mapped_file_new_from_fd (self->fd, FALSE, error);
+  if (self->map == NULL)
+    return FALSE;
+
+  data = g_mapped_file_get_contents (self->map);
+  length = g_mapped_file_get_length (self->map);
+
+  if (length < BLOCK_SIZE ||
+      memcmp (data, FILE_MAGIC, sizeof FILE_MAGIC) != 0 ||
+      *(guint32 *) (data + 8) != FILE_VERSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "%s is not a series store", self->path);
+      return FALSE;
+    }
+
+  /* Blocks that never made it out whole are skipped, not truncated, a
+   * later one of another series may well be good.
+   */
+  for (offset = BLOCK_SIZE; offset + BLOCK_SIZE <= length; offset += BLOCK_SIZE)
+    {
+      const BlockHeader *header = (const BlockHeader *) (data + offset);
+      Series *series;
+      BlockRef ref;
+
+      if (!block_header_is_valid (header))
+        {
+          gairq_debug ("Skipping block at %" G_GUINT64_FORMAT " in %s", offset, self->path);
+          continue;
+        }
+
+      series = gairq_series_store_get_series_locked (self, header->idx, header->pollutant, TRUE);
+      if (series->blocks->len > 0 &&
+          g_array_index (series->blocks, BlockRef, series->blocks->len - 1).last_time >= header->first_time)
+        {
+          gairq_debug ("Skipping out of order block at %" G_GUINT64_FORMAT " in %s",
+                       offset, self->path);
+          continue;
+        }
+
+      ref.offset = offset;
+      ref.first_time = header->first_time;
+      ref.last_time = header->last_time;
+      g_array_append_val (series->blocks, ref);
+
+      self->n_samples += header->n_samples;
+    }
+
+  self->file_size = (length + BLOCK_SIZE - 1) / BLOCK_SIZE * BLOCK_SIZE;
+
+  g_hash_table_iter_init (&iter, self->series);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    gairq_series_store_reopen_series_locked (self, value);
+
+  return TRUE;
+}
+
+/* Must be called with the lock held, and with @time past the latest */
+static gboolean
+gairq_series_store_append_locked (GairqSeriesStore  *self,
+                                  Series            *series,
+                                  gint64             idx,
+                                  GairqPollutant     pollutant,
+                                  gint64             time,
+                                  gdouble            value,
+                                  GError           **error)
+{
+  if (series->open == NULL || !block_append (series->open, &series->cursor, time, value))
+    {
+      if (series->open && !gairq_series_store_close_open_locked (self, series, error))
+        return FALSE;
+
+      series->open = g_new (Block, 1);
+      block_init (series->open, idx, pollutant, value_get_scale (value),
+                  time, value, &series->cursor);
+      series->open_offset = self->file_size;
+      self->file_size += BLOCK_SIZE;
+    }
+
+  series->dirty = TRUE;
+  series->has_latest = TRUE;
+  series->latest.time = time;
+  series->latest.value = value;
+  self->n_samples++;
+
+  return TRUE;
+}
+
+/* Must be called with the lock held */
+static gboolean
+gairq_series_store_flush_locked (GairqSeriesStore  *self,
+                                 GError           **error)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_hash_table_iter_init (&iter, self->series);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      Series *series = value;
+
+      if (series->dirty && !gairq_series_store_write_open_locked (self, series, error))
+        return FALSE;
+    }
+
+  if (fsync (self->fd) < 0)
+    {
+      gint saved_errno = errno;
+
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (saved_errno),
+                   "Failed to sync %s: %s", self->path, g_strerror (saved_errno));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* --- Public APIs --- */
+GairqSeriesStore *
+gairq_series_store_new (const gchar  *path,
+                        GError      **error)
+{
+  GairqSeriesStore *self;
+  gboolean opened;
+
+  g_return_val_if_fail (path != NULL, NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  self = g_object_new (GAIRQ_TYPE_SERIES_STORE, "path", path, NULL);
+
+  g_mutex_lock (&self->lock);
+  opened = gairq_series_store_open_locked (self, error);
+  g_mutex_unlock (&self->lock);
+
+  if (!opened)
+    g_clear_object (&self);
+
+  return self;
+}
+
+const gchar *
+gairq_series_store_get_path (GairqSeriesStore *self)
+{
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (self), NULL);
+
+  return self->path;
+}
+
+/* Fails with G_IO_ERROR_INVALID_ARGUMENT unless @time is past the latest
+ * sample of the series.
+ */
+gboolean
+gairq_series_store_append (GairqSeriesStore  *self,
+                           gint64             idx,
+                           GairqPollutant     pollutant,
+                           gint64             time,
+                           gdouble            value,
+                           GError           **error)
+{
+  Series *series;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  series = gairq_series_store_get_series_locked (self, idx, pollutant, TRUE);
+  if (series->has_latest && time <= series->latest.time)
+    g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                 "%s of station %" G_GINT64_FORMAT " already has a sample at %" G_GINT64_FORMAT,
+                 gairq_pollutant_to_string (pollutant), idx, series->latest.time);
+  else
+    ret = gairq_series_store_append_locked (self, series, idx, pollutant, time, value, error);
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Appends every pollutant @air has a reading of. Readings that are not
+ * newer than what is stored, a station polled twice within the hour,
+ * are skipped.
+ */
+gboolean
+gairq_series_store_append_air (GairqSeriesStore  *self,
+                               GairqAirObject    *air,
+                               GError           **error)
+{
+  GHashTable *iaqi;
+  gint64 idx, time;
+  gboolean ret = TRUE;
+  guint i;
+
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (self), FALSE);
+  g_return_val_if_fail (GAIRQ_IS_AIR_OBJECT (air), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  iaqi = gairq_air_object_get_iaqi (air);
+  if (iaqi == NULL)
+    return TRUE;
+
+  idx = gairq_air_object_get_idx (air);
+  time = gairq_air_object_get_time (air);
+
+  g_mutex_lock (&self->lock);
+
+  for (i = 0; ret && i < N_GAIRQ_POLLUTANTS; i++)
+    {
+      gdouble *value = g_hash_table_lookup (iaqi, gairq_pollutant_to_string (i));
+      Series *series;
+
+      if (value == NULL)
+        continue;
+
+      series = gairq_series_store_get_series_locked (self, idx, i, TRUE);
+      if (series->has_latest && time <= series->latest.time)
+        continue;
+
+      ret = gairq_series_store_append_locked (self, series, idx, i, time, *value, error);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* Writes out the open block of every series and syncs the file */
+gboolean
+gairq_series_store_flush (GairqSeriesStore  *self,
+                          GError           **error)
+{
+  gboolean ret;
+
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (self), FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  ret = gairq_series_store_flush_locked (self, error);
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+/* The samples in [@from, @to) as GairqSeriesSample, oldest first. Only
+ * blocks overlapping the range are decoded.
+ */
+GArray *
+gairq_series_store_query (GairqSeriesStore *self,
+                          gint64            idx,
+                          GairqPollutant    pollutant,
+                          gint64            from,
+                          gint64            to)
+{
+  GArray *ret;
+  Series *series;
+  Cursor cursor;
+  guint lo, hi, i;
+
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (self), NULL);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, NULL);
+
+  ret = g_array_new (FALSE, FALSE, sizeof (GairqSeriesSample));
+
+  g_mutex_lock (&self->lock);
+
+  series = gairq_series_store_get_series_locked (self, idx, pollutant, FALSE);
+  if (series == NULL)
+    goto out;
+
+  /* The first block that reaches @from */
+  lo = 0;
+  hi = series->blocks->len;
+  while (lo < hi)
+    {
+      guint mid = lo + (hi - lo) / 2;
+
+      if (g_array_index (series->blocks, BlockRef, mid).last_time < from)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  for (i = lo; i < series->blocks->len; i++)
+    {
+      BlockRef *ref = &g_array_index (series->blocks, BlockRef, i);
+      const Block *block;
+      guint length = ret->len;
+
+      if (ref->first_time >= to)
+        break;
+
+      block = gairq_series_store_get_block_locked (self, ref->offset);
+      if (block == NULL || !block_data_is_valid (block) ||
+          !block_decode (block, from, to, ret, &cursor))
+        {
+          gairq_debug ("Corrupt block at %" G_GUINT64_FORMAT " in %s", ref->offset, self->path);
+          g_array_set_size (ret, length);
+          continue;
+        }
+
+      self->n_blocks_decoded++;
+    }
+
+  if (series->open &&
+      series->open->header.first_time < to &&
+      series->open->header.last_time >= from)
+    {
+      block_decode (series->open, from, to, ret, &cursor);
+      self->n_blocks_decoded++;
+    }
+
+out:
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+gboolean
+gairq_series_store_get_latest (GairqSeriesStore  *self,
+                               gint64             idx,
+                               GairqPollutant     pollutant,
+                               GairqSeriesSample *sample)
+{
+  Series *series;
+  gboolean ret = FALSE;
+
+  g_return_val_if_fail (GAIRQ_IS_SERIES_STORE (self), FALSE);
+  g_return_val_if_fail (pollutant < N_GAIRQ_POLLUTANTS, FALSE);
+
+  g_mutex_lock (&self->lock);
+
+  series = gairq_series_store_get_series_locked (self, idx, pollutant, FALSE);
+  if (series && series->has_latest)
+    {
+      if (sample)
+        *sample = series->latest;
+      ret = TRUE;
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return ret;
+}
+
+void
+gairq_series_store_get_stats (GairqSeriesStore      *self,
+                              GairqSeriesStoreStats *stats)
+{
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_if_fail (GAIRQ_IS_SERIES_STORE (self));
+  g_return_if_fail (stats != NULL);
+
+  g_mutex_lock (&self->lock);
+
+  stats->n_series = g_hash_table_size (self->series);
+  stats->n_samples = self->n_samples;
+  stats->n_blocks = 0;
+  stats->n_blocks_decoded = self->n_blocks_decoded;
+  stats->size = self->file_size;
+
+  g_hash_table_iter_init (&iter, self->series);
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    stats->n_blocks += ((Series *) value)->blocks->len + (((Series *) value)->open != NULL);
+
+  g_mutex_unlock (&self->lock);
+}
@@ -0,0 +1,85 @@
+/* gairq-series-store.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_SERIES_STORE_H
+#define GAIRQ_SERIES_STORE_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+#include <gairq/gairq-air-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_SERIES_STORE (gairq_series_store_get_type ())
+G_DECLARE_FINAL_TYPE (GairqSeriesStore, gairq_series_store, GAIRQ, SERIES_STORE, GObject)
+
+typedef struct
+{
+  gint64    time;
+  gdouble   value;
+} GairqSeriesSample;
+
+typedef struct
+{
+  guint     n_series;
+  guint64   n_samples;
+  guint64   n_blocks;
+  guint64   n_blocks_decoded;   /* By queries, since the store was opened */
+  guint64   size;               /* Of the file, in bytes */
+} GairqSeriesStoreStats;
+
+/* Readings by station idx and pollutant in an append-only file of fixed
+ * size blocks. Samples of a series have to come in time order, and the
+ * latest block of each is only written out on flush. Only one process
+ * may have a file open at a time.
+ */
+GairqSeriesStore *  gairq_series_store_new          (const gchar            *path,
+                                                     GError                **error);
+const gchar *       gairq_series_store_get_path     (GairqSeriesStore       *self);
+gboolean            gairq_series_store_append       (GairqSeriesStore       *self,
+                                                     gint64                  idx,
+                                                     GairqPollutant          pollutant,
+                                                     gint64                  time,
+                                                     gdouble                 value,
+                                                     GError                **error);
+gboolean            gairq_series_store_append_air   (GairqSeriesStore       *self,
+                                                     GairqAirObject         *air,
+                                                     GError                **error);
+gboolean            gairq_series_store_flush        (GairqSeriesStore       *self,
+                                                     GError                **error);
+GArray *            gairq_series_store_query        (GairqSeriesStore       *self,
+                                                     gint64                  idx,
+                                                     GairqPollutant          pollutant,
+                                                     gint64                  from,
+                                                     gint64                  to);
+gboolean            gairq_series_store_get_latest   (GairqSeriesStore       *self,
+                                                     gint64                  idx,
+                                                     GairqPollutant          pollutant,
+                                                     GairqSeriesSample      *sample);
+void                gairq_series_store_get_stats    (GairqSeriesStore       *self,
+                                                     GairqSeriesStoreStats  *stats);
+
+G_END_DECLS
+
+#endif
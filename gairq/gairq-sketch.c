@@ -0,0 +1,260 @@
+/* gairq-sketch.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "gairq-sketch.h"
+
+#include <math.h>
+#include <string.h>
+
+/* Values land in logarithmic bins, bin k holding (gamma^(k-1), gamma^k]
+ * with gamma = (1 + a) / (1 - a). Reporting the middle of a bin is then
+ * never further than a from any value in it. The bins are one dense run
+ * of counters from the lowest key seen; should it grow past MAX_BINS,
+ * the lowest ones are folded together and only the smallest quantiles
+ * lose accuracy.
+ */
+#define MAX_BINS        2048
+#define MIN_INDEXABLE   1e-9
+
+struct _GairqSketch
+{
+  gdouble     accuracy;
+  gdouble     gamma;
+  gdouble     log_gamma;
+  gdouble     min;
+  gdouble     max;
+  guint64     count;
+  guint64     zero_count;
+  gint        offset;     /* Key of bins [0] */
+  guint       n_bins;
+  guint32 *   bins;
+};
+
+G_DEFINE_BOXED_TYPE (GairqSketch, gairq_sketch,
+                     gairq_sketch_copy, gairq_sketch_free)
+
+
+static inline gint
+sketch_key (const GairqSketch *self,
+            gdouble            value)
+{
+  return (gint) ceil (log (value) / self->log_gamma);
+}
+
+static inline gdouble
+sketch_key_value (const GairqSketch *self,
+                  gint               key)
+{
+  return 2 * exp (key * self->log_gamma) / (self->gamma + 1);
+}
+
+/* Makes room for keys @lo to @hi, folding whatever falls below the
+ * lowest key kept into that one.
+ */
+static void
+sketch_extend (GairqSketch *self,
+               gint         lo,
+               gint         hi)
+{
+  guint32 *bins;
+  guint i, n_bins;
+
+  if (self->n_bins > 0)
+    {
+      lo = MIN (lo, self->offset);
+      hi = MAX (hi, self->offset + (gint) self->n_bins - 1);
+
+      if (lo == self->offset && hi == self->offset + (gint) self->n_bins - 1)
+        return;
+    }
+
+  if (hi - lo + 1 > MAX_BINS)
+    lo = hi - MAX_BINS + 1;
+
+  n_bins = hi - lo + 1;
+  bins = g_new0 (guint32, n_bins);
+
+  for (i = 0; i < self->n_bins; i++)
+    bins [MAX (self->offset + (gint) i, lo) - lo] += self->bins [i];
+
+  g_free (self->bins);
+  self->bins = bins;
+  self->n_bins = n_bins;
+  self->offset = lo;
+}
+
+static inline guint32 *
+sketch_bin (GairqSketch *self,
+            gint         key)
+{
+  return &self->bins [MAX (key, self->offset) - self->offset];
+}
+
+GairqSketch *
+gairq_sketch_new (gdouble relative_accuracy)
+{
+  GairqSketch *self;
+
+  g_return_val_if_fail (relative_accuracy > 0 && relative_accuracy < 1, NULL);
+
+  self = g_slice_new0 (GairqSketch);
+  self->accuracy = relative_accuracy;
+  self->gamma = (1 + relative_accuracy) / (1 - relative_accuracy);
+  self->log_gamma = log (self->gamma);
+  self->min = G_MAXDOUBLE;
+  self->max = -G_MAXDOUBLE;
+
+  return self;
+}
+
+GairqSketch *
+gairq_sketch_copy (const GairqSketch *self)
+{
+  GairqSketch *ret;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  ret = g_slice_dup (GairqSketch, self);
+  if (self->n_bins > 0)
+    {
+      ret->bins = g_new (guint32, self->n_bins);
+      memcpy (ret->bins, self->bins, self->n_bins * sizeof (guint32));
+    }
+
+  return ret;
+}
+
+void
+gairq_sketch_free (GairqSketch *self)
+{
+  if (self == NULL)
+    return;
+
+  g_free (self->bins);
+  g_slice_free (GairqSketch, self);
+}
+
+void
+gairq_sketch_add (GairqSketch *self,
+                  gdouble      value)
+{
+  gint key;
+
+  g_return_if_fail (self != NULL);
+
+  if (isnan (value))
+    return;
+
+  value = MAX (value, 0);
+  self->count++;
+  self->min = MIN (self->min, value);
+  self->max = MAX (self->max, value);
+
+  if (value <= MIN_INDEXABLE)
+    {
+      self->zero_count++;
+      return;
+    }
+
+  key = sketch_key (self, value);
+  sketch_extend (self, key, key);
+  (*sketch_bin (self, key))++;
+}
+
+void
+gairq_sketch_merge (GairqSketch       *self,
+                    const GairqSketch *other)
+{
+  guint i;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (other != NULL);
+  g_return_if_fail (self->gamma == other->gamma);
+
+  if (other->count == 0)
+    return;
+
+  self->count += other->count;
+  self->zero_count += other->zero_count;
+  self->min = MIN (self->min, other->min);
+  self->max = MAX (self->max, other->max);
+
+  if (other->n_bins == 0)
+    return;
+
+  sketch_extend (self, other->offset, other->offset + other->n_bins - 1);
+  for (i = 0; i < other->n_bins; i++)
+    *sketch_bin (self, other->offset + i) += other->bins [i];
+}
+
+/* Lower quantile, the value of rank floor (q * (count - 1)) */
+gdouble
+gairq_sketch_quantile (const GairqSketch *self,
+                       gdouble            q)
+{
+  gdouble rank;
+  guint64 seen;
+  guint i;
+
+  g_return_val_if_fail (self != NULL, NAN);
+  g_return_val_if_fail (q >= 0 && q <= 1, NAN);
+
+  if (self->count == 0)
+    return NAN;
+
+  rank = q * (self->count - 1);
+  seen = self->zero_count;
+  if (seen > rank)
+    return self->min;
+
+  for (i = 0; i < self->n_bins; i++)
+    {
+      seen += self->bins [i];
+      if (seen > rank)
+        return CLAMP (sketch_key_value (self, self->offset + i), self->min, self->max);
+    }
+
+  return self->max;
+}
+
+guint64
+gairq_sketch_get_count (const GairqSketch *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->count;
+}
+
+gdouble
+gairq_sketch_get_accuracy (const GairqSketch *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->accuracy;
+}
+
+/* In memory, in bytes */
+gsize
+gairq_sketch_get_size (const GairqSketch *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return sizeof (GairqSketch) + self->n_bins * sizeof (guint32);
+}
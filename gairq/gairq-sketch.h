@@ -0,0 +1,60 @@
+/* gairq-sketch.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef GAIRQ_SKETCH_H
+#define GAIRQ_SKETCH_H
+
+#if !defined(GAIRQ_INSIDE) && !defined(GAIRQ_COMPILATION)
+# error "Only <gairq/gairq.h> can be included directly."
+#endif
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define GAIRQ_TYPE_SKETCH (gairq_sketch_get_type ())
+
+/* Quantile summary of a stream of values (DDSketch). Any quantile comes
+ * back within @relative_accuracy of the true value, and two sketches of
+ * the same accuracy merge into the sketch of both streams. Values at or
+ * below zero are counted as zero.
+ */
+typedef struct _GairqSketch GairqSketch;
+
+GType           gairq_sketch_get_type         (void) G_GNUC_CONST;
+GairqSketch *   gairq_sketch_new              (gdouble            relative_accuracy);
+GairqSketch *   gairq_sketch_copy             (const GairqSketch *self);
+void            gairq_sketch_free             (GairqSketch       *self);
+
+void            gairq_sketch_add              (GairqSketch       *self,
+                                               gdouble            value);
+void            gairq_sketch_merge            (GairqSketch       *self,
+                                               const GairqSketch *other);
+gdouble         gairq_sketch_quantile         (const GairqSketch *self,
+                                               gdouble            q);
+guint64         gairq_sketch_get_count        (const GairqSketch *self);
+gdouble         gairq_sketch_get_accuracy     (const GairqSketch *self);
+gsize           gairq_sketch_get_size         (const GairqSketch *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GairqSketch, gairq_sketch_free)
+
+G_END_DECLS
+
+#endif
@@ -27,10 +27,82 @@
 
 #include <glib.h>
 
+#include <string.h>
+
 G_BEGIN_DECLS
 
 #define STR_VALIDATOR(_ptr) (_ptr != NULL && *_ptr != '\0')
 
+/* Fast non-cryptographic 64-bit hash, eight bytes a round with the
+ * MurmurHash3 finalizer at the end. Only good for fingerprints.
+ */
+static inline guint64
+gairq_hash64 (gconstpointer data,
+              gsize         length,
+              guint64       seed)
+{
+  const guchar *p = data;
+  guint64 h = seed ^ (length * G_GUINT64_CONSTANT (0x9e3779b97f4a7c15));
+  guint64 word;
+
+  for ( ; length >= 8; p += 8, length -= 8)
+    {
+      memcpy (&word, p, 8);
+      word *= G_GUINT64_CONSTANT (0x87c37b91114253d5);
+      word ^= word >> 31;
+      h = (h ^ word) * G_GUINT64_CONSTANT (0x4cf5ad432745937f);
+    }
+
+  word = 0;
+  memcpy (&word, p, length);
+  h ^= word * G_GUINT64_CONSTANT (0x87c37b91114253d5);
+
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= G_GUINT64_CONSTANT (0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+
+  return h;
+}
+
+/* Days since the epoch of a proleptic Gregorian date and back */
+static inline gint64
+gairq_days_from_civil (gint64 y,
+                       guint  m,
+                       guint  d)
+{
+  gint64 era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+  return era * 146097 + doe - 719468;
+}
+
+static inline void
+gairq_civil_from_days (gint64  days,
+                       gint64 *y,
+                       guint  *m,
+                       guint  *d)
+{
+  gint64 era, doe, yoe, doy, mp;
+
+  days += 719468;
+  era = (days >= 0 ? days : days - 146096) / 146097;
+  doe = days - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
 G_END_DECLS
 
 #endif
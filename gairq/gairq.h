@@ -26,10 +26,28 @@
 G_BEGIN_DECLS
 
 #define GAIRQ_INSIDE
+# include <gairq/gairq-aggregator.h>
+# include <gairq/gairq-air-batch.h>
+# include <gairq/gairq-air-binary.h>
 # include <gairq/gairq-air-object.h>
+# include <gairq/gairq-air-snapshot.h>
+# include <gairq/gairq-aqi.h>
+# include <gairq/gairq-arrow-writer.h>
 # include <gairq/gairq-city.h>
+# include <gairq/gairq-coalescer.h>
+# include <gairq/gairq-csv-import.h>
+# include <gairq/gairq-disk-cache.h>
+# include <gairq/gairq-executor.h>
 # include <gairq/gairq-geo.h>
+# include <gairq/gairq-intern.h>
+# include <gairq/gairq-monitor.h>
+# include <gairq/gairq-ndjson.h>
+# include <gairq/gairq-negative-cache.h>
 # include <gairq/gairq-request.h>
+# include <gairq/gairq-rollup.h>
+# include <gairq/gairq-scheduler.h>
+# include <gairq/gairq-series-store.h>
+# include <gairq/gairq-sketch.h>
 # include <gairq/gairq-version.h>
 #undef GAIRQ_INSIDE
 
@@ -0,0 +1,469 @@
+/* aggregate-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+#include <math.h>
+
+#define START_TIME        G_GINT64_CONSTANT (1546300800)
+#define HOUR              3600
+#define N_RANDOM_PUSHES   5000
+#define N_MONITOR_FETCHES 20
+
+/* Serves a reading an hour after the one before, PM2.5 going up by one */
+typedef struct
+{
+  GairqMonitor      parent_instance;
+
+  guint             issued;
+  guint             done;
+} TestMonitor;
+
+typedef struct
+{
+  GairqMonitorClass parent_class;
+} TestMonitorClass;
+
+G_DEFINE_TYPE (TestMonitor, test_monitor, GAIRQ_TYPE_MONITOR)
+
+static GairqAirObject *
+make_air (gint64  idx,
+          gint64  time,
+          gdouble pm25)
+{
+  GHashTable *iaqi = gairq_object_iaqi_new ();
+  gdouble *value = g_slice_new (gdouble);
+
+  *value = pm25;
+  g_hash_table_insert (iaqi, g_strdup ("pm25"), value);
+
+  return g_object_new (GAIRQ_TYPE_AIR_OBJECT,
+                       "idx", idx,
+                       "time", time,
+                       "iaqi", iaqi,
+                       NULL);
+}
+
+static gboolean
+complete_fetch (gpointer user_data)
+{
+  GTask *task = user_data;
+
+  g_task_return_pointer (task, g_object_ref (g_task_get_task_data (task)), g_object_unref);
+  g_object_unref (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_monitor_fetch_async (GairqMonitor        *monitor,
+                          GairqRequest        *request,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  TestMonitor *self = (TestMonitor *) monitor;
+  GTask *task;
+
+  task = g_task_new (request, cancellable, callback, user_data);
+  g_task_set_task_data (task,
+                        make_air (7, START_TIME + self->issued * HOUR, 10 + self->issued),
+                        g_object_unref);
+  self->issued++;
+
+  g_idle_add (complete_fetch, task);
+}
+
+static GairqAirObject *
+test_monitor_fetch_finish (GairqMonitor      *monitor,
+                           GairqRequest      *request,
+                           GAsyncResult      *res,
+                           GairqResultFlags  *result_flags,
+                           GError           **error)
+{
+  ((TestMonitor *) monitor)->done++;
+
+  return g_task_propagate_pointer (G_TASK (res), error);
+}
+
+static void
+test_monitor_class_init (TestMonitorClass *klass)
+{
+  GairqMonitorClass *monitor_class = GAIRQ_MONITOR_CLASS (klass);
+
+  monitor_class->fetch_async = test_monitor_fetch_async;
+  monitor_class->fetch_finish = test_monitor_fetch_finish;
+}
+
+static void
+test_monitor_init (TestMonitor *self)
+{
+}
+
+/* What the aggregates are by definition, from every reading kept */
+static void
+naive_aggregate (GHashTable     *hours,
+                 gint64          latest_hour,
+                 GairqPollutant  pollutant,
+                 GairqAggregate *aggregate)
+{
+  const guint window_hours [] = { 8, 24 };
+  gdouble *means [] = { &aggregate->mean_8h, &aggregate->mean_24h };
+  gdouble values [12];
+  gdouble min = G_MAXDOUBLE, max = -G_MAXDOUBLE, factor, weight, sum, total;
+  guint i, w, count, n_recent = 0;
+
+  for (w = 0; w < G_N_ELEMENTS (window_hours); w++)
+    {
+      for (i = 0, sum = 0, count = 0; i < window_hours [w]; i++)
+        {
+          gint64 hour = latest_hour - i;
+          gdouble *value = g_hash_table_lookup (hours, &hour);
+
+          if (value && !isnan (*value))
+            {
+              sum += *value;
+              count++;
+            }
+        }
+
+      *means [w] = count * 4 >= window_hours [w] * 3 ? sum / count : NAN;
+    }
+
+  aggregate->nowcast = NAN;
+  if (pollutant != GAIRQ_POLLUTANT_PM25 && pollutant != GAIRQ_POLLUTANT_PM10)
+    return;
+
+  for (i = 0; i < 12; i++)
+    {
+      gint64 hour = latest_hour - i;
+      gdouble *value = g_hash_table_lookup (hours, &hour);
+
+      values [i] = value ? *value : NAN;
+      if (isnan (values [i]))
+        continue;
+
+      n_recent += i < 3;
+      min = MIN (min, values [i]);
+      max = MAX (max, values [i]);
+    }
+
+  if (n_recent < 2)
+    return;
+  if (max <= 0)
+    {
+      aggregate->nowcast = 0;
+      return;
+    }
+
+  factor = MAX (min / max, 0.5);
+  for (i = 0, weight = 1, sum = 0, total = 0; i < 12; i++, weight *= factor)
+    if (!isnan (values [i]))
+      {
+        sum += weight * values [i];
+        total += weight;
+      }
+
+  aggregate->nowcast = sum / total;
+}
+
+static void
+assert_close (gdouble value,
+              gdouble expected)
+{
+  if (isnan (expected))
+    g_assert_true (isnan (value));
+  else
+    g_assert_cmpfloat_with_epsilon (value, expected, 1e-9 * MAX (1, fabs (expected)));
+}
+
+static GairqAggregate
+lookup (GairqAggregator *aggregator,
+        GairqPollutant   pollutant)
+{
+  GairqAggregate aggregate;
+
+  g_assert_true (gairq_aggregator_lookup (aggregator, 1, pollutant, &aggregate));
+
+  return aggregate;
+}
+
+/* Most recent first, NAN for an hour missed */
+static void
+push_hours (GairqAggregator *aggregator,
+            GairqPollutant   pollutant,
+            const gdouble   *values,
+            guint            n_values)
+{
+  guint i;
+
+  for (i = n_values; i > 0; i--)
+    if (!isnan (values [i - 1]))
+      gairq_aggregator_push_sample (aggregator, 1, pollutant,
+                                    START_TIME + (n_values - i) * HOUR + 120,
+                                    values [i - 1]);
+}
+
+static void
+test_gairq_aggregate_nowcast (void)
+{
+  g_autoptr(GairqAggregator) aggregator = NULL;
+  gdouble constant [12];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (constant); i++)
+    constant [i] = 10;
+
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_PM25, constant, 12);
+  assert_close (lookup (aggregator, GAIRQ_POLLUTANT_PM25).nowcast, 10);
+  g_clear_object (&aggregator);
+
+  /* Spread wider than twice, the weight stays at a half */
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_PM25, (const gdouble []) { 40, 20, 30, 10 }, 4);
+  assert_close (lookup (aggregator, GAIRQ_POLLUTANT_PM25).nowcast,
+                (40 + 0.5 * 20 + 0.25 * 30 + 0.125 * 10) / (1 + 0.5 + 0.25 + 0.125));
+  g_assert_cmpfloat (lookup (aggregator, GAIRQ_POLLUTANT_PM25).value, ==, 40);
+  g_clear_object (&aggregator);
+
+  /* Steadier values, the weight is their ratio */
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_PM10, (const gdouble []) { 30, 24, 27 }, 3);
+  assert_close (lookup (aggregator, GAIRQ_POLLUTANT_PM10).nowcast,
+                (30 + 0.8 * 24 + 0.64 * 27) / (1 + 0.8 + 0.64));
+  g_clear_object (&aggregator);
+
+  /* Two of the latest three hours missing */
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_PM25, (const gdouble []) { 30, NAN, NAN, 27, 25 }, 5);
+  g_assert_true (isnan (lookup (aggregator, GAIRQ_POLLUTANT_PM25).nowcast));
+  g_clear_object (&aggregator);
+
+  /* Only defined for particles */
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_O3, constant, 12);
+  g_assert_true (isnan (lookup (aggregator, GAIRQ_POLLUTANT_O3).nowcast));
+  g_clear_object (&aggregator);
+}
+
+static void
+test_gairq_aggregate_means (void)
+{
+  g_autoptr(GairqAggregator) aggregator = NULL;
+  gdouble day [24];
+  GairqAggregate aggregate;
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (day); i++)
+    day [i] = i + 1;
+
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_O3, day, 8);
+  aggregate = lookup (aggregator, GAIRQ_POLLUTANT_O3);
+  assert_close (aggregate.mean_8h, 4.5);
+  g_assert_true (isnan (aggregate.mean_24h));
+  g_clear_object (&aggregator);
+
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_CO, day, 24);
+  aggregate = lookup (aggregator, GAIRQ_POLLUTANT_CO);
+  assert_close (aggregate.mean_8h, 4.5);
+  assert_close (aggregate.mean_24h, 12.5);
+  g_clear_object (&aggregator);
+
+  /* Two hours short of 8 is still an average, three is not */
+  day [1] = day [4] = NAN;
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_O3, day, 8);
+  assert_close (lookup (aggregator, GAIRQ_POLLUTANT_O3).mean_8h, (1 + 3 + 4 + 6 + 7 + 8) / 6.0);
+  g_clear_object (&aggregator);
+
+  day [6] = NAN;
+  aggregator = gairq_aggregator_new ();
+  push_hours (aggregator, GAIRQ_POLLUTANT_O3, day, 8);
+  g_assert_true (isnan (lookup (aggregator, GAIRQ_POLLUTANT_O3).mean_8h));
+
+  /* A day without readings empties every window */
+  gairq_aggregator_push_sample (aggregator, 1, GAIRQ_POLLUTANT_O3, START_TIME + 40 * HOUR, 5);
+  aggregate = lookup (aggregator, GAIRQ_POLLUTANT_O3);
+  g_assert_cmpint (aggregate.time, ==, START_TIME + 40 * HOUR);
+  g_assert_true (isnan (aggregate.mean_8h));
+
+  g_assert_cmpuint (gairq_aggregator_get_n_series (aggregator), ==, 1);
+  gairq_aggregator_remove (aggregator, 1);
+  g_assert_cmpuint (gairq_aggregator_get_n_series (aggregator), ==, 0);
+  g_assert_false (gairq_aggregator_lookup (aggregator, 1, GAIRQ_POLLUTANT_O3, &aggregate));
+}
+
+/* Readings out of order, repeated within the hour and days apart all
+ * have to leave the running sums where a recount would be.
+ */
+static void
+test_gairq_aggregate_incremental (void)
+{
+  g_autoptr(GairqAggregator) aggregator = NULL;
+  g_autoptr(GHashTable) hours = NULL;
+  GairqPollutant pollutants [] = { GAIRQ_POLLUTANT_PM25, GAIRQ_POLLUTANT_CO };
+  guint p;
+
+  for (p = 0; p < G_N_ELEMENTS (pollutants); p++)
+    {
+      gint64 time = START_TIME, latest_time = G_MININT64, latest_hour = G_MININT64;
+      gdouble latest_value = NAN;
+      guint i;
+
+      aggregator = gairq_aggregator_new ();
+      hours = g_hash_table_new_full (g_int64_hash, g_int64_equal, g_free, g_free);
+
+      for (i = 0; i < N_RANDOM_PUSHES; i++)
+        {
+          GairqAggregate aggregate, expected;
+          gint64 reading_time, hour, *key;
+          gdouble value, *stored;
+          gint step = g_test_rand_int_range (0, 100);
+
+          if (step < 70)
+            time += HOUR;
+          else if (step < 80)
+            time += 2 * HOUR;
+          else if (step < 82)
+            time += g_test_rand_int_range (20, 40) * HOUR;
+
+          /* Now and then one from a few hours back */
+          reading_time = time;
+          if (g_test_rand_int_range (0, 10) == 0)
+            reading_time -= g_test_rand_int_range (1, 30) * HOUR;
+          reading_time += g_test_rand_int_range (0, HOUR);
+
+          value = g_test_rand_int_range (0, 5000) / 10.0;
+          gairq_aggregator_push_sample (aggregator, 1, pollutants [p], reading_time, value);
+
+          hour = reading_time / HOUR;
+          latest_hour = MAX (latest_hour, hour);
+          if (hour > latest_hour - 24)
+            {
+              key = g_new (gint64, 1);
+              stored = g_new (gdouble, 1);
+              *key = hour;
+              *stored = value;
+              g_hash_table_replace (hours, key, stored);
+            }
+          if (reading_time >= latest_time)
+            {
+              latest_time = reading_time;
+              latest_value = value;
+            }
+
+          aggregate = lookup (aggregator, pollutants [p]);
+          naive_aggregate (hours, latest_hour, pollutants [p], &expected);
+
+          g_assert_cmpint (aggregate.time, ==, latest_time);
+          g_assert_cmpfloat (aggregate.value, ==, latest_value);
+          assert_close (aggregate.nowcast, expected.nowcast);
+          assert_close (aggregate.mean_8h, expected.mean_8h);
+          assert_close (aggregate.mean_24h, expected.mean_24h);
+        }
+
+      g_clear_pointer (&hours, g_hash_table_unref);
+      g_clear_object (&aggregator);
+    }
+}
+
+static void
+changed_cb (GairqMonitor   *monitor,
+            GairqRequest   *request,
+            GairqAirObject *air,
+            gpointer        user_data)
+{
+  GairqAggregate aggregate;
+
+  /* Already in by the time the change is told */
+  g_assert_true (gairq_aggregator_lookup (gairq_monitor_get_aggregator (monitor),
+                                          7, GAIRQ_POLLUTANT_PM25, &aggregate));
+  g_assert_cmpint (aggregate.time, ==, gairq_air_object_get_time (air));
+}
+
+static void
+test_gairq_aggregate_monitor (void)
+{
+  g_autoptr(GairqAggregator) aggregator = NULL;
+  g_autoptr(GairqMonitor) monitor = NULL;
+  g_autoptr(GairqRequest) request = NULL;
+  g_autoptr(GairqAirObject) air = NULL;
+  GairqAggregate aggregate;
+  TestMonitor *test;
+
+  aggregator = gairq_aggregator_new ();
+  monitor = g_object_new (test_monitor_get_type (),
+                          "jitter", 0.0,
+                          "aggregator", aggregator,
+                          NULL);
+  g_assert_true (gairq_monitor_get_aggregator (monitor) == aggregator);
+  g_signal_connect (monitor, "changed", G_CALLBACK (changed_cb), NULL);
+
+  request = gairq_request_new ("token");
+  gairq_monitor_add (monitor, request, 1);
+
+  test = (TestMonitor *) monitor;
+  gairq_monitor_start (monitor);
+  while (test->done < N_MONITOR_FETCHES)
+    g_main_context_iteration (NULL, TRUE);
+  gairq_monitor_stop (monitor);
+  while (gairq_monitor_get_n_in_flight (monitor) > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* Readings 10, 11, ... an hour apart */
+  g_assert_true (gairq_aggregator_lookup (aggregator, 7, GAIRQ_POLLUTANT_PM25, &aggregate));
+  g_assert_cmpfloat (aggregate.value, ==, 10 + test->done - 1);
+  assert_close (aggregate.mean_8h, 10 + test->done - 4.5);
+  g_assert_false (isnan (aggregate.nowcast));
+
+  /* Pushed straight, the same way */
+  air = make_air (8, START_TIME, 25);
+  gairq_aggregator_push (aggregator, air);
+  g_assert_true (gairq_aggregator_lookup (aggregator, 8, GAIRQ_POLLUTANT_PM25, &aggregate));
+  g_assert_cmpfloat (aggregate.value, ==, 25);
+  g_assert_false (gairq_aggregator_lookup (aggregator, 8, GAIRQ_POLLUTANT_PM10, &aggregate));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/aggregate/nowcast",
+                   test_gairq_aggregate_nowcast);
+
+  g_test_add_func ("/Gairq/aggregate/means",
+                   test_gairq_aggregate_means);
+
+  g_test_add_func ("/Gairq/aggregate/incremental",
+                   test_gairq_aggregate_incremental);
+
+  g_test_add_func ("/Gairq/aggregate/monitor",
+                   test_gairq_aggregate_monitor);
+
+  return g_test_run ();
+}
@@ -0,0 +1,226 @@
+/* aqi-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+#include <math.h>
+
+#define N_BENCH_VALUES  (1 << 20)
+#define N_BENCH_ROUNDS  20
+
+static gdouble *
+random_concentrations (gsize n_values)
+{
+  gdouble *values = g_new (gdouble, n_values);
+  gsize i;
+
+  for (i = 0; i < n_values; i++)
+    values [i] = g_test_rand_double_range (-5.0, 700.0);
+
+  return values;
+}
+
+/* What a caller would write without the engine, US EPA PM2.5 only */
+static void
+naive_epa_pm25 (const gdouble *in,
+                gdouble       *out,
+                gsize          n_values)
+{
+  gsize i;
+
+  for (i = 0; i < n_values; i++)
+    {
+      gdouble c = in [i];
+
+      if (c < 0 || isnan (c))
+        out [i] = NAN;
+      else if (c <= 9.0)
+        out [i] = 50.0 / 9.0 * c;
+      else if (c < 35.5)
+        out [i] = 51 + 49.0 / 26.3 * (c - 9.1);
+      else if (c < 55.5)
+        out [i] = 101 + 49.0 / 19.9 * (c - 35.5);
+      else if (c < 125.5)
+        out [i] = 151 + 49.0 / 69.9 * (c - 55.5);
+      else if (c < 225.5)
+        out [i] = 201 + 99.0 / 99.9 * (c - 125.5);
+      else if (c <= 325.4)
+        out [i] = 301 + 199.0 / 99.9 * (c - 225.5);
+      else
+        out [i] = 500;
+    }
+}
+
+static void
+test_gairq_aqi_breakpoints (void)
+{
+  const gdouble in [] = { 0, 9.0, 35.4, 35.5, 150.5, 1000, -1, NAN };
+  gdouble out [G_N_ELEMENTS (in)];
+
+  gairq_aqi_compute_sub_index (GAIRQ_AQI_STANDARD_US_EPA, GAIRQ_POLLUTANT_PM25,
+                               in, out, G_N_ELEMENTS (in));
+  g_assert_cmpfloat_with_epsilon (out [0], 0, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [1], 50, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [2], 100, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [3], 101, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [4], 201 + 99.0 / 99.9 * 25, 1e-9);
+  g_assert_cmpfloat (out [5], ==, 500);
+  g_assert_true (isnan (out [6]));
+  g_assert_true (isnan (out [7]));
+
+  gairq_aqi_compute_sub_index (GAIRQ_AQI_STANDARD_CN_HJ633, GAIRQ_POLLUTANT_PM25,
+                               (const gdouble []) { 75, 95 }, out, 2);
+  g_assert_cmpfloat_with_epsilon (out [0], 100, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [1], 125, 1e-9);
+
+  gairq_aqi_compute_sub_index (GAIRQ_AQI_STANDARD_EU_CAQI, GAIRQ_POLLUTANT_PM10,
+                               (const gdouble []) { 50, 300 }, out, 2);
+  g_assert_cmpfloat_with_epsilon (out [0], 50, 1e-9);
+  g_assert_cmpfloat (out [1], ==, 100);
+
+  gairq_aqi_compute_sub_index (GAIRQ_AQI_STANDARD_IN_NAQI, GAIRQ_POLLUTANT_CO,
+                               (const gdouble []) { 2, 6 }, out, 2);
+  g_assert_cmpfloat_with_epsilon (out [0], 100, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [1], 150, 1e-9);
+}
+
+static void
+test_gairq_aqi_overall (void)
+{
+  const gdouble pm25 [] = { 9.0, NAN, 500, NAN };
+  const gdouble o3 [] = { 70, 54, NAN, NAN };
+  const gdouble *columns [N_GAIRQ_POLLUTANTS] = { NULL, };
+  gdouble out [4];
+
+  columns [GAIRQ_POLLUTANT_PM25] = pm25;
+  columns [GAIRQ_POLLUTANT_O3] = o3;
+
+  gairq_aqi_compute (GAIRQ_AQI_STANDARD_US_EPA, columns, out, 4);
+  g_assert_cmpfloat_with_epsilon (out [0], 100, 1e-9);
+  g_assert_cmpfloat_with_epsilon (out [1], 50, 1e-9);
+  g_assert_cmpfloat (out [2], ==, 500);
+  g_assert_true (isnan (out [3]));
+}
+
+static void
+test_gairq_aqi_kernels (void)
+{
+  g_autofree gdouble *in = NULL;
+  g_autofree gdouble *expected = NULL;
+  g_autofree gdouble *out = NULL;
+  const gsize n_values = 4099;
+  GairqAqiKernel kernel;
+  guint standard, pollutant;
+  gsize i;
+
+  in = random_concentrations (n_values);
+  expected = g_new (gdouble, n_values);
+  out = g_new (gdouble, n_values);
+
+  /* Every vector kernel has to agree with the scalar one */
+  for (kernel = GAIRQ_AQI_KERNEL_SSE2; kernel < N_GAIRQ_AQI_KERNELS; kernel++)
+    {
+      if (!gairq_aqi_kernel_is_supported (kernel))
+        continue;
+
+      for (standard = 0; standard < N_GAIRQ_AQI_STANDARDS; standard++)
+        for (pollutant = 0; pollutant < N_GAIRQ_POLLUTANTS; pollutant++)
+          {
+            gairq_aqi_compute_sub_index_full (standard, pollutant,
+                                              GAIRQ_AQI_KERNEL_SCALAR,
+                                              in, expected, n_values);
+            gairq_aqi_compute_sub_index_full (standard, pollutant, kernel,
+                                              in, out, n_values);
+
+            for (i = 0; i < n_values; i++)
+              {
+                if (isnan (expected [i]))
+                  g_assert_true (isnan (out [i]));
+                else
+                  g_assert_cmpfloat_with_epsilon (out [i], expected [i], 1e-9);
+              }
+          }
+    }
+}
+
+static void
+test_gairq_aqi_benchmark (void)
+{
+  g_autofree gdouble *in = NULL;
+  g_autofree gdouble *out = NULL;
+  GairqAqiKernel kernel;
+  gdouble elapsed;
+  guint round;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  in = random_concentrations (N_BENCH_VALUES);
+  out = g_new (gdouble, N_BENCH_VALUES);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    naive_epa_pm25 (in, out, N_BENCH_VALUES);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "naive loop: %.1f Mvalues/s",
+                           N_BENCH_ROUNDS * N_BENCH_VALUES / elapsed / 1e6);
+
+  for (kernel = GAIRQ_AQI_KERNEL_SCALAR; kernel < N_GAIRQ_AQI_KERNELS; kernel++)
+    {
+      if (!gairq_aqi_kernel_is_supported (kernel))
+        continue;
+
+      g_test_timer_start ();
+      for (round = 0; round < N_BENCH_ROUNDS; round++)
+        gairq_aqi_compute_sub_index_full (GAIRQ_AQI_STANDARD_US_EPA,
+                                          GAIRQ_POLLUTANT_PM25, kernel,
+                                          in, out, N_BENCH_VALUES);
+      elapsed = g_test_timer_elapsed ();
+      g_test_minimized_result (elapsed, "kernel %d: %.1f Mvalues/s", kernel,
+                               N_BENCH_ROUNDS * N_BENCH_VALUES / elapsed / 1e6);
+    }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/aqi/breakpoints",
+                   test_gairq_aqi_breakpoints);
+
+  g_test_add_func ("/Gairq/aqi/overall",
+                   test_gairq_aqi_overall);
+
+  g_test_add_func ("/Gairq/aqi/kernels",
+                   test_gairq_aqi_kernels);
+
+  g_test_add_func ("/Gairq/aqi/benchmark",
+                   test_gairq_aqi_benchmark);
+
+  return g_test_run ();
+}
@@ -0,0 +1,145 @@
+/* arena-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-utils.h"
+
+#include <locale.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"attributions\":[" \
+  "{\"name\":\"Istanbul Ministry of Environment\",\"url\":\"http://www.havaizleme.gov.tr/\"}," \
+  "{\"name\":\"Istanbul Metropolitan Municipality\",\"url\":\"http://www.ibb.gov.tr/\"}," \
+  "{\"name\":\"European Environment Agency\",\"url\":\"http://www.eea.europa.eu/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"h\":{\"v\":77},\"no2\":{\"v\":21.4},\"o3\":{\"v\":11.2}," \
+  "\"p\":{\"v\":1016},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33},\"so2\":{\"v\":3.6}," \
+  "\"t\":{\"v\":14},\"w\":{\"v\":2.5}}}}"
+
+static JsonNode *
+parse_payload (void)
+{
+  g_autoptr(JsonParser) parser = NULL;
+  GError *error = NULL;
+
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, PAYLOAD, -1, &error);
+  g_assert_no_error (error);
+
+  return json_parser_steal_root (parser);
+}
+
+static void
+test_gairq_arena_content (void)
+{
+  g_autoptr(GairqAirObject) heap = NULL;
+  g_autoptr(GairqAirObject) arena = NULL;
+  g_autoptr(GError) error = NULL;
+  JsonNode *root;
+
+  root = parse_payload ();
+
+  heap = gairq_request_deserialize (root, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+  g_assert_no_error (error);
+  arena = gairq_request_deserialize (root, GAIRQ_AIR_OBJECT_FLAGS_ARENA, &error);
+  g_assert_no_error (error);
+
+  test_assert_air_equal (heap, arena);
+  g_assert_cmpstr (((GairqObjectAttr *) gairq_air_object_get_attributions (arena)->data)->name,
+                   ==, "Istanbul Ministry of Environment");
+
+  /* Replacing arena-owned members must not free them individually */
+  g_object_set (arena,
+                "city", gairq_object_city_new ("Elsewhere", "http://example", 1, 2),
+                "attributions", NULL,
+                NULL);
+  g_assert_cmpstr (gairq_air_object_get_city (arena)->name, ==, "Elsewhere");
+  g_assert_null (gairq_air_object_get_attributions (arena));
+
+  json_node_unref (root);
+}
+
+static void
+test_gairq_arena_allocations (void)
+{
+#ifdef __GLIBC__
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_NONE,
+    GAIRQ_AIR_OBJECT_FLAGS_ARENA,
+  };
+  guint allocs [G_N_ELEMENTS (modes)];
+  guint frees [G_N_ELEMENTS (modes)];
+  JsonNode *root, *data;
+  guint i;
+
+  root = parse_payload ();
+  data = json_object_get_member (json_node_get_object (root), "data");
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      TestAllocCount count;
+      GairqAirObject *air;
+
+      /* Warm up the type system and json-glib's caches first */
+      g_object_unref (gairq_air_object_new_from_data (data, modes [i]));
+
+      test_alloc_count_begin ();
+      air = gairq_air_object_new_from_data (data, modes [i]);
+      test_alloc_count_end (&count);
+      allocs [i] = count.n_allocs;
+
+      test_alloc_count_begin ();
+      g_object_unref (air);
+      test_alloc_count_end (&count);
+      frees [i] = count.n_frees;
+
+      g_test_message ("flags %u: %u allocations, %u frees on finalize",
+                      modes [i], allocs [i], frees [i]);
+    }
+
+  /* Strings, attributions, the city and iaqi values come out of one block */
+  g_assert_cmpuint (allocs [1], <, allocs [0]);
+  g_assert_cmpuint (frees [1], <, frees [0]);
+  g_assert_cmpuint (frees [0] - frees [1], >=, 4 * 4 + 3 + 10 * 2 - 1);
+
+  json_node_unref (root);
+#else
+  g_test_skip ("Counting allocations needs glibc");
+#endif
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/arena/content",
+                   test_gairq_arena_content);
+
+  g_test_add_func ("/Gairq/arena/allocations",
+                   test_gairq_arena_allocations);
+
+  return g_test_run ();
+}
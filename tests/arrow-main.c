@@ -0,0 +1,553 @@
+/* arrow-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+#include <math.h>
+#include <string.h>
+
+#define RESPONSE_FMT \
+  "{\"status\":\"ok\",\"data\":{\"idx\":%d,\"aqi\":%d," \
+  "\"attributions\":[{\"name\":\"%s\",\"url\":\"http://agency.example\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"name\":\"Station\",\"url\":\"http://city.example\",\"geo\":[%d.5,%d.25]}," \
+  "\"iaqi\":{\"pm25\":{\"v\":%d}%s},\"time\":{\"v\":%d}}}"
+
+#define HEADER_SCHEMA         1
+#define HEADER_DICTIONARY     2
+#define HEADER_RECORD_BATCH   3
+
+/* Nodes and buffers of the record batches, in schema order */
+#define NODE_PM25             5
+#define NODE_ATTRIBUTIONS     11
+#define BUFFER_IDX            1
+#define BUFFER_AQI_VALIDITY   2
+#define BUFFER_PM25           (2 * NODE_PM25 + 1)
+#define BUFFER_ATTR_OFFSETS   (2 * NODE_ATTRIBUTIONS + 1)
+#define BUFFER_ATTR_INDICES   (2 * NODE_ATTRIBUTIONS + 3)
+
+#define N_BENCH_ROWS          (1 << 20)
+
+typedef struct
+{
+  guint8          type;
+  gsize           header;
+  const guint8 *  body;
+  gsize           next;
+} Message;
+
+static GairqAirObject *
+build_air (gint         idx,
+           gint         aqi,
+           const gchar *agency,
+           const gchar *extra)
+{
+  g_autoptr(JsonParser) parser = NULL;
+  g_autofree gchar *payload = NULL;
+  GairqAirObject *air;
+  GError *error = NULL;
+
+  payload = g_strdup_printf (RESPONSE_FMT, idx, aqi, agency, idx, idx, idx, extra, idx * 3600);
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, payload, -1, &error);
+  g_assert_no_error (error);
+
+  air = gairq_request_default_deserialize (json_parser_get_root (parser), &error);
+  g_assert_no_error (error);
+
+  return air;
+}
+
+/* --- Just enough of a flatbuffers reader --- */
+static guint16
+get_u16 (const guint8 *p)
+{
+  guint16 v;
+
+  memcpy (&v, p, sizeof v);
+  return GUINT16_FROM_LE (v);
+}
+
+static guint32
+get_u32 (const guint8 *p)
+{
+  guint32 v;
+
+  memcpy (&v, p, sizeof v);
+  return GUINT32_FROM_LE (v);
+}
+
+static guint64
+get_u64 (const guint8 *p)
+{
+  guint64 v;
+
+  memcpy (&v, p, sizeof v);
+  return GUINT64_FROM_LE (v);
+}
+
+static gsize
+fb_deref (const guint8 *buf,
+          gsize         pos)
+{
+  return pos + get_u32 (buf + pos);
+}
+
+/* Where field @id of a table is, 0 when it is absent */
+static gsize
+fb_field (const guint8 *buf,
+          gsize         table,
+          guint         id)
+{
+  gsize vtable = table - (gint32) get_u32 (buf + table);
+  guint16 offset;
+
+  if (4 + 2 * id >= get_u16 (buf + vtable))
+    return 0;
+
+  offset = get_u16 (buf + vtable + 4 + 2 * id);
+
+  return offset ? table + offset : 0;
+}
+
+static guint
+fb_vector_length (const guint8 *buf,
+                  gsize         table,
+                  guint         id)
+{
+  return get_u32 (buf + fb_deref (buf, fb_field (buf, table, id)));
+}
+
+/* Item @i of a vector of structs with @size bytes each */
+static const guint8 *
+fb_struct_at (const guint8 *buf,
+              gsize         table,
+              guint         id,
+              guint         i,
+              gsize         size)
+{
+  return buf + fb_deref (buf, fb_field (buf, table, id)) + 4 + i * size;
+}
+
+static gboolean
+read_message (const guint8 *buf,
+              gsize         pos,
+              Message      *msg)
+{
+  gsize root, length;
+
+  g_assert_cmphex (get_u32 (buf + pos), ==, 0xffffffff);
+  length = get_u32 (buf + pos + 4);
+  if (length == 0)
+    return FALSE;
+
+  g_assert_cmpuint (length % 8, ==, 0);
+
+  root = fb_deref (buf, pos + 8);
+  g_assert_cmpuint (get_u16 (buf + fb_field (buf, root, 0)), ==, 4);
+  msg->type = buf [fb_field (buf, root, 1)];
+  msg->header = fb_deref (buf, fb_field (buf, root, 2));
+  msg->body = buf + pos + 8 + length;
+  msg->next = pos + 8 + length + get_u64 (buf + fb_field (buf, root, 3));
+
+  return TRUE;
+}
+
+/* Body of buffer @i of a RecordBatch table */
+static const guint8 *
+batch_buffer (const guint8 *buf,
+              const Message *msg,
+              gsize          batch,
+              guint          i,
+              gsize         *length)
+{
+  const guint8 *desc = fb_struct_at (buf, batch, 2, i, 16);
+
+  if (length)
+    *length = get_u64 (desc + 8);
+
+  return msg->body + get_u64 (desc);
+}
+
+static GBytes *
+steal_output (GOutputStream *stream)
+{
+  g_autoptr(GError) error = NULL;
+
+  g_output_stream_close (stream, NULL, &error);
+  g_assert_no_error (error);
+
+  return g_memory_output_stream_steal_as_bytes (G_MEMORY_OUTPUT_STREAM (stream));
+}
+
+static void
+test_gairq_arrow_stream (void)
+{
+  g_autoptr(GOutputStream) stream = NULL;
+  g_autoptr(GairqArrowWriter) writer = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  const guint8 *buf, *data;
+  const gint32 *offsets, *indices;
+  GairqArrowWriterStats stats;
+  Message msg;
+  gsize pos, batch, length;
+  gint i;
+
+  stream = g_memory_output_stream_new_resizable ();
+  writer = gairq_arrow_writer_new (stream, GAIRQ_ARROW_FORMAT_STREAM, 0);
+
+  for (i = 0; i < 3; i++)
+    {
+      g_autoptr(GairqAirObject) air = build_air (100 + i, i == 1 ? -1 : 40 + i,
+                                                 i == 2 ? "EPA" : "EEA",
+                                                 i == 0 ? ",\"no2\":{\"v\":1}" : "");
+
+      g_assert_true (gairq_arrow_writer_append (writer, air, &error));
+      g_assert_no_error (error);
+    }
+
+  g_assert_true (gairq_arrow_writer_close (writer, &error));
+  g_assert_no_error (error);
+
+  bytes = steal_output (stream);
+  buf = g_bytes_get_data (bytes, NULL);
+
+  /* Schema with its twelve fields */
+  g_assert_true (read_message (buf, 0, &msg));
+  g_assert_cmpuint (msg.type, ==, HEADER_SCHEMA);
+  g_assert_cmpuint (fb_vector_length (buf, msg.header, 1), ==, 12);
+
+  /* The names in the order they were met, not a delta */
+  g_assert_true (read_message (buf, msg.next, &msg));
+  g_assert_cmpuint (msg.type, ==, HEADER_DICTIONARY);
+  pos = fb_field (buf, msg.header, 2);
+  g_assert_true (pos == 0 || buf [pos] == FALSE);
+  batch = fb_deref (buf, fb_field (buf, msg.header, 1));
+  g_assert_cmpuint (get_u64 (buf + fb_field (buf, batch, 0)), ==, 3);
+  offsets = (const gint32 *) batch_buffer (buf, &msg, batch, 1, NULL);
+  data = batch_buffer (buf, &msg, batch, 2, NULL);
+  g_assert_cmpint (offsets [1], ==, 3);
+  g_assert_cmpmem (data, offsets [1], "EEA", 3);
+  g_assert_cmpmem (data + offsets [1], offsets [2] - offsets [1],
+                   "World Air Quality Index Project", 31);
+
+  g_assert_true (read_message (buf, msg.next, &msg));
+  g_assert_cmpuint (msg.type, ==, HEADER_RECORD_BATCH);
+  batch = msg.header;
+  g_assert_cmpuint (get_u64 (buf + fb_field (buf, batch, 0)), ==, 3);
+  g_assert_cmpuint (fb_vector_length (buf, batch, 1), ==, 13);
+  g_assert_cmpuint (fb_vector_length (buf, batch, 2), ==, 26);
+
+  data = batch_buffer (buf, &msg, batch, BUFFER_IDX, &length);
+  g_assert_cmpuint (length, ==, 3 * sizeof (gint64));
+  for (i = 0; i < 3; i++)
+    g_assert_cmpint (((const gint64 *) data) [i], ==, 100 + i);
+
+  /* The unknown aqi is a null */
+  data = batch_buffer (buf, &msg, batch, BUFFER_AQI_VALIDITY, NULL);
+  g_assert_cmphex (data [0], ==, 0x5);
+  g_assert_cmpuint (get_u64 (fb_struct_at (buf, batch, 1, 1, 16) + 8), ==, 1);
+
+  data = batch_buffer (buf, &msg, batch, BUFFER_PM25, NULL);
+  g_assert_cmpfloat (((const gdouble *) data) [2], ==, 102);
+
+  offsets = (const gint32 *) batch_buffer (buf, &msg, batch, BUFFER_ATTR_OFFSETS, NULL);
+  indices = (const gint32 *) batch_buffer (buf, &msg, batch, BUFFER_ATTR_INDICES, &length);
+  g_assert_cmpuint (length, ==, 6 * sizeof (gint32));
+  g_assert_cmpint (offsets [3], ==, 6);
+  g_assert_cmpint (indices [0], ==, 0);
+  g_assert_cmpint (indices [1], ==, 1);
+  g_assert_cmpint (indices [4], ==, 2);
+
+  /* End of stream */
+  g_assert_false (read_message (buf, msg.next, &msg));
+
+  gairq_arrow_writer_get_stats (writer, &stats);
+  g_assert_cmpuint (stats.n_rows, ==, 3);
+  g_assert_cmpuint (stats.n_batches, ==, 1);
+  g_assert_cmpuint (stats.n_dictionary_batches, ==, 1);
+  g_assert_cmpuint (stats.n_attributions, ==, 3);
+  g_assert_cmpuint (stats.n_bytes, ==, g_bytes_get_size (bytes));
+}
+
+static void
+test_gairq_arrow_file (void)
+{
+  g_autoptr(GOutputStream) stream = NULL;
+  g_autoptr(GairqArrowWriter) writer = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  const guint8 *buf;
+  gsize size, footer;
+  guint64 n_rows = 0;
+  Message msg;
+  guint i;
+
+  stream = g_memory_output_stream_new_resizable ();
+  writer = gairq_arrow_writer_new (stream, GAIRQ_ARROW_FORMAT_FILE, 64);
+
+  for (i = 0; i < 200; i++)
+    {
+      g_autoptr(GairqAirObject) air = build_air (i, i, "EPA", "");
+
+      g_assert_true (gairq_arrow_writer_append (writer, air, &error));
+      g_assert_no_error (error);
+    }
+
+  g_assert_true (gairq_arrow_writer_close (writer, &error));
+  g_assert_no_error (error);
+
+  bytes = steal_output (stream);
+  buf = g_bytes_get_data (bytes, &size);
+
+  g_assert_cmpmem (buf, 8, "ARROW1\0\0", 8);
+  g_assert_cmpmem (buf + size - 6, 6, "ARROW1", 6);
+
+  footer = size - 10 - get_u32 (buf + size - 10);
+  footer = fb_deref (buf, footer);
+  g_assert_cmpuint (fb_vector_length (buf, footer, 2), ==, 1);
+  g_assert_cmpuint (fb_vector_length (buf, footer, 3), ==, 4);
+
+  /* Every block points at a record batch message */
+  for (i = 0; i < 4; i++)
+    {
+      const guint8 *block = fb_struct_at (buf, footer, 3, i, 24);
+
+      g_assert_true (read_message (buf, get_u64 (block), &msg));
+      g_assert_cmpuint (msg.type, ==, HEADER_RECORD_BATCH);
+      g_assert_cmpuint (get_u32 (block + 8), ==, (msg.body - buf) - get_u64 (block));
+      g_assert_cmpuint (get_u64 (block + 16), ==, msg.next - (msg.body - buf));
+      n_rows += get_u64 (buf + fb_field (buf, msg.header, 0));
+    }
+
+  g_assert_cmpuint (n_rows, ==, 200);
+
+  /* Nothing more goes out once closed */
+  g_assert_false (gairq_arrow_writer_close (writer, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CLOSED);
+}
+
+static void
+test_gairq_arrow_batches (void)
+{
+  g_autoptr(GOutputStream) stream = NULL;
+  g_autoptr(GairqArrowWriter) writer = NULL;
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  GairqArrowWriterStats stats;
+  const guint8 *buf;
+  guint64 n_rows = 0, n_nulls = 0;
+  Message msg;
+  gsize pos;
+  guint i;
+
+  batch = gairq_air_batch_new (0);
+  for (i = 0; i < 10000; i++)
+    {
+      gdouble values [N_GAIRQ_POLLUTANTS] = { i, i, i, i, i, i };
+
+      gairq_air_batch_append_row (batch, i, i % 300, 1571000000 + i, NAN, NAN,
+                                  values, i % 3 ? 0x3f : 0x3e);
+    }
+
+  stream = g_memory_output_stream_new_resizable ();
+  writer = gairq_arrow_writer_new (stream, GAIRQ_ARROW_FORMAT_STREAM, 1000);
+
+  /* With a row ahead the first batch is copied row by row, 9 full
+   * record batches and a short one on flush. Then the second one goes
+   * out in place, 9 more and its tail on close.
+   */
+  air = build_air (1, 1, "EPA", "");
+  g_assert_true (gairq_arrow_writer_append (writer, air, &error));
+  g_assert_true (gairq_arrow_writer_append_batch (writer, batch, &error));
+  g_assert_true (gairq_arrow_writer_flush (writer, &error));
+  g_assert_true (gairq_arrow_writer_append_batch (writer, batch, &error));
+  g_assert_true (gairq_arrow_writer_close (writer, &error));
+  g_assert_no_error (error);
+
+  gairq_arrow_writer_get_stats (writer, &stats);
+  g_assert_cmpuint (stats.n_rows, ==, 20001);
+  g_assert_cmpuint (stats.n_batches, ==, 20);
+
+  bytes = steal_output (stream);
+  buf = g_bytes_get_data (bytes, NULL);
+
+  for (pos = 0; read_message (buf, pos, &msg); pos = msg.next)
+    {
+      const guint8 *node;
+
+      if (msg.type != HEADER_RECORD_BATCH)
+        continue;
+
+      n_rows += get_u64 (buf + fb_field (buf, msg.header, 0));
+      node = fb_struct_at (buf, msg.header, 1, NODE_PM25, 16);
+      n_nulls += get_u64 (node + 8);
+
+      /* Rows from a batch have no list at all */
+      node = fb_struct_at (buf, msg.header, 1, NODE_ATTRIBUTIONS, 16);
+      g_assert_cmpuint (get_u64 (node + 8), >=, get_u64 (node) - 1);
+    }
+
+  g_assert_cmpuint (n_rows, ==, 20001);
+  g_assert_cmpuint (n_nulls, ==, 2 * (10000 - gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_PM25)));
+}
+
+static void
+test_gairq_arrow_dictionary (void)
+{
+  g_autoptr(GOutputStream) stream = NULL;
+  g_autoptr(GairqArrowWriter) writer = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) error = NULL;
+  GairqArrowWriterStats stats;
+  const guint8 *buf;
+  guint n_names [3] = { 0, }, n_deltas = 0, n_dictionaries = 0;
+  Message msg;
+  gsize pos;
+  guint i;
+
+  stream = g_memory_output_stream_new_resizable ();
+  writer = gairq_arrow_writer_new (stream, GAIRQ_ARROW_FORMAT_STREAM, 64);
+
+  /* Two names in the first batch, a new one for each of the next two */
+  for (i = 0; i < 64 * 3; i++)
+    {
+      g_autofree gchar *agency = g_strdup_printf ("Agency %u", i / 64);
+      g_autoptr(GairqAirObject) air = build_air (i, i, agency, "");
+
+      g_assert_true (gairq_arrow_writer_append (writer, air, &error));
+      g_assert_no_error (error);
+    }
+
+  g_assert_true (gairq_arrow_writer_close (writer, &error));
+  g_assert_no_error (error);
+
+  bytes = steal_output (stream);
+  buf = g_bytes_get_data (bytes, NULL);
+
+  for (pos = 0; read_message (buf, pos, &msg); pos = msg.next)
+    {
+      gsize delta = fb_field (buf, msg.header, 2);
+      gsize batch;
+
+      if (msg.type != HEADER_DICTIONARY)
+        continue;
+
+      batch = fb_deref (buf, fb_field (buf, msg.header, 1));
+      n_names [n_dictionaries++] = get_u64 (buf + fb_field (buf, batch, 0));
+      if (delta && buf [delta])
+        n_deltas++;
+    }
+
+  g_assert_cmpuint (n_dictionaries, ==, 3);
+  g_assert_cmpuint (n_deltas, ==, 2);
+  g_assert_cmpuint (n_names [0], ==, 2);
+  g_assert_cmpuint (n_names [1], ==, 1);
+  g_assert_cmpuint (n_names [2], ==, 1);
+
+  gairq_arrow_writer_get_stats (writer, &stats);
+  g_assert_cmpuint (stats.n_dictionary_batches, ==, 3);
+  g_assert_cmpuint (stats.n_attributions, ==, 4);
+}
+
+static void
+test_gairq_arrow_benchmark (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autoptr(GPtrArray) stations = NULL;
+  gdouble elapsed;
+  guint i;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  batch = gairq_air_batch_new (N_BENCH_ROWS);
+  for (i = 0; i < N_BENCH_ROWS; i++)
+    {
+      gdouble values [N_GAIRQ_POLLUTANTS] = { i, i, i, i, i, i };
+
+      gairq_air_batch_append_row (batch, i, i % 300, 1571000000 + i, 37.5, 127.0,
+                                  values, i % 7 ? 0x3f : 0x01);
+    }
+
+  stations = g_ptr_array_new_with_free_func (g_object_unref);
+  for (i = 0; i < 1000; i++)
+    g_ptr_array_add (stations, build_air (i, i, i % 2 ? "EPA" : "EEA", ",\"o3\":{\"v\":1}"));
+
+  for (i = 0; i < 2; i++)
+    {
+      g_autoptr(GOutputStream) stream = g_memory_output_stream_new_resizable ();
+      g_autoptr(GairqArrowWriter) writer = NULL;
+      g_autoptr(GError) error = NULL;
+      GairqArrowWriterStats stats;
+      guint j;
+
+      writer = gairq_arrow_writer_new (stream, GAIRQ_ARROW_FORMAT_FILE, 0);
+
+      g_test_timer_start ();
+      if (i == 0)
+        gairq_arrow_writer_append_batch (writer, batch, &error);
+      else
+        for (j = 0; j < N_BENCH_ROWS; j++)
+          gairq_arrow_writer_append (writer, g_ptr_array_index (stations, j % stations->len), &error);
+      gairq_arrow_writer_close (writer, &error);
+      elapsed = g_test_timer_elapsed ();
+      g_assert_no_error (error);
+
+      gairq_arrow_writer_get_stats (writer, &stats);
+      g_test_minimized_result (elapsed, "%s: %.1f Mrows/s, %.0f MB/s",
+                               i == 0 ? "batch" : "objects",
+                               stats.n_rows / elapsed / 1e6,
+                               stats.n_bytes / elapsed / 1e6);
+    }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/arrow/stream",
+                   test_gairq_arrow_stream);
+
+  g_test_add_func ("/Gairq/arrow/file",
+                   test_gairq_arrow_file);
+
+  g_test_add_func ("/Gairq/arrow/batches",
+                   test_gairq_arrow_batches);
+
+  g_test_add_func ("/Gairq/arrow/dictionary",
+                   test_gairq_arrow_dictionary);
+
+  g_test_add_func ("/Gairq/arrow/benchmark",
+                   test_gairq_arrow_benchmark);
+
+  return g_test_run ();
+}
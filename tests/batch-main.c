@@ -0,0 +1,300 @@
+/* batch-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+#include <math.h>
+
+#define RESPONSE_FMT \
+  "{\"status\":\"ok\",\"data\":{\"idx\":%d,\"aqi\":%d," \
+  "\"attributions\":[{\"name\":\"EPA\",\"url\":\"http://epa.example\"}]," \
+  "\"city\":{\"name\":\"Station\",\"url\":\"http://city.example\",\"geo\":[%d.5,%d.25]}," \
+  "\"iaqi\":{\"pm25\":{\"v\":%d}%s},\"time\":{\"v\":%d}}}"
+
+static JsonNode *
+build_response (gint         idx,
+                gint         pm25,
+                const gchar *extra)
+{
+  g_autoptr(JsonParser) parser = NULL;
+  g_autofree gchar *payload = NULL;
+  GError *error = NULL;
+
+  payload = g_strdup_printf (RESPONSE_FMT, idx, pm25, idx, idx, pm25, extra, idx * 3600);
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, payload, -1, &error);
+  g_assert_no_error (error);
+
+  return json_parser_steal_root (parser);
+}
+
+static void
+test_gairq_batch_append (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autoptr(GError) error = NULL;
+  gint i;
+
+  batch = gairq_air_batch_new (0);
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 0);
+
+  /* More than one bitmap word */
+  for (i = 0; i < 100; i++)
+    {
+      JsonNode *root = build_response (i, i, (i % 2) ? ",\"o3\":{\"v\":1}" : "");
+
+      if (i < 50)
+        {
+          g_autoptr(GairqAirObject) air = gairq_request_default_deserialize (root, &error);
+
+          g_assert_no_error (error);
+          gairq_air_batch_append (batch, air);
+        }
+      else
+        {
+          g_assert_true (gairq_air_batch_append_response (batch, root, &error));
+          g_assert_no_error (error);
+        }
+
+      json_node_unref (root);
+    }
+
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 100);
+  g_assert_cmpint (gairq_air_batch_get_idx (batch)[42], ==, 42);
+  g_assert_cmpint (gairq_air_batch_get_aqi (batch)[77], ==, 77);
+  g_assert_cmpint (gairq_air_batch_get_time (batch)[7], ==, 7 * 3600);
+  g_assert_cmpint (gairq_air_batch_get_time (batch)[77], ==, 77 * 3600);
+  g_assert_cmpfloat (gairq_air_batch_get_latitude (batch)[3], ==, 3.5);
+  g_assert_cmpfloat (gairq_air_batch_get_longitude (batch)[3], ==, 3.25);
+
+  g_assert_true (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_O3, 1));
+  g_assert_false (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_O3, 2));
+  g_assert_true (isnan (gairq_air_batch_get_column (batch, GAIRQ_POLLUTANT_O3)[2]));
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_O3), ==, 50);
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_CO), ==, 0);
+
+  gairq_air_batch_clear (batch);
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 0);
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_PM25), ==, 0);
+}
+
+static void
+test_gairq_batch_error (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autoptr(JsonParser) parser = NULL;
+  g_autoptr(GError) error = NULL;
+
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser,
+                              "{\"status\":\"error\",\"data\":\"Unknown station\"}",
+                              -1, NULL);
+
+  batch = gairq_air_batch_new (16);
+  g_assert_false (gairq_air_batch_append_response (batch,
+                                                   json_parser_get_root (parser),
+                                                   &error));
+  g_assert_nonnull (error);
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 0);
+}
+
+static void
+test_gairq_batch_malformed (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  const gchar *payloads [] = {
+    "[1,2]",
+    "{\"data\":{\"idx\":1}}",
+    "{\"status\":\"ok\",\"data\":\"Unknown station\"}",
+    "{\"status\":\"ok\",\"data\":{\"idx\":1,\"iaqi\":{\"pm25\":{}}}}",
+    "{\"status\":\"ok\",\"data\":{\"idx\":1,\"iaqi\":{\"pm25\":{\"v\":\"-\"}}}}",
+    "{\"status\":\"ok\",\"data\":{\"idx\":1,\"city\":{\"geo\":[\"a\",2]}}}",
+  };
+  guint i;
+
+  batch = gairq_air_batch_new (16);
+
+  for (i = 0; i < G_N_ELEMENTS (payloads); i++)
+    {
+      g_autoptr(JsonParser) parser = json_parser_new ();
+      g_autoptr(GError) error = NULL;
+
+      json_parser_load_from_data (parser, payloads [i], -1, &error);
+      g_assert_no_error (error);
+
+      g_assert_false (gairq_air_batch_append_response (batch,
+                                                       json_parser_get_root (parser),
+                                                       &error));
+      g_assert_nonnull (error);
+    }
+
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 0);
+}
+
+static void
+test_gairq_batch_aggregates (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  gdouble value;
+  gint i;
+
+  batch = gairq_air_batch_new (0);
+
+  g_assert_false (gairq_air_batch_max (batch, GAIRQ_POLLUTANT_PM25, &value));
+  g_assert_false (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_PM25, 50, &value));
+
+  /* pm25 goes 1..201, but every third station reads -1 and has no co */
+  for (i = 1; i <= 201; i++)
+    {
+      JsonNode *root;
+
+      if (i % 3 == 0)
+        root = build_response (i, -1, "");
+      else
+        root = build_response (i, i, ",\"co\":{\"v\":2}");
+
+      g_assert_true (gairq_air_batch_append_response (batch, root, NULL));
+      json_node_unref (root);
+    }
+
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_PM25), ==, 201);
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_CO), ==, 134);
+
+  g_assert_true (gairq_air_batch_min (batch, GAIRQ_POLLUTANT_PM25, &value));
+  g_assert_cmpfloat (value, ==, -1);
+  g_assert_true (gairq_air_batch_max (batch, GAIRQ_POLLUTANT_PM25, &value));
+  g_assert_cmpfloat (value, ==, 200);
+  g_assert_true (gairq_air_batch_mean (batch, GAIRQ_POLLUTANT_CO, &value));
+  g_assert_cmpfloat (value, ==, 2);
+
+  g_assert_cmpuint (gairq_air_batch_count_above (batch, GAIRQ_POLLUTANT_PM25, 150), ==, 34);
+  g_assert_cmpuint (gairq_air_batch_count_above (batch, GAIRQ_POLLUTANT_CO, 2), ==, 0);
+
+  g_assert_true (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_CO, 95, &value));
+  g_assert_cmpfloat (value, ==, 2);
+  g_assert_true (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_PM25, 0, &value));
+  g_assert_cmpfloat (value, ==, -1);
+  g_assert_true (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_PM25, 100, &value));
+  g_assert_cmpfloat (value, ==, 200);
+}
+
+static void
+test_gairq_batch_percentile (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  gdouble value;
+  gint i;
+
+  batch = gairq_air_batch_new (0);
+
+  /* 0, 10, ..., 100 in a shuffled order */
+  for (i = 0; i < 11; i++)
+    {
+      JsonNode *root = build_response (i, ((i * 7) % 11) * 10, "");
+
+      gairq_air_batch_append_response (batch, root, NULL);
+      json_node_unref (root);
+    }
+
+  g_assert_true (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_PM25, 50, &value));
+  g_assert_cmpfloat_with_epsilon (value, 50, 1e-9);
+  g_assert_true (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_PM25, 95, &value));
+  g_assert_cmpfloat_with_epsilon (value, 95, 1e-9);
+  g_assert_true (gairq_air_batch_percentile (batch, GAIRQ_POLLUTANT_PM25, 12.5, &value));
+  g_assert_cmpfloat_with_epsilon (value, 12.5, 1e-9);
+}
+
+static void
+test_gairq_batch_append_batch (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autoptr(GairqAirBatch) other = NULL;
+  const gdouble *pm25, *co;
+  const gint64 *time;
+  gdouble values [N_GAIRQ_POLLUTANTS];
+  guint i;
+
+  batch = gairq_air_batch_new (0);
+  other = gairq_air_batch_new (0);
+
+  /* 70 rows leave @batch in the middle of a bitmap word, so the
+   * validity of @other has to be shifted on the way in.
+   */
+  for (i = 0; i < 270; i++)
+    {
+      values [GAIRQ_POLLUTANT_PM25] = i;
+      values [GAIRQ_POLLUTANT_CO] = i;
+      gairq_air_batch_append_row (i < 70 ? batch : other, i, i, i * 3600, NAN, NAN, values,
+                                  (1u << GAIRQ_POLLUTANT_PM25) |
+                                  (i % 3 ? 1u << GAIRQ_POLLUTANT_CO : 0));
+    }
+
+  gairq_air_batch_append_batch (batch, other);
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 270);
+  g_assert_cmpuint (gairq_air_batch_get_length (other), ==, 200);
+
+  time = gairq_air_batch_get_time (batch);
+  pm25 = gairq_air_batch_get_column (batch, GAIRQ_POLLUTANT_PM25);
+  co = gairq_air_batch_get_column (batch, GAIRQ_POLLUTANT_CO);
+
+  for (i = 0; i < 270; i++)
+    {
+      g_assert_cmpint (time [i], ==, i * 3600);
+      g_assert_true (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_PM25, i));
+      g_assert_cmpfloat (pm25 [i], ==, i);
+      g_assert_cmpint (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_CO, i), ==, i % 3 != 0);
+      if (i % 3)
+        g_assert_cmpfloat (co [i], ==, i);
+      g_assert_false (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_O3, i));
+    }
+
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_PM25), ==, 270);
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_CO), ==, 180);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/batch/append",
+                   test_gairq_batch_append);
+
+  g_test_add_func ("/Gairq/batch/error",
+                   test_gairq_batch_error);
+
+  g_test_add_func ("/Gairq/batch/malformed",
+                   test_gairq_batch_malformed);
+
+  g_test_add_func ("/Gairq/batch/aggregates",
+                   test_gairq_batch_aggregates);
+
+  g_test_add_func ("/Gairq/batch/percentile",
+                   test_gairq_batch_percentile);
+
+  g_test_add_func ("/Gairq/batch/append-batch",
+                   test_gairq_batch_append_batch);
+
+  return g_test_run ();
+}
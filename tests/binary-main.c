@@ -0,0 +1,328 @@
+/* binary-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-utils.h"
+
+#include <locale.h>
+#include <math.h>
+#include <string.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"attributions\":[" \
+  "{\"name\":\"Istanbul Ministry of Environment\",\"url\":\"http://www.havaizleme.gov.tr/\"}," \
+  "{\"name\":\"Istanbul Metropolitan Municipality\",\"url\":\"http://www.ibb.gov.tr/\"}," \
+  "{\"name\":\"European Environment Agency\",\"url\":\"http://www.eea.europa.eu/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"h\":{\"v\":77},\"no2\":{\"v\":21.4},\"o3\":{\"v\":11.2}," \
+  "\"p\":{\"v\":1016},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33},\"so2\":{\"v\":3.6}," \
+  "\"t\":{\"v\":14},\"w\":{\"v\":2.5}}," \
+  "\"time\":{\"s\":\"2019-11-20 18:00:00\",\"tz\":\"+03:00\",\"v\":1574272800}}}"
+
+#define N_BENCH_ROUNDS 20000
+
+static GairqAirObject *
+parse_payload (GairqAirObjectFlags flags)
+{
+  g_autoptr(GBytes) payload = NULL;
+  GairqAirObject *air;
+  GError *error = NULL;
+
+  payload = g_bytes_new_static (PAYLOAD, strlen (PAYLOAD));
+  air = gairq_request_deserialize_bytes (payload, flags, &error);
+  g_assert_no_error (error);
+
+  return air;
+}
+
+static void
+test_gairq_binary_roundtrip (void)
+{
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_NONE,
+    GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+  };
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GairqAirObject) empty = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  GError *error = NULL;
+  guint i;
+
+  air = parse_payload (GAIRQ_AIR_OBJECT_FLAGS_NONE);
+  bytes = gairq_air_object_to_binary (air);
+  g_test_message ("%" G_GSIZE_FORMAT " bytes encoded, %" G_GSIZE_FORMAT " of JSON",
+                  g_bytes_get_size (bytes), strlen (PAYLOAD));
+  g_assert_cmpuint (g_bytes_get_size (bytes), <, strlen (PAYLOAD));
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      g_autoptr(GairqAirObject) decoded = NULL;
+
+      decoded = gairq_air_object_new_from_binary (bytes, modes [i], &error);
+      g_assert_no_error (error);
+      test_assert_air_equal (air, decoded);
+    }
+
+  /* Nothing set at all */
+  empty = g_object_new (GAIRQ_TYPE_AIR_OBJECT, NULL);
+  g_clear_pointer (&bytes, g_bytes_unref);
+  bytes = gairq_air_object_to_binary (empty);
+  g_assert_cmpuint (g_bytes_get_size (bytes), ==, GAIRQ_AIR_BINARY_HEADER_SIZE + 2);
+
+  g_clear_object (&air);
+  air = gairq_air_object_new_from_binary (bytes, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+  g_assert_no_error (error);
+  test_assert_air_equal (empty, air);
+}
+
+static void
+test_gairq_binary_view (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  GairqAirView view;
+  GError *error = NULL;
+  const gchar *name, *url, *key;
+  gdouble lat, lng, value;
+  guint i, n_iaqi;
+
+  air = parse_payload (GAIRQ_AIR_OBJECT_FLAGS_NONE);
+  bytes = gairq_air_object_to_binary (air);
+
+  g_assert_true (gairq_air_view_init (&view, g_bytes_get_data (bytes, NULL),
+                                      g_bytes_get_size (bytes), &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (gairq_air_view_get_size (&view), ==, g_bytes_get_size (bytes));
+  g_assert_cmpint (gairq_air_view_get_idx (&view), ==, 4143);
+  g_assert_cmpint (gairq_air_view_get_aqi (&view), ==, 57);
+  g_assert_cmpint (gairq_air_view_get_time (&view), ==, 1574272800);
+
+  g_assert_true (gairq_air_view_get_geo (&view, &lat, &lng));
+  g_assert_cmpfloat (lat, ==, 41.014722);
+  g_assert_cmpfloat (lng, ==, 28.954722);
+  g_assert_cmpstr (gairq_air_view_get_city_name (&view), ==, "Fatih, Istanbul, Turkey");
+  g_assert_cmpstr (gairq_air_view_get_city_url (&view), ==, "https://aqicn.org/city/turkey/istanbul/fatih");
+
+  /* Strings point right into the data */
+  name = gairq_air_view_get_city_name (&view);
+  g_assert_true ((const guint8 *) name > (const guint8 *) g_bytes_get_data (bytes, NULL));
+  g_assert_true ((const guint8 *) name < (const guint8 *) g_bytes_get_data (bytes, NULL) + g_bytes_get_size (bytes));
+
+  g_assert_cmpuint (gairq_air_view_get_n_attributions (&view), ==, 4);
+  g_assert_true (gairq_air_view_get_attribution (&view, 3, &name, &url));
+  g_assert_cmpstr (name, ==, "World Air Quality Index Project");
+  g_assert_cmpstr (url, ==, "https://waqi.info/");
+  g_assert_false (gairq_air_view_get_attribution (&view, 4, &name, &url));
+
+  n_iaqi = gairq_air_view_get_n_iaqi (&view);
+  g_assert_cmpuint (n_iaqi, ==, 10);
+  for (i = 0; i < n_iaqi; i++)
+    {
+      g_assert_true (gairq_air_view_get_iaqi (&view, i, &key, &value));
+      g_assert_cmpfloat (value, ==, *(gdouble *) g_hash_table_lookup (gairq_air_object_get_iaqi (air), key));
+    }
+
+  g_assert_cmpfloat (gairq_air_view_lookup_iaqi (&view, "pm25"), ==, 33);
+  g_assert_cmpfloat (gairq_air_view_lookup_iaqi (&view, "so2"), ==, 3.6);
+  g_assert_true (isnan (gairq_air_view_lookup_iaqi (&view, "nh3")));
+}
+
+static void
+test_gairq_binary_buffer (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autofree guint8 *buffer = NULL;
+  g_autofree guint8 *again = NULL;
+  GairqAirView view;
+  gsize size, i;
+
+  air = parse_payload (GAIRQ_AIR_OBJECT_FLAGS_ARENA);
+
+  size = gairq_air_object_encode (air, NULL, 0);
+  g_assert_cmpuint (size, >, GAIRQ_AIR_BINARY_HEADER_SIZE);
+
+  /* Too small, left alone */
+  buffer = g_malloc (size + 16);
+  memset (buffer, 0xaa, size + 16);
+  g_assert_cmpuint (gairq_air_object_encode (air, buffer, size - 1), ==, size);
+  for (i = 0; i < size + 16; i++)
+    g_assert_cmpuint (buffer [i], ==, 0xaa);
+
+  /* Exactly right, and nothing past it touched */
+  g_assert_cmpuint (gairq_air_object_encode (air, buffer, size), ==, size);
+  for (i = size; i < size + 16; i++)
+    g_assert_cmpuint (buffer [i], ==, 0xaa);
+
+  again = g_malloc (size);
+  g_assert_cmpuint (gairq_air_object_encode (air, again, size), ==, size);
+  g_assert_cmpmem (buffer, size, again, size);
+
+  /* Trailing data after an object is not part of it */
+  g_assert_true (gairq_air_view_init (&view, buffer, size + 16, NULL));
+  g_assert_cmpuint (gairq_air_view_get_size (&view), ==, size);
+}
+
+static void
+test_gairq_binary_corrupt (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autofree guint8 *copy = NULL;
+  GairqAirView view;
+  GError *error = NULL;
+  gsize size, i;
+
+  air = parse_payload (GAIRQ_AIR_OBJECT_FLAGS_NONE);
+  bytes = gairq_air_object_to_binary (air);
+  size = g_bytes_get_size (bytes);
+  copy = g_malloc (size);
+  memcpy (copy, g_bytes_get_data (bytes, NULL), size);
+
+  /* Cut short anywhere, never read past the end */
+  for (i = 0; i < size; i++)
+    {
+      g_autoptr(GBytes) truncated = g_bytes_new (copy, i);
+      GairqAirObject *decoded;
+
+      decoded = gairq_air_object_new_from_binary (truncated, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+      g_assert_null (decoded);
+      g_assert_nonnull (error);
+      g_clear_error (&error);
+    }
+
+  copy [4] = GAIRQ_AIR_BINARY_VERSION + 1;
+  g_assert_false (gairq_air_view_init (&view, copy, size, &error));
+  g_assert_nonnull (error);
+  g_clear_error (&error);
+  copy [4] = GAIRQ_AIR_BINARY_VERSION;
+
+  /* Flipped bytes make it either unreadable or read differently */
+  for (i = 0; i < size; i++)
+    {
+      guint8 saved = copy [i];
+      guint j;
+
+      copy [i] ^= 0xff;
+      if (gairq_air_view_init (&view, copy, size, NULL))
+        {
+          gairq_air_view_get_city_name (&view);
+          gairq_air_view_get_city_url (&view);
+          for (j = 0; j < gairq_air_view_get_n_attributions (&view); j++)
+            gairq_air_view_get_attribution (&view, j, NULL, NULL);
+          gairq_air_view_lookup_iaqi (&view, "pm25");
+        }
+      copy [i] = saved;
+    }
+}
+
+static void
+test_gairq_binary_benchmark (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GBytes) json = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autofree guint8 *buffer = NULL;
+  GairqAirView view;
+  gdouble elapsed, sum = 0;
+  gsize size;
+  guint round;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  json = g_bytes_new_static (PAYLOAD, strlen (PAYLOAD));
+  air = parse_payload (GAIRQ_AIR_OBJECT_FLAGS_NONE);
+  bytes = gairq_air_object_to_binary (air);
+  size = g_bytes_get_size (bytes);
+  buffer = g_malloc (size);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    g_object_unref (gairq_request_deserialize_bytes (json, GAIRQ_AIR_OBJECT_FLAGS_NONE, NULL));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "JSON decode: %.0f objects/s", N_BENCH_ROUNDS / elapsed);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    g_object_unref (gairq_request_deserialize_bytes (json, GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY, NULL));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "JSON zero-copy decode: %.0f objects/s", N_BENCH_ROUNDS / elapsed);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    gairq_air_object_encode (air, buffer, size);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "binary encode: %.0f objects/s", N_BENCH_ROUNDS / elapsed);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    g_object_unref (gairq_air_object_new_from_binary (bytes, GAIRQ_AIR_OBJECT_FLAGS_NONE, NULL));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "binary decode: %.0f objects/s", N_BENCH_ROUNDS / elapsed);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    g_object_unref (gairq_air_object_new_from_binary (bytes, GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY, NULL));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "binary zero-copy decode: %.0f objects/s", N_BENCH_ROUNDS / elapsed);
+
+  g_test_timer_start ();
+  for (round = 0; round < N_BENCH_ROUNDS; round++)
+    {
+      gairq_air_view_init (&view, buffer, size, NULL);
+      sum += gairq_air_view_get_aqi (&view) + gairq_air_view_lookup_iaqi (&view, "pm25");
+    }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "view read: %.0f objects/s", N_BENCH_ROUNDS / elapsed);
+
+  g_assert_cmpfloat (sum, ==, N_BENCH_ROUNDS * (57.0 + 33.0));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/binary/roundtrip",
+                   test_gairq_binary_roundtrip);
+
+  g_test_add_func ("/Gairq/binary/view",
+                   test_gairq_binary_view);
+
+  g_test_add_func ("/Gairq/binary/buffer",
+                   test_gairq_binary_buffer);
+
+  g_test_add_func ("/Gairq/binary/corrupt",
+                   test_gairq_binary_corrupt);
+
+  g_test_add_func ("/Gairq/binary/benchmark",
+                   test_gairq_binary_benchmark);
+
+  return g_test_run ();
+}
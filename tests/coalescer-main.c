@@ -0,0 +1,201 @@
+/* coalescer-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <locale.h>
+
+typedef struct
+{
+  guint       n_batches;
+  guint       n_completions;
+  guint       n_failed;
+  guint *     seen;
+  GPtrArray * kept;
+} Results;
+
+static void
+completed (GairqCoalescer *coalescer,
+           GPtrArray      *completions,
+           gpointer        user_data)
+{
+  Results *results = user_data;
+  guint i;
+
+  results->n_batches++;
+
+  for (i = 0; i < completions->len; i++)
+    {
+      GairqCompletion *completion = g_ptr_array_index (completions, i);
+
+      g_assert_true (GAIRQ_IS_REQUEST (completion->request));
+      g_assert_null (completion->root);
+
+      if (completion->air)
+        {
+          g_assert_null (completion->error);
+          g_assert_cmpint (gairq_air_object_get_idx (completion->air), ==, 4143);
+          if (results->kept)
+            g_ptr_array_add (results->kept, g_steal_pointer (&completion->air));
+        }
+      else
+        {
+          g_assert_nonnull (completion->error);
+          results->n_failed++;
+        }
+
+      if (results->seen)
+        results->seen [GPOINTER_TO_UINT (completion->tag)]++;
+      results->n_completions++;
+    }
+}
+
+static void
+wait_for_results (Results *results,
+                  guint    n_completions)
+{
+  while (results->n_completions < n_completions)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_gairq_coalescer_batch (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqCoalescer) coalescer = NULL;
+  g_autoptr(TestRequest) request = NULL;
+  g_autoptr(GPtrArray) kept = NULL;
+  GairqCoalescerStats stats;
+  Results results = { 0, };
+  guint seen [200] = { 0, };
+  guint i;
+
+  request = test_request_new (0);
+  executor = gairq_executor_new (0, 8, 0);
+  coalescer = gairq_coalescer_new (executor, 0);
+  g_assert_true (gairq_coalescer_get_executor (coalescer) == executor);
+  g_assert_cmpuint (gairq_coalescer_get_window (coalescer), ==, 0);
+
+  kept = g_ptr_array_new_with_free_func (g_object_unref);
+  results.seen = seen;
+  results.kept = kept;
+  g_signal_connect (coalescer, "completed", G_CALLBACK (completed), &results);
+
+  /* Nothing is dispatched before the loop runs, whatever came back by
+   * then goes out in one go
+   */
+  for (i = 0; i < G_N_ELEMENTS (seen); i++)
+    gairq_coalescer_poll (coalescer, GAIRQ_REQUEST (request), NULL, GUINT_TO_POINTER (i));
+  g_assert_cmpuint (results.n_batches, ==, 0);
+
+  wait_for_results (&results, G_N_ELEMENTS (seen));
+  g_assert_cmpuint (results.n_failed, ==, 0);
+  for (i = 0; i < G_N_ELEMENTS (seen); i++)
+    g_assert_cmpuint (seen [i], ==, 1);
+
+  /* Stolen objects outlive their batch */
+  g_assert_cmpuint (kept->len, ==, G_N_ELEMENTS (seen));
+  g_assert_cmpint (gairq_air_object_get_idx (g_ptr_array_index (kept, 0)), ==, 4143);
+
+  gairq_coalescer_get_stats (coalescer, &stats);
+  g_assert_cmpuint (stats.n_in_flight, ==, 0);
+  g_assert_cmpuint (stats.n_pending, ==, 0);
+  g_assert_cmpuint (stats.n_completions, ==, G_N_ELEMENTS (seen));
+  g_assert_cmpuint (stats.n_batches, ==, results.n_batches);
+  g_assert_cmpuint (stats.n_batches, <, G_N_ELEMENTS (seen));
+  g_assert_cmpuint (stats.max_batch, >, 1);
+}
+
+static void
+test_gairq_coalescer_window (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqCoalescer) coalescer = NULL;
+  g_autoptr(TestRequest) request = NULL;
+  Results results = { 0, };
+  gint64 started;
+  guint i;
+
+  request = test_request_new (5);
+  executor = gairq_executor_new (0, 4, 0);
+  coalescer = gairq_coalescer_new (executor, 300);
+  g_signal_connect (coalescer, "completed", G_CALLBACK (completed), &results);
+
+  /* All are back well within the window, which starts with the first */
+  started = g_get_monotonic_time ();
+  for (i = 0; i < 8; i++)
+    gairq_coalescer_poll (coalescer, GAIRQ_REQUEST (request), NULL, NULL);
+
+  wait_for_results (&results, 8);
+  g_assert_cmpuint (results.n_batches, ==, 1);
+  g_assert_cmpint (g_get_monotonic_time () - started, >=, 300 * G_TIME_SPAN_MILLISECOND);
+
+  gairq_coalescer_set_window (coalescer, 0);
+  g_assert_cmpuint (gairq_coalescer_get_window (coalescer), ==, 0);
+
+  gairq_coalescer_poll (coalescer, GAIRQ_REQUEST (request), NULL, NULL);
+  wait_for_results (&results, 9);
+  g_assert_cmpuint (results.n_batches, ==, 2);
+}
+
+static void
+test_gairq_coalescer_errors (void)
+{
+  g_autoptr(GairqCoalescer) coalescer = NULL;
+  g_autoptr(GCancellable) cancellable = NULL;
+  g_autoptr(TestRequest) request = NULL;
+  Results results = { 0, };
+
+  request = test_request_new (0);
+  request->fail = TRUE;
+  cancellable = g_cancellable_new ();
+  g_cancellable_cancel (cancellable);
+
+  coalescer = gairq_coalescer_new (NULL, 0);
+  g_assert_true (gairq_coalescer_get_executor (coalescer) == gairq_executor_get_default ());
+  g_signal_connect (coalescer, "completed", G_CALLBACK (completed), &results);
+
+  /* Failures and cancellations come back like any other result */
+  gairq_coalescer_poll (coalescer, GAIRQ_REQUEST (request), NULL, NULL);
+  gairq_coalescer_poll (coalescer, GAIRQ_REQUEST (request), cancellable, NULL);
+
+  wait_for_results (&results, 2);
+  g_assert_cmpuint (results.n_failed, ==, 2);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/coalescer/batch",
+                   test_gairq_coalescer_batch);
+
+  g_test_add_func ("/Gairq/coalescer/window",
+                   test_gairq_coalescer_window);
+
+  g_test_add_func ("/Gairq/coalescer/errors",
+                   test_gairq_coalescer_errors);
+
+  return g_test_run ();
+}
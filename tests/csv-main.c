@@ -0,0 +1,355 @@
+/* csv-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <gio/gio.h>
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define EXPORT \
+  "\xef\xbb\xbf" "date, pm25, pm10, o3, wd, CO\r\n" \
+  "2019/11/20, 57, 33, 11.5, 4, 1\r\n" \
+  "\"2019-11-21\", 61, , 9.25, 3,\r\n" \
+  "\r\n" \
+  "not a date, 1, 2, 3, 4, 5\r\n" \
+  "2019/2/29, 1, 2, 3, 4, 5\r\n" \
+  "2019/11/19,,,,,\r\n" \
+  "2019/11/22 00:00, 40, 20, abc, 1, 0.5"
+
+#define DAY               86400
+#define NOV_20_2019       G_GINT64_CONSTANT (1574208000)
+#define N_BENCH_ROWS      (1 << 21)
+
+static gchar *
+write_file (const gchar *name,
+            const gchar *contents,
+            gssize       length)
+{
+  GError *error = NULL;
+  gchar *dir, *path;
+
+  dir = g_dir_make_tmp ("gairq-csv-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (dir, name, NULL);
+  g_file_set_contents (path, contents, length, &error);
+  g_assert_no_error (error);
+  g_free (dir);
+
+  return path;
+}
+
+static void
+remove_file (const gchar *path)
+{
+  gchar *dir = g_path_get_dirname (path);
+
+  g_unlink (path);
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+/* One row a day from 2014 on, the days in a shuffled order */
+static GString *
+generate_export (guint n_rows)
+{
+  GString *csv = g_string_new ("date,pm25,pm10,o3,no2,so2,co\n");
+  guint i;
+
+  for (i = 0; i < n_rows; i++)
+    {
+      gint64 days = 16071 + (guint64) i * 7919 % n_rows;
+      g_autoptr(GDateTime) date = g_date_time_new_from_unix_utc (days * DAY);
+
+      g_string_append_printf (csv, "%d/%d/%d,%u,%u,%u,%u.%u,,%u\n",
+                              g_date_time_get_year (date),
+                              g_date_time_get_month (date),
+                              g_date_time_get_day_of_month (date),
+                              i % 300, i % 200, i % 80, i % 40, i % 10, i % 9);
+    }
+
+  return csv;
+}
+
+static void
+test_gairq_csv_batch (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autofree gchar *path = NULL;
+  GairqCsvImportStats stats;
+  GError *error = NULL;
+  const gdouble *o3;
+
+  path = write_file ("export.csv", EXPORT, -1);
+  batch = gairq_air_batch_new (0);
+
+  g_assert_true (gairq_csv_import_batch (path, 4143, 0, batch, &stats, &error));
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (stats.n_bytes, ==, strlen (EXPORT));
+  g_assert_cmpuint (stats.n_rows, ==, 4);
+  g_assert_cmpuint (stats.n_invalid, ==, 2);
+  g_assert_cmpuint (stats.n_readings, ==, 4 + 2 + 3);
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 4);
+
+  /* In file order, blank lines and bad dates left out */
+  g_assert_cmpint (gairq_air_batch_get_idx (batch)[0], ==, 4143);
+  g_assert_cmpint (gairq_air_batch_get_time (batch)[0], ==, NOV_20_2019);
+  g_assert_cmpint (gairq_air_batch_get_time (batch)[1], ==, NOV_20_2019 + DAY);
+  g_assert_cmpint (gairq_air_batch_get_time (batch)[2], ==, NOV_20_2019 - DAY);
+  g_assert_cmpint (gairq_air_batch_get_time (batch)[3], ==, NOV_20_2019 + 2 * DAY);
+
+  g_assert_cmpint (gairq_air_batch_get_aqi (batch)[0], ==, 57);
+  g_assert_cmpint (gairq_air_batch_get_aqi (batch)[2], ==, -1);
+  g_assert_true (isnan (gairq_air_batch_get_latitude (batch)[0]));
+
+  o3 = gairq_air_batch_get_column (batch, GAIRQ_POLLUTANT_O3);
+  g_assert_cmpfloat (o3 [0], ==, 11.5);
+  g_assert_cmpfloat (o3 [1], ==, 9.25);
+  g_assert_false (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_O3, 3));
+  g_assert_false (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_PM10, 1));
+  g_assert_false (gairq_air_batch_is_valid (batch, GAIRQ_POLLUTANT_CO, 1));
+  g_assert_cmpfloat (gairq_air_batch_get_column (batch, GAIRQ_POLLUTANT_CO)[3], ==, 0.5);
+  g_assert_cmpuint (gairq_air_batch_count_valid (batch, GAIRQ_POLLUTANT_NO2), ==, 0);
+
+  remove_file (path);
+}
+
+/* However the file is cut up, the rows come out the same */
+static void
+test_gairq_csv_chunks (void)
+{
+  g_autoptr(GairqAirBatch) single = NULL;
+  g_autoptr(GairqAirBatch) parallel = NULL;
+  g_autoptr(GString) csv = NULL;
+  g_autofree gchar *path = NULL;
+  GairqCsvImportStats stats;
+  GError *error = NULL;
+  guint i, p, n_rows = 120000;
+
+  csv = generate_export (n_rows);
+  g_assert_cmpuint (csv->len, >, 3 << 20);
+  path = write_file ("large.csv", csv->str, csv->len);
+
+  single = gairq_air_batch_new (0);
+  g_assert_true (gairq_csv_import_batch (path, 1, 1, single, &stats, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (stats.n_threads, ==, 1);
+  g_assert_cmpuint (stats.n_rows, ==, n_rows);
+
+  parallel = gairq_air_batch_new (0);
+  g_assert_true (gairq_csv_import_batch (path, 1, 4, parallel, &stats, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (stats.n_threads, ==, 4);
+  g_assert_cmpuint (stats.n_rows, ==, n_rows);
+  g_assert_cmpuint (stats.n_invalid, ==, 0);
+
+  g_assert_cmpmem (gairq_air_batch_get_time (single), n_rows * sizeof (gint64),
+                   gairq_air_batch_get_time (parallel), n_rows * sizeof (gint64));
+  for (p = 0; p < N_GAIRQ_POLLUTANTS; p++)
+    for (i = 0; i < n_rows; i++)
+      {
+        g_assert_cmpint (gairq_air_batch_is_valid (single, p, i), ==,
+                         gairq_air_batch_is_valid (parallel, p, i));
+        if (gairq_air_batch_is_valid (single, p, i))
+          g_assert_cmpfloat (gairq_air_batch_get_column (single, p)[i], ==,
+                             gairq_air_batch_get_column (parallel, p)[i]);
+      }
+
+  g_assert_cmpfloat (gairq_air_batch_get_column (parallel, GAIRQ_POLLUTANT_NO2)[12345], ==, 25.5);
+  g_assert_false (gairq_air_batch_is_valid (parallel, GAIRQ_POLLUTANT_SO2, 12345));
+
+  remove_file (path);
+}
+
+static void
+check_store_import (guint n_rows)
+{
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GArray) samples = NULL;
+  g_autoptr(GString) csv = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *store_path = NULL;
+  g_autofree gchar *dir = NULL;
+  GairqCsvImportStats stats;
+  GError *error = NULL;
+  guint i;
+
+  csv = generate_export (n_rows);
+  path = write_file ("station.csv", csv->str, csv->len);
+  dir = g_path_get_dirname (path);
+  store_path = g_build_filename (dir, "readings.series", NULL);
+
+  store = gairq_series_store_new (store_path, &error);
+  g_assert_no_error (error);
+
+  /* Days out of order in the file, in order in the store */
+  g_assert_true (gairq_csv_import_store (path, 9, 2, store, &stats, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (stats.n_rows, ==, n_rows);
+  g_assert_cmpuint (stats.n_invalid, ==, 0);
+  g_assert_cmpuint (stats.n_readings, ==, n_rows * 5);
+  g_assert_cmpuint (stats.n_skipped, ==, 0);
+
+  samples = gairq_series_store_query (store, 9, GAIRQ_POLLUTANT_PM25, G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (samples->len, ==, n_rows);
+  for (i = 1; i < samples->len; i++)
+    g_assert_cmpint (g_array_index (samples, GairqSeriesSample, i).time, ==,
+                     g_array_index (samples, GairqSeriesSample, i - 1).time + DAY);
+  g_clear_pointer (&samples, g_array_unref);
+
+  samples = gairq_series_store_query (store, 9, GAIRQ_POLLUTANT_SO2, G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (samples->len, ==, 0);
+
+  /* The second time round there is nothing new */
+  g_assert_true (gairq_csv_import_store (path, 9, 2, store, &stats, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (stats.n_readings, ==, 0);
+  g_assert_cmpuint (stats.n_skipped, ==, n_rows * 5);
+
+  g_clear_object (&store);
+  g_unlink (store_path);
+  remove_file (path);
+}
+
+static void
+test_gairq_csv_store (void)
+{
+  check_store_import (1000);
+}
+
+/* Over 2^16 days, which goes into the store in two windows */
+static void
+test_gairq_csv_store_windows (void)
+{
+  check_store_import (120000);
+}
+
+static void
+test_gairq_csv_errors (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autofree gchar *path = NULL;
+  GError *error = NULL;
+
+  batch = gairq_air_batch_new (0);
+
+  g_assert_false (gairq_csv_import_batch ("/nonexistent/export.csv", 1, 0, batch, NULL, &error));
+  g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+  g_clear_error (&error);
+
+  path = write_file ("nodate.csv", "day,pm25\n2019/1/1,5\n", -1);
+  g_assert_false (gairq_csv_import_batch (path, 1, 0, batch, NULL, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_clear_error (&error);
+  remove_file (path);
+  g_clear_pointer (&path, g_free);
+
+  path = write_file ("empty.csv", "", 0);
+  g_assert_false (gairq_csv_import_batch (path, 1, 0, batch, NULL, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_clear_error (&error);
+  remove_file (path);
+
+  g_assert_cmpuint (gairq_air_batch_get_length (batch), ==, 0);
+}
+
+static void
+test_gairq_csv_benchmark (void)
+{
+  g_autoptr(GairqAirBatch) batch = NULL;
+  g_autoptr(GString) csv = NULL;
+  g_autofree gchar *path = NULL;
+  gchar line [256];
+  GairqCsvImportStats stats;
+  GError *error = NULL;
+  gdouble elapsed, sum = 0;
+  guint n_rows = 0;
+  FILE *file;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  csv = generate_export (N_BENCH_ROWS);
+  path = write_file ("bench.csv", csv->str, csv->len);
+
+  /* What a line-at-a-time importer would do */
+  g_test_timer_start ();
+  file = fopen (path, "r");
+  g_assert_nonnull (fgets (line, sizeof line, file));
+  while (fgets (line, sizeof line, file))
+    {
+      gchar *field = strtok (line, ",");
+
+      for (n_rows++; (field = strtok (NULL, ",")) != NULL; )
+        sum += g_ascii_strtod (field, NULL);
+    }
+  fclose (file);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "fgets: %.0f MB/s (%u rows, %g)",
+                           csv->len / elapsed / 1e6, n_rows, sum);
+
+  batch = gairq_air_batch_new (N_BENCH_ROWS);
+  g_test_timer_start ();
+  g_assert_true (gairq_csv_import_batch (path, 1, 0, batch, &stats, &error));
+  elapsed = g_test_timer_elapsed ();
+  g_assert_no_error (error);
+  g_test_minimized_result (elapsed, "import: %.0f MB/s on %u threads",
+                           csv->len / elapsed / 1e6, stats.n_threads);
+
+  remove_file (path);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/csv/batch",
+                   test_gairq_csv_batch);
+
+  g_test_add_func ("/Gairq/csv/chunks",
+                   test_gairq_csv_chunks);
+
+  g_test_add_func ("/Gairq/csv/store",
+                   test_gairq_csv_store);
+
+  g_test_add_func ("/Gairq/csv/store-windows",
+                   test_gairq_csv_store_windows);
+
+  g_test_add_func ("/Gairq/csv/errors",
+                   test_gairq_csv_errors);
+
+  g_test_add_func ("/Gairq/csv/benchmark",
+                   test_gairq_csv_benchmark);
+
+  return g_test_run ();
+}
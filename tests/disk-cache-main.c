@@ -0,0 +1,351 @@
+/* disk-cache-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <string.h>
+
+#define N_COMPACT_ROUNDS  400
+#define BIG_PAYLOAD_SIZE  8192
+
+static gchar *
+make_cache_path (void)
+{
+  GError *error = NULL;
+  gchar *dir;
+  gchar *path;
+
+  dir = g_dir_make_tmp ("gairq-disk-cache-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (dir, "responses.cache", NULL);
+  g_free (dir);
+
+  return path;
+}
+
+static void
+remove_cache_path (const gchar *path)
+{
+  gchar *dir = g_path_get_dirname (path);
+
+  g_unlink (path);
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+static GairqDiskCache *
+open_cache (const gchar *path)
+{
+  GairqDiskCache *cache;
+  GError *error = NULL;
+
+  cache = gairq_disk_cache_new (path, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (cache);
+
+  return cache;
+}
+
+static void
+store (GairqDiskCache *cache,
+       const gchar    *key,
+       const gchar    *payload)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  GError *error = NULL;
+
+  bytes = g_bytes_new (payload, strlen (payload));
+  g_assert_true (gairq_disk_cache_store (cache, key, bytes, &error));
+  g_assert_no_error (error);
+}
+
+static void
+assert_lookup (GairqDiskCache *cache,
+               const gchar    *key,
+               const gchar    *expected)
+{
+  g_autoptr(GBytes) bytes = NULL;
+  gint64 stored_at = 0;
+  gsize length;
+
+  bytes = gairq_disk_cache_lookup (cache, key, &stored_at);
+  if (expected == NULL)
+    {
+      g_assert_null (bytes);
+      return;
+    }
+
+  g_assert_nonnull (bytes);
+  g_assert_cmpmem (g_bytes_get_data (bytes, &length), length, expected, strlen (expected));
+  g_assert_cmpint (stored_at, >, 0);
+  g_assert_cmpint (stored_at, <=, g_get_real_time ());
+}
+
+/* Stands in for a crash or a bad sector */
+static void
+mangle_file (const gchar *path,
+             const gchar *needle,
+             gssize       truncate_by)
+{
+  g_autofree gchar *contents = NULL;
+  GError *error = NULL;
+  gsize length;
+
+  g_file_get_contents (path, &contents, &length, &error);
+  g_assert_no_error (error);
+
+  if (needle)
+    {
+      gchar *found = g_strstr_len (contents, length, needle);
+
+      g_assert_nonnull (found);
+      found [0] ^= 0x20;
+    }
+
+  g_file_set_contents (path, contents, length - truncate_by, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_gairq_disk_cache_reopen (void)
+{
+  g_autofree gchar *path = make_cache_path ();
+  GairqDiskCache *cache;
+  gint64 first_stored_at, stored_at;
+  GBytes *bytes;
+
+  cache = open_cache (path);
+  g_assert_cmpuint (gairq_disk_cache_get_n_entries (cache), ==, 0);
+  assert_lookup (cache, "/feed/istanbul/", NULL);
+
+  store (cache, "/feed/istanbul/", "first");
+  store (cache, "/feed/@4143/", "other");
+  store (cache, "/feed/istanbul/", "second");
+  assert_lookup (cache, "/feed/istanbul/", "second");
+  g_assert_cmpuint (gairq_disk_cache_get_n_entries (cache), ==, 2);
+
+  bytes = gairq_disk_cache_lookup (cache, "/feed/istanbul/", &first_stored_at);
+  g_bytes_unref (bytes);
+  g_object_unref (cache);
+
+  /* The latest record of each key comes back from the mapping */
+  cache = open_cache (path);
+  g_assert_cmpuint (gairq_disk_cache_get_n_entries (cache), ==, 2);
+  assert_lookup (cache, "/feed/istanbul/", "second");
+  assert_lookup (cache, "/feed/@4143/", "other");
+
+  bytes = gairq_disk_cache_lookup (cache, "/feed/istanbul/", &stored_at);
+  g_assert_cmpint (stored_at, ==, first_stored_at);
+  g_bytes_unref (bytes);
+
+  g_object_unref (cache);
+  remove_cache_path (path);
+}
+
+static void
+test_gairq_disk_cache_torn (void)
+{
+  g_autofree gchar *path = make_cache_path ();
+  GairqDiskCache *cache;
+  guint64 size;
+
+  cache = open_cache (path);
+  store (cache, "/feed/istanbul/", "kept");
+  size = gairq_disk_cache_get_size (cache);
+  store (cache, "/feed/@4143/", "torn-in-half");
+  g_object_unref (cache);
+
+  /* The last record never made it in whole */
+  mangle_file (path, NULL, 5);
+
+  cache = open_cache (path);
+  g_assert_cmpuint (gairq_disk_cache_get_size (cache), ==, size);
+  assert_lookup (cache, "/feed/istanbul/", "kept");
+  assert_lookup (cache, "/feed/@4143/", NULL);
+
+  /* Appending goes on right after the good records */
+  store (cache, "/feed/@4143/", "again");
+  g_object_unref (cache);
+
+  cache = open_cache (path);
+  assert_lookup (cache, "/feed/istanbul/", "kept");
+  assert_lookup (cache, "/feed/@4143/", "again");
+
+  g_object_unref (cache);
+  remove_cache_path (path);
+}
+
+static void
+test_gairq_disk_cache_corrupt (void)
+{
+  g_autofree gchar *path = make_cache_path ();
+  GairqDiskCache *cache;
+  GError *error = NULL;
+
+  cache = open_cache (path);
+  store (cache, "/feed/istanbul/", "good");
+  store (cache, "/feed/@4143/", "rotten");
+  store (cache, "/feed/here/", "also-good");
+  g_object_unref (cache);
+
+  mangle_file (path, "rotten", 0);
+
+  /* Only the record whose checksum fails is lost */
+  cache = open_cache (path);
+  assert_lookup (cache, "/feed/istanbul/", "good");
+  assert_lookup (cache, "/feed/@4143/", NULL);
+  assert_lookup (cache, "/feed/here/", "also-good");
+  g_assert_cmpuint (gairq_disk_cache_get_n_entries (cache), ==, 2);
+  g_object_unref (cache);
+
+  /* Anything else is refused */
+  g_file_set_contents (path, "not a cache at all", -1, &error);
+  g_assert_no_error (error);
+  g_assert_null (gairq_disk_cache_new (path, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_clear_error (&error);
+
+  remove_cache_path (path);
+}
+
+static void
+test_gairq_disk_cache_compact (void)
+{
+  g_autofree gchar *path = make_cache_path ();
+  g_autofree gchar *big = NULL;
+  GairqDiskCache *cache;
+  GError *error = NULL;
+  GStatBuf st;
+  guint i;
+
+  big = g_strnfill (BIG_PAYLOAD_SIZE, 'x');
+
+  cache = open_cache (path);
+  store (cache, "/feed/here/", "small");
+
+  /* Rewritten over and over, the file doesn't keep growing */
+  for (i = 0; i < N_COMPACT_ROUNDS; i++)
+    {
+      big [0] = 'a' + i % 26;
+      store (cache, "/feed/istanbul/", big);
+    }
+
+  g_assert_cmpuint (gairq_disk_cache_get_size (cache), <, 2 * (1 << 20));
+  g_assert_cmpint (g_stat (path, &st), ==, 0);
+  g_assert_cmpuint (st.st_size, ==, gairq_disk_cache_get_size (cache));
+  assert_lookup (cache, "/feed/istanbul/", big);
+  assert_lookup (cache, "/feed/here/", "small");
+
+  g_assert_true (gairq_disk_cache_compact (cache, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (gairq_disk_cache_get_size (cache), <, 2 * BIG_PAYLOAD_SIZE);
+  g_object_unref (cache);
+
+  cache = open_cache (path);
+  assert_lookup (cache, "/feed/istanbul/", big);
+  assert_lookup (cache, "/feed/here/", "small");
+
+  g_object_unref (cache);
+  remove_cache_path (path);
+}
+
+static void
+test_gairq_disk_cache_warm_start (void)
+{
+  g_autofree gchar *path = make_cache_path ();
+  GairqDiskCache *cache;
+  GairqResultFlags flags;
+  GError *error = NULL;
+  TestRequest *request;
+  GairqAirObject *air;
+
+  /* The first run fetches and keeps the response */
+  cache = open_cache (path);
+  request = g_object_new (test_request_get_type (),
+                          "cache-ttl", 60000,
+                          "disk-cache", cache,
+                          NULL);
+  air = gairq_request_poll_sync (GAIRQ_REQUEST (request), &flags, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_cmpint (request->n_fetches, ==, 1);
+  g_object_unref (air);
+  g_object_unref (request);
+  g_object_unref (cache);
+
+  /* After a restart, the first poll is served locally */
+  cache = open_cache (path);
+  request = g_object_new (test_request_get_type (),
+                          "cache-ttl", 60000,
+                          "disk-cache", cache,
+                          NULL);
+  air = gairq_request_poll_sync (GAIRQ_REQUEST (request), &flags, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_CACHED);
+  g_assert_cmpint (request->n_fetches, ==, 0);
+  g_assert_cmpint (gairq_air_object_get_aqi (air), ==, 57);
+  g_object_unref (air);
+  g_object_unref (request);
+
+  /* Unless it is too old by now */
+  request = g_object_new (test_request_get_type (),
+                          "cache-ttl", 1,
+                          "disk-cache", cache,
+                          NULL);
+  g_usleep (2 * G_TIME_SPAN_MILLISECOND);
+  air = gairq_request_poll_sync (GAIRQ_REQUEST (request), &flags, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_cmpint (request->n_fetches, ==, 1);
+  g_object_unref (air);
+  g_object_unref (request);
+
+  g_object_unref (cache);
+  remove_cache_path (path);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/disk-cache/reopen",
+                   test_gairq_disk_cache_reopen);
+
+  g_test_add_func ("/Gairq/disk-cache/torn",
+                   test_gairq_disk_cache_torn);
+
+  g_test_add_func ("/Gairq/disk-cache/corrupt",
+                   test_gairq_disk_cache_corrupt);
+
+  g_test_add_func ("/Gairq/disk-cache/compact",
+                   test_gairq_disk_cache_compact);
+
+  g_test_add_func ("/Gairq/disk-cache/warm-start",
+                   test_gairq_disk_cache_warm_start);
+
+  return g_test_run ();
+}
@@ -0,0 +1,490 @@
+/* executor-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <locale.h>
+
+/* Jobs hold on until the gate opens, counting how many ran at once */
+typedef struct
+{
+  GMutex    lock;
+  GCond     cond;
+  gboolean  open;
+  guint     running;
+  guint     most_running;
+  guint     n_done;
+  guint     n_freed;
+} Gate;
+
+static void
+gate_job (gpointer data)
+{
+  Gate *gate = data;
+
+  g_mutex_lock (&gate->lock);
+  gate->running++;
+  gate->most_running = MAX (gate->most_running, gate->running);
+  g_cond_broadcast (&gate->cond);
+  while (!gate->open)
+    g_cond_wait (&gate->cond, &gate->lock);
+  gate->running--;
+  gate->n_done++;
+  g_mutex_unlock (&gate->lock);
+}
+
+static void
+gate_job_free (gpointer data)
+{
+  Gate *gate = data;
+
+  g_mutex_lock (&gate->lock);
+  gate->n_freed++;
+  g_cond_broadcast (&gate->cond);
+  g_mutex_unlock (&gate->lock);
+}
+
+static void
+gate_open (Gate *gate)
+{
+  g_mutex_lock (&gate->lock);
+  gate->open = TRUE;
+  g_cond_broadcast (&gate->cond);
+  g_mutex_unlock (&gate->lock);
+}
+
+static void
+gate_wait_running (Gate  *gate,
+                   guint  running)
+{
+  g_mutex_lock (&gate->lock);
+  while (gate->running < running)
+    g_cond_wait (&gate->cond, &gate->lock);
+  g_mutex_unlock (&gate->lock);
+}
+
+static void
+gate_wait_freed (Gate  *gate,
+                 guint  n_freed)
+{
+  g_mutex_lock (&gate->lock);
+  while (gate->n_freed < n_freed)
+    g_cond_wait (&gate->cond, &gate->lock);
+  g_mutex_unlock (&gate->lock);
+}
+
+static void
+wait_for_stats (GairqExecutor      *executor,
+                GairqExecutorStats *stats,
+                guint               n_threads,
+                guint               n_busy)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+
+  for (;;)
+    {
+      gairq_executor_get_stats (executor, stats);
+      if (stats->n_threads == n_threads && stats->n_busy == n_busy)
+        return;
+
+      g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+      g_usleep (G_TIME_SPAN_MILLISECOND);
+    }
+}
+
+static void
+test_gairq_executor_bounds (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GError) error = NULL;
+  GairqExecutorStats stats;
+  Gate gate = { 0, };
+  gdouble utilization;
+  gint64 start;
+  guint i;
+
+  g_mutex_init (&gate.lock);
+  g_cond_init (&gate.cond);
+
+  executor = gairq_executor_new (0, 2, 3);
+  g_assert_cmpuint (gairq_executor_get_min_threads (executor), ==, 0);
+  g_assert_cmpuint (gairq_executor_get_max_threads (executor), ==, 2);
+  g_assert_cmpuint (gairq_executor_get_max_queued (executor), ==, 3);
+
+  /* Two running, three waiting, which is all there is room for */
+  for (i = 0; i < 5; i++)
+    {
+      gairq_executor_push (executor, GAIRQ_PRIORITY_NORMAL,
+                           gate_job, &gate, gate_job_free, -1, &error);
+      g_assert_no_error (error);
+
+      if (i < 2)
+        gate_wait_running (&gate, i + 1);
+    }
+
+  gairq_executor_get_stats (executor, &stats);
+  g_assert_cmpuint (stats.n_threads, ==, 2);
+  g_assert_cmpuint (stats.n_queued, ==, 3);
+  g_assert_cmpuint (stats.max_queued, ==, 3);
+
+  g_assert_false (gairq_executor_push (executor, GAIRQ_PRIORITY_NORMAL,
+                                       gate_job, &gate, gate_job_free, 0, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_BUSY);
+  g_clear_error (&error);
+
+  start = g_get_monotonic_time ();
+  g_assert_false (gairq_executor_push (executor, GAIRQ_PRIORITY_NORMAL,
+                                       gate_job, &gate, gate_job_free,
+                                       20 * G_TIME_SPAN_MILLISECOND, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_BUSY);
+  g_assert_cmpint (g_get_monotonic_time () - start, >=, 20 * G_TIME_SPAN_MILLISECOND);
+  g_clear_error (&error);
+
+  gate_open (&gate);
+  gate_wait_freed (&gate, 5);
+  g_assert_cmpuint (gate.n_done, ==, 5);
+  g_assert_cmpuint (gate.most_running, ==, 2);
+
+  wait_for_stats (executor, &stats, 2, 0);
+  g_assert_cmpuint (stats.n_queued, ==, 0);
+  g_assert_cmpuint (stats.n_submitted, ==, 5);
+  g_assert_cmpuint (stats.n_completed, ==, 5);
+  g_assert_cmpuint (stats.n_rejected, ==, 2);
+  g_assert_cmpint (stats.wait_time, >, 0);
+  g_assert_cmpint (stats.busy_time, <=, stats.thread_time);
+
+  utilization = gairq_executor_stats_get_utilization (&stats);
+  g_assert_cmpfloat (utilization, >, 0.0);
+  g_assert_cmpfloat (utilization, <=, 1.0);
+
+  g_mutex_clear (&gate.lock);
+  g_cond_clear (&gate.cond);
+}
+
+static void
+test_gairq_executor_idle (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  GairqExecutorStats stats;
+  Gate gate = { 0, };
+  guint i;
+
+  g_mutex_init (&gate.lock);
+  g_cond_init (&gate.cond);
+
+  executor = g_object_new (GAIRQ_TYPE_EXECUTOR,
+                           "min-threads", 1,
+                           "max-threads", 4,
+                           "idle-timeout", 20,
+                           NULL);
+  g_assert_cmpuint (gairq_executor_get_idle_timeout (executor), ==, 20);
+
+  gairq_executor_get_stats (executor, &stats);
+  g_assert_cmpuint (stats.n_threads, ==, 1);
+
+  for (i = 0; i < 4; i++)
+    gairq_executor_push (executor, GAIRQ_PRIORITY_NORMAL,
+                         gate_job, &gate, gate_job_free, -1, NULL);
+  gate_wait_running (&gate, 4);
+  wait_for_stats (executor, &stats, 4, 4);
+
+  /* The spare ones go away once there is nothing left for them */
+  gate_open (&gate);
+  gate_wait_freed (&gate, 4);
+  wait_for_stats (executor, &stats, 1, 0);
+
+  g_mutex_clear (&gate.lock);
+  g_cond_clear (&gate.cond);
+}
+
+/* Notes down its tag when it runs, so that the order can be checked */
+typedef struct
+{
+  Gate *    gate;
+  GString * order;
+  gchar     tag;
+} Tagged;
+
+static void
+tagged_job (gpointer data)
+{
+  Tagged *tagged = data;
+
+  g_string_append_c (tagged->order, tagged->tag);
+}
+
+static void
+tagged_job_free (gpointer data)
+{
+  Tagged *tagged = data;
+
+  gate_job_free (tagged->gate);
+  g_free (tagged);
+}
+
+static void
+push_tagged (GairqExecutor *executor,
+             GairqPriority  priority,
+             Gate          *gate,
+             GString       *order)
+{
+  Tagged *tagged = g_new (Tagged, 1);
+  GError *error = NULL;
+
+  tagged->gate = gate;
+  tagged->order = order;
+  tagged->tag = "inb" [priority];
+
+  gairq_executor_push (executor, priority, tagged_job, tagged, tagged_job_free, -1, &error);
+  g_assert_no_error (error);
+}
+
+static void
+hold_worker (GairqExecutor *executor,
+             Gate          *gate)
+{
+  g_mutex_lock (&gate->lock);
+  gate->open = FALSE;
+  g_mutex_unlock (&gate->lock);
+
+  gairq_executor_push (executor, GAIRQ_PRIORITY_NORMAL,
+                       gate_job, gate, gate_job_free, -1, NULL);
+  gate_wait_running (gate, 1);
+}
+
+static void
+test_gairq_executor_priority (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqSketch) bulk_waits = NULL;
+  g_autoptr(GString) order = NULL;
+  GairqExecutorStats stats;
+  Gate gate = { 0, };
+  guint i;
+
+  g_mutex_init (&gate.lock);
+  g_cond_init (&gate.cond);
+
+  /* One worker, so that the queue decides everything */
+  executor = gairq_executor_new (1, 1, 0);
+  order = g_string_new (NULL);
+
+  /* Without aging, classes go strictly in order */
+  gairq_executor_set_aging (executor, 0);
+  hold_worker (executor, &gate);
+  for (i = 0; i < 2; i++)
+    {
+      push_tagged (executor, GAIRQ_PRIORITY_BULK, &gate, order);
+      push_tagged (executor, GAIRQ_PRIORITY_NORMAL, &gate, order);
+      push_tagged (executor, GAIRQ_PRIORITY_INTERACTIVE, &gate, order);
+    }
+
+  gairq_executor_get_stats (executor, &stats);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_BULK].n_queued, ==, 2);
+
+  gate_open (&gate);
+  gate_wait_freed (&gate, 7);
+  g_assert_cmpstr (order->str, ==, "iinnbb");
+
+  /* A bulk job that waited long enough goes ahead of fresh interactive ones */
+  g_object_set (executor, "aging", 10, NULL);
+  g_string_truncate (order, 0);
+  hold_worker (executor, &gate);
+  push_tagged (executor, GAIRQ_PRIORITY_BULK, &gate, order);
+  g_usleep (50 * G_TIME_SPAN_MILLISECOND);
+  push_tagged (executor, GAIRQ_PRIORITY_INTERACTIVE, &gate, order);
+  push_tagged (executor, GAIRQ_PRIORITY_INTERACTIVE, &gate, order);
+  push_tagged (executor, GAIRQ_PRIORITY_BULK, &gate, order);
+
+  gate_open (&gate);
+  gate_wait_freed (&gate, 12);
+  g_assert_cmpstr (order->str, ==, "biib");
+
+  gairq_executor_get_stats (executor, &stats);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_INTERACTIVE].n_completed, ==, 4);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_INTERACTIVE].n_aged, ==, 0);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_NORMAL].n_completed, >=, 2);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_BULK].n_completed, ==, 4);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_BULK].n_aged, ==, 1);
+  g_assert_cmpint (stats.priorities [GAIRQ_PRIORITY_BULK].max_wait, >=, 50 * G_TIME_SPAN_MILLISECOND);
+  g_assert_cmpint (stats.priorities [GAIRQ_PRIORITY_BULK].wait_time, >=,
+                   stats.priorities [GAIRQ_PRIORITY_BULK].max_wait);
+
+  bulk_waits = gairq_executor_get_wait_sketch (executor, GAIRQ_PRIORITY_BULK);
+  g_assert_cmpuint (gairq_sketch_get_count (bulk_waits), ==, 4);
+  g_assert_cmpfloat (gairq_sketch_quantile (bulk_waits, 1.0), >=,
+                     50 * G_TIME_SPAN_MILLISECOND * (1 - gairq_sketch_get_accuracy (bulk_waits)));
+
+  g_mutex_clear (&gate.lock);
+  g_cond_clear (&gate.cond);
+}
+
+static void
+task_thread (GTask        *task,
+             gpointer      source_object,
+             gpointer      task_data,
+             GCancellable *cancellable)
+{
+  Gate *gate = task_data;
+
+  gate_job (gate);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+task_done (GObject      *source_object,
+           GAsyncResult *res,
+           gpointer      user_data)
+{
+  GError **error = user_data;
+
+  g_task_propagate_boolean (G_TASK (res), error);
+}
+
+static void
+test_gairq_executor_task (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GTask) rejected = NULL;
+  GError *error = NULL;
+  GError *rejected_error = NULL;
+  Gate gate = { 0, };
+
+  g_mutex_init (&gate.lock);
+  g_cond_init (&gate.cond);
+
+  executor = gairq_executor_new (1, 1, 1);
+
+  /* Hold the only worker, so that the next task fills the queue */
+  gairq_executor_push (executor, GAIRQ_PRIORITY_NORMAL,
+                       gate_job, &gate, gate_job_free, -1, NULL);
+  gate_wait_running (&gate, 1);
+
+  task = g_task_new (NULL, NULL, task_done, &error);
+  g_task_set_task_data (task, &gate, NULL);
+  g_assert_true (gairq_executor_run_in_thread (executor, GAIRQ_PRIORITY_NORMAL,
+                                               task, task_thread));
+
+  rejected = g_task_new (NULL, NULL, task_done, &rejected_error);
+  g_assert_false (gairq_executor_run_in_thread (executor, GAIRQ_PRIORITY_NORMAL,
+                                                rejected, task_thread));
+
+  gate_open (&gate);
+  while (!g_task_get_completed (task) || !g_task_get_completed (rejected))
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_no_error (error);
+  g_assert_error (rejected_error, G_IO_ERROR, G_IO_ERROR_BUSY);
+  g_clear_error (&rejected_error);
+
+  gate_wait_freed (&gate, 1);
+  g_mutex_clear (&gate.lock);
+  g_cond_clear (&gate.cond);
+}
+
+static void
+poll_done (GObject      *source_object,
+           GAsyncResult *res,
+           gpointer      user_data)
+{
+  guint *n_done = user_data;
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GError) error = NULL;
+
+  air = gairq_request_poll_finish (GAIRQ_REQUEST (source_object), res, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_cmpint (gairq_air_object_get_idx (air), ==, 4143);
+
+  (*n_done)++;
+}
+
+static void
+test_gairq_executor_request (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(TestRequest) request = NULL;
+  GairqExecutorStats stats, default_before, default_after;
+  guint i, n_done = 0;
+
+  executor = gairq_executor_new (0, 3, 0);
+  request = g_object_new (TEST_TYPE_REQUEST,
+                          "executor", executor,
+                          "priority", GAIRQ_PRIORITY_INTERACTIVE,
+                          NULL);
+  g_assert_true (gairq_request_get_executor (GAIRQ_REQUEST (request)) == executor);
+  g_assert_cmpuint (gairq_request_get_priority (GAIRQ_REQUEST (request)), ==,
+                    GAIRQ_PRIORITY_INTERACTIVE);
+
+  gairq_executor_get_stats (gairq_executor_get_default (), &default_before);
+
+  for (i = 0; i < 10; i++)
+    gairq_request_poll_async (GAIRQ_REQUEST (request), NULL, poll_done, &n_done);
+  while (n_done < 10)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpint (request->n_fetches, ==, 10);
+
+  /* All of it went through the executor given, none through the default */
+  gairq_executor_get_stats (executor, &stats);
+  g_assert_cmpuint (stats.n_submitted, ==, 10);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_INTERACTIVE].n_queued +
+                    stats.priorities [GAIRQ_PRIORITY_INTERACTIVE].n_completed +
+                    stats.n_busy, >=, 10);
+  g_assert_cmpuint (stats.priorities [GAIRQ_PRIORITY_NORMAL].n_completed, ==, 0);
+  g_assert_cmpuint (stats.n_threads, <=, 3);
+  gairq_executor_get_stats (gairq_executor_get_default (), &default_after);
+  g_assert_cmpuint (default_after.n_submitted, ==, default_before.n_submitted);
+
+  /* Back to the default */
+  g_object_set (request, "executor", NULL, NULL);
+  gairq_request_poll_async (GAIRQ_REQUEST (request), NULL, poll_done, &n_done);
+  while (n_done < 11)
+    g_main_context_iteration (NULL, TRUE);
+
+  gairq_executor_get_stats (gairq_executor_get_default (), &default_after);
+  g_assert_cmpuint (default_after.n_submitted, ==, default_before.n_submitted + 1);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/executor/bounds",
+                   test_gairq_executor_bounds);
+
+  g_test_add_func ("/Gairq/executor/idle",
+                   test_gairq_executor_idle);
+
+  g_test_add_func ("/Gairq/executor/priority",
+                   test_gairq_executor_priority);
+
+  g_test_add_func ("/Gairq/executor/task",
+                   test_gairq_executor_task);
+
+  g_test_add_func ("/Gairq/executor/request",
+                   test_gairq_executor_request);
+
+  return g_test_run ();
+}
@@ -0,0 +1,227 @@
+/* intern-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+
+#define N_STATIONS  500
+#define N_THREADS   4
+
+#define RESPONSE_FMT \
+  "{\"status\":\"ok\",\"data\":{\"idx\":%d,\"aqi\":%d,\"attributions\":[" \
+  "{\"name\":\"United States Environmental Protection Agency\",\"url\":\"https://www.airnow.gov/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"name\":\"Station %d\",\"url\":\"https://aqicn.org/city/usa/\",\"geo\":[1,2]}," \
+  "\"iaqi\":{\"pm25\":{\"v\":%d}}}}"
+
+static GairqAirObject *
+deserialize_station (gint                idx,
+                     GairqAirObjectFlags flags)
+{
+  g_autoptr(JsonParser) parser = NULL;
+  g_autofree gchar *payload = NULL;
+  GairqAirObject *ret;
+  GError *error = NULL;
+
+  payload = g_strdup_printf (RESPONSE_FMT, idx, idx % 300, idx, idx % 300);
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, payload, -1, &error);
+  g_assert_no_error (error);
+
+  ret = gairq_request_deserialize (json_parser_get_root (parser), flags, &error);
+  g_assert_no_error (error);
+
+  return ret;
+}
+
+static void
+test_gairq_intern_string (void)
+{
+  GairqInternStats before, after;
+  g_autofree gchar *plain = g_strdup ("gairq-intern-test");
+  const gchar *a, *b;
+
+  gairq_intern_get_stats (&before);
+
+  a = gairq_intern_string (plain);
+  b = gairq_intern_string ("gairq-intern-test");
+  g_assert_true (a == b);
+  g_assert_true (a != plain);
+  g_assert_true (gairq_intern_contains (a));
+  g_assert_false (gairq_intern_contains (plain));
+
+  gairq_intern_get_stats (&after);
+  g_assert_cmpuint (after.n_requests - before.n_requests, ==, 2);
+  g_assert_cmpuint (after.n_hits - before.n_hits, ==, 1);
+  g_assert_cmpuint (after.n_strings, ==, before.n_strings + 1);
+  g_assert_cmpuint (after.bytes_saved, ==, before.bytes_saved + sizeof ("gairq-intern-test"));
+
+  /* An equal but separate string is not the pool's to release */
+  g_assert_false (gairq_intern_release (plain));
+  g_assert_true (gairq_intern_release (a));
+  g_assert_true (gairq_intern_release (b));
+  g_assert_false (gairq_intern_contains (a));
+
+  gairq_intern_get_stats (&after);
+  g_assert_cmpuint (after.n_strings, ==, before.n_strings);
+  g_assert_cmpuint (after.bytes_used, ==, before.bytes_used);
+  g_assert_cmpuint (after.bytes_saved, ==, before.bytes_saved);
+}
+
+static void
+test_gairq_intern_fleet (void)
+{
+  GairqAirObject *stations [N_STATIONS];
+  GairqInternStats before, after;
+  GairqObjectAttr *first, *attr, *copy;
+  GairqObjectCity *city;
+  guint i;
+
+  gairq_intern_get_stats (&before);
+
+  for (i = 0; i < N_STATIONS; i++)
+    stations [i] = deserialize_station (i, GAIRQ_AIR_OBJECT_FLAGS_INTERN);
+
+  gairq_intern_get_stats (&after);
+
+  /* Two names, two attribution URLs and one city URL for the whole fleet */
+  g_assert_cmpuint (after.n_strings - before.n_strings, ==, 5);
+  g_assert_cmpuint (after.n_requests - before.n_requests, ==, 5 * N_STATIONS);
+  g_assert_cmpuint (after.n_hits - before.n_hits, ==, 5 * (N_STATIONS - 1));
+  g_assert_cmpfloat (gairq_intern_get_dedup_ratio (), >, 0.99);
+  g_test_message ("%" G_GSIZE_FORMAT " bytes used, %" G_GSIZE_FORMAT " bytes saved",
+                  after.bytes_used - before.bytes_used,
+                  after.bytes_saved - before.bytes_saved);
+
+  first = gairq_air_object_get_attributions (stations [0])->data;
+  for (i = 1; i < N_STATIONS; i++)
+    {
+      attr = gairq_air_object_get_attributions (stations [i])->data;
+      g_assert_true (attr->name == first->name);
+      g_assert_true (attr->url == first->url);
+      g_assert_true (gairq_air_object_get_city (stations [i])->url ==
+                     gairq_air_object_get_city (stations [0])->url);
+    }
+
+  /* Deep copies share the pooled strings as well, and keep them alive */
+  g_assert_true (first->interned);
+  copy = gairq_object_attr_copy_deep (first);
+  g_assert_true (copy->interned);
+  g_assert_true (copy->name == first->name);
+  g_assert_true (copy->url == first->url);
+  city = gairq_object_city_copy_deep (gairq_air_object_get_city (stations [0]));
+  g_assert_true (city->interned);
+  g_assert_true (city->url == gairq_air_object_get_city (stations [0])->url);
+
+  for (i = 0; i < N_STATIONS; i++)
+    g_object_unref (stations [i]);
+
+  g_assert_true (gairq_intern_contains (copy->name));
+  g_assert_true (gairq_intern_contains (city->url));
+  g_assert_cmpstr (copy->url, ==, "https://www.airnow.gov/");
+  gairq_object_attr_free (copy);
+  gairq_object_city_free (city);
+
+  gairq_intern_get_stats (&after);
+  g_assert_cmpuint (after.n_strings, ==, before.n_strings);
+  g_assert_cmpuint (after.bytes_used, ==, before.bytes_used);
+  g_assert_cmpuint (after.bytes_saved, ==, before.bytes_saved);
+}
+
+static void
+test_gairq_intern_plain (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  GairqObjectAttr *attr, *copy;
+
+  /* Objects built without the flag keep owning their own strings */
+  air = deserialize_station (1, GAIRQ_AIR_OBJECT_FLAGS_NONE);
+  attr = gairq_air_object_get_attributions (air)->data;
+  g_assert_false (attr->interned);
+  g_assert_false (gairq_intern_contains (attr->name));
+
+  copy = gairq_object_attr_copy_deep (attr);
+  g_assert_false (copy->interned);
+  g_assert_true (copy->name != attr->name);
+  g_assert_cmpstr (copy->name, ==, attr->name);
+  gairq_object_attr_free (copy);
+}
+
+static gpointer
+intern_thread (gpointer data)
+{
+  guint i;
+
+  for (i = 0; i < 20000; i++)
+    {
+      g_autofree gchar *key = g_strdup_printf ("thread-key-%u", i % 16);
+      const gchar *str = gairq_intern_string (key);
+
+      g_assert_cmpstr (str, ==, key);
+      g_assert_true (gairq_intern_ref (str));
+      g_assert_true (gairq_intern_release (str));
+      g_assert_true (gairq_intern_release (str));
+    }
+
+  return NULL;
+}
+
+static void
+test_gairq_intern_threads (void)
+{
+  GThread *threads [N_THREADS];
+  GairqInternStats before, after;
+  guint i;
+
+  gairq_intern_get_stats (&before);
+
+  for (i = 0; i < N_THREADS; i++)
+    threads [i] = g_thread_new ("intern", intern_thread, NULL);
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads [i]);
+
+  gairq_intern_get_stats (&after);
+  g_assert_cmpuint (after.n_strings, ==, before.n_strings);
+  g_assert_cmpuint (after.n_requests - before.n_requests, ==, N_THREADS * 20000 * 2);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/intern/string",
+                   test_gairq_intern_string);
+
+  g_test_add_func ("/Gairq/intern/fleet",
+                   test_gairq_intern_fleet);
+
+  g_test_add_func ("/Gairq/intern/plain",
+                   test_gairq_intern_plain);
+
+  g_test_add_func ("/Gairq/intern/threads",
+                   test_gairq_intern_threads);
+
+  return g_test_run ();
+}
@@ -0,0 +1,202 @@
+/* lazy-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-utils.h"
+
+#include <locale.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"attributions\":[" \
+  "{\"name\":\"Istanbul Ministry of Environment\",\"url\":\"http://www.havaizleme.gov.tr/\"}," \
+  "{\"name\":\"Istanbul Metropolitan Municipality\",\"url\":\"http://www.ibb.gov.tr/\"}," \
+  "{\"name\":\"European Environment Agency\",\"url\":\"http://www.eea.europa.eu/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"h\":{\"v\":77},\"no2\":{\"v\":21.4},\"o3\":{\"v\":11.2}," \
+  "\"p\":{\"v\":1016},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33},\"so2\":{\"v\":3.6}," \
+  "\"t\":{\"v\":14},\"w\":{\"v\":2.5}}," \
+  "\"time\":{\"s\":\"2019-05-08 21:00:00\",\"tz\":\"+03:00\",\"v\":1557349200}}}"
+
+#define N_THREADS 8
+
+static GairqAirObject *
+new_lazy (GairqAirObjectFlags flags)
+{
+  g_autoptr(GBytes) payload = NULL;
+  GError *error = NULL;
+  GairqAirObject *air;
+
+  payload = g_bytes_new_static (PAYLOAD, sizeof (PAYLOAD) - 1);
+  air = gairq_request_deserialize_bytes (payload, flags, &error);
+  g_assert_no_error (error);
+
+  return air;
+}
+
+static void
+test_gairq_lazy_content (void)
+{
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY,
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY | GAIRQ_AIR_OBJECT_FLAGS_INTERN,
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY | GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+  };
+  g_autoptr(GairqAirObject) eager = NULL;
+  guint i;
+
+  eager = new_lazy (GAIRQ_AIR_OBJECT_FLAGS_NONE);
+  g_assert_cmpint (gairq_air_object_get_time (eager), ==, 1557349200);
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      g_autoptr(GairqAirObject) lazy = new_lazy (modes [i]);
+
+      test_assert_air_equal (eager, lazy);
+      /* And again, now that everything is decoded */
+      test_assert_air_equal (lazy, eager);
+    }
+}
+
+static void
+test_gairq_lazy_aqi_only (void)
+{
+#ifdef __GLIBC__
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY,
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY | GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      g_autoptr(GairqAirObject) air = new_lazy (modes [i]);
+      guint aqi_allocs, city_allocs;
+      TestAllocCount count;
+
+      test_alloc_count_begin ();
+      g_assert_cmpint (gairq_air_object_get_aqi (air), ==, 57);
+      test_alloc_count_end (&count);
+      aqi_allocs = count.n_allocs;
+
+      test_alloc_count_begin ();
+      g_assert_cmpstr (gairq_air_object_get_city (air)->name, ==, "Fatih, Istanbul, Turkey");
+      test_alloc_count_end (&count);
+      city_allocs = count.n_allocs;
+
+      g_test_message ("flags %u: %u allocations for aqi, %u for city",
+                      modes [i], aqi_allocs, city_allocs);
+
+      /* A number parse only, nothing else gets materialized. GLib keeps
+       * pending g_once_init_enter () locations in a list, that one's ok.
+       */
+      g_assert_cmpuint (aqi_allocs, <=, 1);
+      g_assert_cmpuint (city_allocs, >, 0);
+    }
+#else
+  g_test_skip ("Counting allocations needs glibc");
+#endif
+}
+
+static gpointer
+read_all_thread (gpointer data)
+{
+  GairqAirObject *air = data;
+  GairqObjectCity *city;
+
+  city = gairq_air_object_get_city (air);
+  g_assert_cmpstr (city->url, ==, "https://aqicn.org/city/turkey/istanbul/fatih");
+  g_assert_cmpuint (g_slist_length (gairq_air_object_get_attributions (air)), ==, 4);
+  g_assert_cmpuint (g_hash_table_size (gairq_air_object_get_iaqi (air)), ==, 10);
+  g_assert_cmpint (gairq_air_object_get_idx (air), ==, 4143);
+
+  return city;
+}
+
+static void
+test_gairq_lazy_threads (void)
+{
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY,
+    GAIRQ_AIR_OBJECT_FLAGS_LAZY | GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+  };
+  guint i, j;
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      g_autoptr(GairqAirObject) air = new_lazy (modes [i]);
+      GThread *threads [N_THREADS];
+      gpointer city = NULL;
+
+      for (j = 0; j < N_THREADS; j++)
+        threads [j] = g_thread_new ("lazy", read_all_thread, air);
+
+      /* Every thread must have seen the one and only decoded city */
+      for (j = 0; j < N_THREADS; j++)
+        {
+          gpointer ret = g_thread_join (threads [j]);
+
+          if (city == NULL)
+            city = ret;
+          g_assert_true (city == ret);
+        }
+    }
+}
+
+static void
+test_gairq_lazy_set (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+
+  air = new_lazy (GAIRQ_AIR_OBJECT_FLAGS_LAZY | GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY);
+
+  /* A value set before the member was decoded has to win over it */
+  g_object_set (air,
+                "city", gairq_object_city_new ("Elsewhere", "http://example", 1, 2),
+                "aqi", (gint64) 12,
+                NULL);
+  g_assert_cmpstr (gairq_air_object_get_city (air)->name, ==, "Elsewhere");
+  g_assert_cmpint (gairq_air_object_get_aqi (air), ==, 12);
+  g_assert_cmpint (gairq_air_object_get_idx (air), ==, 4143);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/lazy/content",
+                   test_gairq_lazy_content);
+
+  g_test_add_func ("/Gairq/lazy/aqi-only",
+                   test_gairq_lazy_aqi_only);
+
+  g_test_add_func ("/Gairq/lazy/threads",
+                   test_gairq_lazy_threads);
+
+  g_test_add_func ("/Gairq/lazy/set",
+                   test_gairq_lazy_set);
+
+  return g_test_run ();
+}
@@ -0,0 +1,347 @@
+/* monitor-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+
+#define N_STATIONS        100
+#define N_SCALE_STATIONS  50000
+#define MAX_IN_FLIGHT     4
+
+/* Serves made-up samples whose AQI changes every third fetch */
+typedef struct
+{
+  GairqMonitor  parent_instance;
+
+  guint         outstanding;
+  guint         max_outstanding;
+} TestMonitor;
+
+typedef struct
+{
+  GairqMonitorClass parent_class;
+} TestMonitorClass;
+
+G_DEFINE_TYPE (TestMonitor, test_monitor, GAIRQ_TYPE_MONITOR)
+
+static gboolean
+complete_fetch (gpointer user_data)
+{
+  GTask *task = user_data;
+
+  g_task_return_pointer (task, g_object_ref (g_task_get_task_data (task)), g_object_unref);
+  g_object_unref (task);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+test_monitor_fetch_async (GairqMonitor        *monitor,
+                          GairqRequest        *request,
+                          GCancellable        *cancellable,
+                          GAsyncReadyCallback  callback,
+                          gpointer             user_data)
+{
+  TestMonitor *self = (TestMonitor *) monitor;
+  guint issued = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (request), "issued"));
+  GairqAirObject *air;
+  GTask *task;
+
+  g_object_set_data (G_OBJECT (request), "issued", GUINT_TO_POINTER (issued + 1));
+
+  if (g_object_get_data (G_OBJECT (request), "period"))
+    {
+      /* Publishes once a period, or never if it is negative */
+      gint period = GPOINTER_TO_INT (g_object_get_data (G_OBJECT (request), "period"));
+      gint64 now = g_get_real_time () / G_USEC_PER_SEC;
+
+      air = g_object_new (GAIRQ_TYPE_AIR_OBJECT,
+                          "aqi", (gint64) 50,
+                          "time", period > 0 ? now - now % period : (gint64) 1000,
+                          NULL);
+    }
+  else
+    air = g_object_new (GAIRQ_TYPE_AIR_OBJECT, "aqi", (gint64) (issued / 3), NULL);
+  task = g_task_new (request, cancellable, callback, user_data);
+  g_task_set_task_data (task, air, g_object_unref);
+
+  self->outstanding++;
+  self->max_outstanding = MAX (self->max_outstanding, self->outstanding);
+
+  g_timeout_add (g_random_int_range (0, 3), complete_fetch, task);
+}
+
+static GairqAirObject *
+test_monitor_fetch_finish (GairqMonitor      *monitor,
+                           GairqRequest      *request,
+                           GAsyncResult      *res,
+                           GairqResultFlags  *result_flags,
+                           GError           **error)
+{
+  TestMonitor *self = (TestMonitor *) monitor;
+  GairqAirObject *air;
+
+  self->outstanding--;
+
+  air = g_task_propagate_pointer (G_TASK (res), error);
+  if (air)
+    {
+      guint done = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (request), "done"));
+
+      g_object_set_data (G_OBJECT (request), "done", GUINT_TO_POINTER (done + 1));
+    }
+
+  return air;
+}
+
+static void
+test_monitor_class_init (TestMonitorClass *klass)
+{
+  GairqMonitorClass *monitor_class = GAIRQ_MONITOR_CLASS (klass);
+
+  monitor_class->fetch_async = test_monitor_fetch_async;
+  monitor_class->fetch_finish = test_monitor_fetch_finish;
+}
+
+static void
+test_monitor_init (TestMonitor *self)
+{
+}
+
+static void
+changed_cb (GairqMonitor   *monitor,
+            GairqRequest   *request,
+            GairqAirObject *air,
+            gpointer        user_data)
+{
+  guint changes = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (request), "changes"));
+
+  g_assert_cmpint (gairq_air_object_get_aqi (air), ==, changes);
+  g_object_set_data (G_OBJECT (request), "changes", GUINT_TO_POINTER (changes + 1));
+}
+
+static gboolean
+quit_cb (gpointer user_data)
+{
+  g_main_loop_quit (user_data);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+run_for (guint ms)
+{
+  GMainLoop *loop = g_main_loop_new (NULL, FALSE);
+
+  g_timeout_add (ms, quit_cb, loop);
+  g_main_loop_run (loop);
+  g_main_loop_unref (loop);
+}
+
+static void
+drain (GairqMonitor *monitor)
+{
+  while (gairq_monitor_get_n_in_flight (monitor) > 0)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_gairq_monitor_changes (void)
+{
+  g_autoptr(GairqMonitor) monitor = NULL;
+  GairqRequest *requests [N_STATIONS];
+  guint i;
+
+  monitor = g_object_new (test_monitor_get_type (),
+                          "jitter", 0.5,
+                          "max-in-flight", MAX_IN_FLIGHT,
+                          NULL);
+  g_signal_connect (monitor, "changed", G_CALLBACK (changed_cb), NULL);
+
+  for (i = 0; i < N_STATIONS; i++)
+    {
+      requests [i] = gairq_request_new ("token");
+      g_assert_cmpuint (gairq_monitor_add (monitor, requests [i], 10), ==, i + 1);
+    }
+
+  gairq_monitor_start (monitor);
+  run_for (400);
+  gairq_monitor_stop (monitor);
+  drain (monitor);
+
+  g_assert_cmpuint (((TestMonitor *) monitor)->max_outstanding, <=, MAX_IN_FLIGHT);
+  g_assert_cmpuint (((TestMonitor *) monitor)->outstanding, ==, 0);
+
+  for (i = 0; i < N_STATIONS; i++)
+    {
+      guint done = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (requests [i]), "done"));
+      guint changes = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (requests [i]), "changes"));
+
+      /* Every station had its turn, and only changes were told */
+      g_assert_cmpuint (done, >=, 2);
+      g_assert_cmpuint (changes, ==, (done + 2) / 3);
+
+      g_object_unref (requests [i]);
+    }
+}
+
+static void
+remove_cb (GairqMonitor   *monitor,
+           GairqRequest   *request,
+           GairqAirObject *air,
+           gpointer        user_data)
+{
+  guint id = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (request), "id"));
+
+  g_assert_true (gairq_monitor_remove (monitor, id));
+  g_assert_false (gairq_monitor_remove (monitor, id));
+}
+
+static void
+test_gairq_monitor_remove (void)
+{
+  g_autoptr(GairqMonitor) monitor = NULL;
+  guint i;
+
+  monitor = g_object_new (test_monitor_get_type (), NULL);
+  g_signal_connect (monitor, "changed", G_CALLBACK (remove_cb), NULL);
+  gairq_monitor_start (monitor);
+
+  for (i = 0; i < N_STATIONS; i++)
+    {
+      g_autoptr(GairqRequest) request = gairq_request_new ("token");
+      guint id = gairq_monitor_add (monitor, request, 5);
+
+      g_object_set_data (G_OBJECT (request), "id", GUINT_TO_POINTER (id));
+    }
+
+  /* Each station removes itself on its first sample */
+  while (gairq_monitor_get_n_stations (monitor) > 0)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (gairq_monitor_get_n_in_flight (monitor), ==, 0);
+  g_assert_true (gairq_monitor_is_running (monitor));
+}
+
+static void
+test_gairq_monitor_adaptive (void)
+{
+  g_autoptr(GairqMonitor) monitor = NULL;
+  g_autoptr(GairqRequest) hourly = NULL;
+  g_autoptr(GairqRequest) dormant = NULL;
+  guint hourly_done, dormant_done;
+  gint64 saved;
+
+  if (!g_test_slow ())
+    {
+      g_test_skip ("Learning update periods of seconds only runs with -m slow");
+      return;
+    }
+
+  monitor = g_object_new (test_monitor_get_type (),
+                          "adaptive", TRUE,
+                          "max-backoff", 16,
+                          NULL);
+
+  /* Seconds stand in for hours here, the server only tells seconds */
+  hourly = gairq_request_new ("token");
+  g_object_set_data (G_OBJECT (hourly), "period", GINT_TO_POINTER (1));
+  dormant = gairq_request_new ("token");
+  g_object_set_data (G_OBJECT (dormant), "period", GINT_TO_POINTER (-1));
+
+  gairq_monitor_add (monitor, hourly, 100);
+  gairq_monitor_add (monitor, dormant, 100);
+
+  gairq_monitor_start (monitor);
+  run_for (4000);
+  gairq_monitor_stop (monitor);
+  drain (monitor);
+
+  hourly_done = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (hourly), "done"));
+  dormant_done = GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (dormant), "done"));
+  saved = gairq_monitor_get_n_requests_saved (monitor);
+
+  g_test_message ("%u fetches for the hourly one, %u for the dormant one, %"
+                  G_GINT64_FORMAT " saved out of %" G_GUINT64_FORMAT,
+                  hourly_done, dormant_done, saved,
+                  gairq_monitor_get_n_requests (monitor));
+
+  /* The fixed interval would have made about 40 each */
+  g_assert_cmpuint (hourly_done, >=, 4);
+  g_assert_cmpuint (hourly_done, <=, 20);
+  g_assert_cmpuint (dormant_done, <=, 10);
+  g_assert_cmpint (saved, >=, 40);
+}
+
+static void
+test_gairq_monitor_scale (void)
+{
+  g_autoptr(GairqMonitor) monitor = NULL;
+  g_autoptr(GairqRequest) request = NULL;
+  g_autofree guint *ids = NULL;
+  gdouble elapsed;
+  guint i;
+
+  monitor = g_object_new (test_monitor_get_type (), NULL);
+  request = gairq_request_new ("token");
+  ids = g_new (guint, N_SCALE_STATIONS);
+
+  g_test_timer_start ();
+
+  gairq_monitor_start (monitor);
+  for (i = 0; i < N_SCALE_STATIONS; i++)
+    ids [i] = gairq_monitor_add (monitor, request, 3600 * 1000);
+
+  for (i = 0; i < N_SCALE_STATIONS; i += 2)
+    g_assert_true (gairq_monitor_remove (monitor, ids [i]));
+
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "%u stations added, half removed: %.1f ms",
+                           N_SCALE_STATIONS, elapsed * 1e3);
+
+  g_assert_cmpuint (gairq_monitor_get_n_stations (monitor), ==, N_SCALE_STATIONS / 2);
+
+  gairq_monitor_stop (monitor);
+  drain (monitor);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/monitor/changes",
+                   test_gairq_monitor_changes);
+
+  g_test_add_func ("/Gairq/monitor/remove",
+                   test_gairq_monitor_remove);
+
+  g_test_add_func ("/Gairq/monitor/adaptive",
+                   test_gairq_monitor_adaptive);
+
+  g_test_add_func ("/Gairq/monitor/scale",
+                   test_gairq_monitor_scale);
+
+  return g_test_run ();
+}
@@ -0,0 +1,372 @@
+/* ndjson-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-utils.h"
+
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <string.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"attributions\":[" \
+  "{\"name\":\"Istanbul Ministry of Environment\",\"url\":\"http://www.havaizleme.gov.tr/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"h\":{\"v\":77},\"no2\":{\"v\":21.4},\"o3\":{\"v\":11.2}," \
+  "\"p\":{\"v\":1016},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33},\"so2\":{\"v\":3.6}," \
+  "\"t\":{\"v\":-0.3},\"w\":{\"v\":2.5}},\"time\":{\"s\":\"2019-11-20 12:00:00\",\"v\":1574251200}}}"
+
+/* Escapes, a dash for aqi and an attribution without url */
+#define ODD_PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":%d,\"aqi\":\"-\"," \
+  "\"attributions\":[{\"name\":\"Quote \\\" back\\\\slash\\nline \\u00e9 \\u0001\",\"url\":null}]," \
+  "\"city\":{\"geo\":[-33.5,151.25],\"name\":\"Tab\\there\",\"url\":\"http://x\"}," \
+  "\"iaqi\":{\"pm25\":{\"v\":0.1},\"o3\":{\"v\":123456789.123}},\"time\":{\"v\":%d}}}"
+
+/* Neither city nor iaqi */
+#define BARE_PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":%d,\"aqi\":%d,\"time\":{\"v\":0}}}"
+
+#define N_CHUNK_LINES     20000
+#define N_BENCH_LINES     100000
+
+static GairqAirObject *
+parse_air (const gchar *payload)
+{
+  g_autoptr(JsonParser) parser = NULL;
+  GairqAirObject *air;
+  GError *error = NULL;
+
+  parser = json_parser_new ();
+  json_parser_load_from_data (parser, payload, -1, &error);
+  g_assert_no_error (error);
+
+  air = gairq_request_default_deserialize (json_parser_get_root (parser), &error);
+  g_assert_no_error (error);
+
+  return air;
+}
+
+static GairqAirObject *
+build_air (guint i)
+{
+  g_autofree gchar *payload = NULL;
+
+  switch (i % 3)
+    {
+    case 0:
+      return parse_air (PAYLOAD);
+
+    case 1:
+      payload = g_strdup_printf (ODD_PAYLOAD, i, i * 3600);
+      break;
+
+    default:
+      payload = g_strdup_printf (BARE_PAYLOAD, i, i % 500);
+      break;
+    }
+
+  return parse_air (payload);
+}
+
+/* Writes @n_lines stations to a file, returns its path */
+static gchar *
+write_stations (GPtrArray *stations,
+                guint      n_lines)
+{
+  g_autoptr(GOutputStream) stream = NULL;
+  g_autoptr(GairqNdjsonWriter) writer = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autofree gchar *dir = NULL;
+  GairqNdjsonStats stats;
+  gchar *path;
+  guint i;
+
+  dir = g_dir_make_tmp ("gairq-ndjson-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (dir, "stations.ndjson", NULL);
+  file = g_file_new_for_path (path);
+
+  stream = G_OUTPUT_STREAM (g_file_replace (file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, &error));
+  g_assert_no_error (error);
+
+  writer = gairq_ndjson_writer_new (stream);
+  for (i = 0; i < n_lines; i++)
+    {
+      g_assert_true (gairq_ndjson_writer_append (writer, g_ptr_array_index (stations, i % stations->len),
+                                                 &error));
+      g_assert_no_error (error);
+    }
+
+  g_assert_true (gairq_ndjson_writer_flush (writer, &error));
+  g_assert_no_error (error);
+
+  gairq_ndjson_writer_get_stats (writer, &stats);
+  g_assert_cmpuint (stats.n_lines, ==, n_lines);
+
+  g_output_stream_close (stream, NULL, &error);
+  g_assert_no_error (error);
+
+  return path;
+}
+
+static void
+remove_file (const gchar *path)
+{
+  g_autofree gchar *dir = g_path_get_dirname (path);
+
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+static GPtrArray *
+build_stations (guint n_stations)
+{
+  GPtrArray *stations = g_ptr_array_new_with_free_func (g_object_unref);
+  guint i;
+
+  for (i = 0; i < n_stations; i++)
+    g_ptr_array_add (stations, build_air (i));
+
+  return stations;
+}
+
+static void
+test_gairq_ndjson_serialize (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GairqAirObject) back = NULL;
+  g_autoptr(GairqAirObject) odd = NULL;
+  g_autoptr(GairqAirObject) odd_back = NULL;
+  JsonNode *node;
+
+  /* Every property makes it through json-glib and back */
+  air = build_air (0);
+  node = json_gobject_serialize (G_OBJECT (air));
+  back = GAIRQ_AIR_OBJECT (json_gobject_deserialize (GAIRQ_TYPE_AIR_OBJECT, node));
+  test_assert_air_equal (air, back);
+  json_node_unref (node);
+
+  odd = build_air (1);
+  node = json_gobject_serialize (G_OBJECT (odd));
+  odd_back = GAIRQ_AIR_OBJECT (json_gobject_deserialize (GAIRQ_TYPE_AIR_OBJECT, node));
+  test_assert_air_equal (odd, odd_back);
+  json_node_unref (node);
+}
+
+static void
+test_gairq_ndjson_roundtrip (void)
+{
+  const GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_NONE,
+    GAIRQ_AIR_OBJECT_FLAGS_ARENA,
+    GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+    GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY | GAIRQ_AIR_OBJECT_FLAGS_LAZY,
+  };
+  g_autoptr(GPtrArray) stations = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *contents = NULL;
+  g_auto(GStrv) lines = NULL;
+  guint i, j;
+
+  stations = build_stations (9);
+  path = write_stations (stations, stations->len);
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      g_autoptr(GPtrArray) objects = NULL;
+      GairqNdjsonStats stats;
+
+      objects = gairq_ndjson_read (path, modes [i], 1, &stats, &error);
+      g_assert_no_error (error);
+      g_assert_cmpuint (objects->len, ==, stations->len);
+      g_assert_cmpuint (stats.n_lines, ==, stations->len);
+      g_assert_cmpuint (stats.n_invalid, ==, 0);
+
+      for (j = 0; j < stations->len; j++)
+        test_assert_air_equal (g_ptr_array_index (stations, j), g_ptr_array_index (objects, j));
+    }
+
+  /* Each line is a response of its own */
+  g_file_get_contents (path, &contents, NULL, &error);
+  g_assert_no_error (error);
+  g_assert_true (g_str_has_suffix (contents, "}}\n"));
+  g_assert_null (strstr (contents, "\n\n"));
+
+  lines = g_strsplit (contents, "\n", -1);
+  for (j = 0; j < stations->len; j++)
+    {
+      g_autoptr(GBytes) bytes = g_bytes_new_static (lines [j], strlen (lines [j]));
+      g_autoptr(GairqAirObject) air = NULL;
+
+      air = gairq_request_deserialize_bytes (bytes, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+      g_assert_no_error (error);
+      test_assert_air_equal (g_ptr_array_index (stations, j), air);
+    }
+
+  /* A missing file is an error */
+  remove_file (path);
+  g_assert_null (gairq_ndjson_read (path, GAIRQ_AIR_OBJECT_FLAGS_NONE, 1, NULL, &error));
+  g_assert_error (error, G_FILE_ERROR, G_FILE_ERROR_NOENT);
+}
+
+static void
+test_gairq_ndjson_chunks (void)
+{
+  g_autoptr(GPtrArray) stations = NULL;
+  g_autoptr(GPtrArray) serial = NULL;
+  g_autoptr(GPtrArray) parallel = NULL;
+  g_autoptr(GString) contents = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  g_autofree gchar *raw = NULL;
+  g_auto(GStrv) lines = NULL;
+  GairqNdjsonStats stats;
+  guint i, n_garbage = 0;
+
+  stations = build_stations (N_CHUNK_LINES);
+  path = write_stations (stations, N_CHUNK_LINES);
+
+  /* Blank lines are passed over, broken ones and errors counted */
+  g_file_get_contents (path, &raw, NULL, &error);
+  g_assert_no_error (error);
+  lines = g_strsplit (raw, "\n", -1);
+
+  contents = g_string_new (NULL);
+  for (i = 0; lines [i] && *lines [i]; i++)
+    {
+      g_string_append_printf (contents, "%s\n", lines [i]);
+      if (i % 1000 == 0)
+        {
+          g_string_append (contents, "\n  \r\n{\"status\":\"error\",\"data\":\"Unknown station\"}\n"
+                                     "{\"status\":\"ok\",\"data\":{\"idx\":1,\"aqi\n");
+          n_garbage += 2;
+        }
+    }
+  /* No newline at the very end */
+  g_string_truncate (contents, contents->len - 1);
+
+  g_file_set_contents (path, contents->str, contents->len, &error);
+  g_assert_no_error (error);
+
+  serial = gairq_ndjson_read (path, GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY, 1, &stats, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (stats.n_threads, ==, 1);
+  g_assert_cmpuint (stats.n_lines, ==, N_CHUNK_LINES + n_garbage);
+  g_assert_cmpuint (stats.n_invalid, ==, n_garbage);
+  g_assert_cmpuint (stats.n_bytes, ==, contents->len);
+
+  parallel = gairq_ndjson_read (path, GAIRQ_AIR_OBJECT_FLAGS_NONE, 3, &stats, &error);
+  g_assert_no_error (error);
+  g_assert_cmpuint (stats.n_threads, ==, 3);
+  g_assert_cmpuint (stats.n_invalid, ==, n_garbage);
+
+  /* Same stations in the same order whichever way it was read */
+  g_assert_cmpuint (serial->len, ==, N_CHUNK_LINES);
+  g_assert_cmpuint (parallel->len, ==, N_CHUNK_LINES);
+  for (i = 0; i < N_CHUNK_LINES; i++)
+    {
+      test_assert_air_equal (g_ptr_array_index (stations, i), g_ptr_array_index (serial, i));
+      test_assert_air_equal (g_ptr_array_index (stations, i), g_ptr_array_index (parallel, i));
+    }
+
+  remove_file (path);
+}
+
+static void
+test_gairq_ndjson_benchmark (void)
+{
+  g_autoptr(GPtrArray) stations = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree gchar *path = NULL;
+  gdouble elapsed;
+  gsize length, total = 0;
+  guint i;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  stations = build_stations (30);
+
+  /* What it takes through a JsonNode tree and the generator */
+  g_test_timer_start ();
+  for (i = 0; i < N_BENCH_LINES; i++)
+    {
+      g_autofree gchar *line = json_gobject_to_data (g_ptr_array_index (stations, i % stations->len),
+                                                     &length);
+
+      total += length;
+    }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "json_gobject_to_data: %.0f lines/s, %.0f MB/s",
+                           N_BENCH_LINES / elapsed, total / elapsed / 1e6);
+
+  g_test_timer_start ();
+  path = write_stations (stations, N_BENCH_LINES);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "writer: %.0f lines/s", N_BENCH_LINES / elapsed);
+
+  for (i = 0; i < 2; i++)
+    {
+      g_autoptr(GPtrArray) objects = NULL;
+      GairqNdjsonStats stats;
+
+      g_test_timer_start ();
+      objects = gairq_ndjson_read (path, GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY, i ? 0 : 1, &stats, &error);
+      elapsed = g_test_timer_elapsed ();
+      g_assert_no_error (error);
+
+      g_test_minimized_result (elapsed, "reader, %u threads: %.0f lines/s, %.0f MB/s",
+                               stats.n_threads, stats.n_lines / elapsed,
+                               stats.n_bytes / elapsed / 1e6);
+    }
+
+  remove_file (path);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/ndjson/serialize",
+                   test_gairq_ndjson_serialize);
+
+  g_test_add_func ("/Gairq/ndjson/roundtrip",
+                   test_gairq_ndjson_roundtrip);
+
+  g_test_add_func ("/Gairq/ndjson/chunks",
+                   test_gairq_ndjson_chunks);
+
+  g_test_add_func ("/Gairq/ndjson/benchmark",
+                   test_gairq_ndjson_benchmark);
+
+  return g_test_run ();
+}
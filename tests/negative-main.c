@@ -0,0 +1,225 @@
+/* negative-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <locale.h>
+
+#define UNKNOWN_PAYLOAD "{\"status\":\"error\",\"data\":\"Unknown station\"}"
+#define INVALID_PAYLOAD "{\"status\":\"error\",\"data\":\"Invalid key\"}"
+
+#define TTL_MS          100
+#define N_KEYS          1000
+#define N_PROBES        100000
+
+static TestRequest *
+negative_request_new (const gchar *key,
+                      const gchar *payload,
+                      guint        negative_ttl)
+{
+  TestRequest *self;
+
+  self = test_request_new (0);
+  gairq_request_set_negative_ttl (GAIRQ_REQUEST (self), negative_ttl);
+  self->key = key;
+  self->payload = payload;
+
+  return self;
+}
+
+static void
+assert_poll_fails (TestRequest *request,
+                   const gchar *message)
+{
+  GairqAirObject *air;
+  GError *error = NULL;
+
+  air = gairq_request_poll_sync (GAIRQ_REQUEST (request), NULL, &error);
+  g_assert_null (air);
+  g_assert_nonnull (error);
+  g_assert_cmpstr (error->message, ==, message);
+  g_error_free (error);
+}
+
+static void
+test_gairq_negative_cache (void)
+{
+  GairqNegativeCacheStats stats;
+
+  gairq_negative_cache_clear ();
+
+  gairq_negative_cache_add ("/feed/nowhere/", TTL_MS);
+  g_assert_true (gairq_negative_cache_contains ("/feed/nowhere/"));
+  g_assert_false (gairq_negative_cache_contains ("/feed/istanbul/"));
+  g_assert_false (gairq_negative_cache_contains (NULL));
+
+  /* A zero TTL remembers nothing */
+  gairq_negative_cache_add ("/feed/elsewhere/", 0);
+  g_assert_false (gairq_negative_cache_contains ("/feed/elsewhere/"));
+
+  g_assert_true (gairq_negative_cache_remove ("/feed/nowhere/"));
+  g_assert_false (gairq_negative_cache_remove ("/feed/nowhere/"));
+  g_assert_false (gairq_negative_cache_contains ("/feed/nowhere/"));
+
+  gairq_negative_cache_add ("/feed/nowhere/", TTL_MS);
+  g_usleep ((TTL_MS + 20) * G_TIME_SPAN_MILLISECOND);
+  g_assert_false (gairq_negative_cache_contains ("/feed/nowhere/"));
+
+  gairq_negative_cache_get_stats (&stats);
+  g_assert_cmpuint (stats.n_keys, ==, 0);
+  g_assert_cmpuint (stats.n_hits, >=, 1);
+
+  gairq_negative_cache_add ("/feed/nowhere/", TTL_MS);
+  gairq_negative_cache_clear ();
+  g_assert_false (gairq_negative_cache_contains ("/feed/nowhere/"));
+}
+
+static void
+test_gairq_negative_bloom (void)
+{
+  GairqNegativeCacheStats before, after;
+  guint64 n_lookups, n_filtered, n_false_positives;
+  gchar key [64];
+  guint i;
+
+  gairq_negative_cache_clear ();
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      g_snprintf (key, sizeof key, "/feed/@%u/", i);
+      gairq_negative_cache_add (key, G_MAXUINT);
+    }
+
+  gairq_negative_cache_get_stats (&before);
+  g_assert_cmpuint (before.n_keys, ==, N_KEYS);
+
+  for (i = 0; i < N_KEYS; i++)
+    {
+      g_snprintf (key, sizeof key, "/feed/@%u/", i);
+      g_assert_true (gairq_negative_cache_contains (key));
+    }
+
+  /* Good keys mostly never get to the table */
+  for (i = 0; i < N_PROBES; i++)
+    {
+      g_snprintf (key, sizeof key, "/feed/good-%u/", i);
+      g_assert_false (gairq_negative_cache_contains (key));
+    }
+
+  gairq_negative_cache_get_stats (&after);
+  n_lookups = after.n_lookups - before.n_lookups;
+  n_filtered = after.n_filtered - before.n_filtered;
+  n_false_positives = after.n_false_positives - before.n_false_positives;
+
+  g_test_message ("%" G_GUINT64_FORMAT " of %" G_GUINT64_FORMAT " good keys went past the filter",
+                  n_false_positives, (guint64) N_PROBES);
+  g_assert_cmpuint (n_lookups, ==, N_KEYS + N_PROBES);
+  g_assert_cmpuint (n_filtered + n_false_positives, ==, N_PROBES);
+  g_assert_cmpuint (n_false_positives, <, N_PROBES / 100);
+
+  gairq_negative_cache_clear ();
+}
+
+static void
+test_gairq_negative_request (void)
+{
+  g_autoptr(TestRequest) request = NULL;
+  g_autoptr(TestRequest) other = NULL;
+  g_autoptr(TestRequest) elsewhere = NULL;
+
+  gairq_negative_cache_clear ();
+
+  request = negative_request_new ("/feed/nowhere/", UNKNOWN_PAYLOAD, TTL_MS);
+  assert_poll_fails (request, "Error-Response: Unknown station");
+  g_assert_cmpint (request->n_fetches, ==, 1);
+
+  /* Rejected locally, by any request for the same endpoint */
+  assert_poll_fails (request, "Error-Response: Unknown station");
+  g_assert_cmpint (request->n_fetches, ==, 1);
+
+  other = negative_request_new ("/feed/nowhere/", UNKNOWN_PAYLOAD, TTL_MS);
+  assert_poll_fails (other, "Error-Response: Unknown station");
+  g_assert_cmpint (other->n_fetches, ==, 0);
+
+  /* Another server may well know it */
+  elsewhere = g_object_new (TEST_TYPE_REQUEST,
+                            "base-url", "http://127.0.0.1:1",
+                            "negative-ttl", TTL_MS,
+                            NULL);
+  elsewhere->key = "/feed/nowhere/";
+  elsewhere->payload = UNKNOWN_PAYLOAD;
+  assert_poll_fails (elsewhere, "Error-Response: Unknown station");
+  g_assert_cmpint (elsewhere->n_fetches, ==, 1);
+
+  /* Until the TTL runs out */
+  g_usleep ((TTL_MS + 20) * G_TIME_SPAN_MILLISECOND);
+  assert_poll_fails (request, "Error-Response: Unknown station");
+  g_assert_cmpint (request->n_fetches, ==, 2);
+
+  gairq_negative_cache_clear ();
+}
+
+static void
+test_gairq_negative_uncached (void)
+{
+  g_autoptr(TestRequest) disabled = NULL;
+  g_autoptr(TestRequest) invalid = NULL;
+  guint i;
+
+  gairq_negative_cache_clear ();
+
+  disabled = negative_request_new ("/feed/nowhere/", UNKNOWN_PAYLOAD, 0);
+  g_assert_cmpuint (gairq_request_get_negative_ttl (GAIRQ_REQUEST (disabled)), ==, 0);
+
+  /* Other errors may well go away, each one is asked for */
+  invalid = negative_request_new ("/feed/istanbul/", INVALID_PAYLOAD, TTL_MS);
+
+  for (i = 0; i < 3; i++)
+    {
+      assert_poll_fails (disabled, "Error-Response: Unknown station");
+      assert_poll_fails (invalid, "Error-Response: Invalid key");
+    }
+
+  g_assert_cmpint (disabled->n_fetches, ==, 3);
+  g_assert_cmpint (invalid->n_fetches, ==, 3);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/negative/cache",
+                   test_gairq_negative_cache);
+
+  g_test_add_func ("/Gairq/negative/bloom",
+                   test_gairq_negative_bloom);
+
+  g_test_add_func ("/Gairq/negative/request",
+                   test_gairq_negative_request);
+
+  g_test_add_func ("/Gairq/negative/uncached",
+                   test_gairq_negative_uncached);
+
+  return g_test_run ();
+}
@@ -0,0 +1,202 @@
+/* payload-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-utils.h"
+
+#include <locale.h>
+#include <string.h>
+
+/* The server escapes every slash, so URLs are never plain */
+#define ATTRIBUTION \
+  "{\"url\":\"http:\\/\\/www.airkorea.or.kr\\/\",\"name\":\"Korea Environment Corporation (\\ud55c\\uad6d\\ud658\\uacbd\\uacf5\\ub2e8)\",\"logo\":\"Korea-Airkorea.png\"},"
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"aqi\":78,\"idx\":1132,\"attributions\":[" \
+  ATTRIBUTION ATTRIBUTION ATTRIBUTION ATTRIBUTION ATTRIBUTION ATTRIBUTION \
+  ATTRIBUTION ATTRIBUTION ATTRIBUTION ATTRIBUTION ATTRIBUTION \
+  "{\"url\":\"https:\\/\\/waqi.info\\/\",\"name\":\"World Air Quality Index Project\"}]," \
+  "\"city\":{\"geo\":[37.5665,126.978],\"name\":\"Seoul (\\uc11c\\uc6b8)\"," \
+  "\"url\":\"https:\\/\\/aqicn.org\\/city\\/seoul\",\"location\":\"\"}," \
+  "\"dominentpol\":\"pm25\",\"iaqi\":{\"co\":{\"v\":4.6},\"h\":{\"v\":43},\"no2\":{\"v\":21.1}," \
+  "\"o3\":{\"v\":24.7},\"p\":{\"v\":1021.5},\"pm10\":{\"v\":42},\"pm25\":{\"v\":78}," \
+  "\"so2\":{\"v\":2.6},\"t\":{\"v\":11.5},\"w\":{\"v\":1.5}}," \
+  "\"time\":{\"s\":\"2019-11-20 15:00:00\",\"tz\":\"+09:00\",\"v\":1574262000}," \
+  "\"forecast\":{\"daily\":{\"o3\":[{\"avg\":9,\"day\":\"2019-11-20\",\"max\":19,\"min\":1}]}}," \
+  "\"debug\":{\"sync\":\"2019-11-20T15:26:40+09:00\"}}}"
+
+static GairqAirObject *
+deserialize (const gchar          *payload,
+             GairqAirObjectFlags   flags,
+             GError              **error)
+{
+  g_autoptr(GBytes) bytes = NULL;
+
+  bytes = g_bytes_new_static (payload, strlen (payload));
+
+  return gairq_request_deserialize_bytes (bytes, flags, error);
+}
+
+static void
+test_gairq_payload_zero_copy (void)
+{
+  g_autoptr(GairqAirObject) heap = NULL;
+  g_autoptr(GairqAirObject) view = NULL;
+  g_autoptr(GError) error = NULL;
+  GSList *la, *lb;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  heap = deserialize (PAYLOAD, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+  g_assert_no_error (error);
+  view = deserialize (PAYLOAD, GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpint (gairq_air_object_get_idx (view), ==, 1132);
+  g_assert_cmpint (gairq_air_object_get_aqi (view), ==, 78);
+
+  la = gairq_air_object_get_attributions (heap);
+  lb = gairq_air_object_get_attributions (view);
+  g_assert_cmpuint (g_slist_length (lb), ==, 12);
+  for ( ; la && lb; la = la->next, lb = lb->next)
+    {
+      GairqObjectAttr *attr_a = la->data, *attr_b = lb->data;
+
+      g_assert_cmpstr (attr_a->name, ==, attr_b->name);
+      g_assert_cmpstr (attr_a->url, ==, attr_b->url);
+    }
+  g_assert_null (la);
+  g_assert_null (lb);
+
+  g_assert_cmpstr (gairq_air_object_get_city (view)->name, ==, "Seoul (서울)");
+  g_assert_cmpstr (gairq_air_object_get_city (view)->url, ==, "https://aqicn.org/city/seoul");
+  g_assert_cmpfloat (gairq_air_object_get_city (view)->geo.latitude, ==, 37.5665);
+  g_assert_cmpfloat (gairq_air_object_get_city (view)->geo.longitude, ==, 126.978);
+
+  g_assert_cmpuint (g_hash_table_size (gairq_air_object_get_iaqi (view)), ==, 10);
+  g_hash_table_iter_init (&iter, gairq_air_object_get_iaqi (heap));
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      gdouble *other = g_hash_table_lookup (gairq_air_object_get_iaqi (view), key);
+
+      g_assert_nonnull (other);
+      g_assert_cmpfloat (*(gdouble *) value, ==, *other);
+    }
+}
+
+static void
+test_gairq_payload_error (void)
+{
+  const gchar *payload = "{\"status\":\"error\",\"data\":\"Unknown station\"}";
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_NONE,
+    GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+  };
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      g_autoptr(GError) error = NULL;
+      GairqAirObject *air;
+
+      air = deserialize (payload, modes [i], &error);
+      g_assert_null (air);
+      g_assert_error (error, g_quark_from_static_string ("gairq-request-error-quark"), 0);
+      g_assert_cmpstr (error->message, ==, "Error-Response: Unknown station");
+    }
+}
+
+static void
+test_gairq_payload_malformed (void)
+{
+  gsize length = strlen (PAYLOAD);
+  gsize i;
+
+  /* Every truncation of a valid payload has to fail cleanly */
+  for (i = 0; i < length; i++)
+    {
+      g_autoptr(GError) error = NULL;
+      g_autofree gchar *prefix = g_strndup (PAYLOAD, i);
+      GairqAirObject *air;
+
+      air = deserialize (prefix, GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY, &error);
+      g_assert_null (air);
+      g_assert_nonnull (error);
+    }
+}
+
+static void
+test_gairq_payload_memory (void)
+{
+#ifdef __GLIBC__
+  GairqAirObjectFlags modes [] = {
+    GAIRQ_AIR_OBJECT_FLAGS_NONE,
+    GAIRQ_AIR_OBJECT_FLAGS_ZERO_COPY,
+  };
+  gsize bytes [G_N_ELEMENTS (modes)];
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS (modes); i++)
+    {
+      TestAllocCount count;
+      GairqAirObject *air;
+
+      g_object_unref (deserialize (PAYLOAD, modes [i], NULL));
+
+      test_alloc_count_begin ();
+      air = deserialize (PAYLOAD, modes [i], NULL);
+      test_alloc_count_end (&count);
+      bytes [i] = count.n_bytes;
+
+      g_assert_nonnull (air);
+      g_object_unref (air);
+
+      g_test_message ("flags %u: %" G_GSIZE_FORMAT " bytes allocated for a %"
+                      G_GSIZE_FORMAT " bytes payload",
+                      modes [i], bytes [i], strlen (PAYLOAD));
+    }
+
+  g_assert_cmpuint (bytes [1] * 2, <, bytes [0]);
+#else
+  g_test_skip ("Counting allocations needs glibc");
+#endif
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/payload/zero-copy",
+                   test_gairq_payload_zero_copy);
+
+  g_test_add_func ("/Gairq/payload/error",
+                   test_gairq_payload_error);
+
+  g_test_add_func ("/Gairq/payload/malformed",
+                   test_gairq_payload_malformed);
+
+  g_test_add_func ("/Gairq/payload/memory",
+                   test_gairq_payload_memory);
+
+  return g_test_run ();
+}
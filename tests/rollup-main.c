@@ -0,0 +1,487 @@
+/* rollup-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <math.h>
+#include <stdlib.h>
+
+#define START_TIME        G_GINT64_CONSTANT (1546300800)   /* 2019-01-01 UTC */
+#define HOUR              3600
+#define DAY               (24 * HOUR)
+#define N_YEAR_SAMPLES    (365 * 24)
+#define N_STATIONS        40
+#define ACCURACY          0.01
+
+typedef struct
+{
+  gint64    idx;
+  gint64    time;
+  gdouble   value;
+} Reading;
+
+static gint
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  gdouble x = *(const gdouble *) a, y = *(const gdouble *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+static gint64
+floor_to (gint64 time,
+          gint64 unit)
+{
+  return time >= 0 ? time / unit * unit : -((-time + unit - 1) / unit) * unit;
+}
+
+static void
+assert_quantiles (GairqSketch *sketch,
+                  GArray      *values)
+{
+  guint i;
+
+  g_assert_cmpuint (gairq_sketch_get_count (sketch), ==, values->len);
+  if (values->len == 0)
+    {
+      g_assert_true (isnan (gairq_sketch_quantile (sketch, 0.5)));
+      return;
+    }
+
+  g_array_sort (values, compare_doubles);
+
+  for (i = 0; i <= 20; i++)
+    {
+      gdouble q = i / 20.0;
+      gdouble exact = g_array_index (values, gdouble, (guint) floor (q * (values->len - 1)));
+
+      g_assert_cmpfloat (fabs (gairq_sketch_quantile (sketch, q) - exact), <=, ACCURACY * exact + 1e-12);
+    }
+}
+
+static void
+test_gairq_rollup_sketch (void)
+{
+  g_autoptr(GairqSketch) sketch = NULL;
+  g_autoptr(GairqSketch) low = NULL;
+  g_autoptr(GairqSketch) high = NULL;
+  g_autoptr(GArray) values = NULL;
+  guint i;
+
+  sketch = gairq_sketch_new (ACCURACY);
+  g_assert_true (isnan (gairq_sketch_quantile (sketch, 0.95)));
+
+  low = gairq_sketch_new (ACCURACY);
+  high = gairq_sketch_new (ACCURACY);
+  values = g_array_new (FALSE, FALSE, sizeof (gdouble));
+
+  /* Long tailed like particle readings, some zeros and junk below */
+  for (i = 0; i < 20000; i++)
+    {
+      gdouble value = exp (g_test_rand_double_range (-2, 7));
+
+      if (i % 97 == 0)
+        value = i % 2 ? 0 : -3;
+
+      gairq_sketch_add (i % 2 ? low : high, value);
+      gairq_sketch_add (sketch, value);
+      value = MAX (value, 0);
+      g_array_append_val (values, value);
+    }
+  gairq_sketch_add (sketch, NAN);
+
+  assert_quantiles (sketch, values);
+  g_assert_cmpfloat (gairq_sketch_quantile (sketch, 0), ==, 0);
+
+  /* Merging halves gives back the whole, bin for bin */
+  gairq_sketch_merge (low, high);
+  for (i = 0; i <= 100; i++)
+    g_assert_cmpfloat (gairq_sketch_quantile (low, i / 100.0), ==,
+                       gairq_sketch_quantile (sketch, i / 100.0));
+
+  /* A few hundred bins cover AQI values whatever their number */
+  g_assert_cmpuint (gairq_sketch_get_size (sketch), <, 4096);
+}
+
+static void
+test_gairq_rollup_buckets (void)
+{
+  g_autoptr(GairqRollup) rollup = NULL;
+  g_autoptr(GArray) buckets = NULL;
+  GairqRollupBucket *bucket;
+  guint i;
+
+  rollup = gairq_rollup_new (ACCURACY);
+
+  /* January and February 2019, hourly, the value being the hour of the day */
+  for (i = 0; i < 59 * 24; i++)
+    gairq_rollup_push (rollup, 1, GAIRQ_POLLUTANT_PM25, START_TIME + i * HOUR + 600, i % 24);
+  gairq_rollup_push (rollup, 1, GAIRQ_POLLUTANT_PM25, START_TIME + 1000, NAN);
+
+  buckets = gairq_rollup_query (rollup, 1, GAIRQ_POLLUTANT_PM25, GAIRQ_ROLLUP_MONTH,
+                                G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (buckets->len, ==, 2);
+  bucket = &g_array_index (buckets, GairqRollupBucket, 1);
+  g_assert_cmpint (bucket->start, ==, START_TIME + 31 * DAY);
+  g_assert_cmpuint (bucket->count, ==, 28 * 24);
+  g_assert_cmpfloat (bucket->min, ==, 0);
+  g_assert_cmpfloat (bucket->max, ==, 23);
+  g_assert_cmpfloat (bucket->sum, ==, 28 * 276);
+  g_clear_pointer (&buckets, g_array_unref);
+
+  buckets = gairq_rollup_query (rollup, 1, GAIRQ_POLLUTANT_PM25, GAIRQ_ROLLUP_DAY,
+                                START_TIME + 30 * DAY, START_TIME + 32 * DAY);
+  g_assert_cmpuint (buckets->len, ==, 2);
+  g_assert_cmpint (g_array_index (buckets, GairqRollupBucket, 0).start, ==, START_TIME + 30 * DAY);
+  g_assert_cmpuint (g_array_index (buckets, GairqRollupBucket, 1).count, ==, 24);
+  g_clear_pointer (&buckets, g_array_unref);
+
+  buckets = gairq_rollup_query (rollup, 1, GAIRQ_POLLUTANT_PM25, GAIRQ_ROLLUP_HOUR,
+                                START_TIME + 50 * DAY + 5 * HOUR, START_TIME + 50 * DAY + 8 * HOUR);
+  g_assert_cmpuint (buckets->len, ==, 3);
+  g_assert_cmpfloat (g_array_index (buckets, GairqRollupBucket, 2).sum, ==, 7);
+  g_clear_pointer (&buckets, g_array_unref);
+
+  /* Hours are only kept for a month behind the latest one */
+  buckets = gairq_rollup_query (rollup, 1, GAIRQ_POLLUTANT_PM25, GAIRQ_ROLLUP_HOUR,
+                                G_MININT64, START_TIME + 59 * DAY - 31 * DAY);
+  g_assert_cmpuint (buckets->len, <, 59 * 24 - 31 * 24);
+  g_clear_pointer (&buckets, g_array_unref);
+
+  /* A reading from before lands in a bucket of its own, in order */
+  gairq_rollup_push (rollup, 1, GAIRQ_POLLUTANT_PM25, START_TIME - 10 * DAY, 99);
+  buckets = gairq_rollup_query (rollup, 1, GAIRQ_POLLUTANT_PM25, GAIRQ_ROLLUP_MONTH,
+                                G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (buckets->len, ==, 3);
+  g_assert_cmpint (g_array_index (buckets, GairqRollupBucket, 0).start, ==, START_TIME - 31 * DAY);
+  g_assert_cmpfloat (g_array_index (buckets, GairqRollupBucket, 0).max, ==, 99);
+  g_clear_pointer (&buckets, g_array_unref);
+
+  buckets = gairq_rollup_query (rollup, 2, GAIRQ_POLLUTANT_PM25, GAIRQ_ROLLUP_DAY,
+                                G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (buckets->len, ==, 0);
+}
+
+/* Aggregates and sketches over random ranges against a plain scan of
+ * the readings, across enough stations to be split into parts. With a
+ * single worker and one job queued, the caller has to take the rest.
+ */
+static void
+test_gairq_rollup_ranges (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqRollup) rollup = NULL;
+  g_autoptr(GArray) readings = NULL;
+  gint64 stations [N_STATIONS];
+  guint i, round;
+
+  executor = gairq_executor_new (1, 1, 1);
+  rollup = gairq_rollup_new (ACCURACY);
+  gairq_rollup_set_executor (rollup, executor);
+  readings = g_array_new (FALSE, FALSE, sizeof (Reading));
+
+  /* The readings span more than the default retention */
+  gairq_rollup_set_retention (rollup, GAIRQ_ROLLUP_HOUR, 0);
+  gairq_rollup_set_retention (rollup, GAIRQ_ROLLUP_DAY, 0);
+
+  for (i = 0; i < N_STATIONS; i++)
+    stations [i] = 100 + i;
+
+  for (i = 0; i < 50000; i++)
+    {
+      Reading reading;
+
+      reading.idx = stations [g_test_rand_int_range (0, N_STATIONS)];
+      reading.time = START_TIME + g_test_rand_int_range (-30 * DAY / 60, 420 * DAY / 60) * (gint64) 60;
+      reading.value = exp (g_test_rand_double_range (0, 6));
+      gairq_rollup_push (rollup, reading.idx, GAIRQ_POLLUTANT_PM10, reading.time, reading.value);
+      g_array_append_val (readings, reading);
+    }
+
+  for (round = 0; round < 60; round++)
+    {
+      g_autoptr(GairqSketch) sketch = NULL;
+      g_autoptr(GArray) values = NULL;
+      GairqRollupBucket bucket, expected = { 0, NAN, NAN, 0, 0 };
+      guint first = g_test_rand_int_range (0, N_STATIONS);
+      guint n_idx = round % 2 ? N_STATIONS - first : 1;
+      gint64 from, to, span;
+
+      span = round % 3 ? 400 * DAY : 3 * DAY;
+      from = START_TIME + g_test_rand_int_range (-40 * DAY / 60, 430 * DAY / 60) * (gint64) 60;
+      to = from + g_test_rand_int_range (0, span / 60) * (gint64) 60;
+
+      /* Whole hours for the aggregate */
+      for (i = 0; i < readings->len; i++)
+        {
+          Reading *reading = &g_array_index (readings, Reading, i);
+
+          if (reading->idx < stations [first] || reading->idx >= stations [first] + n_idx ||
+              reading->time < floor_to (from, HOUR) || reading->time >= -floor_to (-to, HOUR))
+            continue;
+
+          expected.min = expected.count ? MIN (expected.min, reading->value) : reading->value;
+          expected.max = expected.count ? MAX (expected.max, reading->value) : reading->value;
+          expected.sum += reading->value;
+          expected.count++;
+        }
+
+      g_assert_cmpint (gairq_rollup_aggregate (rollup, stations + first, n_idx, GAIRQ_POLLUTANT_PM10,
+                                               from, to, &bucket), ==, expected.count > 0);
+      g_assert_cmpuint (bucket.count, ==, expected.count);
+      g_assert_cmpfloat_with_epsilon (bucket.sum, expected.sum, 1e-9 * MAX (1, expected.sum));
+      if (expected.count)
+        {
+          g_assert_cmpfloat (bucket.min, ==, expected.min);
+          g_assert_cmpfloat (bucket.max, ==, expected.max);
+        }
+
+      /* Whole days for the sketch */
+      values = g_array_new (FALSE, FALSE, sizeof (gdouble));
+      for (i = 0; i < readings->len; i++)
+        {
+          Reading *reading = &g_array_index (readings, Reading, i);
+
+          if (reading->idx >= stations [first] && reading->idx < stations [first] + n_idx &&
+              reading->time >= floor_to (from, DAY) && reading->time < -floor_to (-to, DAY))
+            g_array_append_val (values, reading->value);
+        }
+
+      sketch = gairq_rollup_sketch (rollup, stations + first, n_idx, GAIRQ_POLLUTANT_PM10, from, to);
+      assert_quantiles (sketch, values);
+    }
+}
+
+static void
+test_gairq_rollup_year (void)
+{
+  g_autoptr(GairqRollup) rollup = NULL;
+  g_autoptr(GairqSketch) sketch = NULL;
+  GairqRollupStats before, after;
+  GairqRollupBucket bucket;
+  gint64 idx = 7;
+  guint i;
+
+  rollup = gairq_rollup_new (ACCURACY);
+  gairq_rollup_set_retention (rollup, GAIRQ_ROLLUP_HOUR, 0);
+  g_assert_cmpint (gairq_rollup_get_retention (rollup, GAIRQ_ROLLUP_HOUR), ==, 0);
+  g_assert_cmpint (gairq_rollup_get_retention (rollup, GAIRQ_ROLLUP_DAY), ==, 366 * DAY);
+  for (i = 0; i < N_YEAR_SAMPLES; i++)
+    gairq_rollup_push (rollup, idx, GAIRQ_POLLUTANT_O3, START_TIME + i * HOUR, i % 100);
+
+  gairq_rollup_get_stats (rollup, &before);
+  g_assert_cmpuint (before.n_series, ==, 1);
+  g_assert_cmpuint (before.n_buckets, ==, N_YEAR_SAMPLES + 365 + 12);
+
+  /* Twelve months, nothing finer */
+  g_assert_true (gairq_rollup_aggregate (rollup, &idx, 1, GAIRQ_POLLUTANT_O3,
+                                         START_TIME, START_TIME + 365 * DAY, &bucket));
+  g_assert_cmpuint (bucket.count, ==, N_YEAR_SAMPLES);
+  gairq_rollup_get_stats (rollup, &after);
+  g_assert_cmpuint (after.n_buckets_read - before.n_buckets_read, ==, 12);
+
+  /* Ragged ends only add the days and hours around the months */
+  before = after;
+  g_assert_true (gairq_rollup_aggregate (rollup, &idx, 1, GAIRQ_POLLUTANT_O3,
+                                         START_TIME + 10 * DAY + 5 * HOUR,
+                                         START_TIME + 350 * DAY + 20 * HOUR, &bucket));
+  g_assert_cmpuint (bucket.count, ==, 340 * 24 + 15);
+  gairq_rollup_get_stats (rollup, &after);
+  g_assert_cmpuint (after.n_buckets_read - before.n_buckets_read, <=, 10 + 19 + 2 * 31 + 24);
+
+  before = after;
+  sketch = gairq_rollup_sketch (rollup, &idx, 1, GAIRQ_POLLUTANT_O3,
+                                START_TIME, START_TIME + 365 * DAY);
+  g_assert_cmpuint (gairq_sketch_get_count (sketch), ==, N_YEAR_SAMPLES);
+  /* The last cycle of 0..99 stops at 59, which puts rank 8321 on 94 */
+  g_assert_cmpfloat_with_epsilon (gairq_sketch_quantile (sketch, 0.95), 94, 94 * ACCURACY);
+  gairq_rollup_get_stats (rollup, &after);
+  g_assert_cmpuint (after.n_buckets_read - before.n_buckets_read, ==, 12);
+}
+
+static void
+test_gairq_rollup_store (void)
+{
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GairqRollup) rollup = NULL;
+  g_autoptr(GArray) months = NULL;
+  g_autoptr(GArray) hours = NULL;
+  g_autofree gchar *dir = NULL;
+  g_autofree gchar *path = NULL;
+  GairqRollupStats before, after;
+  GairqRollupBucket bucket;
+  GError *error = NULL;
+  gint64 idx = 4143;
+  gdouble sum = 0, range_sum = 0;
+  guint i;
+
+  dir = g_dir_make_tmp ("gairq-rollup-XXXXXX", &error);
+  g_assert_no_error (error);
+  path = g_build_filename (dir, "readings.series", NULL);
+
+  store = gairq_series_store_new (path, &error);
+  g_assert_no_error (error);
+
+  for (i = 0; i < 24 * 90; i++)
+    {
+      gdouble value = 20 + i % 37 / 2.0;
+
+      g_assert_true (gairq_series_store_append (store, idx, GAIRQ_POLLUTANT_NO2,
+                                                START_TIME + i * HOUR, value, &error));
+      g_assert_no_error (error);
+      sum += value;
+      if (i >= 10 * 24 + 5 && i < 80 * 24 + 20)
+        range_sum += value;
+    }
+
+  rollup = gairq_rollup_new (ACCURACY);
+  g_assert_cmpuint (gairq_rollup_load (rollup, store, idx, GAIRQ_POLLUTANT_NO2), ==, 24 * 90);
+  g_assert_cmpuint (gairq_rollup_load (rollup, store, idx + 1, GAIRQ_POLLUTANT_NO2), ==, 0);
+
+  g_assert_true (gairq_rollup_aggregate (rollup, &idx, 1, GAIRQ_POLLUTANT_NO2,
+                                         G_MININT64, G_MAXINT64, &bucket));
+  g_assert_cmpuint (bucket.count, ==, 24 * 90);
+  g_assert_cmpfloat_with_epsilon (bucket.sum, sum, 1e-9 * sum);
+  g_assert_cmpfloat (bucket.min, ==, 20);
+  g_assert_cmpfloat (bucket.max, ==, 38);
+
+  months = gairq_rollup_query (rollup, idx, GAIRQ_POLLUTANT_NO2, GAIRQ_ROLLUP_MONTH,
+                               G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (months->len, ==, 3);
+  g_assert_cmpuint (g_array_index (months, GairqRollupBucket, 1).count, ==, 28 * 24);
+
+  /* Loading dropped the hours past a month behind the latest one */
+  hours = gairq_rollup_query (rollup, idx, GAIRQ_POLLUTANT_NO2, GAIRQ_ROLLUP_HOUR,
+                              G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (hours->len, >, 31 * 24);
+  g_assert_cmpuint (hours->len, <, 90 * 24 / 2);
+  gairq_rollup_get_stats (rollup, &before);
+  g_assert_cmpuint (before.n_buckets, ==, hours->len + 90 + 3);
+
+  /* The hours at the start of the range come from the store */
+  gairq_rollup_set_store (rollup, store);
+  g_assert_true (gairq_rollup_aggregate (rollup, &idx, 1, GAIRQ_POLLUTANT_NO2,
+                                         START_TIME + 10 * DAY + 5 * HOUR,
+                                         START_TIME + 80 * DAY + 20 * HOUR, &bucket));
+  g_assert_cmpuint (bucket.count, ==, 70 * 24 + 15);
+  g_assert_cmpfloat_with_epsilon (bucket.sum, range_sum, 1e-9 * range_sum);
+  gairq_rollup_get_stats (rollup, &after);
+  g_assert_cmpuint (after.n_samples_read - before.n_samples_read, ==, 19);
+
+  /* Without it, they are missing */
+  gairq_rollup_set_store (rollup, NULL);
+  g_assert_true (gairq_rollup_aggregate (rollup, &idx, 1, GAIRQ_POLLUTANT_NO2,
+                                         START_TIME + 10 * DAY + 5 * HOUR,
+                                         START_TIME + 80 * DAY + 20 * HOUR, &bucket));
+  g_assert_cmpuint (bucket.count, ==, 70 * 24 + 15 - 19);
+
+  g_clear_object (&store);
+  g_unlink (path);
+  g_rmdir (dir);
+}
+
+static void
+test_gairq_rollup_benchmark (void)
+{
+  g_autoptr(GairqRollup) rollup = NULL;
+  g_autofree gdouble *values = NULL;
+  gint64 stations [100];
+  GairqRollupBucket bucket;
+  gdouble elapsed, sum;
+  guint i, j, round;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  rollup = gairq_rollup_new (ACCURACY);
+  values = g_new (gdouble, N_YEAR_SAMPLES);
+  for (i = 0; i < N_YEAR_SAMPLES; i++)
+    values [i] = g_test_rand_double_range (0, 300);
+
+  g_test_timer_start ();
+  for (i = 0; i < G_N_ELEMENTS (stations); i++)
+    {
+      stations [i] = i + 1;
+      for (j = 0; j < N_YEAR_SAMPLES; j++)
+        gairq_rollup_push (rollup, stations [i], GAIRQ_POLLUTANT_PM25,
+                           START_TIME + j * HOUR, values [j]);
+    }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "push: %.1f Msamples/s",
+                           G_N_ELEMENTS (stations) * N_YEAR_SAMPLES / elapsed / 1e6);
+
+  /* What a report over raw readings would do */
+  g_test_timer_start ();
+  for (round = 0, sum = 0; round < 10; round++)
+    for (i = 0; i < G_N_ELEMENTS (stations); i++)
+      for (j = 0; j < N_YEAR_SAMPLES; j++)
+        sum += values [j];
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "raw year sum: %.0f queries/s (%g)", 10 / elapsed, sum);
+
+  g_test_timer_start ();
+  for (round = 0; round < 1000; round++)
+    gairq_rollup_aggregate (rollup, stations, G_N_ELEMENTS (stations), GAIRQ_POLLUTANT_PM25,
+                            START_TIME + 3 * HOUR, START_TIME + 364 * DAY, &bucket);
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "rollup year aggregate: %.0f queries/s", 1000 / elapsed);
+
+  g_test_timer_start ();
+  for (round = 0; round < 100; round++)
+    gairq_sketch_free (gairq_rollup_sketch (rollup, stations, G_N_ELEMENTS (stations),
+                                            GAIRQ_POLLUTANT_PM25, START_TIME, START_TIME + 365 * DAY));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "rollup year p95 sketch: %.0f queries/s", 100 / elapsed);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/rollup/sketch",
+                   test_gairq_rollup_sketch);
+
+  g_test_add_func ("/Gairq/rollup/buckets",
+                   test_gairq_rollup_buckets);
+
+  g_test_add_func ("/Gairq/rollup/ranges",
+                   test_gairq_rollup_ranges);
+
+  g_test_add_func ("/Gairq/rollup/year",
+                   test_gairq_rollup_year);
+
+  g_test_add_func ("/Gairq/rollup/store",
+                   test_gairq_rollup_store);
+
+  g_test_add_func ("/Gairq/rollup/benchmark",
+                   test_gairq_rollup_benchmark);
+
+  return g_test_run ();
+}
@@ -0,0 +1,307 @@
+/* scheduler-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <locale.h>
+
+/* Notes down which request fetched, by the first letter of its key */
+typedef struct
+{
+  GString *     str;
+  GMutex        lock;
+} Log;
+
+static void
+log_fetch (TestRequest *request,
+           gpointer     user_data)
+{
+  Log *log = user_data;
+
+  g_mutex_lock (&log->lock);
+  g_string_append_c (log->str, request->key [0]);
+  g_mutex_unlock (&log->lock);
+}
+
+typedef struct
+{
+  guint     n_done;
+  guint     n_failed;
+} Results;
+
+static void
+poll_done (GObject      *source_object,
+           GAsyncResult *res,
+           gpointer      user_data)
+{
+  Results *results = user_data;
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GError) error = NULL;
+
+  air = gairq_scheduler_poll_finish (GAIRQ_SCHEDULER (source_object), res, NULL, &error);
+  if (air)
+    g_assert_cmpint (gairq_air_object_get_idx (air), ==, 4143);
+  else
+    results->n_failed++;
+
+  results->n_done++;
+}
+
+static void
+wait_for_results (Results *results,
+                  guint    n_done)
+{
+  while (results->n_done < n_done)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+test_gairq_scheduler_weights (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqScheduler) scheduler = NULL;
+  g_autoptr(TestRequest) heavy = NULL;
+  g_autoptr(TestRequest) light = NULL;
+  GairqTenantStats stats;
+  Results results = { 0, };
+  Log log;
+  guint i, n_heavy = 0;
+
+  g_mutex_init (&log.lock);
+  log.str = g_string_new (NULL);
+
+  heavy = test_request_new (5);
+  light = test_request_new (5);
+  heavy->key = "heavy";
+  light->key = "light";
+  heavy->on_fetch = light->on_fetch = log_fetch;
+  heavy->on_fetch_data = light->on_fetch_data = &log;
+
+  /* One call at a time, so that the log is the schedule */
+  executor = gairq_executor_new (0, 4, 0);
+  scheduler = gairq_scheduler_new (executor, 1);
+  gairq_scheduler_set_tenant (scheduler, "heavy", 3, 0);
+  gairq_scheduler_set_tenant (scheduler, "light", 1, 0);
+
+  for (i = 0; i < 40; i++)
+    gairq_scheduler_poll_async (scheduler, "heavy", GAIRQ_REQUEST (heavy), NULL,
+                                poll_done, &results);
+  for (i = 0; i < 40; i++)
+    gairq_scheduler_poll_async (scheduler, "light", GAIRQ_REQUEST (light), NULL,
+                                poll_done, &results);
+
+  gairq_scheduler_get_tenant_stats (scheduler, "light", &stats);
+  g_assert_cmpuint (stats.weight, ==, 1);
+  g_assert_cmpuint (stats.n_submitted, ==, 40);
+  g_assert_cmpuint (stats.n_queued + stats.n_in_flight + stats.n_completed, ==, 40);
+
+  wait_for_results (&results, 80);
+  g_assert_cmpuint (results.n_failed, ==, 0);
+  g_assert_cmpuint (log.str->len, ==, 80);
+
+  /* Three to one while both have calls waiting, whoever asked first */
+  g_assert_true (g_str_has_prefix (log.str->str, "hhhlhhhlhhhl"));
+  for (i = 0; i < 40; i++)
+    n_heavy += log.str->str [i] == 'h';
+  g_assert_cmpuint (n_heavy, ==, 30);
+
+  g_assert_cmpint (heavy->most_running, ==, 1);
+  g_assert_cmpint (light->most_running, ==, 1);
+
+  g_string_free (log.str, TRUE);
+  g_mutex_clear (&log.lock);
+}
+
+static void
+test_gairq_scheduler_caps (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqScheduler) scheduler = NULL;
+  g_autoptr(TestRequest) capped = NULL;
+  g_autoptr(TestRequest) free_running = NULL;
+  Results results = { 0, };
+  guint i;
+
+  capped = test_request_new (20);
+  free_running = test_request_new (20);
+
+  executor = gairq_executor_new (0, 8, 0);
+  scheduler = gairq_scheduler_new (executor, 6);
+  g_assert_true (gairq_scheduler_get_executor (scheduler) == executor);
+  g_assert_cmpuint (gairq_scheduler_get_max_in_flight (scheduler), ==, 6);
+
+  gairq_scheduler_set_tenant (scheduler, "capped", 10, 2);
+
+  /* However much it weighs, it never has more than two going */
+  for (i = 0; i < 8; i++)
+    gairq_scheduler_poll_async (scheduler, "capped", GAIRQ_REQUEST (capped), NULL,
+                                poll_done, &results);
+  for (i = 0; i < 8; i++)
+    gairq_scheduler_poll_async (scheduler, "free", GAIRQ_REQUEST (free_running), NULL,
+                                poll_done, &results);
+
+  wait_for_results (&results, 16);
+  g_assert_cmpuint (results.n_failed, ==, 0);
+
+  g_assert_cmpint (capped->most_running, ==, 2);
+  g_assert_cmpint (free_running->most_running, >, 2);
+  g_assert_cmpint (free_running->most_running, <=, 6);
+}
+
+static void
+test_gairq_scheduler_stats (void)
+{
+  g_autoptr(GairqScheduler) scheduler = NULL;
+  g_autoptr(TestRequest) good = NULL;
+  g_autoptr(TestRequest) bad = NULL;
+  GairqTenantStats stats;
+  Results results = { 0, };
+  guint i;
+
+  good = test_request_new (5);
+  bad = test_request_new (0);
+  bad->fail = TRUE;
+
+  scheduler = gairq_scheduler_new (NULL, 2);
+  g_assert_true (gairq_scheduler_get_executor (scheduler) == gairq_executor_get_default ());
+  g_assert_false (gairq_scheduler_get_tenant_stats (scheduler, "good", &stats));
+
+  for (i = 0; i < 10; i++)
+    gairq_scheduler_poll_async (scheduler, "good", GAIRQ_REQUEST (good), NULL,
+                                poll_done, &results);
+  gairq_scheduler_poll_async (scheduler, "bad", GAIRQ_REQUEST (bad), NULL,
+                              poll_done, &results);
+  wait_for_results (&results, 11);
+  g_assert_cmpuint (results.n_failed, ==, 1);
+
+  /* Tenants first seen in a call get the defaults */
+  g_assert_true (gairq_scheduler_get_tenant_stats (scheduler, "good", &stats));
+  g_assert_cmpuint (stats.weight, ==, 1);
+  g_assert_cmpuint (stats.max_in_flight, ==, 0);
+  g_assert_cmpuint (stats.n_queued, ==, 0);
+  g_assert_cmpuint (stats.n_in_flight, ==, 0);
+  g_assert_cmpuint (stats.n_submitted, ==, 10);
+  g_assert_cmpuint (stats.n_completed, ==, 10);
+  g_assert_cmpuint (stats.n_failed, ==, 0);
+  g_assert_cmpint (stats.max_wait, >=, 5 * G_TIME_SPAN_MILLISECOND);
+  g_assert_cmpint (stats.wait_time, >=, stats.max_wait);
+  g_assert_cmpfloat (stats.throughput, >, 0.0);
+
+  g_assert_true (gairq_scheduler_get_tenant_stats (scheduler, "bad", &stats));
+  g_assert_cmpuint (stats.n_completed, ==, 1);
+  g_assert_cmpuint (stats.n_failed, ==, 1);
+}
+
+static void
+test_gairq_scheduler_busy (void)
+{
+  g_autoptr(GairqExecutor) executor = NULL;
+  g_autoptr(GairqScheduler) scheduler = NULL;
+  g_autoptr(TestRequest) request = NULL;
+  GairqExecutorStats executor_stats;
+  GairqTenantStats stats;
+  Results results = { 0, };
+  guint i;
+
+  /* Room for one running and one waiting, the rest is turned away */
+  executor = gairq_executor_new (1, 1, 1);
+  scheduler = gairq_scheduler_new (executor, 4);
+  request = test_request_new (20);
+
+  for (i = 0; i < 8; i++)
+    gairq_scheduler_poll_async (scheduler, "busy", GAIRQ_REQUEST (request), NULL,
+                                poll_done, &results);
+  wait_for_results (&results, 8);
+
+  /* Those wait for a slot rather than fail */
+  gairq_executor_get_stats (executor, &executor_stats);
+  g_assert_cmpuint (executor_stats.n_rejected, >, 0);
+  g_assert_cmpuint (results.n_failed, ==, 0);
+
+  gairq_scheduler_get_tenant_stats (scheduler, "busy", &stats);
+  g_assert_cmpuint (stats.n_completed, ==, 8);
+  g_assert_cmpuint (stats.n_failed, ==, 0);
+}
+
+static void
+test_gairq_scheduler_cancel (void)
+{
+  g_autoptr(GairqScheduler) scheduler = NULL;
+  g_autoptr(TestRequest) request = NULL;
+  g_autoptr(GCancellable) cancellable = NULL;
+  GairqTenantStats stats;
+  Results running = { 0, };
+  Results waiting = { 0, };
+
+  scheduler = gairq_scheduler_new (NULL, 1);
+  request = test_request_new (500);
+  cancellable = g_cancellable_new ();
+
+  gairq_scheduler_poll_async (scheduler, "cancel", GAIRQ_REQUEST (request), NULL,
+                              poll_done, &running);
+  gairq_scheduler_poll_async (scheduler, "cancel", GAIRQ_REQUEST (request), cancellable,
+                              poll_done, &waiting);
+
+  /* Done with, without waiting for the call ahead of it */
+  g_cancellable_cancel (cancellable);
+  wait_for_results (&waiting, 1);
+  g_assert_cmpuint (waiting.n_failed, ==, 1);
+  g_assert_cmpuint (running.n_done, ==, 0);
+
+  gairq_scheduler_get_tenant_stats (scheduler, "cancel", &stats);
+  g_assert_cmpuint (stats.n_queued, ==, 0);
+  g_assert_cmpuint (stats.n_in_flight, ==, 1);
+
+  wait_for_results (&running, 1);
+  g_assert_cmpuint (running.n_failed, ==, 0);
+  g_assert_cmpint (request->n_fetches, ==, 1);
+
+  /* Cancelled before it is even asked for */
+  gairq_scheduler_poll_async (scheduler, "cancel", GAIRQ_REQUEST (request), cancellable,
+                              poll_done, &waiting);
+  wait_for_results (&waiting, 2);
+  g_assert_cmpuint (waiting.n_failed, ==, 2);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/scheduler/weights",
+                   test_gairq_scheduler_weights);
+
+  g_test_add_func ("/Gairq/scheduler/caps",
+                   test_gairq_scheduler_caps);
+
+  g_test_add_func ("/Gairq/scheduler/stats",
+                   test_gairq_scheduler_stats);
+
+  g_test_add_func ("/Gairq/scheduler/busy",
+                   test_gairq_scheduler_busy);
+
+  g_test_add_func ("/Gairq/scheduler/cancel",
+                   test_gairq_scheduler_cancel);
+
+  return g_test_run ();
+}
@@ -0,0 +1,516 @@
+/* series-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <glib/gstdio.h>
+#include <locale.h>
+#include <math.h>
+#include <string.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"no2\":{\"v\":21.4},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33}}," \
+  "\"time\":{\"s\":\"2019-11-20 18:00:00\",\"tz\":\"+03:00\",\"v\":1574272800}}}"
+
+/* As laid out by the store */
+#define BLOCK_SIZE        512
+#define BLOCK_HEADER_SIZE 64
+
+#define START_TIME        G_GINT64_CONSTANT (1546300800)
+#define HOUR              3600
+#define N_YEAR_SAMPLES    (365 * 24)
+
+static gchar *
+make_store_path (void)
+{
+  GError *error = NULL;
+  gchar *dir;
+  gchar *path;
+
+  dir = g_dir_make_tmp ("gairq-series-XXXXXX", &error);
+  g_assert_no_error (error);
+
+  path = g_build_filename (dir, "readings.series", NULL);
+  g_free (dir);
+
+  return path;
+}
+
+static void
+remove_store_path (const gchar *path)
+{
+  gchar *dir = g_path_get_dirname (path);
+
+  g_unlink (path);
+  g_rmdir (dir);
+  g_free (dir);
+}
+
+static GairqSeriesStore *
+open_store (const gchar *path)
+{
+  GairqSeriesStore *store;
+  GError *error = NULL;
+
+  store = gairq_series_store_new (path, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (store);
+
+  return store;
+}
+
+/* Hourly readings wandering about, with the odd hour missed. Values
+ * have @decimals digits after the point, like stations report them.
+ */
+static GArray *
+append_walk (GairqSeriesStore *store,
+             gint64            idx,
+             GairqPollutant    pollutant,
+             gint64            start,
+             guint             n_samples,
+             guint             decimals)
+{
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (GairqSeriesSample));
+  GairqSeriesSample sample = { start, 40 };
+  GError *error = NULL;
+  gdouble scale = pow (10, decimals);
+  gint64 level = 40 * scale;
+  guint i;
+
+  for (i = 0; i < n_samples; i++)
+    {
+      sample.value = level / scale;
+      g_assert_true (gairq_series_store_append (store, idx, pollutant,
+                                                sample.time, sample.value, &error));
+      g_assert_no_error (error);
+      g_array_append_val (samples, sample);
+
+      level = MAX (0, level + g_test_rand_int_range (-3 * (gint32) scale, 3 * (gint32) scale + 1));
+      sample.time += g_test_rand_int_range (0, 40) == 0 ? 2 * HOUR : HOUR;
+    }
+
+  return samples;
+}
+
+static void
+assert_samples_equal (GArray            *samples,
+                      GairqSeriesSample *expected,
+                      guint              n_expected)
+{
+  guint i;
+
+  g_assert_cmpuint (samples->len, ==, n_expected);
+  for (i = 0; i < n_expected; i++)
+    {
+      GairqSeriesSample *sample = &g_array_index (samples, GairqSeriesSample, i);
+
+      g_assert_cmpint (sample->time, ==, expected [i].time);
+      g_assert_cmpfloat (sample->value, ==, expected [i].value);
+    }
+}
+
+static void
+assert_query (GairqSeriesStore *store,
+              gint64            idx,
+              GairqPollutant    pollutant,
+              GArray           *expected)
+{
+  g_autoptr(GArray) samples = NULL;
+
+  samples = gairq_series_store_query (store, idx, pollutant, G_MININT64, G_MAXINT64);
+  assert_samples_equal (samples, (GairqSeriesSample *) expected->data, expected->len);
+}
+
+/* Stands in for a crash or a bad sector */
+static void
+mangle_file (const gchar *path,
+             gsize        offset,
+             gsize        truncate_by)
+{
+  g_autofree gchar *contents = NULL;
+  GError *error = NULL;
+  gsize length;
+
+  g_file_get_contents (path, &contents, &length, &error);
+  g_assert_no_error (error);
+
+  g_assert_cmpuint (offset, <, length);
+  contents [offset] ^= 0x5a;
+
+  g_file_set_contents (path, contents, length - truncate_by, &error);
+  g_assert_no_error (error);
+}
+
+static void
+test_gairq_series_roundtrip (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GArray) pm25 = NULL;
+  g_autoptr(GArray) no2 = NULL;
+  g_autoptr(GArray) co = NULL;
+  g_autoptr(GArray) samples = NULL;
+  GairqSeriesStoreStats stats;
+  GairqSeriesSample *day;
+  guint64 decoded;
+
+  store = open_store (path);
+
+  pm25 = append_walk (store, 4143, GAIRQ_POLLUTANT_PM25, START_TIME, 3000, 0);
+  no2 = append_walk (store, 4143, GAIRQ_POLLUTANT_NO2, START_TIME, 3000, 1);
+  co = append_walk (store, 1451, GAIRQ_POLLUTANT_CO, START_TIME, 3000, 2);
+
+  assert_query (store, 4143, GAIRQ_POLLUTANT_PM25, pm25);
+  assert_query (store, 4143, GAIRQ_POLLUTANT_NO2, no2);
+  assert_query (store, 1451, GAIRQ_POLLUTANT_CO, co);
+
+  /* Nothing under another key */
+  samples = gairq_series_store_query (store, 1451, GAIRQ_POLLUTANT_PM25, G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (samples->len, ==, 0);
+  g_clear_pointer (&samples, g_array_unref);
+
+  gairq_series_store_get_stats (store, &stats);
+  g_assert_cmpuint (stats.n_series, ==, 3);
+  g_assert_cmpuint (stats.n_samples, ==, 9000);
+  g_assert_cmpuint (stats.n_blocks, >, 6);
+
+  /* A day out of the middle only decodes the block or two it is in */
+  day = &g_array_index (pm25, GairqSeriesSample, 1500);
+  decoded = stats.n_blocks_decoded;
+  samples = gairq_series_store_query (store, 4143, GAIRQ_POLLUTANT_PM25,
+                                      day [0].time, day [24].time);
+  assert_samples_equal (samples, day, 24);
+
+  gairq_series_store_get_stats (store, &stats);
+  g_assert_cmpuint (stats.n_blocks_decoded - decoded, >=, 1);
+  g_assert_cmpuint (stats.n_blocks_decoded - decoded, <=, 2);
+
+  /* Bounds fall between samples too */
+  g_clear_pointer (&samples, g_array_unref);
+  samples = gairq_series_store_query (store, 4143, GAIRQ_POLLUTANT_PM25,
+                                      day [0].time - 1, day [24].time - 1);
+  assert_samples_equal (samples, day, 24);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+static void
+test_gairq_series_order (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GArray) samples = NULL;
+  GairqSeriesSample latest;
+  GError *error = NULL;
+
+  store = open_store (path);
+
+  g_assert_false (gairq_series_store_get_latest (store, 1, GAIRQ_POLLUTANT_O3, &latest));
+
+  g_assert_true (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, START_TIME, 12, &error));
+  g_assert_no_error (error);
+
+  g_assert_false (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, START_TIME, 13, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+  g_clear_error (&error);
+
+  g_assert_false (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, START_TIME - HOUR, 13, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT);
+  g_clear_error (&error);
+
+  /* Series are ordered on their own */
+  g_assert_true (gairq_series_store_append (store, 2, GAIRQ_POLLUTANT_O3, START_TIME - HOUR, 7, &error));
+  g_assert_true (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_SO2, START_TIME - HOUR, 3, &error));
+
+  /* Values that are no short decimal, and timestamps far apart */
+  g_assert_true (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, START_TIME + 1, NAN, &error));
+  g_assert_true (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, START_TIME + 2, G_PI, &error));
+  g_assert_true (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, START_TIME + 3, -0.0, &error));
+  g_assert_true (gairq_series_store_append (store, 1, GAIRQ_POLLUTANT_O3, G_GINT64_CONSTANT (1) << 40, 1e300, &error));
+  g_assert_no_error (error);
+
+  g_assert_true (gairq_series_store_get_latest (store, 1, GAIRQ_POLLUTANT_O3, &latest));
+  g_assert_cmpint (latest.time, ==, G_GINT64_CONSTANT (1) << 40);
+  g_assert_cmpfloat (latest.value, ==, 1e300);
+
+  samples = gairq_series_store_query (store, 1, GAIRQ_POLLUTANT_O3, G_MININT64, G_MAXINT64);
+  g_assert_cmpuint (samples->len, ==, 5);
+  g_assert_cmpfloat (g_array_index (samples, GairqSeriesSample, 0).value, ==, 12);
+  g_assert_true (isnan (g_array_index (samples, GairqSeriesSample, 1).value));
+  g_assert_cmpfloat (g_array_index (samples, GairqSeriesSample, 2).value, ==, G_PI);
+  g_assert_true (signbit (g_array_index (samples, GairqSeriesSample, 3).value));
+  g_assert_cmpint (g_array_index (samples, GairqSeriesSample, 4).time, ==, G_GINT64_CONSTANT (1) << 40);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+static void
+test_gairq_series_reopen (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GArray) pm25 = NULL;
+  g_autoptr(GArray) more = NULL;
+  GairqSeriesStoreStats before, after;
+  GairqSeriesSample latest;
+  GError *error = NULL;
+
+  /* Few enough to leave the one block with room */
+  store = open_store (path);
+  pm25 = append_walk (store, 4143, GAIRQ_POLLUTANT_PM25, START_TIME, 100, 1);
+  g_assert_true (gairq_series_store_flush (store, &error));
+  g_assert_no_error (error);
+  gairq_series_store_get_stats (store, &before);
+  g_assert_cmpuint (before.n_blocks, ==, 1);
+  g_clear_object (&store);
+
+  store = open_store (path);
+  assert_query (store, 4143, GAIRQ_POLLUTANT_PM25, pm25);
+
+  gairq_series_store_get_stats (store, &after);
+  g_assert_cmpuint (after.n_samples, ==, before.n_samples);
+  g_assert_cmpuint (after.n_blocks, ==, before.n_blocks);
+  g_assert_cmpuint (after.size, ==, before.size);
+
+  g_assert_true (gairq_series_store_get_latest (store, 4143, GAIRQ_POLLUTANT_PM25, &latest));
+  g_assert_cmpint (latest.time, ==, g_array_index (pm25, GairqSeriesSample, pm25->len - 1).time);
+
+  /* The block is picked up again rather than a new one started */
+  g_assert_true (gairq_series_store_append (store, 4143, GAIRQ_POLLUTANT_PM25,
+                                            latest.time + HOUR, latest.value, &error));
+  g_assert_no_error (error);
+  g_array_append_vals (pm25, &(GairqSeriesSample) { latest.time + HOUR, latest.value }, 1);
+
+  gairq_series_store_get_stats (store, &after);
+  g_assert_cmpuint (after.n_blocks, ==, 1);
+  g_assert_cmpuint (after.size, ==, before.size);
+
+  /* Unflushed samples go out on finalize */
+  more = append_walk (store, 4143, GAIRQ_POLLUTANT_PM25, latest.time + 2 * HOUR, 2000, 1);
+  g_array_append_vals (pm25, more->data, more->len);
+  g_clear_object (&store);
+
+  store = open_store (path);
+  assert_query (store, 4143, GAIRQ_POLLUTANT_PM25, pm25);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+static void
+test_gairq_series_corrupt (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GArray) pm25 = NULL;
+  g_autoptr(GArray) samples = NULL;
+  g_autoptr(GArray) more = NULL;
+  GairqSeriesSample *tail;
+  GError *error = NULL;
+
+  store = open_store (path);
+  pm25 = append_walk (store, 4143, GAIRQ_POLLUTANT_PM25, START_TIME, 3000, 0);
+  g_clear_object (&store);
+
+  /* A bad byte in the first block, and the last one torn */
+  mangle_file (path, BLOCK_SIZE + BLOCK_HEADER_SIZE + 10, 100);
+
+  store = open_store (path);
+  samples = gairq_series_store_query (store, 4143, GAIRQ_POLLUTANT_PM25, G_MININT64, G_MAXINT64);
+
+  /* What is left is the blocks in between, untouched */
+  g_assert_cmpuint (samples->len, >, 0);
+  g_assert_cmpuint (samples->len, <, pm25->len);
+  tail = (GairqSeriesSample *) pm25->data;
+  while (tail->time != g_array_index (samples, GairqSeriesSample, 0).time)
+    tail++;
+  assert_samples_equal (samples, tail, samples->len);
+
+  /* And appending goes on past the damage */
+  more = append_walk (store, 4143, GAIRQ_POLLUTANT_PM25,
+                      g_array_index (pm25, GairqSeriesSample, pm25->len - 1).time + HOUR, 10, 0);
+  g_assert_true (gairq_series_store_flush (store, &error));
+  g_assert_no_error (error);
+  g_clear_object (&store);
+
+  store = open_store (path);
+  g_clear_pointer (&samples, g_array_unref);
+  samples = gairq_series_store_query (store, 4143, GAIRQ_POLLUTANT_PM25,
+                                      g_array_index (more, GairqSeriesSample, 0).time, G_MAXINT64);
+  assert_samples_equal (samples, (GairqSeriesSample *) more->data, more->len);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+static void
+test_gairq_series_air (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GBytes) payload = NULL;
+  GairqSeriesStoreStats stats;
+  GairqSeriesSample latest;
+  GError *error = NULL;
+
+  payload = g_bytes_new_static (PAYLOAD, strlen (PAYLOAD));
+  air = gairq_request_deserialize_bytes (payload, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+  g_assert_no_error (error);
+
+  store = open_store (path);
+  g_assert_true (gairq_series_store_append_air (store, air, &error));
+  g_assert_no_error (error);
+
+  gairq_series_store_get_stats (store, &stats);
+  g_assert_cmpuint (stats.n_series, ==, 4);
+  g_assert_cmpuint (stats.n_samples, ==, 4);
+
+  g_assert_true (gairq_series_store_get_latest (store, 4143, GAIRQ_POLLUTANT_NO2, &latest));
+  g_assert_cmpint (latest.time, ==, 1574272800);
+  g_assert_cmpfloat (latest.value, ==, 21.4);
+  g_assert_false (gairq_series_store_get_latest (store, 4143, GAIRQ_POLLUTANT_O3, &latest));
+
+  /* The same reading again is not a new sample */
+  g_assert_true (gairq_series_store_append_air (store, air, &error));
+  g_assert_no_error (error);
+  gairq_series_store_get_stats (store, &stats);
+  g_assert_cmpuint (stats.n_samples, ==, 4);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+static void
+test_gairq_series_footprint (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  GairqSeriesStoreStats stats;
+  GError *error = NULL;
+  gint64 idx;
+
+  store = open_store (path);
+
+  /* A year of a few stations, reporting whole and one decimal values */
+  for (idx = 1; idx <= 10; idx++)
+    {
+      g_array_unref (append_walk (store, idx, GAIRQ_POLLUTANT_PM25, START_TIME, N_YEAR_SAMPLES, 0));
+      g_array_unref (append_walk (store, idx, GAIRQ_POLLUTANT_NO2, START_TIME, N_YEAR_SAMPLES, 1));
+    }
+
+  g_assert_true (gairq_series_store_flush (store, &error));
+  g_assert_no_error (error);
+
+  gairq_series_store_get_stats (store, &stats);
+  g_test_message ("%" G_GUINT64_FORMAT " samples in %" G_GUINT64_FORMAT " bytes, %.2f bytes a sample",
+                  stats.n_samples, stats.size, (gdouble) stats.size / stats.n_samples);
+  g_assert_cmpfloat ((gdouble) stats.size / stats.n_samples, <, 2.0);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+static void
+test_gairq_series_benchmark (void)
+{
+  g_autofree gchar *path = make_store_path ();
+  g_autoptr(GairqSeriesStore) store = NULL;
+  GArray *samples;
+  gdouble elapsed;
+  gint64 idx;
+  guint round;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  store = open_store (path);
+
+  g_test_timer_start ();
+  for (idx = 1; idx <= 100; idx++)
+    g_array_unref (append_walk (store, idx, GAIRQ_POLLUTANT_PM25, START_TIME, N_YEAR_SAMPLES, 1));
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "append: %.1f Msamples/s",
+                           100 * N_YEAR_SAMPLES / elapsed / 1e6);
+
+  g_test_timer_start ();
+  for (round = 0; round < 100; round++)
+    {
+      samples = gairq_series_store_query (store, round + 1, GAIRQ_POLLUTANT_PM25, G_MININT64, G_MAXINT64);
+      g_assert_cmpuint (samples->len, ==, N_YEAR_SAMPLES);
+      g_array_unref (samples);
+    }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "year scan: %.1f Msamples/s",
+                           100 * N_YEAR_SAMPLES / elapsed / 1e6);
+
+  g_test_timer_start ();
+  for (round = 0; round < 10000; round++)
+    {
+      gint64 from = START_TIME + g_test_rand_int_range (0, 300) * 24 * HOUR;
+
+      samples = gairq_series_store_query (store, round % 100 + 1, GAIRQ_POLLUTANT_PM25,
+                                          from, from + 24 * HOUR);
+      g_array_unref (samples);
+    }
+  elapsed = g_test_timer_elapsed ();
+  g_test_minimized_result (elapsed, "day query: %.0f queries/s", 10000 / elapsed);
+
+  g_clear_object (&store);
+  remove_store_path (path);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/series/roundtrip",
+                   test_gairq_series_roundtrip);
+
+  g_test_add_func ("/Gairq/series/order",
+                   test_gairq_series_order);
+
+  g_test_add_func ("/Gairq/series/reopen",
+                   test_gairq_series_reopen);
+
+  g_test_add_func ("/Gairq/series/corrupt",
+                   test_gairq_series_corrupt);
+
+  g_test_add_func ("/Gairq/series/air",
+                   test_gairq_series_air);
+
+  g_test_add_func ("/Gairq/series/footprint",
+                   test_gairq_series_footprint);
+
+  g_test_add_func ("/Gairq/series/benchmark",
+                   test_gairq_series_benchmark);
+
+  return g_test_run ();
+}
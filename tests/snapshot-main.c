@@ -0,0 +1,193 @@
+/* snapshot-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+#include <math.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"attributions\":[" \
+  "{\"name\":\"Istanbul Ministry of Environment\",\"url\":\"http://www.havaizleme.gov.tr/\"}," \
+  "{\"name\":\"Istanbul Metropolitan Municipality\",\"url\":\"http://www.ibb.gov.tr/\"}," \
+  "{\"name\":\"European Environment Agency\",\"url\":\"http://www.eea.europa.eu/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"h\":{\"v\":77},\"no2\":{\"v\":21.4},\"o3\":{\"v\":11.2}," \
+  "\"p\":{\"v\":1016},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33},\"so2\":{\"v\":3.6}," \
+  "\"t\":{\"v\":14},\"w\":{\"v\":2.5}}}}"
+
+#define N_READERS   4
+#define N_PUBLISHES 2000
+
+static GairqAirObject *
+new_air (void)
+{
+  g_autoptr(GBytes) payload = NULL;
+  GError *error = NULL;
+  GairqAirObject *air;
+
+  payload = g_bytes_new_static (PAYLOAD, sizeof (PAYLOAD) - 1);
+  air = gairq_request_deserialize_bytes (payload, GAIRQ_AIR_OBJECT_FLAGS_NONE, &error);
+  g_assert_no_error (error);
+
+  return air;
+}
+
+static void
+test_gairq_snapshot_content (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GairqAirSnapshot) snapshot = NULL;
+  g_autoptr(GairqAirSnapshot) empty = NULL;
+  gdouble lat, lng, value;
+  guint i;
+
+  air = new_air ();
+  snapshot = gairq_air_snapshot_new (air);
+
+  g_assert_cmpint (gairq_air_snapshot_get_idx (snapshot), ==, 4143);
+  g_assert_cmpint (gairq_air_snapshot_get_aqi (snapshot), ==, 57);
+  g_assert_cmpstr (gairq_air_snapshot_get_city_name (snapshot), ==, "Fatih, Istanbul, Turkey");
+  g_assert_true (gairq_air_snapshot_get_city_geo (snapshot, &lat, &lng));
+  g_assert_cmpfloat (lat, ==, 41.014722);
+  g_assert_cmpfloat (lng, ==, 28.954722);
+
+  g_assert_cmpuint (gairq_air_snapshot_get_n_attributions (snapshot), ==, 4);
+  g_assert_cmpstr (gairq_air_snapshot_get_attribution_name (snapshot, 0), ==,
+                   "Istanbul Ministry of Environment");
+  g_assert_cmpstr (gairq_air_snapshot_get_attribution_url (snapshot, 3), ==,
+                   "https://waqi.info/");
+
+  g_assert_cmpuint (gairq_air_snapshot_get_n_iaqi (snapshot), ==, 10);
+  for (i = 1; i < gairq_air_snapshot_get_n_iaqi (snapshot); i++)
+    g_assert_cmpstr (gairq_air_snapshot_get_iaqi_key (snapshot, i - 1), <,
+                     gairq_air_snapshot_get_iaqi_key (snapshot, i));
+  g_assert_true (gairq_air_snapshot_lookup_iaqi (snapshot, "w", &value));
+  g_assert_cmpfloat (value, ==, 2.5);
+  g_assert_false (gairq_air_snapshot_lookup_iaqi (snapshot, "nope", NULL));
+  g_assert_cmpfloat (gairq_air_snapshot_get_pollutant (snapshot, GAIRQ_POLLUTANT_PM25), ==, 33);
+
+  /* Changing the object afterwards leaves the snapshot alone */
+  g_object_set (air,
+                "city", gairq_object_city_new ("Elsewhere", "http://example", 1, 2),
+                "attributions", NULL,
+                "iaqi", NULL,
+                NULL);
+  g_assert_cmpstr (gairq_air_snapshot_get_city_name (snapshot), ==, "Fatih, Istanbul, Turkey");
+  g_assert_cmpuint (gairq_air_snapshot_get_n_attributions (snapshot), ==, 4);
+  g_assert_cmpfloat (gairq_air_snapshot_get_pollutant (snapshot, GAIRQ_POLLUTANT_CO), ==, 1.1);
+
+  empty = gairq_air_snapshot_new (air);
+  g_assert_cmpuint (gairq_air_snapshot_get_n_attributions (empty), ==, 0);
+  g_assert_cmpuint (gairq_air_snapshot_get_n_iaqi (empty), ==, 0);
+  g_assert_true (isnan (gairq_air_snapshot_get_pollutant (empty, GAIRQ_POLLUTANT_PM25)));
+
+  /* Boxed copies are just references */
+  g_assert_true (g_boxed_copy (GAIRQ_TYPE_AIR_SNAPSHOT, snapshot) == snapshot);
+  g_boxed_free (GAIRQ_TYPE_AIR_SNAPSHOT, snapshot);
+}
+
+typedef struct
+{
+  GairqAirSnapshotSlot  slot;
+  gint                  done;
+} SlotTest;
+
+static gpointer
+reader_thread (gpointer data)
+{
+  SlotTest *test = data;
+  gint64 last = -1;
+
+  while (!g_atomic_int_get (&test->done))
+    {
+      g_autoptr(GairqAirSnapshot) snapshot = NULL;
+
+      snapshot = gairq_air_snapshot_slot_acquire (&test->slot);
+      if (snapshot == NULL)
+        continue;
+
+      /* Published in order, and never torn down while held */
+      g_assert_cmpint (gairq_air_snapshot_get_aqi (snapshot), >=, last);
+      last = gairq_air_snapshot_get_aqi (snapshot);
+      g_assert_cmpstr (gairq_air_snapshot_get_city_name (snapshot), ==, "Fatih, Istanbul, Turkey");
+    }
+
+  return NULL;
+}
+
+static void
+test_gairq_snapshot_slot (void)
+{
+  g_autoptr(GairqAirObject) air = NULL;
+  g_autoptr(GairqAirSnapshot) last = NULL;
+  GThread *readers [N_READERS];
+  SlotTest test;
+  guint i;
+
+  air = new_air ();
+
+  gairq_air_snapshot_slot_init (&test.slot);
+  test.done = 0;
+  g_assert_null (gairq_air_snapshot_slot_acquire (&test.slot));
+
+  for (i = 0; i < N_READERS; i++)
+    readers [i] = g_thread_new ("reader", reader_thread, &test);
+
+  for (i = 0; i < N_PUBLISHES; i++)
+    {
+      GairqAirSnapshot *snapshot;
+
+      g_object_set (air, "aqi", (gint64) i, NULL);
+      snapshot = gairq_air_snapshot_new (air);
+      gairq_air_snapshot_slot_publish (&test.slot, snapshot);
+      gairq_air_snapshot_unref (snapshot);
+    }
+
+  g_atomic_int_set (&test.done, 1);
+  for (i = 0; i < N_READERS; i++)
+    g_thread_join (readers [i]);
+
+  last = gairq_air_snapshot_slot_acquire (&test.slot);
+  g_assert_cmpint (gairq_air_snapshot_get_aqi (last), ==, N_PUBLISHES - 1);
+
+  gairq_air_snapshot_slot_clear (&test.slot);
+  g_assert_null (gairq_air_snapshot_slot_acquire (&test.slot));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/snapshot/content",
+                   test_gairq_snapshot_content);
+
+  g_test_add_func ("/Gairq/snapshot/slot",
+                   test_gairq_snapshot_slot);
+
+  return g_test_run ();
+}
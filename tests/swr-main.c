@@ -0,0 +1,239 @@
+/* swr-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <locale.h>
+
+#define TTL_MS          500
+#define STALE_MS        500
+#define LATENCY_MS      50
+
+static GairqAirObject *
+poll (GairqRequest     *request,
+      GairqResultFlags *result_flags)
+{
+  GError *error = NULL;
+  GairqAirObject *air;
+
+  air = gairq_request_poll_sync (request, result_flags, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (air);
+
+  return air;
+}
+
+/* Polls until the refresh behind @old has stored what it fetched. Until
+ * then @old keeps being served from the cache, stale or not.
+ */
+static GairqAirObject *
+wait_for_refresh (GairqRequest   *request,
+                  GairqAirObject *old)
+{
+  gint64 deadline = g_get_monotonic_time () + 5 * G_USEC_PER_SEC;
+  GairqResultFlags flags;
+  GairqAirObject *air;
+
+  for (;;)
+    {
+      air = poll (request, &flags);
+      g_assert_true (flags & GAIRQ_RESULT_FLAGS_CACHED);
+      if (air != old)
+        return air;
+
+      g_object_unref (air);
+      g_assert_cmpint (g_get_monotonic_time (), <, deadline);
+      g_usleep (G_TIME_SPAN_MILLISECOND);
+    }
+}
+
+static void
+test_gairq_swr_disabled (void)
+{
+  g_autoptr(TestRequest) request = NULL;
+  g_autoptr(GairqAirObject) first = NULL;
+  g_autoptr(GairqAirObject) second = NULL;
+  GairqResultFlags flags;
+
+  request = test_request_new (LATENCY_MS);
+  g_assert_cmpuint (gairq_request_get_cache_ttl (GAIRQ_REQUEST (request)), ==, 0);
+
+  first = poll (GAIRQ_REQUEST (request), &flags);
+  second = poll (GAIRQ_REQUEST (request), &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_true (first != second);
+  g_assert_cmpint (request->n_fetches, ==, 2);
+}
+
+/* Each phase sleeps into the middle of its window, the margins are
+ * what a slow machine has to oversleep by before the test goes wrong
+ */
+static void
+test_gairq_swr_lifecycle (void)
+{
+  g_autoptr(TestRequest) request = NULL;
+  g_autoptr(GairqAirObject) first = NULL;
+  g_autoptr(GairqAirObject) cached = NULL;
+  g_autoptr(GairqAirObject) refreshed = NULL;
+  g_autoptr(GairqAirObject) stale = NULL;
+  g_autoptr(GairqAirObject) revalidated = NULL;
+  g_autoptr(GairqAirObject) expired = NULL;
+  GairqResultFlags flags;
+
+  request = test_request_new (LATENCY_MS);
+  g_object_set (request,
+                "cache-ttl", TTL_MS,
+                "refresh-ahead", 0.5,
+                "serve-stale", STALE_MS,
+                NULL);
+
+  /* Nothing cached yet, the caller waits for the server */
+  first = poll (GAIRQ_REQUEST (request), &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_cmpint (request->n_fetches, ==, 1);
+
+  cached = poll (GAIRQ_REQUEST (request), &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_CACHED);
+  g_assert_true (cached == first);
+  g_assert_cmpint (request->n_fetches, ==, 1);
+  g_clear_object (&cached);
+
+  /* Past the refresh-ahead point, served from cache and refreshed behind */
+  g_usleep (TTL_MS * 6 / 10 * G_TIME_SPAN_MILLISECOND);
+  cached = poll (GAIRQ_REQUEST (request), &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_CACHED);
+  g_assert_true (cached == first);
+
+  refreshed = wait_for_refresh (GAIRQ_REQUEST (request), first);
+  g_assert_cmpint (request->n_fetches, ==, 2);
+
+  /* The refresh failed to come in time, the expired object is still served */
+  gairq_request_set_refresh_ahead (GAIRQ_REQUEST (request), 1.0);
+  g_usleep ((TTL_MS + STALE_MS / 2) * G_TIME_SPAN_MILLISECOND);
+  stale = poll (GAIRQ_REQUEST (request), &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_CACHED | GAIRQ_RESULT_FLAGS_STALE);
+  g_assert_true (stale == refreshed);
+
+  revalidated = wait_for_refresh (GAIRQ_REQUEST (request), refreshed);
+  g_assert_cmpint (request->n_fetches, ==, 3);
+
+  /* Too old to serve at all, back to a blocking fetch */
+  g_usleep ((TTL_MS + STALE_MS + 100) * G_TIME_SPAN_MILLISECOND);
+  expired = poll (GAIRQ_REQUEST (request), &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_true (expired != revalidated);
+  g_assert_cmpint (request->n_fetches, ==, 4);
+}
+
+typedef struct
+{
+  GairqAirObject *  air;
+  GairqResultFlags  flags;
+  gboolean          done;
+} Polled;
+
+static void
+poll_done (GObject      *object,
+           GAsyncResult *res,
+           gpointer      user_data)
+{
+  Polled *polled = user_data;
+  GError *error = NULL;
+
+  polled->air = gairq_request_poll_finish (GAIRQ_REQUEST (object), res, &polled->flags, &error);
+  g_assert_no_error (error);
+  polled->done = TRUE;
+}
+
+/* The test server answers on this thread, so it has to keep iterating */
+static GairqAirObject *
+poll_on_loop (GairqRequest     *request,
+              GairqResultFlags *result_flags)
+{
+  Polled polled = { 0, };
+
+  gairq_request_poll_async (request, NULL, poll_done, &polled);
+  while (!polled.done)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_nonnull (polled.air);
+  *result_flags = polled.flags;
+
+  return polled.air;
+}
+
+static void
+test_gairq_swr_endpoint (void)
+{
+  g_autoptr(GSocketService) service = NULL;
+  g_autoptr(GairqRequest) request = NULL;
+  g_autoptr(GairqAirObject) first = NULL;
+  g_autoptr(GairqAirObject) cached = NULL;
+  g_autoptr(GairqAirObject) moved = NULL;
+  g_autofree gchar *base_url = NULL;
+  GairqResultFlags flags;
+  gint n_served = 0;
+
+  service = test_server_new (TEST_PAYLOAD, &n_served, &base_url);
+  request = g_object_new (GAIRQ_TYPE_CITY,
+                          "base-url", base_url,
+                          "token", "demo",
+                          "type", GAIRQ_CITY_TYPE_ID,
+                          "city", "@4143",
+                          "cache-ttl", 60 * 1000,
+                          NULL);
+
+  first = poll_on_loop (request, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  cached = poll_on_loop (request, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_CACHED);
+  g_assert_true (cached == first);
+  g_assert_cmpint (g_atomic_int_get (&n_served), ==, 1);
+
+  /* Another station, nothing of the first one may be served for it */
+  g_object_set (request, "city", "@8397", NULL);
+  moved = poll_on_loop (request, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_true (moved != first);
+  g_assert_cmpint (g_atomic_int_get (&n_served), ==, 2);
+
+  g_socket_service_stop (service);
+  g_socket_listener_close (G_SOCKET_LISTENER (service));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/swr/disabled",
+                   test_gairq_swr_disabled);
+
+  g_test_add_func ("/Gairq/swr/lifecycle",
+                   test_gairq_swr_lifecycle);
+
+  g_test_add_func ("/Gairq/swr/endpoint",
+                   test_gairq_swr_endpoint);
+
+  return g_test_run ();
+}
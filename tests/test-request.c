@@ -0,0 +1,158 @@
+/* test-request.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <string.h>
+
+G_DEFINE_TYPE (TestRequest, test_request, GAIRQ_TYPE_REQUEST)
+
+static GBytes *
+test_request_fetch_payload (GairqRequest  *request,
+                            GError       **error)
+{
+  TestRequest *self = (TestRequest *) request;
+  const gchar *payload = self->payload ? self->payload : TEST_PAYLOAD;
+  gint running, most;
+
+  running = g_atomic_int_add (&self->running, 1) + 1;
+  do
+    most = g_atomic_int_get (&self->most_running);
+  while (running > most &&
+         !g_atomic_int_compare_and_exchange (&self->most_running, most, running));
+
+  if (self->on_fetch)
+    self->on_fetch (self, self->on_fetch_data);
+
+  g_usleep (self->latency_ms * G_TIME_SPAN_MILLISECOND);
+
+  g_atomic_int_add (&self->running, -1);
+  g_atomic_int_inc (&self->n_fetches);
+
+  if (self->fail)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Upstream is down");
+      return NULL;
+    }
+
+  return g_bytes_new_static (payload, strlen (payload));
+}
+
+static gchar *
+test_request_get_key (GairqRequest *request)
+{
+  TestRequest *self = (TestRequest *) request;
+
+  return g_strdup (self->key ? self->key : TEST_KEY);
+}
+
+static void
+test_request_class_init (TestRequestClass *klass)
+{
+  GAIRQ_REQUEST_CLASS (klass)->fetch_payload = test_request_fetch_payload;
+  GAIRQ_REQUEST_CLASS (klass)->get_key = test_request_get_key;
+}
+
+static void
+test_request_init (TestRequest *self)
+{
+}
+
+TestRequest *
+test_request_new (guint latency_ms)
+{
+  TestRequest *self = g_object_new (TEST_TYPE_REQUEST, NULL);
+
+  self->latency_ms = latency_ms;
+
+  return self;
+}
+
+/* --- TestServer --- */
+static gboolean
+test_server_run (GThreadedSocketService *service,
+                 GSocketConnection      *connection,
+                 GObject                *source_object,
+                 gpointer                user_data)
+{
+  const gchar *payload = g_object_get_data (G_OBJECT (service), "payload");
+  gint *n_served = user_data;
+  GOutputStream *output;
+  GDataInputStream *input;
+  gchar *header;
+
+  input = g_data_input_stream_new (g_io_stream_get_input_stream (G_IO_STREAM (connection)));
+  output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  header = g_strdup_printf ("HTTP/1.1 200 OK\r\n"
+                            "Content-Type: application/json\r\n"
+                            "Content-Length: %" G_GSIZE_FORMAT "\r\n"
+                            "\r\n", strlen (payload));
+
+  for (;;)
+    {
+      gboolean done = FALSE;
+      gchar *line;
+
+      /* Up to the blank line closing the headers, a GET has no body */
+      while ((line = g_data_input_stream_read_line (input, NULL, NULL, NULL)))
+        {
+          done = line [0] == '\0' || strcmp (line, "\r") == 0;
+          g_free (line);
+          if (done)
+            break;
+        }
+      if (!done)
+        break;
+
+      if (!g_output_stream_write_all (output, header, strlen (header), NULL, NULL, NULL) ||
+          !g_output_stream_write_all (output, payload, strlen (payload), NULL, NULL, NULL))
+        break;
+
+      if (n_served)
+        g_atomic_int_inc (n_served);
+    }
+
+  g_free (header);
+  g_object_unref (input);
+
+  return TRUE;
+}
+
+GSocketService *
+test_server_new (const gchar  *payload,
+                 gint         *n_served,
+                 gchar       **base_url)
+{
+  GSocketService *service;
+  GError *error = NULL;
+  guint16 port;
+
+  service = g_threaded_socket_service_new (-1);
+  port = g_socket_listener_add_any_inet_port (G_SOCKET_LISTENER (service), NULL, &error);
+  g_assert_no_error (error);
+
+  g_object_set_data_full (G_OBJECT (service), "payload", g_strdup (payload), g_free);
+  g_signal_connect (service, "run", G_CALLBACK (test_server_run), n_served);
+  g_socket_service_start (service);
+
+  *base_url = g_strdup_printf ("http://127.0.0.1:%u", port);
+
+  return service;
+}
@@ -0,0 +1,83 @@
+/* test-request.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef TEST_REQUEST_H
+#define TEST_REQUEST_H
+
+#include <gairq/gairq.h>
+
+G_BEGIN_DECLS
+
+#define TEST_PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"pm10\":{\"v\":57},\"pm25\":{\"v\":33}}}}"
+
+#define TEST_KEY "/feed/istanbul/"
+
+typedef struct _TestRequest TestRequest;
+
+typedef void (*TestRequestFunc) (TestRequest *self,
+                                 gpointer     user_data);
+
+/* Answers fetches locally, without a round-trip. The hooks are set
+ * before the request is first used.
+ */
+struct _TestRequest
+{
+  GairqRequest      parent_instance;
+
+  const gchar *     payload;        /* TEST_PAYLOAD by default */
+  const gchar *     key;            /* TEST_KEY by default */
+  guint             latency_ms;
+  gboolean          fail;           /* Fetches fail with G_IO_ERROR_FAILED */
+  TestRequestFunc   on_fetch;       /* Runs as each fetch starts */
+  gpointer          on_fetch_data;
+
+  /* Kept with atomics */
+  gint              n_fetches;      /* Fetches answered */
+  gint              running;
+  gint              most_running;   /* Fetches running at once, at most */
+};
+
+typedef struct
+{
+  GairqRequestClass parent_class;
+} TestRequestClass;
+
+#define TEST_TYPE_REQUEST (test_request_get_type ())
+
+GType           test_request_get_type     (void);
+TestRequest *   test_request_new          (guint         latency_ms);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (TestRequest, g_object_unref)
+
+/* A keep-alive HTTP server on the loopback answering every request with
+ * @payload, one thread per connection. Connections are accepted on the
+ * thread-default main context of the caller.
+ */
+GSocketService *  test_server_new         (const gchar  *payload,
+                                           gint         *n_served,
+                                           gchar       **base_url);
+
+G_END_DECLS
+
+#endif
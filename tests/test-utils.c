@@ -0,0 +1,145 @@
+/* test-utils.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-utils.h"
+
+#include <stdlib.h>
+
+/* --- Allocation counting --- */
+static gboolean counting;
+static TestAllocCount counted;
+
+#ifdef __GLIBC__
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void  __libc_free (void *ptr);
+
+void *
+malloc (size_t size)
+{
+  if (counting)
+    {
+      counted.n_allocs++;
+      counted.n_bytes += size;
+    }
+  return __libc_malloc (size);
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  if (counting)
+    {
+      counted.n_allocs++;
+      counted.n_bytes += n_members * size;
+    }
+  return __libc_calloc (n_members, size);
+}
+
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+  if (counting)
+    {
+      counted.n_allocs++;
+      counted.n_bytes += size;
+    }
+  return __libc_realloc (ptr, size);
+}
+
+void
+free (void *ptr)
+{
+  if (counting && ptr)
+    counted.n_frees++;
+  __libc_free (ptr);
+}
+#endif
+
+void
+test_alloc_count_begin (void)
+{
+  counted = (TestAllocCount) { 0, };
+  counting = TRUE;
+}
+
+void
+test_alloc_count_end (TestAllocCount *count)
+{
+  counting = FALSE;
+  *count = counted;
+}
+
+/* --- GairqAirObject --- */
+void
+test_assert_air_equal (GairqAirObject *a,
+                       GairqAirObject *b)
+{
+  GairqObjectCity *city_a, *city_b;
+  GSList *la, *lb;
+  GHashTable *iaqi_a, *iaqi_b;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_assert_cmpint (gairq_air_object_get_idx (a), ==, gairq_air_object_get_idx (b));
+  g_assert_cmpint (gairq_air_object_get_aqi (a), ==, gairq_air_object_get_aqi (b));
+  g_assert_cmpint (gairq_air_object_get_time (a), ==, gairq_air_object_get_time (b));
+
+  la = gairq_air_object_get_attributions (a);
+  lb = gairq_air_object_get_attributions (b);
+  g_assert_cmpuint (g_slist_length (la), ==, g_slist_length (lb));
+  for ( ; la && lb; la = la->next, lb = lb->next)
+    {
+      GairqObjectAttr *attr_a = la->data, *attr_b = lb->data;
+
+      g_assert_cmpstr (attr_a->name, ==, attr_b->name);
+      g_assert_cmpstr (attr_a->url, ==, attr_b->url);
+    }
+
+  city_a = gairq_air_object_get_city (a);
+  city_b = gairq_air_object_get_city (b);
+  g_assert_true ((city_a == NULL) == (city_b == NULL));
+  if (city_a)
+    {
+      g_assert_cmpstr (city_a->name, ==, city_b->name);
+      g_assert_cmpstr (city_a->url, ==, city_b->url);
+      g_assert_cmpfloat (city_a->geo.latitude, ==, city_b->geo.latitude);
+      g_assert_cmpfloat (city_a->geo.longitude, ==, city_b->geo.longitude);
+    }
+
+  iaqi_a = gairq_air_object_get_iaqi (a);
+  iaqi_b = gairq_air_object_get_iaqi (b);
+  g_assert_true ((iaqi_a == NULL) == (iaqi_b == NULL));
+  if (iaqi_a == NULL)
+    return;
+
+  g_assert_cmpuint (g_hash_table_size (iaqi_a), ==, g_hash_table_size (iaqi_b));
+  g_hash_table_iter_init (&iter, iaqi_a);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      gdouble *other = g_hash_table_lookup (iaqi_b, key);
+
+      g_assert_nonnull (other);
+      g_assert_cmpfloat (*(gdouble *) value, ==, *other);
+    }
+}
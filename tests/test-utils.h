@@ -0,0 +1,48 @@
+/* test-utils.h
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#ifndef TEST_UTILS_H
+#define TEST_UTILS_H
+
+#include <gairq/gairq.h>
+
+G_BEGIN_DECLS
+
+/* What malloc (), calloc (), realloc () and free () were called for
+ * between test_alloc_count_begin () and test_alloc_count_end (). Only
+ * glibc lets the test replace them, elsewhere nothing is counted.
+ */
+typedef struct
+{
+  guint     n_allocs;
+  guint     n_frees;        /* Of blocks, free (NULL) is not counted */
+  gsize     n_bytes;        /* Asked for by the allocations */
+} TestAllocCount;
+
+void      test_alloc_count_begin  (void);
+void      test_alloc_count_end    (TestAllocCount *count);
+
+/* Every member the API hands out, compared by value */
+void      test_assert_air_equal   (GairqAirObject *a,
+                                   GairqAirObject *b);
+
+G_END_DECLS
+
+#endif
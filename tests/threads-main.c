@@ -0,0 +1,292 @@
+/* threads-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include "test-request.h"
+
+#include <locale.h>
+#include <string.h>
+
+#define N_THREADS     8
+#define N_CALLS       50
+
+typedef struct
+{
+  GairqRequest *  request;
+  GairqExecutor * executors [2];
+  gint            n_done;
+  gint            n_failed;
+  gint            stop;
+} Shared;
+
+static gpointer
+call_thread (gpointer data)
+{
+  Shared *shared = data;
+  guint i;
+
+  for (i = 0; i < N_CALLS; i++)
+    {
+      g_autoptr(JsonNode) root = NULL;
+      g_autoptr(GError) error = NULL;
+
+      root = gairq_request_call_sync (shared->request, &error);
+      if (root == NULL ||
+          g_strcmp0 (json_object_get_string_member (json_node_get_object (root), "status"), "ok") != 0)
+        g_atomic_int_inc (&shared->n_failed);
+    }
+
+  g_atomic_int_inc (&shared->n_done);
+  g_main_context_wakeup (NULL);
+
+  return NULL;
+}
+
+static void
+test_gairq_threads_call_sync (void)
+{
+  g_autoptr(GSocketService) service = NULL;
+  g_autoptr(GairqRequest) request = NULL;
+  g_autofree gchar *base_url = NULL;
+  GThread *threads [N_THREADS];
+  GairqRequestStats stats;
+  Shared shared = { 0, };
+  gint n_served = 0;
+  guint i;
+
+  service = test_server_new (TEST_PAYLOAD, &n_served, &base_url);
+
+  /* One request, shared by every thread */
+  request = g_object_new (GAIRQ_TYPE_CITY,
+                          "base-url", base_url,
+                          "token", "demo",
+                          "type", GAIRQ_CITY_TYPE_ID,
+                          "city", "@4143",
+                          NULL);
+  g_assert_cmpstr (gairq_request_get_base_url (request), ==, base_url);
+  shared.request = request;
+
+  for (i = 0; i < N_THREADS; i++)
+    threads [i] = g_thread_new ("call", call_thread, &shared);
+
+  /* Connections are accepted on this thread */
+  while (g_atomic_int_get (&shared.n_done) < N_THREADS)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads [i]);
+
+  g_assert_cmpint (shared.n_failed, ==, 0);
+  g_assert_cmpint (g_atomic_int_get (&n_served), ==, N_THREADS * N_CALLS);
+
+  gairq_request_get_stats (request, &stats);
+  g_assert_cmpuint (stats.n_in_flight, ==, 0);
+  g_assert_cmpuint (stats.n_calls, ==, N_THREADS * N_CALLS);
+  g_assert_cmpuint (stats.n_failed, ==, 0);
+  g_assert_cmpuint (stats.bytes_received, ==, N_THREADS * N_CALLS * strlen (TEST_PAYLOAD));
+  g_assert_cmpint (stats.call_time, >, 0);
+
+  g_socket_service_stop (service);
+  g_socket_listener_close (G_SOCKET_LISTENER (service));
+}
+
+static gpointer
+poll_thread (gpointer data)
+{
+  Shared *shared = data;
+  guint i;
+
+  for (i = 0; i < N_CALLS * 20; i++)
+    {
+      g_autoptr(GairqAirObject) air = NULL;
+      g_autoptr(GError) error = NULL;
+
+      air = gairq_request_poll_sync (shared->request, NULL, &error);
+      if (air == NULL || gairq_air_object_get_idx (air) != 4143)
+        g_atomic_int_inc (&shared->n_failed);
+    }
+
+  g_atomic_int_inc (&shared->n_done);
+
+  return NULL;
+}
+
+/* Turns the settings and the executor over while the polls run */
+static gpointer
+settings_thread (gpointer data)
+{
+  Shared *shared = data;
+  GairqExecutor *executor;
+  guint i;
+
+  for (i = 0; !g_atomic_int_get (&shared->stop); i++)
+    {
+      gairq_request_set_skip_unchanged (shared->request, i % 2);
+      gairq_request_set_cache_ttl (shared->request, i % 3);
+      gairq_request_set_serve_stale (shared->request, i % 5);
+      gairq_request_set_refresh_ahead (shared->request, (i % 4) / 4.0);
+      gairq_request_set_object_flags (shared->request,
+                                      i % 2 ? GAIRQ_AIR_OBJECT_FLAGS_LAZY
+                                            : GAIRQ_AIR_OBJECT_FLAGS_NONE);
+      gairq_request_set_priority (shared->request, i % N_GAIRQ_PRIORITIES);
+      executor = i % 3 < 2 ? shared->executors [i % 3] : NULL;
+      gairq_request_set_executor (shared->request, executor);
+      g_assert_true (gairq_request_get_executor (shared->request) == executor);
+      g_thread_yield ();
+    }
+
+  return NULL;
+}
+
+static void
+test_gairq_threads_poll_sync (void)
+{
+  g_autoptr(TestRequest) request = NULL;
+  GThread *threads [N_THREADS];
+  GThread *settings;
+  GairqRequestStats stats;
+  Shared shared = { 0, };
+  guint i;
+
+  request = test_request_new (0);
+  shared.request = GAIRQ_REQUEST (request);
+  shared.executors [0] = gairq_executor_new (0, 2, 0);
+  shared.executors [1] = gairq_executor_new (0, 2, 0);
+
+  settings = g_thread_new ("settings", settings_thread, &shared);
+  for (i = 0; i < N_THREADS; i++)
+    threads [i] = g_thread_new ("poll", poll_thread, &shared);
+
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads [i]);
+  g_atomic_int_set (&shared.stop, TRUE);
+  g_thread_join (settings);
+
+  g_assert_cmpint (shared.n_failed, ==, 0);
+
+  /* Background refreshes may still be going, they don't poll */
+  gairq_request_get_stats (GAIRQ_REQUEST (request), &stats);
+  g_assert_cmpuint (stats.n_polls, ==, N_THREADS * N_CALLS * 20);
+  g_assert_cmpuint (stats.n_failed, ==, 0);
+  g_assert_cmpuint (stats.n_cached, <=, stats.n_polls);
+  g_assert_cmpuint (stats.n_calls, >=, stats.n_polls - stats.n_cached);
+
+  g_object_unref (shared.executors [0]);
+  g_object_unref (shared.executors [1]);
+}
+
+/* Moves the request between stations while the calls run */
+static gpointer
+endpoint_thread (gpointer data)
+{
+  Shared *shared = data;
+  guint i;
+
+  for (i = 0; !g_atomic_int_get (&shared->stop); i++)
+    {
+      if (GAIRQ_IS_CITY (shared->request))
+        g_object_set (shared->request, "city", i % 2 ? "@4143" : "@8397", NULL);
+      else
+        g_object_set (shared->request,
+                      "latitude", i % 2 ? "41.01" : "37.57",
+                      "longitude", i % 2 ? "28.95" : "126.98",
+                      NULL);
+      g_thread_yield ();
+    }
+
+  return NULL;
+}
+
+static void
+run_endpoint_test (GairqRequest *request)
+{
+  GThread *threads [N_THREADS];
+  GThread *endpoint;
+  Shared shared = { 0, };
+  guint i;
+
+  shared.request = request;
+
+  endpoint = g_thread_new ("endpoint", endpoint_thread, &shared);
+  for (i = 0; i < N_THREADS; i++)
+    threads [i] = g_thread_new ("call", call_thread, &shared);
+
+  while (g_atomic_int_get (&shared.n_done) < N_THREADS)
+    g_main_context_iteration (NULL, TRUE);
+
+  for (i = 0; i < N_THREADS; i++)
+    g_thread_join (threads [i]);
+  g_atomic_int_set (&shared.stop, TRUE);
+  g_thread_join (endpoint);
+
+  g_assert_cmpint (shared.n_failed, ==, 0);
+}
+
+static void
+test_gairq_threads_endpoint (void)
+{
+  g_autoptr(GSocketService) service = NULL;
+  g_autoptr(GairqRequest) city = NULL;
+  g_autoptr(GairqRequest) geo = NULL;
+  g_autofree gchar *base_url = NULL;
+
+  service = test_server_new (TEST_PAYLOAD, NULL, &base_url);
+
+  city = g_object_new (GAIRQ_TYPE_CITY,
+                       "base-url", base_url,
+                       "token", "demo",
+                       "type", GAIRQ_CITY_TYPE_ID,
+                       "city", "@4143",
+                       "cache-ttl", 5,
+                       NULL);
+  run_endpoint_test (city);
+
+  geo = g_object_new (GAIRQ_TYPE_GEO,
+                      "base-url", base_url,
+                      "token", "demo",
+                      "type", GAIRQ_GEO_TYPE_LATLNG,
+                      "latitude", "41.01",
+                      "longitude", "28.95",
+                      "cache-ttl", 5,
+                      NULL);
+  run_endpoint_test (geo);
+
+  g_socket_service_stop (service);
+  g_socket_listener_close (G_SOCKET_LISTENER (service));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/threads/call-sync",
+                   test_gairq_threads_call_sync);
+
+  g_test_add_func ("/Gairq/threads/poll-sync",
+                   test_gairq_threads_poll_sync);
+
+  g_test_add_func ("/Gairq/threads/endpoint",
+                   test_gairq_threads_endpoint);
+
+  return g_test_run ();
+}
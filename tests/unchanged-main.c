@@ -0,0 +1,181 @@
+/* unchanged-main.c
+ *
+ * Copyright 2019 Leesoo Ahn <yisooan@fedoraproject.org>
+ *
+ * This file is free software; you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation; either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * SPDX-License-Identifier: LGPL-3.0-or-later
+ */
+
+#include <gairq/gairq.h>
+
+#include <locale.h>
+#include <string.h>
+
+#define PAYLOAD \
+  "{\"status\":\"ok\",\"data\":{\"idx\":4143,\"aqi\":57," \
+  "\"attributions\":[" \
+  "{\"name\":\"Istanbul Ministry of Environment\",\"url\":\"http://www.havaizleme.gov.tr/\"}," \
+  "{\"name\":\"Istanbul Metropolitan Municipality\",\"url\":\"http://www.ibb.gov.tr/\"}," \
+  "{\"name\":\"European Environment Agency\",\"url\":\"http://www.eea.europa.eu/\"}," \
+  "{\"name\":\"World Air Quality Index Project\",\"url\":\"https://waqi.info/\"}]," \
+  "\"city\":{\"geo\":[41.014722,28.954722],\"name\":\"Fatih, Istanbul, Turkey\"," \
+  "\"url\":\"https://aqicn.org/city/turkey/istanbul/fatih\"}," \
+  "\"iaqi\":{\"co\":{\"v\":1.1},\"h\":{\"v\":77},\"no2\":{\"v\":21.4},\"o3\":{\"v\":11.2}," \
+  "\"p\":{\"v\":1016},\"pm10\":{\"v\":57},\"pm25\":{\"v\":33},\"so2\":{\"v\":3.6}," \
+  "\"t\":{\"v\":14},\"w\":{\"v\":2.5}}}}"
+
+#define ERROR_PAYLOAD "{\"status\":\"error\",\"data\":\"Invalid key\"}"
+
+#define N_BENCH_ROUNDS 20000
+
+static GairqAirObject *
+process (GairqRequest     *request,
+         const gchar      *data,
+         GairqResultFlags *result_flags)
+{
+  g_autoptr(GBytes) payload = NULL;
+  GError *error = NULL;
+  GairqAirObject *air;
+
+  payload = g_bytes_new_static (data, strlen (data));
+  air = gairq_request_process_payload (request, payload, result_flags, &error);
+  g_assert_no_error (error);
+
+  return air;
+}
+
+static void
+test_gairq_unchanged_skip (void)
+{
+  g_autoptr(GairqRequest) request = NULL;
+  g_autoptr(GairqAirObject) first = NULL;
+  g_autoptr(GairqAirObject) second = NULL;
+  g_autoptr(GairqAirObject) third = NULL;
+  g_autofree gchar *changed = NULL;
+  GairqResultFlags flags;
+
+  request = gairq_request_new ("token");
+  gairq_request_set_skip_unchanged (request, TRUE);
+
+  first = process (request, PAYLOAD, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+
+  /* Same bytes, same object */
+  second = process (request, PAYLOAD, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_UNCHANGED);
+  g_assert_true (first == second);
+
+  changed = g_strdup (PAYLOAD);
+  strstr (changed, "\"aqi\":57") [6] = '6';
+  third = process (request, changed, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_true (third != first);
+  g_assert_cmpint (gairq_air_object_get_aqi (third), ==, 67);
+}
+
+static void
+test_gairq_unchanged_disabled (void)
+{
+  g_autoptr(GairqRequest) request = NULL;
+  g_autoptr(GairqAirObject) first = NULL;
+  g_autoptr(GairqAirObject) second = NULL;
+  GairqResultFlags flags;
+
+  request = gairq_request_new ("token");
+  g_assert_false (gairq_request_get_skip_unchanged (request));
+
+  first = process (request, PAYLOAD, &flags);
+  second = process (request, PAYLOAD, &flags);
+  g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+  g_assert_true (first != second);
+}
+
+static void
+test_gairq_unchanged_error (void)
+{
+  g_autoptr(GairqRequest) request = NULL;
+  g_autoptr(GBytes) payload = NULL;
+  GairqResultFlags flags;
+  guint i;
+
+  request = gairq_request_new ("token");
+  g_object_set (request, "skip-unchanged", TRUE, NULL);
+
+  payload = g_bytes_new_static (ERROR_PAYLOAD, sizeof (ERROR_PAYLOAD) - 1);
+
+  /* Errors are never remembered, each one is reported */
+  for (i = 0; i < 2; i++)
+    {
+      g_autoptr(GError) error = NULL;
+
+      g_assert_null (gairq_request_process_payload (request, payload, &flags, &error));
+      g_assert_error (error, g_quark_from_static_string ("gairq-request-error-quark"), 0);
+      g_assert_cmpuint (flags, ==, GAIRQ_RESULT_FLAGS_NONE);
+    }
+}
+
+static void
+test_gairq_unchanged_benchmark (void)
+{
+  g_autoptr(GairqRequest) request = NULL;
+  gboolean skip;
+  guint round;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Benchmarks only run with -m perf");
+      return;
+    }
+
+  request = gairq_request_new ("token");
+
+  for (skip = FALSE; skip <= TRUE; skip++)
+    {
+      gdouble elapsed;
+
+      gairq_request_set_skip_unchanged (request, skip);
+
+      g_test_timer_start ();
+      for (round = 0; round < N_BENCH_ROUNDS; round++)
+        g_object_unref (process (request, PAYLOAD, NULL));
+      elapsed = g_test_timer_elapsed ();
+
+      g_test_minimized_result (elapsed, "skip-unchanged %d: %.1f responses/ms",
+                               skip, N_BENCH_ROUNDS / elapsed / 1e3);
+    }
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_CTYPE, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/Gairq/unchanged/skip",
+                   test_gairq_unchanged_skip);
+
+  g_test_add_func ("/Gairq/unchanged/disabled",
+                   test_gairq_unchanged_disabled);
+
+  g_test_add_func ("/Gairq/unchanged/error",
+                   test_gairq_unchanged_error);
+
+  g_test_add_func ("/Gairq/unchanged/benchmark",
+                   test_gairq_unchanged_benchmark);
+
+  return g_test_run ();
+}